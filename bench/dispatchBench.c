@@ -0,0 +1,174 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "server/http.h"
+#include "server/connio.h"
+#include "server/HttpStatusCodes_C.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define cycles() __rdtsc()
+#else
+#include <time.h>
+/**
+ * No cycle counter: nanoseconds are reported instead.
+ */
+static unsigned long long cycles()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+#endif
+
+static const char *methods[] = { "GET", "HEAD", "POST", "PUT", "DELETE", "CONNECT", "OPTIONS", "TRACE", "PATCH" };
+#define METHODS (sizeof(methods) / sizeof(methods[0]))
+
+static const char *versions[] = { "HTTP/1.1", "HTTP/1.0" };
+
+static const int statuses[] = { 200, 204, 301, 304, 400, 404, 413, 500 };
+#define STATUSES (sizeof(statuses) / sizeof(statuses[0]))
+
+/**
+ * strcmp(3) chain the parser used before, each method has its own code.
+ */
+static int legacyParseMethod(const char *method_str)
+{
+	if (!strcmp(method_str, "GET")) return HTTPM_GET;
+	else if (!strcmp(method_str, "HEAD")) return HTTPM_HEAD;
+	else if (!strcmp(method_str, "POST")) return HTTPM_POST;
+	else if (!strcmp(method_str, "PUT")) return HTTPM_PUT;
+	else if (!strcmp(method_str, "DELETE")) return HTTPM_DELETE;
+	else if (!strcmp(method_str, "CONNECT")) return HTTPM_CONNECT;
+	else if (!strcmp(method_str, "OPTIONS")) return HTTPM_OPTIONS;
+	else if (!strcmp(method_str, "TRACE")) return HTTPM_TRACE;
+	else if (!strcmp(method_str, "PATCH")) return HTTPM_PATCH;
+	else return HTTPM_FAILED;
+}
+
+static int legacyParseVersion(const char *version_str)
+{
+	if (!strcmp(version_str, "HTTP/1.0")) return HTTPV_10;
+	else if (!strcmp(version_str, "HTTP/1.1")) return HTTPV_11;
+	else return HTTPV_INVAL;
+}
+
+static unsigned long long runLegacyMethod(size_t iterations)
+{
+	int sum = 0;
+
+	unsigned long long start = cycles();
+	for (size_t i = 0; i < iterations; i++)
+		sum += legacyParseMethod(methods[i % METHODS]);
+	unsigned long long elapsed = cycles() - start;
+
+	if (sum == 0) printf(" ");
+	return elapsed;
+}
+
+static unsigned long long runMethod(size_t iterations)
+{
+	size_t lens[METHODS];
+	for (size_t i = 0; i < METHODS; i++)
+		lens[i] = strlen(methods[i]);
+
+	int sum = 0;
+
+	unsigned long long start = cycles();
+	for (size_t i = 0; i < iterations; i++)
+		sum += httpMethodId(methods[i % METHODS], lens[i % METHODS]);
+	unsigned long long elapsed = cycles() - start;
+
+	if (sum == 0) printf(" ");
+	return elapsed;
+}
+
+static unsigned long long runLegacyVersion(size_t iterations)
+{
+	int sum = 0;
+
+	unsigned long long start = cycles();
+	for (size_t i = 0; i < iterations; i++)
+		sum += legacyParseVersion(versions[i & 1]);
+	unsigned long long elapsed = cycles() - start;
+
+	if (sum == 0) printf(" ");
+	return elapsed;
+}
+
+static unsigned long long runVersion(size_t iterations)
+{
+	int sum = 0;
+
+	unsigned long long start = cycles();
+	for (size_t i = 0; i < iterations; i++)
+		sum += httpVersionId(versions[i & 1], 8);
+	unsigned long long elapsed = cycles() - start;
+
+	if (sum == 0) printf(" ");
+	return elapsed;
+}
+
+/**
+ * Status line formatted by connIOPrintf() with reason phrase switch, as writeHTTPResponse() did.
+ */
+static unsigned long long runLegacyStatus(size_t iterations)
+{
+	struct connIO io;
+	initConnIO(&io, -1, 1, 0);
+
+	unsigned long long start = cycles();
+	for (size_t i = 0; i < iterations; i++) {
+		int status = statuses[i % STATUSES];
+		connIOPrintf(&io, "%s %d %s\r\n", HTTPVersionToString(HTTPV_11), status, HttpStatus_reasonPhrase(status));
+		connIOOutputConsume(&io, io.wlen);
+	}
+	unsigned long long elapsed = cycles() - start;
+
+	destroyConnIO(&io);
+	return elapsed;
+}
+
+static unsigned long long runStatus(size_t iterations)
+{
+	struct connIO io;
+	initConnIO(&io, -1, 1, 0);
+
+	unsigned long long start = cycles();
+	for (size_t i = 0; i < iterations; i++) {
+		size_t len;
+		const char *line = httpStatusLine(HTTPV_11, statuses[i % STATUSES], &len);
+		connIOWrite(&io, line, len);
+		connIOOutputConsume(&io, io.wlen);
+	}
+	unsigned long long elapsed = cycles() - start;
+
+	destroyConnIO(&io);
+	return elapsed;
+}
+
+static void report(const char *name, unsigned long long elapsed, size_t iterations)
+{
+	printf("%-24s %8.2f cycles/op\n", name, (double)elapsed / iterations);
+}
+
+int main(int argc, const char *argv[])
+{
+	size_t iterations = argc > 1 ? strtoull(argv[1], NULL, 10) : 1000000;
+	if (iterations == 0) iterations = 1;
+
+	// Status lines are built on the first call.
+	size_t len;
+	httpStatusLine(HTTPV_11, 200, &len);
+
+	printf("%zu iterations\n", iterations);
+
+	report("strcmp method", runLegacyMethod(iterations), iterations);
+	report("perfect hash method", runMethod(iterations), iterations);
+	report("strcmp version", runLegacyVersion(iterations), iterations);
+	report("word version", runVersion(iterations), iterations);
+	report("printf status line", runLegacyStatus(iterations), iterations);
+	report("table status line", runStatus(iterations), iterations);
+
+	return 0;
+}
@@ -0,0 +1,147 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "server/router.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define cycles() __rdtsc()
+#else
+#include <time.h>
+/**
+ * No cycle counter: nanoseconds are reported instead.
+ */
+static unsigned long long cycles()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+#endif
+
+#define PATHS 4096
+
+static void benchProcessor(struct HTTPRequest *request, struct HTTPResponse *response)
+{
+	response->status = 200;
+}
+
+static char (*patterns)[64];
+static char (*paths)[64];
+
+/**
+ * Pattern matching the processors do by hand: patterns are tried in order, segment by segment.
+ *
+ * @Returns 1 if @path matches @pattern.
+ */
+static int linearMatch(const char *pattern, const char *path)
+{
+	while (*pattern != '\0' && *path != '\0') {
+		if (*pattern == ':') {
+			while (*pattern != '\0' && *pattern != '/') pattern++;
+			while (*path != '\0' && *path != '/') path++;
+			continue;
+		}
+
+		if (*pattern++ != *path++) return 0;
+	}
+
+	return *pattern == '\0' && *path == '\0';
+}
+
+static unsigned long long runLinear(size_t routes, size_t iterations)
+{
+	size_t sum = 0;
+
+	unsigned long long start = cycles();
+	for (size_t i = 0; i < iterations; i++) {
+		const char *path = paths[i % PATHS];
+
+		for (size_t r = 0; r < routes; r++)
+			if (linearMatch(patterns[r], path)) {
+				sum += r;
+				break;
+			}
+	}
+	unsigned long long elapsed = cycles() - start;
+
+	if (sum == 0) printf(" ");
+	return elapsed;
+}
+
+static unsigned long long runRadix(struct httpRouter *router, size_t iterations)
+{
+	size_t lens[PATHS];
+	for (size_t i = 0; i < PATHS; i++)
+		lens[i] = strlen(paths[i]);
+
+	size_t sum = 0;
+
+	unsigned long long start = cycles();
+	for (size_t i = 0; i < iterations; i++) {
+		struct httpRouteMatch match;
+		if (matchHTTPRoute(router, HTTPM_GET, paths[i % PATHS], lens[i % PATHS], &match) == HTTPROUTE_FOUND)
+			sum += match.paramsc;
+	}
+	unsigned long long elapsed = cycles() - start;
+
+	if (sum == 0) printf(" ");
+	return elapsed;
+}
+
+static void report(const char *name, size_t routes, unsigned long long elapsed, size_t iterations)
+{
+	printf("%-8s %6zu routes %12.1f cycles/lookup\n", name, routes, (double)elapsed / iterations);
+}
+
+int main(int argc, const char *argv[])
+{
+	size_t iterations = argc > 1 ? strtoull(argv[1], NULL, 10) : 200000;
+	if (iterations == 0) iterations = 1;
+
+	size_t counts[] = { 16, 128, 1024, 4096 };
+	size_t maxRoutes = counts[sizeof(counts) / sizeof(counts[0]) - 1];
+
+	patterns = malloc(maxRoutes * sizeof(*patterns));
+	paths = malloc(PATHS * sizeof(*paths));
+	if (patterns == NULL || paths == NULL) return 1;
+
+	// REST-like API: versions, resources with identifiers and nested collections.
+	for (size_t r = 0; r < maxRoutes; r++) {
+		if (r % 2 == 0) snprintf(patterns[r], sizeof(*patterns), "/api/v%zu/resource%zu/:id", r % 4, r);
+		else snprintf(patterns[r], sizeof(*patterns), "/api/v%zu/resource%zu/:id/items/:item", r % 4, r);
+	}
+
+	printf("%zu iterations\n", iterations);
+
+	srand(1);
+	for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); c++) {
+		size_t routes = counts[c];
+
+		// Paths are spread over all the routes, so the linear scan stops in the middle on average.
+		for (size_t i = 0; i < PATHS; i++) {
+			size_t r = (size_t)rand() % routes;
+
+			if (r % 2 == 0) snprintf(paths[i], sizeof(*paths), "/api/v%zu/resource%zu/%d", r % 4, r, rand());
+			else snprintf(paths[i], sizeof(*paths), "/api/v%zu/resource%zu/%d/items/%d", r % 4, r, rand(), rand());
+		}
+
+		struct httpRouter router;
+		initHTTPRouter(&router);
+		for (size_t r = 0; r < routes; r++)
+			if (addHTTPRoute(&router, HTTPM_GET, patterns[r], benchProcessor)) {
+				perror("addHTTPRoute");
+				return 1;
+			}
+
+		report("linear", routes, runLinear(routes, iterations), iterations);
+		report("radix", routes, runRadix(&router, iterations), iterations);
+
+		destroyHTTPRouter(&router);
+	}
+
+	free(patterns);
+	free(paths);
+
+	return 0;
+}
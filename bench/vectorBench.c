@@ -0,0 +1,145 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+#include "server/utils.h"
+
+/**
+ * Count of elements in benchmarked vectors.
+ */
+#define BENCH_ELEMENTS 1024
+
+struct benchContext {
+	struct vector *vec;
+	struct rcuVector *rcuvec;
+	size_t iterations;
+	int stop;
+};
+
+static double nowNs()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void *readMutexVector(void *rawctx)
+{
+	struct benchContext *ctx = rawctx;
+	size_t sum = 0;
+
+	for (size_t i = 0; i < ctx->iterations; i++)
+		sum += (size_t)vectorGetEl(ctx->vec, i % BENCH_ELEMENTS);
+
+	return (void *)sum;
+}
+
+static void *readRcuVector(void *rawctx)
+{
+	struct benchContext *ctx = rawctx;
+	size_t sum = 0;
+
+	for (size_t i = 0; i < ctx->iterations; i++)
+		sum += (size_t)rcuVectorGetEl(ctx->rcuvec, i % BENCH_ELEMENTS);
+
+	return (void *)sum;
+}
+
+/**
+ * Keeps writers busy while readers run: the usual accept burst pattern.
+ */
+static void *writeVectors(void *rawctx)
+{
+	struct benchContext *ctx = rawctx;
+
+	for (size_t i = 0; !__atomic_load_n(&ctx->stop, __ATOMIC_RELAXED); i++) {
+		vectorSetEl(ctx->vec, i % BENCH_ELEMENTS, (void *)i);
+		rcuVectorSetEl(ctx->rcuvec, i % BENCH_ELEMENTS, (void *)i);
+	}
+
+	return NULL;
+}
+
+/**
+ * Runs @readers threads of @fn and one writer.
+ *
+ * @Returns average time of one read in nanoseconds.
+ */
+static double runReaders(struct benchContext *ctx, void *(*fn)(void *), int readers)
+{
+	pthread_t *thrs = malloc(sizeof(pthread_t) * readers);
+	pthread_t writer;
+
+	ctx->stop = 0;
+	pthread_create(&writer, NULL, writeVectors, ctx);
+
+	double start = nowNs();
+	for (int i = 0; i < readers; i++)
+		pthread_create(thrs + i, NULL, fn, ctx);
+	for (int i = 0; i < readers; i++)
+		pthread_join(thrs[i], NULL);
+	double elapsed = nowNs() - start;
+
+	__atomic_store_n(&ctx->stop, 1, __ATOMIC_RELAXED);
+	pthread_join(writer, NULL);
+	free(thrs);
+
+	return elapsed / ((double)ctx->iterations * readers);
+}
+
+static double runLocal(struct vector_p *vec, size_t iterations)
+{
+	size_t sum = 0;
+	double start = nowNs();
+
+	for (size_t i = 0; i < iterations; i++) {
+		size_t el;
+		vectorCopyEl_p(vec, i % BENCH_ELEMENTS, (char *)&el);
+		sum += el;
+	}
+
+	double elapsed = nowNs() - start;
+	if (sum == 0) printf(" ");
+
+	return elapsed / iterations;
+}
+
+int main(int argc, const char *argv[])
+{
+	int readers = argc > 1 ? atoi(argv[1]) : 4;
+	size_t iterations = argc > 2 ? strtoull(argv[2], NULL, 10) : 1000000;
+	if (readers <= 0) readers = 1;
+
+	struct vector vec;
+	struct rcuVector rcuvec;
+	struct vector_p lockedvec, localvec;
+
+	initVector(&vec, 2);
+	initRcuVector(&rcuvec, 2);
+	initVector_p(&lockedvec, sizeof(size_t), 2);
+	initLocalVector_p(&localvec, sizeof(size_t), 2);
+
+	for (size_t i = 0; i < BENCH_ELEMENTS; i++) {
+		insertVector(&vec, (void *)i);
+		insertRcuVector(&rcuvec, (void *)i);
+		insertVector_p(&lockedvec, (char *)&i);
+		insertVector_p(&localvec, (char *)&i);
+	}
+
+	struct benchContext ctx = { .vec = &vec, .rcuvec = &rcuvec, .iterations = iterations };
+
+	printf("Shared vector, %d readers and 1 writer, %zu reads per reader:\n", readers, iterations);
+	printf("  mutex vectorGetEl:      %8.2f ns/read\n", runReaders(&ctx, readMutexVector, readers));
+	printf("  rcuVectorGetEl:         %8.2f ns/read\n", runReaders(&ctx, readRcuVector, readers));
+
+	printf("Thread-local vector_p, %zu reads:\n", iterations);
+	printf("  locked vectorCopyEl_p:  %8.2f ns/read\n", runLocal(&lockedvec, iterations));
+	printf("  local vectorCopyEl_p:   %8.2f ns/read\n", runLocal(&localvec, iterations));
+
+	vectorDestroy(&vec);
+	rcuVectorDestroy(&rcuvec);
+	vectorDestroy_p(&lockedvec);
+	vectorDestroy_p(&localvec);
+
+	return 0;
+}
@@ -6,6 +6,7 @@
 #include <search.h>
 #include <unistd.h>
 #include "http.h"
+#include "handoff.h"
 
 
 void httpRequestProcessor(struct HTTPRequest *request, struct HTTPResponse *response) 
@@ -28,7 +29,9 @@ int main(int argc, const char *argv[])
 	registerApplication(&serverContext);
 
 
-	if (initContext(&serverContext, httpConnetionHandler, &httpConnhandlerArgs) || initSighandler()) {
+	if (	initContext(&serverContext, httpConnetionHandler, &httpConnhandlerArgs) || 
+		contextSetEventHandler(&serverContext, httpEventHandler) || 
+		initSighandler()) {
 		perror("Unable to initialize context");
 		return 1;
 	}
@@ -38,7 +41,28 @@ int main(int argc, const char *argv[])
 		return 1;
 	}
 
+	// Sockets passed by the service manager or the predecessor are not bound again.
+	if (contextInheritSockets(&serverContext) < 0) {
+		perror("Unable to inherit listening sockets");
+		closeApplication(0);
+		return 1;
+	}
+
+	if (args.handoffPath != NULL) {
+		int taken = contextTakeoverSockets(&serverContext, args.handoffPath);
+		if (taken < 0) {
+			perror("Unable to take listening sockets over");
+			closeApplication(0);
+			return 1;
+		}
+
+		if (taken > 0)
+			printf("Took %d listening sockets over from the predecessor\n", taken);
+	}
+
 	for (int i = 0; i < args.unixc; i++) {
+		if (contextHasUnixSocket(&serverContext, args.unixSocks[i])) continue;
+
 		struct ssock *sock = malloc(sizeof(struct ssock));
 		if (bindUnixSocket(sock, args.unixSocks[i]) || contextRegisterSocket(&serverContext, *sock)) {
 			fprintf(stderr, "Unable to set up a unix socket %s: %s\n", args.unixSocks[i], strerror(errno));
@@ -48,6 +72,8 @@ int main(int argc, const char *argv[])
 	}
 
 	for (int i = 0; i < args.TCPc; i++) {
+		if (contextHasTCPSocket(&serverContext, args.TCPPorts[i], args.TCPAddrs[i])) continue;
+
 		struct ssock *sock = malloc(sizeof(struct ssock));
 		if (bindTCPSocket(sock, args.TCPPorts[i], args.TCPAddrs[i]) || contextRegisterSocket(&serverContext, *sock)) {
 			fprintf(stderr, "Unable to set up a tcp socket %ud:%d: %s\n", 
@@ -57,7 +83,28 @@ int main(int argc, const char *argv[])
 		}
 	}
 
-	if (startServer(&serverContext)) {
+	if (args.handoffPath != NULL && contextServeHandoff(&serverContext, args.handoffPath)) {
+		fprintf(stderr, "Unable to listen for successors on %s: %s\n", args.handoffPath, strerror(errno));
+		closeApplication(0);
+		return 1;
+	}
+
+	struct ServerOptions options = {
+		.mode = SERVER_MODE_THREADS,
+		.threads = args.threads,
+		.reuseport = args.reuseport != 0,
+		.pinThreads = args.reuseport >= 2,
+		.steerCPU = args.reuseport == 3,
+		.timeouts = { .response = HTTP_TIMEOUT_RESPONSE }
+	};
+
+	options.inputLimit = httpInputLimit(&httpConnhandlerArgs);
+
+	if (args.mode == 'E') options.mode = SERVER_MODE_EPOLL;
+	else if (args.mode == 'R') options.mode = SERVER_MODE_URING;
+	else if (args.mode == 'P') options.mode = SERVER_MODE_POOL;
+
+	if (startServer(&serverContext, &options)) {
 		perror("Unable to start up server");
 		return 1;
 	}
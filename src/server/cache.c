@@ -0,0 +1,601 @@
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+#include "cache.h"
+#include "timer.h"
+#include "HttpStatusCodes_C.h"
+
+/**
+ * Starting count of hash buckets of shard. Buckets are doubled when entries outnumber them.
+ */
+#define HTTP_CACHE_BUCKETS 64
+
+uint64_t httpCacheHash(const char *buf, size_t len)
+{
+	uint64_t hash = 14695981039346656037ull;
+	for (size_t i = 0; i < len; i++) {
+		hash ^= (unsigned char)buf[i];
+		hash *= 1099511628211ull;
+	}
+
+	return hash;
+}
+
+int initHTTPCache(struct httpCache *cache, size_t capacity, size_t shards)
+{
+	memset(cache, 0, sizeof(struct httpCache));
+
+	if (shards == 0) {
+		long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+		shards = ncpu > 0 ? ncpu : 1;
+	}
+
+	cache->shardsc = 1;
+	while (cache->shardsc < shards) cache->shardsc <<= 1;
+
+	cache->shards = calloc(cache->shardsc, sizeof(struct httpCacheShard));
+	if (cache->shards == NULL) return -1;
+
+	for (size_t i = 0; i < cache->shardsc; i++) {
+		struct httpCacheShard *shard = &cache->shards[i];
+		shard->capacity = capacity / cache->shardsc;
+		shard->bucketsc = HTTP_CACHE_BUCKETS;
+		shard->buckets = calloc(shard->bucketsc, sizeof(struct httpCacheEntry *));
+
+		int err = shard->buckets == NULL ? ENOMEM : pthread_mutex_init(&shard->lock, NULL);
+		if (err != 0) {
+			free(shard->buckets);
+			cache->shardsc = i;
+			destroyHTTPCache(cache);
+			errno = err;
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+void releaseHTTPCacheEntry(void *ctx)
+{
+	struct httpCacheEntry *entry = ctx;
+
+	// Entry is one allocation along with its strings.
+	if (__atomic_sub_fetch(&entry->refs, 1, __ATOMIC_ACQ_REL) == 0) free(entry);
+}
+
+/**
+ * Unlinks @entry from @shard and drops the cache reference. Shard lock should be held.
+ */
+static void removeHTTPCacheEntry(struct httpCacheShard *shard, struct httpCacheEntry *entry)
+{
+	struct httpCacheEntry **link = &shard->buckets[(entry->hash >> 32) & (shard->bucketsc - 1)];
+	while (*link != entry) link = &(*link)->hashNext;
+	*link = entry->hashNext;
+
+	if (entry->lruPrev != NULL) entry->lruPrev->lruNext = entry->lruNext;
+	else shard->lruHead = entry->lruNext;
+	if (entry->lruNext != NULL) entry->lruNext->lruPrev = entry->lruPrev;
+	else shard->lruTail = entry->lruPrev;
+
+	shard->size -= entry->size;
+	shard->entries--;
+
+	releaseHTTPCacheEntry(entry);
+}
+
+void destroyHTTPCache(struct httpCache *cache)
+{
+	for (size_t i = 0; i < cache->shardsc; i++) {
+		struct httpCacheShard *shard = &cache->shards[i];
+
+		while (shard->lruHead != NULL)
+			removeHTTPCacheEntry(shard, shard->lruHead);
+
+		free(shard->buckets);
+		pthread_mutex_destroy(&shard->lock);
+	}
+
+	free(cache->shards);
+	cache->shards = NULL;
+	cache->shardsc = 0;
+}
+
+int addHTTPCacheVary(struct httpCache *cache, const char *name)
+{
+	if (cache->varyc == HTTP_CACHE_MAX_VARY) {
+		errno = ENOSPC;
+		return -1;
+	}
+
+	cache->vary[cache->varyc++] = name;
+
+	return 0;
+}
+
+/**
+ * Appends @len bytes of @buf to @key.
+ *
+ * @Returns 0 on success, -1 if the key is too long.
+ */
+static int httpCacheKeyPut(struct httpCacheKey *key, const char *buf, size_t len)
+{
+	if (key->len + len > HTTP_CACHE_KEY_MAX) return -1;
+
+	memcpy(key->buf + key->len, buf, len);
+	key->len += len;
+
+	return 0;
+}
+
+void buildHTTPCacheKey(struct HTTPRequest *request, const char *const *vary, size_t varyc, struct httpCacheKey *key)
+{
+	key->len = 0;
+	key->cacheable = 0;
+
+	if (request->method != HTTPM_GET && request->method != HTTPM_HEAD) return;
+	// Response to authorized request is private.
+	if (getHTTPRequestHeader(request, "Authorization", NULL) != NULL) return;
+
+	const char *path = request->views ? request->pathv.ptr : request->path;
+	size_t len = request->views ? request->pathv.len : strlen(request->path);
+
+	// Lines are terminated by '\n' that can not be part of them. HEAD has the key of GET.
+	if (httpCacheKeyPut(key, "GET ", 4) || httpCacheKeyPut(key, path, len) || httpCacheKeyPut(key, "\n", 1))
+		return;
+
+	for (size_t i = 0; i < varyc; i++) {
+		const char *value = getHTTPRequestHeader(request, vary[i], &len);
+		if (value == NULL) len = 0;
+
+		if (httpCacheKeyPut(key, value, len) || httpCacheKeyPut(key, "\n", 1)) return;
+	}
+
+	key->hash = httpCacheHash(key->buf, key->len);
+	key->cacheable = 1;
+}
+
+static struct httpCacheShard *httpCacheShard(struct httpCache *cache, uint64_t hash)
+{
+	return &cache->shards[hash & (cache->shardsc - 1)];
+}
+
+/**
+ * Finds entry of @key in @shard. Shard lock should be held.
+ */
+static struct httpCacheEntry *findHTTPCacheEntry(struct httpCacheShard *shard, struct httpCacheKey *key)
+{
+	struct httpCacheEntry *entry = shard->buckets[(key->hash >> 32) & (shard->bucketsc - 1)];
+
+	while (entry != NULL && (entry->hash != key->hash || entry->keyLen != key->len || memcmp(entry->key, key->buf, key->len)))
+		entry = entry->hashNext;
+
+	return entry;
+}
+
+/**
+ * @Returns 1 if entity tag list @list (value of If-None-Match) matches @etag by weak comparison.
+ */
+static int httpETagMatches(const char *list, size_t len, const char *etag)
+{
+	if (!strncmp(etag, "W/", 2)) etag += 2;
+	size_t etagLen = strlen(etag);
+
+	size_t i = 0;
+	while (i < len) {
+		while (i < len && (list[i] == ' ' || list[i] == '\t' || list[i] == ',')) i++;
+
+		size_t start = i;
+		while (i < len && list[i] != ',') i++;
+
+		size_t end = i;
+		while (end > start && (list[end - 1] == ' ' || list[end - 1] == '\t')) end--;
+
+		if (end - start == 1 && list[start] == '*') return 1;
+		if (end - start > 2 && !strncmp(list + start, "W/", 2)) start += 2;
+
+		if (end - start == etagLen && !memcmp(list + start, etag, etagLen)) return 1;
+	}
+
+	return 0;
+}
+
+/**
+ * Makes @response 304 to conditional @request if it matches entity tag of @entry.
+ *
+ * @Returns 1 if the response is 304.
+ */
+static int answerHTTPNotModified(struct HTTPRequest *request, struct HTTPResponse *response,
+	const struct httpCacheEntry *entry)
+{
+	if (entry->etag == NULL) return 0;
+
+	size_t len;
+	const char *list = getHTTPRequestHeader(request, "If-None-Match", &len);
+	if (list == NULL || !httpETagMatches(list, len, entry->etag)) return 0;
+
+	response->status = HttpStatus_NotModified;
+	addKVHTTPHeader_p(&response->headers, "ETag", entry->etag);
+	if (entry->cacheControl != NULL)
+		addKVHTTPHeader_p(&response->headers, "Cache-Control", entry->cacheControl);
+
+	// Content-Length of 304 is the one of the response it stands for.
+	response->headOnly = 1;
+	response->bodyc = entry->bodyc;
+
+	return 1;
+}
+
+void respondHTTPCacheEntry(struct HTTPRequest *request, struct HTTPResponse *response, struct httpCacheEntry *entry)
+{
+	if (answerHTTPNotModified(request, response, entry)) {
+		releaseHTTPCacheEntry(entry);
+		return;
+	}
+
+	response->status = entry->status;
+	response->rawHeaders = entry->head;
+	response->rawHeadersc = entry->headLen;
+	response->body = entry->body;
+	response->bodyc = entry->bodyc;
+	response->bodyRelease = releaseHTTPCacheEntry;
+	response->bodyCtx = entry;
+	response->headOnly = request->method == HTTPM_HEAD;
+}
+
+int lookupHTTPCache(struct httpCache *cache, struct HTTPRequest *request, struct HTTPResponse *response,
+	struct httpCacheKey *key)
+{
+	buildHTTPCacheKey(request, cache->vary, cache->varyc, key);
+	if (!key->cacheable) return 0;
+
+	struct httpCacheShard *shard = httpCacheShard(cache, key->hash);
+	uint64_t now = timerNow();
+
+	pthread_mutex_lock(&shard->lock);
+
+	struct httpCacheEntry *entry = findHTTPCacheEntry(shard, key);
+	if (entry != NULL && now >= entry->expires) {
+		removeHTTPCacheEntry(shard, entry);
+		shard->expirations++;
+		entry = NULL;
+	}
+
+	if (entry == NULL) {
+		shard->misses++;
+		pthread_mutex_unlock(&shard->lock);
+		return 0;
+	}
+
+	shard->hits++;
+	__atomic_add_fetch(&entry->refs, 1, __ATOMIC_ACQ_REL);
+
+	if (shard->lruHead != entry) {
+		entry->lruPrev->lruNext = entry->lruNext;
+		if (entry->lruNext != NULL) entry->lruNext->lruPrev = entry->lruPrev;
+		else shard->lruTail = entry->lruPrev;
+
+		entry->lruPrev = NULL;
+		entry->lruNext = shard->lruHead;
+		shard->lruHead->lruPrev = entry;
+		shard->lruHead = entry;
+	}
+
+	pthread_mutex_unlock(&shard->lock);
+
+	char age[24];
+	snprintf(age, sizeof(age), "%llu", (unsigned long long)(now - entry->stored) / 1000);
+	addKVHTTPHeader_p(&response->headers, "Age", age);
+
+	respondHTTPCacheEntry(request, response, entry);
+
+	return 1;
+}
+
+/**
+ * Statuses cacheable by default (RFC 9110, 15.1).
+ */
+static int httpCacheableStatus(int status)
+{
+	switch (status) {
+	case 200: case 203: case 204: case 206: case 300: case 301: case 308:
+	case 404: case 405: case 410: case 414: case 501:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+/**
+ * Parses Cache-Control of the response.
+ *
+ * @Returns freshness lifetime in seconds: s-maxage, or max-age if there is none. 0 if the response
+ * should not be stored.
+ */
+static unsigned long httpCacheLifetime(const char *cacheControl)
+{
+	unsigned long maxAge = 0;
+	int shared = 0;
+
+	const char *p = cacheControl;
+	while (*p != '\0') {
+		while (*p == ' ' || *p == '\t' || *p == ',') p++;
+
+		const char *name = p;
+		while (*p != '\0' && *p != ',' && *p != '=' && *p != ' ') p++;
+		size_t len = p - name;
+
+		if (	(len == 8 && !strncasecmp(name, "no-store", 8)) ||
+			(len == 8 && !strncasecmp(name, "no-cache", 8)) ||
+			(len == 7 && !strncasecmp(name, "private", 7)))
+			return 0;
+
+		if (*p == '=') {
+			const char *value = ++p;
+			while (*p != '\0' && *p != ',') p++;
+
+			int isShared = len == 8 && !strncasecmp(name, "s-maxage", 8);
+			if ((isShared || (len == 7 && !strncasecmp(name, "max-age", 7))) && (isShared || !shared)) {
+				maxAge = strtoul(value, NULL, 10);
+				shared = isShared;
+			}
+		}
+
+		while (*p != '\0' && *p != ',') p++;
+	}
+
+	return maxAge;
+}
+
+/**
+ * Parses Vary of the response.
+ *
+ * @Returns 1 if every request header it lists is a part of the key (see addHTTPCacheVary()), 0 if the response
+ * varies on another header or on anything (*).
+ */
+static int httpCacheKeyVaries(struct httpCache *cache, const char *vary)
+{
+	const char *p = vary;
+	while (*p != '\0') {
+		while (*p == ' ' || *p == '\t' || *p == ',') p++;
+
+		const char *name = p;
+		while (*p != '\0' && *p != ',' && *p != ' ' && *p != '\t') p++;
+		size_t len = p - name;
+		if (len == 0) continue;
+		if (len == 1 && *name == '*') return 0;
+
+		size_t i = 0;
+		while (i < cache->varyc && (strlen(cache->vary[i]) != len || strncasecmp(cache->vary[i], name, len))) i++;
+		if (i == cache->varyc) return 0;
+	}
+
+	return 1;
+}
+
+/**
+ * Doubles the hash buckets of @shard. Shard lock should be held. Buckets stay the same on allocation failure.
+ */
+static void growHTTPCacheShard(struct httpCacheShard *shard)
+{
+	size_t nbucketsc = shard->bucketsc * 2;
+	struct httpCacheEntry **nbuckets = calloc(nbucketsc, sizeof(struct httpCacheEntry *));
+	if (nbuckets == NULL) return;
+
+	for (size_t i = 0; i < shard->bucketsc; i++) {
+		struct httpCacheEntry *entry = shard->buckets[i];
+
+		while (entry != NULL) {
+			struct httpCacheEntry *next = entry->hashNext;
+			struct httpCacheEntry **bucket = &nbuckets[(entry->hash >> 32) & (nbucketsc - 1)];
+
+			entry->hashNext = *bucket;
+			*bucket = entry;
+			entry = next;
+		}
+	}
+
+	free(shard->buckets);
+	shard->buckets = nbuckets;
+	shard->bucketsc = nbucketsc;
+}
+
+/**
+ * Adds @entry to @shard replacing the entry of the same key. Least recently used entries are evicted
+ * to fit it. Shard lock should be held.
+ */
+static void insertHTTPCacheEntry(struct httpCacheShard *shard, struct httpCacheEntry *entry, struct httpCacheKey *key)
+{
+	struct httpCacheEntry *old = findHTTPCacheEntry(shard, key);
+	if (old != NULL) removeHTTPCacheEntry(shard, old);
+
+	while (shard->size + entry->size > shard->capacity) {
+		removeHTTPCacheEntry(shard, shard->lruTail);
+		shard->evictions++;
+	}
+
+	if (shard->entries >= shard->bucketsc) growHTTPCacheShard(shard);
+
+	struct httpCacheEntry **bucket = &shard->buckets[(entry->hash >> 32) & (shard->bucketsc - 1)];
+	entry->hashNext = *bucket;
+	*bucket = entry;
+
+	entry->lruPrev = NULL;
+	entry->lruNext = shard->lruHead;
+	if (shard->lruHead != NULL) shard->lruHead->lruPrev = entry;
+	else shard->lruTail = entry;
+	shard->lruHead = entry;
+
+	shard->size += entry->size;
+	shard->entries++;
+}
+
+/**
+ * @Returns 1 if header of name @key is not stored: it is set for each response or is rendered from the body.
+ */
+static int httpCacheSkipsHeader(const char *key)
+{
+	return	!strcasecmp(key, "Content-Length") || !strcasecmp(key, "Transfer-Encoding") ||
+		!strcasecmp(key, "Connection") || !strcasecmp(key, "Age");
+}
+
+struct httpCacheEntry *newHTTPCacheEntry(struct httpCacheKey *key, struct HTTPResponse *response,
+	const char *etag, const char *cacheControl, size_t maxSize)
+{
+	if (response->headOnly || (response->bodyType != HTTP_BODY_BUFFER && response->bodyType != HTTP_BODY_IOVEC)) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	size_t headLen = 0;
+	for (size_t i = 0; i < response->headers.vec.size; i++) {
+		struct HTTPHeader *header = (struct HTTPHeader *)vectorElPtr_p(&response->headers.vec, i);
+		if (header->value == NULL || httpCacheSkipsHeader(header->key)) continue;
+
+		headLen += strlen(header->key) + 2 + strlen(header->value) + 2;
+	}
+
+	size_t etagLen = etag != NULL ? strlen(etag) + 1 : 0;
+	size_t ccLen = cacheControl != NULL ? strlen(cacheControl) + 1 : 0;
+	size_t size = sizeof(struct httpCacheEntry) + key->len + headLen + response->bodyc + etagLen + ccLen;
+	if (size > maxSize) {
+		errno = E2BIG;
+		return NULL;
+	}
+
+	struct httpCacheEntry *entry = malloc(size);
+	if (entry == NULL) return NULL;
+
+	memset(entry, 0, sizeof(struct httpCacheEntry));
+	entry->hash = key->hash;
+	entry->key = (char *)(entry + 1);
+	entry->keyLen = key->len;
+	memcpy(entry->key, key->buf, key->len);
+
+	entry->head = entry->key + key->len;
+	for (size_t i = 0; i < response->headers.vec.size; i++) {
+		struct HTTPHeader *header = (struct HTTPHeader *)vectorElPtr_p(&response->headers.vec, i);
+		if (header->value == NULL || httpCacheSkipsHeader(header->key)) continue;
+
+		size_t klen = strlen(header->key), vlen = strlen(header->value);
+		char *line = entry->head + entry->headLen;
+		memcpy(line, header->key, klen);
+		memcpy(line + klen, ": ", 2);
+		memcpy(line + klen + 2, header->value, vlen);
+		memcpy(line + klen + 2 + vlen, "\r\n", 2);
+		entry->headLen += klen + 2 + vlen + 2;
+	}
+
+	entry->body = entry->head + headLen;
+	entry->bodyc = response->bodyc;
+	if (response->bodyType == HTTP_BODY_BUFFER) {
+		if (response->bodyc != 0) memcpy(entry->body, response->body, response->bodyc);
+	} else {
+		size_t off = 0;
+		for (int i = 0; i < response->source.iov.iovc; i++) {
+			memcpy(entry->body + off, response->source.iov.iov[i].iov_base, response->source.iov.iov[i].iov_len);
+			off += response->source.iov.iov[i].iov_len;
+		}
+	}
+
+	if (etag != NULL) {
+		entry->etag = entry->body + entry->bodyc;
+		memcpy(entry->etag, etag, etagLen);
+	}
+	if (cacheControl != NULL) {
+		entry->cacheControl = entry->body + entry->bodyc + etagLen;
+		memcpy(entry->cacheControl, cacheControl, ccLen);
+	}
+
+	entry->status = response->status;
+	entry->stored = timerNow();
+	entry->size = size;
+	entry->refs = 1;
+
+	return entry;
+}
+
+void storeHTTPCache(struct httpCache *cache, struct httpCacheKey *key, struct HTTPRequest *request,
+	struct HTTPResponse *response)
+{
+	if (!key->cacheable || request->method != HTTPM_GET || response->headOnly || response->rawHeaders != NULL) return;
+	if (!httpCacheableStatus(response->status)) return;
+	if (response->bodyType != HTTP_BODY_BUFFER && response->bodyType != HTTP_BODY_IOVEC) return;
+
+	const char *cacheControl = getHTTPHeader_p(&response->headers, "Cache-Control");
+	if (cacheControl == NULL || getHTTPHeader_p(&response->headers, "Set-Cookie") != NULL) return;
+
+	// Response varying on a header outside of the key would answer requests it was not chosen for.
+	const char *vary = getHTTPHeader_p(&response->headers, "Vary");
+	if (vary != NULL && !httpCacheKeyVaries(cache, vary)) return;
+
+	unsigned long lifetime = httpCacheLifetime(cacheControl);
+	if (lifetime == 0) return;
+
+	struct httpCacheShard *shard = httpCacheShard(cache, key->hash);
+
+	// Strong entity tag of the body is added if the processor has not set one.
+	char etag[24];
+	const char *etagh = getHTTPHeader_p(&response->headers, "ETag");
+	if (etagh == NULL) {
+		uint64_t hash = 14695981039346656037ull;
+		if (response->bodyType == HTTP_BODY_BUFFER) {
+			hash = httpCacheHash(response->body, response->bodyc);
+		} else {
+			for (int i = 0; i < response->source.iov.iovc; i++)
+				for (size_t j = 0; j < response->source.iov.iov[i].iov_len; j++) {
+					hash ^= ((unsigned char *)response->source.iov.iov[i].iov_base)[j];
+					hash *= 1099511628211ull;
+				}
+		}
+
+		snprintf(etag, sizeof(etag), "\"%016llx\"", (unsigned long long)hash);
+		if (addKVHTTPHeader_p(&response->headers, "ETag", etag)) return;
+		etagh = etag;
+		// Header vector owns its copy, the value above is a local one.
+		cacheControl = getHTTPHeader_p(&response->headers, "Cache-Control");
+	}
+
+	struct httpCacheEntry *entry = newHTTPCacheEntry(key, response, etagh, cacheControl, shard->capacity);
+	if (entry == NULL) return;
+
+	entry->expires = entry->stored + lifetime * 1000;
+	// Reference of the response answered below is kept as well.
+	entry->refs = 2;
+
+	pthread_mutex_lock(&shard->lock);
+	insertHTTPCacheEntry(shard, entry, key);
+	pthread_mutex_unlock(&shard->lock);
+
+	// Conditional request is answered by 304 even if the response is processed.
+	int httpver = response->httpver;
+	struct HTTPResponse notModified;
+	if (initHTTPResponse(&notModified, httpver) == 0 && answerHTTPNotModified(request, &notModified, entry)) {
+		destroyHTTPResponse(response);
+		*response = notModified;
+	} else {
+		destroyHTTPResponse(&notModified);
+	}
+
+	releaseHTTPCacheEntry(entry);
+}
+
+void getHTTPCacheStats(struct httpCache *cache, struct httpCacheStats *stats)
+{
+	memset(stats, 0, sizeof(struct httpCacheStats));
+
+	for (size_t i = 0; i < cache->shardsc; i++) {
+		struct httpCacheShard *shard = &cache->shards[i];
+
+		pthread_mutex_lock(&shard->lock);
+		stats->hits += shard->hits;
+		stats->misses += shard->misses;
+		stats->evictions += shard->evictions;
+		stats->expirations += shard->expirations;
+		stats->entries += shard->entries;
+		stats->size += shard->size;
+		pthread_mutex_unlock(&shard->lock);
+	}
+}
@@ -0,0 +1,202 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "http.h"
+
+#ifndef HTTP_CACHE_MAX_VARY
+/**
+ * Maximum count of request headers the cached responses vary on.
+ */
+#define HTTP_CACHE_MAX_VARY 8
+#endif
+
+#ifndef HTTP_CACHE_KEY_MAX
+/**
+ * Maximum length of cache key: method, path and values of vary headers. Requests with longer keys are not cached.
+ */
+#define HTTP_CACHE_KEY_MAX 2048
+#endif
+
+/**
+ * Cached response. Header lines (without Content-Length) and the body are serialized once when the response
+ * is stored, hits only prepend the status line. Entry is referenced by the cache and by every response
+ * sending it, so an entry evicted while it is sent stays alive until the response is released.
+ */
+struct httpCacheEntry {
+	uint64_t hash;
+	char *key;
+	size_t keyLen;
+
+	int status;
+	// Serialized header lines, see rawHeaders of struct HTTPResponse.
+	char *head;
+	size_t headLen;
+	char *body;
+	size_t bodyc;
+	// Quoted entity tag, set by the processor or computed from the body. May be NULL.
+	char *etag;
+	// Cache-Control of the response, repeated by 304 responses. May be NULL.
+	char *cacheControl;
+
+	// Times (see timerNow()) the entry is stored at and stops being fresh at.
+	uint64_t stored;
+	uint64_t expires;
+
+	// Size charged to the cache capacity.
+	size_t size;
+	int refs;
+
+	struct httpCacheEntry *lruPrev;
+	struct httpCacheEntry *lruNext;
+	struct httpCacheEntry *hashNext;
+};
+
+/**
+ * Part of the cache with its own lock, so requests of different keys do not contend.
+ */
+struct httpCacheShard {
+	pthread_mutex_t lock;
+
+	struct httpCacheEntry **buckets;
+	size_t bucketsc;
+	// Most recently used entry is the head.
+	struct httpCacheEntry *lruHead;
+	struct httpCacheEntry *lruTail;
+	size_t entries;
+	size_t size;
+	size_t capacity;
+
+	size_t hits;
+	size_t misses;
+	size_t evictions;
+	size_t expirations;
+};
+
+/**
+ * Stores serialized responses the processor marks cacheable by Cache-Control max-age (or s-maxage),
+ * until they are stale or evicted as least recently used when the shard is full. GET and HEAD requests
+ * without Authorization are looked up, HEAD is answered from the GET response. Thread-safe.
+ */
+struct httpCache {
+	struct httpCacheShard *shards;
+	size_t shardsc;
+
+	// Request headers the responses vary on, e.g. Accept-Encoding. Their values are part of the key.
+	const char *vary[HTTP_CACHE_MAX_VARY];
+	size_t varyc;
+};
+
+struct httpCacheStats {
+	size_t hits;
+	size_t misses;
+	size_t evictions;
+	size_t expirations;
+	// Count and total size of stored entries.
+	size_t entries;
+	size_t size;
+};
+
+/**
+ * Key of request built by lookupHTTPCache() and used by storeHTTPCache() after the request is processed.
+ */
+struct httpCacheKey {
+	char buf[HTTP_CACHE_KEY_MAX];
+	size_t len;
+	uint64_t hash;
+	// Request may be answered from the cache and its response may be stored.
+	int cacheable;
+};
+
+/**
+ * Initializes the cache of @capacity bytes in total split into @shards shards.
+ *
+ * @shards Count of shards rounded up to a power of 2, 0 means one shard per online CPU core.
+ *
+ * @Returns 0 on success, -1 + errno otherwise.
+ */
+int initHTTPCache(struct httpCache *cache, size_t capacity, size_t shards);
+
+/**
+ * Frees the cache. Entries still being sent are freed once they are released.
+ */
+void destroyHTTPCache(struct httpCache *cache);
+
+/**
+ * Makes the responses vary on request header @name (not copied). Should be called before the cache is used.
+ *
+ * @Returns 0 on success, -1 + errno otherwise. ENOSPC if there are HTTP_CACHE_MAX_VARY headers already.
+ */
+int addHTTPCacheVary(struct httpCache *cache, const char *name);
+
+/**
+ * Answers @request by the fresh cached response: with 304 if If-None-Match matches its entity tag,
+ * otherwise with the response itself.
+ *
+ * @key Set to the key of request, for storeHTTPCache().
+ *
+ * @Returns 1 if @response is set, 0 if the request should be processed.
+ */
+int lookupHTTPCache(struct httpCache *cache, struct HTTPRequest *request, struct HTTPResponse *response,
+	struct httpCacheKey *key);
+
+/**
+ * Stores @response processed for @request of @key if it is cacheable: GET response of cacheable status
+ * with in-memory body, positive max-age and without no-store, no-cache, private or Set-Cookie.
+ * Response with Vary is stored only if the headers it lists are added by addHTTPCacheVary(), never with Vary: *.
+ * Stored response gets ETag if it has none, and is replaced by 304 if If-None-Match of @request matches it.
+ */
+void storeHTTPCache(struct httpCache *cache, struct httpCacheKey *key, struct HTTPRequest *request,
+	struct HTTPResponse *response);
+
+/**
+ * Builds @key of @request: method, path and values of @varyc request headers @vary. Only GET and HEAD
+ * requests without Authorization are cacheable, HEAD has the key of GET.
+ */
+void buildHTTPCacheKey(struct HTTPRequest *request, const char *const *vary, size_t varyc, struct httpCacheKey *key);
+
+/**
+ * @Returns 64-bit FNV-1a hash of @len bytes of @buf.
+ */
+uint64_t httpCacheHash(const char *buf, size_t len);
+
+/**
+ * Serializes @response with in-memory body into a new entry of @key with one reference.
+ *
+ * @etag Entity tag of the response, may be NULL.
+ * @cacheControl Cache-Control of the response, may be NULL.
+ * @maxSize Maximum size of the entry.
+ *
+ * @Returns the entry on success, NULL + errno otherwise. EINVAL if the body is not in memory, E2BIG if
+ * the entry is larger than @maxSize.
+ */
+struct httpCacheEntry *newHTTPCacheEntry(struct httpCacheKey *key, struct HTTPResponse *response,
+	const char *etag, const char *cacheControl, size_t maxSize);
+
+/**
+ * Answers @request by @entry: with 304 if If-None-Match matches its entity tag, otherwise with the entry
+ * itself. Reference of @entry is passed to @response.
+ */
+void respondHTTPCacheEntry(struct HTTPRequest *request, struct HTTPResponse *response, struct httpCacheEntry *entry);
+
+/**
+ * Releases reference of entry @ctx, it is freed once the last one is released.
+ */
+void releaseHTTPCacheEntry(void *ctx);
+
+/**
+ * Sums counters of the cache shards.
+ */
+void getHTTPCacheStats(struct httpCache *cache, struct httpCacheStats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CACHE_H */
@@ -0,0 +1,557 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <sys/sendfile.h>
+#include "connio.h"
+
+/**
+ * Rounds @n up to a power of 2, 0 is CONN_IO_BUFSZ.
+ */
+static size_t ringCapacity(size_t n)
+{
+	if (n == 0) return CONN_IO_BUFSZ;
+
+	size_t cap = 1;
+	while (cap < n)
+		cap <<= 1;
+
+	return cap;
+}
+
+/**
+ * Fills @iov with up to 2 spans of ring @buf: @len bytes starting from @off.
+ *
+ * @Returns count of spans.
+ */
+static int ringSpans(char *buf, size_t cap, size_t off, size_t len, struct iovec *iov)
+{
+	if (len == 0) return 0;
+
+	off &= cap - 1;
+	size_t first = cap - off;
+	if (first >= len) {
+		iov[0] = (struct iovec){ .iov_base = buf + off, .iov_len = len };
+		return 1;
+	}
+
+	iov[0] = (struct iovec){ .iov_base = buf + off, .iov_len = first };
+	iov[1] = (struct iovec){ .iov_base = buf, .iov_len = len - first };
+	return 2;
+}
+
+/**
+ * Moves @len bytes at @*head of ring @*buf to the start of new buffer with capacity @ncap.
+ *
+ * @Returns 0 on success, -1 + errno otherwise.
+ */
+static int ringRelocate(char **buf, size_t *cap, size_t *head, size_t len, size_t ncap)
+{
+	char *nbuf = malloc(ncap);
+	if (nbuf == NULL) return -1;
+
+	struct iovec iov[2];
+	int cnt = ringSpans(*buf, *cap, *head, len, iov);
+
+	size_t off = 0;
+	for (int i = 0; i < cnt; i++) {
+		memcpy(nbuf + off, iov[i].iov_base, iov[i].iov_len);
+		off += iov[i].iov_len;
+	}
+
+	free(*buf);
+	*buf = nbuf;
+	*cap = ncap;
+	*head = 0;
+
+	return 0;
+}
+
+/**
+ * Copies @n bytes into ring at @off.
+ */
+static void ringCopyIn(char *buf, size_t cap, size_t off, const char *src, size_t n)
+{
+	struct iovec iov[2];
+	int cnt = ringSpans(buf, cap, off, n, iov);
+
+	for (int i = 0; i < cnt; i++) {
+		memcpy(iov[i].iov_base, src, iov[i].iov_len);
+		src += iov[i].iov_len;
+	}
+}
+
+int initConnIO(struct connIO *io, int fd, size_t rcap, size_t wcap)
+{
+	memset(io, 0, sizeof(struct connIO));
+	io->fd = fd;
+
+	if (fd >= 0) {
+		int flags = fcntl(fd, F_GETFL);
+		if (flags == -1) goto error;
+
+		io->nonblock = (flags & O_NONBLOCK) != 0;
+	}
+
+	io->rcap = ringCapacity(rcap);
+	io->wcap = ringCapacity(wcap);
+
+	io->rbuf = malloc(io->rcap);
+	if (io->rbuf == NULL) goto error;
+
+	io->wbuf = malloc(io->wcap);
+	if (io->wbuf == NULL) goto rbuf_error;
+
+	return 0;
+
+rbuf_error:
+	free(io->rbuf);
+	io->rbuf = NULL;
+error:
+	return -1;
+}
+
+void destroyConnIO(struct connIO *io)
+{
+	free(io->rbuf);
+	free(io->wbuf);
+	io->rbuf = NULL;
+	io->wbuf = NULL;
+	io->rlen = 0;
+	io->wlen = 0;
+}
+
+ssize_t connIOFill(struct connIO *io)
+{
+	if (io->fd < 0 || io->eof) {
+		io->eof = 1;
+		return 0;
+	}
+
+	if (io->rlen == io->rcap) {
+		errno = ENOBUFS;
+		return -1;
+	}
+
+	struct iovec iov[2];
+	int cnt = ringSpans(io->rbuf, io->rcap, io->rhead + io->rlen, io->rcap - io->rlen, iov);
+
+	ssize_t rd;
+	do {
+		rd = readv(io->fd, iov, cnt);
+	} while (rd == -1 && errno == EINTR);
+
+	if (rd == -1) return -1;
+	if (rd == 0) io->eof = 1;
+
+	io->rlen += rd;
+	return rd;
+}
+
+const char *connIOPeek(struct connIO *io, size_t *len)
+{
+	*len = io->rlen;
+
+	if (io->rhead + io->rlen > io->rcap &&
+		ringRelocate(&io->rbuf, &io->rcap, &io->rhead, io->rlen, io->rcap)) {
+		// Out of memory: the first span is still readable.
+		*len = io->rcap - io->rhead;
+	}
+
+	return io->rbuf + io->rhead;
+}
+
+void connIOConsume(struct connIO *io, size_t n)
+{
+	if (n > io->rlen) n = io->rlen;
+
+	io->rlen -= n;
+	io->rhead = io->rlen == 0 ? 0 : (io->rhead + n) & (io->rcap - 1);
+}
+
+int connIOCompact(struct connIO *io)
+{
+	if (io->rhead == 0) return 0;
+
+	if (io->rhead + io->rlen > io->rcap)
+		return ringRelocate(&io->rbuf, &io->rcap, &io->rhead, io->rlen, io->rcap);
+
+	memmove(io->rbuf, io->rbuf + io->rhead, io->rlen);
+	io->rhead = 0;
+
+	return 0;
+}
+
+int connIOReserve(struct connIO *io, size_t cap)
+{
+	if (io->rcap >= cap) return connIOCompact(io);
+
+	return ringRelocate(&io->rbuf, &io->rcap, &io->rhead, io->rlen, ringCapacity(cap));
+}
+
+int connIOFeed(struct connIO *io, const char *buf, size_t n)
+{
+	if (io->rcap - io->rlen < n) {
+		size_t ncap = ringCapacity(io->rlen + n);
+		if (ringRelocate(&io->rbuf, &io->rcap, &io->rhead, io->rlen, ncap))
+			return -1;
+	}
+
+	ringCopyIn(io->rbuf, io->rcap, io->rhead + io->rlen, buf, n);
+	io->rlen += n;
+
+	return 0;
+}
+
+ssize_t connIORead(struct connIO *io, char *buf, size_t n)
+{
+	size_t readc = 0;
+
+	while (readc < n) {
+		if (io->rlen == 0) {
+			ssize_t rd = connIOFill(io);
+			if (rd == 0) break;
+			if (rd == -1) {
+				if (readc > 0 && errno == EAGAIN) break;
+				return -1;
+			}
+		}
+
+		struct iovec iov[2];
+		size_t take = io->rlen < n - readc ? io->rlen : n - readc;
+		int cnt = ringSpans(io->rbuf, io->rcap, io->rhead, take, iov);
+
+		for (int i = 0; i < cnt; i++) {
+			memcpy(buf + readc, iov[i].iov_base, iov[i].iov_len);
+			readc += iov[i].iov_len;
+		}
+
+		connIOConsume(io, take);
+	}
+
+	return readc;
+}
+
+ssize_t connIOGetLine(struct connIO *io, char **line, size_t *cap)
+{
+	size_t len = 0;
+
+	while (1) {
+		if (io->rlen == 0) {
+			ssize_t rd = connIOFill(io);
+			if (rd == 0) break;
+			if (rd == -1) goto error;
+		}
+
+		size_t avail;
+		const char *data = connIOPeek(io, &avail);
+
+		const char *nl = memchr(data, '\n', avail);
+		size_t take = nl != NULL ? (size_t)(nl - data) + 1 : avail;
+
+		if (*line == NULL || *cap < len + take + 1) {
+			size_t ncap = *cap > 0 ? *cap : 120;
+			while (ncap < len + take + 1)
+				ncap *= 2;
+
+			char *nline = realloc(*line, ncap);
+			if (nline == NULL) goto error;
+
+			*line = nline;
+			*cap = ncap;
+		}
+
+		memcpy(*line + len, data, take);
+		len += take;
+		connIOConsume(io, take);
+
+		if (nl != NULL) break;
+	}
+
+	if (len == 0) goto error;
+
+	(*line)[len] = '\0';
+	return len;
+error:
+	return -1;
+}
+
+int connIOWrite(struct connIO *io, const char *buf, size_t n)
+{
+	while (n > 0) {
+		size_t space = io->wcap - io->wlen;
+
+		if (space == 0) {
+			if (io->fd >= 0 && !io->nonblock) {
+				if (connIOFlush(io)) return -1;
+				continue;
+			}
+
+			size_t ncap = ringCapacity(io->wlen + n);
+			if (ringRelocate(&io->wbuf, &io->wcap, &io->whead, io->wlen, ncap))
+				return -1;
+			continue;
+		}
+
+		size_t take = space < n ? space : n;
+		ringCopyIn(io->wbuf, io->wcap, io->whead + io->wlen, buf, take);
+		io->wlen += take;
+		buf += take;
+		n -= take;
+	}
+
+	return 0;
+}
+
+int connIOPrintf(struct connIO *io, const char *fmt, ...)
+{
+	char sbuf[256];
+	char *buf = sbuf;
+
+	va_list args;
+	va_start(args, fmt);
+	int len = vsnprintf(sbuf, sizeof(sbuf), fmt, args);
+	va_end(args);
+
+	if (len < 0) return -1;
+
+	if ((size_t)len >= sizeof(sbuf)) {
+		buf = malloc(len + 1);
+		if (buf == NULL) return -1;
+
+		va_start(args, fmt);
+		vsnprintf(buf, len + 1, fmt, args);
+		va_end(args);
+	}
+
+	int ret = connIOWrite(io, buf, len);
+
+	if (buf != sbuf) free(buf);
+
+	return ret ? -1 : len;
+}
+
+/**
+ * Gathered write to connection. Socket is written with MSG_NOSIGNAL: closed peer is reported by EPIPE.
+ */
+static ssize_t connIOWritev(struct connIO *io, struct iovec *iov, int cnt)
+{
+	if (!io->notsock) {
+		struct msghdr msg = { .msg_iov = iov, .msg_iovlen = cnt };
+
+		ssize_t wr = sendmsg(io->fd, &msg, MSG_NOSIGNAL);
+		if (wr != -1 || errno != ENOTSOCK) return wr;
+
+		io->notsock = 1;
+	}
+
+	return writev(io->fd, iov, cnt);
+}
+
+int connIOFlush(struct connIO *io)
+{
+	if (io->fd < 0) return 0;
+
+	while (io->wlen > 0) {
+		struct iovec iov[2];
+		int cnt = ringSpans(io->wbuf, io->wcap, io->whead, io->wlen, iov);
+
+		ssize_t wr = connIOWritev(io, iov, cnt);
+		if (wr == -1) {
+			if (errno == EINTR) continue;
+			return -1;
+		}
+
+		connIOOutputConsume(io, wr);
+	}
+
+	return 0;
+}
+
+char *connIOWriteReserve(struct connIO *io, size_t n)
+{
+	size_t tail = io->whead + io->wlen;
+
+	// Free bytes are contiguous up to the end of buffer, or up to the head if output wraps.
+	size_t space = tail < io->wcap ? io->wcap - tail : io->whead - (tail - io->wcap);
+
+	if (space < n) {
+		size_t ncap = ringCapacity(io->wlen + n);
+		if (ncap < io->wcap) ncap = io->wcap;
+
+		if (ringRelocate(&io->wbuf, &io->wcap, &io->whead, io->wlen, ncap))
+			return NULL;
+
+		tail = io->wlen;
+	}
+
+	return io->wbuf + (tail & (io->wcap - 1));
+}
+
+void connIOWriteCommit(struct connIO *io, size_t n)
+{
+	io->wlen += n;
+}
+
+int connIOSend(struct connIO *io, const char *buf, size_t n)
+{
+	struct iovec iov = { .iov_base = (char *)buf, .iov_len = n };
+
+	return connIOSendv(io, &iov, 1);
+}
+
+int connIOSendv(struct connIO *io, const struct iovec *parts, int partsc)
+{
+	if (io->fd < 0) {
+		for (int i = 0; i < partsc; i++)
+			if (connIOWrite(io, parts[i].iov_base, parts[i].iov_len)) return -1;
+
+		return 0;
+	}
+
+	// Part being sent and count of its bytes sent already.
+	int part = 0;
+	size_t sent = 0;
+
+	while (1) {
+		struct iovec iov[CONN_IO_IOV];
+		int cnt = ringSpans(io->wbuf, io->wcap, io->whead, io->wlen, iov);
+
+		// Empty parts are skipped, so the write is empty only when everything is sent.
+		for (int i = part; i < partsc && cnt < CONN_IO_IOV; i++) {
+			size_t skip = i == part ? sent : 0;
+			if (parts[i].iov_len == skip) continue;
+
+			iov[cnt++] = (struct iovec){
+				.iov_base = (char *)parts[i].iov_base + skip,
+				.iov_len = parts[i].iov_len - skip
+			};
+		}
+		if (cnt == 0) return 0;
+
+		ssize_t wr = connIOWritev(io, iov, cnt);
+		if (wr == -1) {
+			if (errno == EINTR) continue;
+
+			if (errno == EAGAIN) {
+				for (int i = part; i < partsc; i++) {
+					size_t skip = i == part ? sent : 0;
+					if (connIOWrite(io, (char *)parts[i].iov_base + skip, parts[i].iov_len - skip)) return -1;
+				}
+				errno = EAGAIN;
+			}
+
+			return -1;
+		}
+
+		size_t buffered = (size_t)wr < io->wlen ? (size_t)wr : io->wlen;
+		connIOOutputConsume(io, buffered);
+		wr -= buffered;
+
+		while (wr > 0) {
+			size_t rest = parts[part].iov_len - sent;
+			if ((size_t)wr < rest) {
+				sent += wr;
+				break;
+			}
+
+			wr -= rest;
+			part++;
+			sent = 0;
+		}
+	}
+}
+
+ssize_t sendFileRange(int sock, int fd, off_t *offset, size_t len)
+{
+	ssize_t n = sendfile(sock, fd, offset, len);
+	if (n != -1 || (errno != EINVAL && errno != ESPIPE)) return n;
+
+	// Pipe can not be the source of sendfile(2): its pages are moved to the socket instead.
+	n = splice(fd, NULL, sock, NULL, len, SPLICE_F_MOVE);
+	if (n > 0) *offset += n;
+
+	return n;
+}
+
+int readFileRange(int fd, char *buf, size_t n, off_t offset)
+{
+	int pipe = 0;
+
+	while (n != 0) {
+		ssize_t rd = pipe ? read(fd, buf, n) : pread(fd, buf, n, offset);
+		if (rd == -1) {
+			if (errno == EINTR) continue;
+			if (errno == ESPIPE && !pipe) {
+				pipe = 1;
+				continue;
+			}
+			return -1;
+		}
+		if (rd == 0) {
+			errno = EIO;
+			return -1;
+		}
+
+		buf += rd;
+		n -= rd;
+		offset += rd;
+	}
+
+	return 0;
+}
+
+int connIOSendFile(struct connIO *io, int fd, off_t offset, size_t n)
+{
+	if (io->fd < 0) {
+		char *out = connIOWriteReserve(io, n);
+		if (out == NULL || readFileRange(fd, out, n, offset)) return -1;
+
+		connIOWriteCommit(io, n);
+		return 0;
+	}
+
+	if (connIOFlush(io)) return -1;
+
+	while (n != 0) {
+		ssize_t wr = sendFileRange(io->fd, fd, &offset, n);
+		if (wr == -1) {
+			if (errno == EINTR) continue;
+			return -1;
+		}
+		// File is truncated while it is sent.
+		if (wr == 0) {
+			errno = EIO;
+			return -1;
+		}
+
+		n -= wr;
+	}
+
+	return 0;
+}
+
+const char *connIOOutput(struct connIO *io, size_t *len)
+{
+	*len = io->wlen;
+
+	if (io->whead + io->wlen > io->wcap &&
+		ringRelocate(&io->wbuf, &io->wcap, &io->whead, io->wlen, io->wcap)) {
+		*len = io->wcap - io->whead;
+	}
+
+	return io->wbuf + io->whead;
+}
+
+void connIOOutputConsume(struct connIO *io, size_t n)
+{
+	if (n > io->wlen) n = io->wlen;
+
+	io->wlen -= n;
+	io->whead = io->wlen == 0 ? 0 : (io->whead + n) & (io->wcap - 1);
+}
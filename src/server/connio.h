@@ -0,0 +1,219 @@
+#ifndef CONNIO_H
+#define CONNIO_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#ifndef CONN_IO_BUFSZ
+/**
+ * Default size of connection read and write buffers. MUST be a power of 2.
+ */
+#define CONN_IO_BUFSZ 16384
+#endif
+
+#ifndef CONN_IO_IOV
+/**
+ * Maximum count of buffers passed to one gathered write.
+ */
+#define CONN_IO_IOV 64
+#endif
+
+/**
+ * Buffered connection I/O. Replaces stdio streams for sockets: buffers are explicit ring buffers,
+ * buffered bytes may be accessed directly (see connIOPeek()) and no locking is done, so one
+ * connIO MUST be used by one thread at a time.
+ *
+ * Works with blocking and non-blocking sockets: on non-blocking ones fill and flush return EAGAIN
+ * instead of waiting. connIO with fd -1 is a memory buffer: input is supplied by connIOFeed()
+ * and output is taken by connIOOutput().
+ */
+struct connIO {
+	int fd;
+	// Socket is in O_NONBLOCK mode.
+	int nonblock;
+	// Peer closed its write side: all the input is in the read buffer.
+	int eof;
+	// fd is not a socket: output is sent by writev(2) instead of sendmsg(2) with MSG_NOSIGNAL.
+	int notsock;
+
+	/**
+	 * Read ring buffer. Bytes [rhead; rhead + rlen) modulo rcap are received but not yet consumed.
+	 */
+	char *rbuf;
+	size_t rcap;
+	size_t rhead;
+	size_t rlen;
+
+	/**
+	 * Write ring buffer. Bytes [whead; whead + wlen) modulo wcap are pending to be sent.
+	 */
+	char *wbuf;
+	size_t wcap;
+	size_t whead;
+	size_t wlen;
+};
+
+/**
+ * Initializes connIO over @fd. Capacities are rounded up to a power of 2, 0 means CONN_IO_BUFSZ.
+ *
+ * @Returns 0 on success, -1 + errno otherwise.
+ */
+int initConnIO(struct connIO *io, int fd, size_t rcap, size_t wcap);
+
+/**
+ * Frees buffers of connIO. Pending output is dropped and the socket is not closed.
+ */
+void destroyConnIO(struct connIO *io);
+
+/**
+ * Reads available bytes from the socket into free space of read buffer.
+ * Blocks until at least one byte is read if socket is blocking.
+ *
+ * @Returns count of read bytes, 0 on end of file (eof is set), -1 + errno otherwise.
+ * EAGAIN if socket is non-blocking and has no data, ENOBUFS if read buffer is full.
+ */
+ssize_t connIOFill(struct connIO *io);
+
+/**
+ * Returns buffered input as one contiguous span. Wrapped ring is linearized first.
+ *
+ * @len Count of bytes in span.
+ */
+const char *connIOPeek(struct connIO *io, size_t *len);
+
+/**
+ * Drops @n first bytes of buffered input.
+ */
+void connIOConsume(struct connIO *io, size_t n);
+
+/**
+ * Moves buffered input to the start of read buffer. Until the input is consumed, filled bytes
+ * are appended contiguously, so spans returned by connIOPeek() stay valid.
+ *
+ * @Returns 0 on success, -1 + errno otherwise.
+ */
+int connIOCompact(struct connIO *io);
+
+/**
+ * Grows read buffer to hold at least @cap bytes. Buffered input is moved to the start of the buffer.
+ *
+ * @Returns 0 on success, -1 + errno otherwise.
+ */
+int connIOReserve(struct connIO *io, size_t cap);
+
+/**
+ * Appends @n bytes to the input. Read buffer grows if needed. Used with memory connIO.
+ *
+ * @Returns 0 on success, -1 + errno otherwise.
+ */
+int connIOFeed(struct connIO *io, const char *buf, size_t n);
+
+/**
+ * Reads @n bytes into @buf, filling the buffer as needed.
+ *
+ * @Returns count of read bytes: less than @n only on end of file. -1 + errno on error.
+ */
+ssize_t connIORead(struct connIO *io, char *buf, size_t n);
+
+/**
+ * Reads line ending with '\n' into @*line, same as getline(3): the line is null-terminated and
+ * includes the newline, @*line is reallocated as needed.
+ *
+ * @Returns line length, -1 on end of file without any bytes or on error (errno is set).
+ */
+ssize_t connIOGetLine(struct connIO *io, char **line, size_t *cap);
+
+/**
+ * Buffers @n bytes of output. Full buffer is flushed on blocking sockets and grows on non-blocking
+ * sockets and memory connIO.
+ *
+ * @Returns 0 on success, -1 + errno otherwise.
+ */
+int connIOWrite(struct connIO *io, const char *buf, size_t n);
+
+/**
+ * Formats output same as printf(3).
+ *
+ * @Returns count of written bytes, -1 + errno on error.
+ */
+int connIOPrintf(struct connIO *io, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+/**
+ * Sends pending output. Blocks until everything is sent if socket is blocking.
+ * Does nothing on memory connIO.
+ *
+ * @Returns 0 when the output is sent, -1 + errno otherwise. EAGAIN if non-blocking socket is full.
+ */
+int connIOFlush(struct connIO *io);
+
+/**
+ * Reserves @n contiguous bytes after pending output, e.g. to serialize data in place.
+ * Reserved bytes are appended to the output by connIOWriteCommit().
+ *
+ * @Returns pointer to reserved bytes, NULL + errno on allocation failure.
+ */
+char *connIOWriteReserve(struct connIO *io, size_t n);
+void connIOWriteCommit(struct connIO *io, size_t n);
+
+/**
+ * Sends pending output followed by @n bytes of @buf with gathered writes, so @buf is not copied.
+ * Memory connIO appends @buf to the output instead.
+ *
+ * @Returns 0 when everything is sent, -1 + errno otherwise. EAGAIN if non-blocking socket is full,
+ * the unsent part of @buf is buffered then.
+ */
+int connIOSend(struct connIO *io, const char *buf, size_t n);
+
+/**
+ * Same as connIOSend() for scatter list of @iovc buffers, they are sent along with pending output
+ * by gathered writes.
+ *
+ * @Returns 0 when everything is sent, -1 + errno otherwise. EAGAIN if non-blocking socket is full,
+ * the unsent part of buffers is buffered then.
+ */
+int connIOSendv(struct connIO *io, const struct iovec *iov, int iovc);
+
+/**
+ * Sends pending output followed by @n bytes of file @fd from @offset, see sendFileRange().
+ * Memory connIO reads the range into the output instead.
+ *
+ * @Returns 0 when everything is sent, -1 + errno otherwise. EIO if the file ends before.
+ */
+int connIOSendFile(struct connIO *io, int fd, off_t offset, size_t n);
+
+/**
+ * Sends up to @len bytes of file @fd from @offset to socket @sock without copying them to user space:
+ * by sendfile(2), or by splice(2) if @fd is a pipe. Pipe is read from its current position.
+ *
+ * @offset Advanced by the count of sent bytes.
+ *
+ * @Returns count of sent bytes (0 at the end of file), -1 + errno otherwise.
+ */
+ssize_t sendFileRange(int sock, int fd, off_t *offset, size_t len);
+
+/**
+ * Reads @n bytes of file @fd from @offset into @buf. Pipe is read from its current position.
+ *
+ * @Returns 0 on success, -1 + errno otherwise. EIO if the file ends before.
+ */
+int readFileRange(int fd, char *buf, size_t n, off_t offset);
+
+/**
+ * Returns pending output as one contiguous span. Wrapped ring is linearized first.
+ * Bytes are dropped by connIOOutputConsume().
+ *
+ * @len Count of bytes in span.
+ */
+const char *connIOOutput(struct connIO *io, size_t *len);
+void connIOOutputConsume(struct connIO *io, size_t n);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CONNIO_H */
@@ -0,0 +1,580 @@
+#include <sys/types.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "utils.h"
+#include "server.h"
+#include "eventloop.h"
+#include "uring.h"
+
+#ifndef EVENTLOOP_MAX_EVENTS
+/**
+ * Maximum count of events processed by one epoll_wait(2) call.
+ */
+#define EVENTLOOP_MAX_EVENTS 256
+#endif
+
+#ifndef EVENTCONN_BUFSZ
+/**
+ * Starting size of connection input buffer and minimum free space requested on each read.
+ */
+#define EVENTCONN_BUFSZ 4096
+#endif
+
+#ifndef EVENTCONN_READ_BUDGET
+/**
+ * Maximum count of bytes read from one connection per wakeup, so a fast client does not starve the others.
+ */
+#define EVENTCONN_READ_BUDGET (256 << 10)
+#endif
+
+int initEventLoop(struct eventLoop *loop, struct ApplicationContext *context, int id)
+{
+	memset(loop, 0, sizeof(struct eventLoop));
+	loop->context = context;
+	loop->epfd = -1;
+	loop->wake.fd = -1;
+	loop->wake.type = EVSOURCE_WAKE;
+	loop->now = timerNow();
+	initTimerWheel(&loop->timers, loop->now);
+
+	loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (loop->epfd == -1)
+		goto error;
+
+	loop->wake.fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (loop->wake.fd == -1)
+		goto error;
+
+	struct epoll_event ev = { .events = EPOLLIN, .data.ptr = &loop->wake };
+	if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, loop->wake.fd, &ev))
+		goto error;
+
+	size_t sz = context->socks.size;
+	loop->listeners = calloc(sz, sizeof(struct eventSource));
+	if (sz != 0 && loop->listeners == NULL)
+		goto error;
+
+	for (size_t i = 0; i < sz; i++) {
+		struct ssock *sock = vectorGetEl(&context->socks, i);
+		// Reuseport shards are owned by the loop with the same index.
+		if (sock == NULL || (sock->cpu != -1 && sock->cpu != id)) continue;
+
+		struct eventSource *lsrc = loop->listeners + loop->listenersc++;
+		lsrc->type = EVSOURCE_LISTENER;
+		lsrc->fd = sock->fd;
+
+		// Wake only one of the loops waiting on the same listener.
+		struct epoll_event lev = { .events = EPOLLIN, .data.ptr = lsrc };
+		if (sock->cpu == -1) lev.events |= EPOLLEXCLUSIVE;
+		if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, lsrc->fd, &lev))
+			goto error;
+	}
+
+	if (	pthread_mutex_init(&loop->stopLock, NULL) ||
+		pthread_cond_init(&loop->stopCond, NULL))
+		goto error;
+
+	return 0;
+
+error:;
+	int err = errno;
+	if (loop->wake.fd != -1) close(loop->wake.fd);
+	if (loop->epfd != -1) close(loop->epfd);
+	free(loop->listeners);
+	loop->listeners = NULL;
+	errno = err;
+	return -1;
+}
+
+static void freeEventConn(struct eventConn *conn)
+{
+	struct eventLoop *loop = conn->loop;
+
+	if (conn->prev != NULL) conn->prev->next = conn->next;
+	else loop->conns = conn->next;
+	if (conn->next != NULL) conn->next->prev = conn->prev;
+	loop->connsc--;
+
+	timerCancel(&loop->timers, &conn->deadline.timer);
+
+	// Closing the fd also removes it from epoll set.
+	close(conn->src.fd);
+	free(conn->rbuf);
+	free(conn->wbuf);
+	eventConnFreeState(conn);
+	free(conn);
+}
+
+/**
+ * Closes connection. While draining the connection is counted as drained.
+ */
+static void closeEventConn(struct eventConn *conn)
+{
+	if (conn->loop->stop) conn->loop->drained++;
+
+	freeEventConn(conn);
+}
+
+char *eventConnAppend(struct eventConn *conn, size_t len)
+{
+	if (conn->wlen + len > conn->wcap) {
+		size_t ncap = conn->wcap ? conn->wcap : EVENTCONN_BUFSZ;
+		while (ncap < conn->wlen + len) ncap *= 2;
+
+		char *tmp = realloc(conn->wbuf, ncap);
+		if (tmp == NULL) return NULL;
+
+		conn->wbuf = tmp;
+		conn->wcap = ncap;
+	}
+
+	char *out = conn->wbuf + conn->wlen;
+	conn->wlen += len;
+
+	return out;
+}
+
+void eventConnTrim(struct eventConn *conn, size_t len)
+{
+	conn->wlen -= len;
+}
+
+int eventConnWrite(struct eventConn *conn, const char *buf, size_t len)
+{
+	char *out = eventConnAppend(conn, len);
+	if (out == NULL) return -1;
+
+	memcpy(out, buf, len);
+
+	return 0;
+}
+
+int eventConnReserve(struct eventConn *conn, size_t need)
+{
+	if (conn->rcap - conn->rlen >= need)
+		return 0;
+
+	size_t ncap = conn->rcap ? conn->rcap : EVENTCONN_BUFSZ;
+	while (ncap - conn->rlen < need) ncap *= 2;
+
+	char *tmp = realloc(conn->rbuf, ncap);
+	if (tmp == NULL) return -1;
+
+	conn->rbuf = tmp;
+	conn->rcap = ncap;
+
+	return 0;
+}
+
+int eventConnDraining(struct eventConn *conn)
+{
+	return conn->loop->stop;
+}
+
+int eventConnIdle(struct eventConn *conn)
+{
+	return	conn->received != 0 && conn->rlen == 0 && !conn->readable && conn->wlen == conn->woff && !conn->sending &&
+		!conn->producing && conn->phase == CONN_PHASE_IDLE;
+}
+
+void eventConnFreeState(struct eventConn *conn)
+{
+	if (conn->handlerStateFree != NULL) conn->handlerStateFree(conn->handlerState);
+	else free(conn->handlerState);
+
+	conn->handlerState = NULL;
+}
+
+void eventConnConsume(struct eventConn *conn, size_t n)
+{
+	if (n >= conn->rlen) {
+		conn->rlen = 0;
+		return;
+	}
+
+	memmove(conn->rbuf, conn->rbuf + n, conn->rlen - n);
+	conn->rlen -= n;
+}
+
+void eventConnCut(struct eventConn *conn, size_t off, size_t n)
+{
+	memmove(conn->rbuf + off, conn->rbuf + off + n, conn->rlen - off - n);
+	conn->rlen -= n;
+}
+
+ssize_t eventConnSendFile(struct eventConn *conn, int fd, off_t *offset, size_t len)
+{
+	if (conn->wlen != 0) {
+		errno = EBUSY;
+		return -1;
+	}
+
+	while (1) {
+		ssize_t n = sendFileRange(conn->src.fd, fd, offset, len);
+
+		if (n == -1) {
+			if (errno == EINTR) continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				errno = EAGAIN;
+				conn->writeBlocked = 1;
+			}
+		}
+
+		return n;
+	}
+}
+
+/**
+ * Sends pending output until it is empty or socket buffer is full.
+ *
+ * @Returns 0 on success (or EAGAIN), -1 on socket failure.
+ */
+static int flushEventConn(struct eventConn *conn)
+{
+	while (conn->woff < conn->wlen) {
+		ssize_t n = send(conn->src.fd, conn->wbuf + conn->woff,
+			conn->wlen - conn->woff, MSG_NOSIGNAL);
+
+		if (n == -1) {
+			if (errno == EINTR) continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+			return -1;
+		}
+
+		conn->woff += n;
+	}
+
+	conn->woff = 0;
+	conn->wlen = 0;
+
+	return 0;
+}
+
+/**
+ * Reads available input until EAGAIN, until the input buffer holds the input limit or @budget is spent.
+ * Connection is edge-triggered, so input left unread is marked by conn->readable.
+ *
+ * @budget Count of bytes the connection may read in this wakeup, decreased by the count read.
+ *
+ * @Returns count of bytes read, -1 on socket failure.
+ */
+static ssize_t fillEventConn(struct eventConn *conn, size_t *budget)
+{
+	size_t limit = conn->loop->context->inputLimit;
+	ssize_t total = 0;
+
+	while (conn->readable && conn->rlen < limit && *budget != 0) {
+		if (eventConnReserve(conn, EVENTCONN_BUFSZ))
+			return -1;
+
+		size_t len = conn->rcap - conn->rlen;
+		if (len > limit - conn->rlen) len = limit - conn->rlen;
+		if (len > *budget) len = *budget;
+
+		ssize_t n = recv(conn->src.fd, conn->rbuf + conn->rlen, len, 0);
+
+		if (n == -1) {
+			if (errno == EINTR) continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				conn->readable = 0;
+				break;
+			}
+			return -1;
+		} else if (n == 0) {
+			conn->eof = 1;
+			conn->readable = 0;
+			break;
+		}
+
+		conn->rlen += n;
+		conn->received += n;
+		*budget -= n;
+		total += n;
+	}
+
+	if (conn->deadline.phase == CONN_PHASE_BODY)
+		conn->deadline.progress += total;
+
+	return total;
+}
+
+/**
+ * Makes epoll report the connection again: edge-triggered events of input left unread are not repeated.
+ *
+ * @Returns 0 on success, -1 + errno otherwise.
+ */
+static int rearmEventConn(struct eventConn *conn)
+{
+	struct epoll_event ev = {
+		.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET,
+		.data.ptr = conn
+	};
+
+	return epoll_ctl(conn->loop->epfd, EPOLL_CTL_MOD, conn->src.fd, &ev);
+}
+
+/**
+ * Deadline of the connection expired: closes it or rejects the slow request.
+ */
+static void eventConnExpired(struct timer *timer)
+{
+	struct eventConn *conn = timer->arg;
+	struct eventLoop *loop = conn->loop;
+	const struct ConnTimeouts *timeouts = &loop->context->timeouts;
+
+	int verdict = connDeadlineExpired(&loop->timers, &conn->deadline, timeouts, loop->now);
+	if (verdict == CONNDL_KEEP) return;
+
+	if (verdict == CONNDL_REJECT && timeouts->response != NULL && !conn->closing) {
+		conn->closing = 1;
+		// Idle deadline bounds the time given to flush the response.
+		conn->phase = CONN_PHASE_IDLE;
+		connDeadlineUpdate(&loop->timers, &conn->deadline, timeouts, conn->phase, loop->now);
+
+		if (	eventConnWrite(conn, timeouts->response, strlen(timeouts->response)) == 0 &&
+			flushEventConn(conn) == 0 && conn->wlen != 0)
+			return;
+	}
+
+	closeEventConn(conn);
+}
+
+static void acceptEventConns(struct eventLoop *loop, struct eventSource *lsrc)
+{
+	while (1) {
+		int nfd = accept4(lsrc->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+		if (nfd == -1) {
+			if (errno == EINTR) continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				perror("Unable to accept new connection");
+			return;
+		}
+
+		struct eventConn *conn = calloc(1, sizeof(struct eventConn));
+		if (conn == NULL) {
+			close(nfd);
+			continue;
+		}
+
+		conn->src.type = EVSOURCE_CONN;
+		conn->src.fd = nfd;
+		conn->loop = loop;
+		initConnDeadline(&conn->deadline, eventConnExpired, conn);
+
+		struct epoll_event ev = {
+			.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET,
+			.data.ptr = conn
+		};
+		if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, nfd, &ev)) {
+			perror("Unable to register connection");
+			close(nfd);
+			free(conn);
+			continue;
+		}
+
+		conn->next = loop->conns;
+		if (loop->conns != NULL) loop->conns->prev = conn;
+		loop->conns = conn;
+		loop->connsc++;
+
+		connDeadlineUpdate(&loop->timers, &conn->deadline, &loop->context->timeouts, conn->phase, loop->now);
+	}
+}
+
+static void processEventConn(struct eventConn *conn, uint32_t events)
+{
+	struct ApplicationContext *context = conn->loop->context;
+
+	if (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR) && !conn->eof)
+		conn->readable = 1;
+
+	size_t budget = EVENTCONN_READ_BUDGET;
+	ssize_t n = fillEventConn(conn, &budget);
+	if (n == -1) goto closeConn;
+
+	if (events & EPOLLOUT) conn->writeBlocked = 0;
+
+	if (flushEventConn(conn)) goto closeConn;
+
+	/*
+	 * Handler runs on new input or when input left by the previous run may be processed now that
+	 * its output is sent. Handler may process received requests by batches (e.g. of HTTP pipeline depth),
+	 * so it runs again while it consumes input and output is sent. Producing handler runs
+	 * while output is sent, so the produced output is bounded by the socket buffer.
+	 * Input consumed by the handler makes room for input left unread by the input limit.
+	 */
+	int producing = conn->producing && !conn->writeBlocked;
+	int run = n > 0 || ((conn->rlen != 0 || producing) && conn->wlen == 0);
+	while (run && !conn->closing && (conn->rlen != 0 || conn->producing)) {
+		size_t pending = conn->rlen;
+
+		int status = context->connevhandler(conn, context->connhandlerArgs);
+
+		if (status == CONNEV_ABORT) goto closeConn;
+		else if (status == CONNEV_CLOSE) conn->closing = 1;
+
+		if (flushEventConn(conn)) goto closeConn;
+
+		int consumed = conn->rlen < pending;
+		if (consumed && !conn->closing && fillEventConn(conn, &budget) == -1)
+			goto closeConn;
+
+		run = (consumed || (conn->producing && !conn->writeBlocked)) && conn->wlen == 0;
+	}
+
+	if (conn->wlen == 0 && !conn->producing && (conn->closing || conn->eof))
+		goto closeConn;
+
+	// Handler waits for more input than the limit allows, e.g. for a request larger than it.
+	if (conn->rlen >= context->inputLimit && conn->wlen == 0 && !conn->producing) {
+		printf("Connection input limit is reached\n");
+		goto closeConn;
+	}
+
+	// Input left unread by the spent budget is reported again after the other connections.
+	if (conn->readable && conn->rlen < context->inputLimit && rearmEventConn(conn))
+		goto closeConn;
+
+	// Keep-alive connection becoming idle while draining.
+	if (conn->loop->stop && eventConnIdle(conn))
+		goto closeConn;
+
+	connDeadlineUpdate(&conn->loop->timers, &conn->deadline, &context->timeouts, conn->phase, conn->loop->now);
+
+	return;
+
+closeConn:
+	closeEventConn(conn);
+}
+
+/**
+ * Starts draining: listeners are unregistered and idle connections are closed.
+ */
+static void startEventLoopDrain(struct eventLoop *loop)
+{
+	loop->stop = 1;
+
+	for (size_t i = 0; i < loop->listenersc; i++)
+		epoll_ctl(loop->epfd, EPOLL_CTL_DEL, loop->listeners[i].fd, NULL);
+
+	struct eventConn *conn = loop->conns;
+	while (conn != NULL) {
+		struct eventConn *next = conn->next;
+
+		if (eventConnIdle(conn))
+			closeEventConn(conn);
+		else if (conn->received == 0)
+			timerArm(&loop->timers, &conn->deadline.timer, loop->now, CONN_DRAIN_GRACE);
+
+		conn = next;
+	}
+}
+
+void *eventLoopRunner(void *rawloop)
+{
+	struct eventLoop *loop = rawloop;
+	struct epoll_event events[EVENTLOOP_MAX_EVENTS];
+
+	while (!loop->stop || (loop->conns != NULL && loop->now < loop->drainDeadline)) {
+		int timeout = timerWheelTimeout(&loop->timers, loop->now);
+		if (loop->stop) {
+			int left = loop->drainDeadline - loop->now;
+			if (timeout == -1 || timeout > left) timeout = left;
+		}
+
+		int n = epoll_wait(loop->epfd, events, EVENTLOOP_MAX_EVENTS, timeout);
+		loop->now = timerNow();
+
+		if (n == -1) {
+			if (errno == EINTR) continue;
+			perror("Unable to wait for events");
+			break;
+		}
+
+		// Drain frees idle connections, so it starts after the events which may reference them.
+		int drain = 0;
+
+		for (int i = 0; i < n; i++) {
+			struct eventSource *src = events[i].data.ptr;
+
+			if (src->type == EVSOURCE_WAKE) {
+				uint64_t val;
+				if (read(loop->wake.fd, &val, sizeof(val)) == -1 && errno != EAGAIN)
+					perror("Unable to read wake event");
+
+				drain = 1;
+			} else if (src->type == EVSOURCE_LISTENER) {
+				if (!loop->stop) acceptEventConns(loop, src);
+			} else if (src->type == EVSOURCE_CONN) {
+				processEventConn((struct eventConn *)src, events[i].events);
+			}
+		}
+
+		if (drain && !loop->stop) startEventLoopDrain(loop);
+
+		timerWheelAdvance(&loop->timers, loop->now);
+	}
+
+	loop->forced += loop->connsc;
+	while (loop->conns != NULL)
+		freeEventConn(loop->conns);
+
+	pthread_mutex_lock(&loop->stopLock);
+	loop->stopped = 1;
+	pthread_cond_broadcast(&loop->stopCond);
+	pthread_mutex_unlock(&loop->stopLock);
+
+	return NULL;
+}
+
+int drainEventLoop(struct eventLoop *loop, uint64_t deadline)
+{
+	// Published to the loop by the eventfd write.
+	loop->drainDeadline = deadline;
+
+	uint64_t one = 1;
+	if (write(loop->wake.fd, &one, sizeof(one)) != sizeof(one))
+		return -1;
+
+	return 0;
+}
+
+void waitEventLoop(struct eventLoop *loop)
+{
+	pthread_mutex_lock(&loop->stopLock);
+	while (!loop->stopped)
+		pthread_cond_wait(&loop->stopCond, &loop->stopLock);
+	pthread_mutex_unlock(&loop->stopLock);
+}
+
+void stopEventLoop(struct eventLoop *loop)
+{
+	if (drainEventLoop(loop, 0)) {
+		perror("Unable to interrupt event loop");
+		return;
+	}
+
+	waitEventLoop(loop);
+}
+
+void destroyEventLoop(struct eventLoop *loop)
+{
+	close(loop->wake.fd);
+	if (loop->epfd != -1) close(loop->epfd);
+	if (loop->uring != NULL) destroyUring(loop->uring);
+	loop->uring = NULL;
+	free(loop->listeners);
+	pthread_mutex_destroy(&loop->stopLock);
+	pthread_cond_destroy(&loop->stopCond);
+
+	loop->listeners = NULL;
+	loop->listenersc = 0;
+}
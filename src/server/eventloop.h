@@ -0,0 +1,257 @@
+#ifndef EVENTLOOP_H
+#define EVENTLOOP_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <pthread.h>
+#include <sys/types.h>
+#include "timer.h"
+
+struct ApplicationContext;
+
+/**
+ * Type tag of epoll event source. Stored as the first member of every struct registered in epoll.
+ */
+#define EVSOURCE_WAKE 1
+#define EVSOURCE_LISTENER 2
+#define EVSOURCE_CONN 3
+
+struct eventSource {
+	int type;
+	int fd;
+};
+
+/**
+ * Represents a non-blocking connection owned by an event loop.
+ * A connection costs only this structure and its buffers instead of a thread.
+ */
+struct eventConn {
+	// MUST be first. Used to determine the type of epoll event.
+	struct eventSource src;
+
+	/**
+	 * Input buffer. Bytes [0; rlen) are received but not yet consumed by handler.
+	 */
+	char *rbuf;
+	size_t rlen;
+	size_t rcap;
+	// Count of bytes ever received. Fresh connection is not idle: it gets CONN_DRAIN_GRACE on drain.
+	size_t received;
+	// Socket may have input left unread by the input limit or the read budget of the wakeup.
+	int readable;
+
+	/**
+	 * Output buffer. Bytes [woff; wlen) are pending to be sent.
+	 */
+	char *wbuf;
+	size_t woff;
+	size_t wlen;
+	size_t wcap;
+
+	// Peer closed its write side.
+	int eof;
+	// Connection should be closed after output buffer is flushed.
+	int closing;
+
+	// Count of in-flight io_uring operations referencing this connection.
+	int pending;
+	// Output buffer is being sent by io_uring and MUST NOT be modified.
+	int sending;
+	// Multishot receive is armed.
+	int receiving;
+	// Connection is shut down and waits for in-flight operations to be freed.
+	int shut;
+
+	/**
+	 * Phase of the request being received. One of CONN_PHASE_ defines, set by the handler.
+	 * Deadline of the phase is enforced by the loop.
+	 */
+	int phase;
+	struct connDeadline deadline;
+
+	// State kept by the handler between events, e.g. partially parsed request. Freed along with the connection
+	// by @handlerStateFree, or by free(3) if it is NULL.
+	void *handlerState;
+	void (*handlerStateFree)(void *state);
+	// Handler has more output to produce: it runs again once the output is sent, even without new input.
+	int producing;
+	// Socket buffer is full after eventConnSendFile(): producing handler waits for the socket to be writable.
+	int writeBlocked;
+
+	struct eventLoop *loop;
+	// Intrusive list of live connections of the loop.
+	struct eventConn *prev;
+	struct eventConn *next;
+};
+
+/**
+ * Statuses returned by connevhandler_t.
+ */
+#define CONNEV_KEEP 0
+#define CONNEV_CLOSE 1
+#define CONNEV_ABORT -1
+
+/**
+ * Callback function that is called by event loop each time new data arrives on connection.
+ * Must not block. Handler consumes input with eventConnConsume() and writes output with eventConnWrite().
+ *
+ * @conn Connection with received data.
+ * @args Additional args specified by each handler.
+ *
+ * @Returns CONNEV_KEEP to wait for more data, CONNEV_CLOSE to close connection after output is flushed,
+ * CONNEV_ABORT to close connection immediately.
+ */
+typedef int (*connevhandler_t)(struct eventConn *conn, void *args);
+
+/**
+ * Represents one event loop thread with its own epoll instance.
+ */
+struct eventLoop {
+	// epoll instance. -1 if loop uses io_uring backend.
+	int epfd;
+	// io_uring instance. NULL if loop uses epoll backend.
+	struct uring *uring;
+	// eventfd used to interrupt the loop.
+	struct eventSource wake;
+	// Listening sockets registered in this loop.
+	struct eventSource *listeners;
+	size_t listenersc;
+
+	struct ApplicationContext *context;
+	pthread_t thread;
+
+	// Head of live connections list.
+	struct eventConn *conns;
+	size_t connsc;
+
+	// Deadlines of the loop connections.
+	struct timerWheel timers;
+	// Time of the last wakeup in milliseconds.
+	uint64_t now;
+
+	/**
+	 * Loop is draining: listeners are removed, idle connections are closed and the rest
+	 * are closed after their current request. Loop stops when all the connections are closed.
+	 */
+	int stop;
+	// Time when connections still open are closed forcibly.
+	uint64_t drainDeadline;
+	// Count of connections closed gracefully and forcibly while draining.
+	size_t drained;
+	size_t forced;
+
+	int stopped;
+	pthread_mutex_t stopLock;
+	pthread_cond_t stopCond;
+};
+
+/**
+ * Initializes event loop. Registers all the context shared listening sockets and reuseport shards
+ * with cpu equal to @id in it.
+ * Listening sockets should be already listen(2)-ed and non-blocking.
+ *
+ * @Returns Initialization status: 0 on success, -1 + errno otherwise.
+ */
+int initEventLoop(struct eventLoop *loop, struct ApplicationContext *context, int id);
+
+/**
+ * Thread callback that runs event loop until stopEventLoop() is called.
+ *
+ * @rawloop pointer to struct eventLoop.
+ */
+void *eventLoopRunner(void *rawloop);
+
+/**
+ * Starts draining of event loop. Does not wait for the loop, see waitEventLoop().
+ *
+ * @deadline Time (see timerNow()) when the loop closes remaining connections forcibly.
+ *
+ * @Returns 0 on success, -1 + errno otherwise.
+ */
+int drainEventLoop(struct eventLoop *loop, uint64_t deadline);
+
+/**
+ * Waits for event loop to close all its connections and stop.
+ */
+void waitEventLoop(struct eventLoop *loop);
+
+/**
+ * Interrupts event loop and waits for it to close all its connections.
+ */
+void stopEventLoop(struct eventLoop *loop);
+
+/**
+ * Deallocates event loop resources. The loop should be stopped.
+ */
+void destroyEventLoop(struct eventLoop *loop);
+
+/**
+ * Grows connection input buffer so at least @need bytes may be appended to it.
+ *
+ * @Returns 0 on success, -1 on allocation failure.
+ */
+int eventConnReserve(struct eventConn *conn, size_t need);
+
+/**
+ * Appends data to connection output buffer. Data is sent when the handler returns.
+ *
+ * @Returns 0 on success, -1 on allocation failure.
+ */
+int eventConnWrite(struct eventConn *conn, const char *buf, size_t len);
+
+/**
+ * Appends @len bytes to connection output buffer, the caller fills them in place.
+ *
+ * @Returns pointer to appended bytes, NULL on allocation failure.
+ */
+char *eventConnAppend(struct eventConn *conn, size_t len);
+
+/**
+ * Drops the last @len bytes appended to connection output buffer, e.g. unused part of eventConnAppend().
+ */
+void eventConnTrim(struct eventConn *conn, size_t len);
+
+/**
+ * Sends up to @len bytes of file @fd from @offset directly to the connection socket (see sendFileRange()),
+ * without copying them through the output buffer. Output buffer MUST be empty. Epoll backend only.
+ *
+ * @offset Advanced by the count of sent bytes.
+ *
+ * @Returns count of sent bytes, -1 + errno otherwise. EAGAIN if the socket buffer is full:
+ * the handler runs again once the socket is writable.
+ */
+ssize_t eventConnSendFile(struct eventConn *conn, int fd, off_t *offset, size_t len);
+
+/**
+ * Drops first n bytes of connection input buffer.
+ */
+void eventConnConsume(struct eventConn *conn, size_t n);
+
+/**
+ * Drops @n bytes of connection input buffer at offset @off, e.g. body spilled to a file.
+ */
+void eventConnCut(struct eventConn *conn, size_t off, size_t n);
+
+/**
+ * @Returns 1 if the loop of connection is draining, so the connection should be closed
+ * after the current request, 0 otherwise.
+ */
+int eventConnDraining(struct eventConn *conn);
+
+/**
+ * Frees handler state of the connection.
+ */
+void eventConnFreeState(struct eventConn *conn);
+
+/**
+ * @Returns 1 if connection has received data before and has no partially received request and no pending output.
+ */
+int eventConnIdle(struct eventConn *conn);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* EVENTLOOP_H */
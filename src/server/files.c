@@ -0,0 +1,446 @@
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/openat2.h>
+#include "files.h"
+#include "timer.h"
+#include "HttpStatusCodes_C.h"
+
+static const struct {
+	const char *ext;
+	const char *type;
+} contentTypes[] = {
+	{ "html", "text/html; charset=utf-8" },
+	{ "htm", "text/html; charset=utf-8" },
+	{ "css", "text/css; charset=utf-8" },
+	{ "js", "text/javascript; charset=utf-8" },
+	{ "mjs", "text/javascript; charset=utf-8" },
+	{ "json", "application/json" },
+	{ "txt", "text/plain; charset=utf-8" },
+	{ "xml", "application/xml" },
+	{ "svg", "image/svg+xml" },
+	{ "png", "image/png" },
+	{ "jpg", "image/jpeg" },
+	{ "jpeg", "image/jpeg" },
+	{ "gif", "image/gif" },
+	{ "webp", "image/webp" },
+	{ "ico", "image/x-icon" },
+	{ "wasm", "application/wasm" },
+	{ "pdf", "application/pdf" },
+	{ "woff", "font/woff" },
+	{ "woff2", "font/woff2" },
+	{ "mp4", "video/mp4" },
+};
+
+static const char *httpFileContentType(const char *name)
+{
+	const char *ext = strrchr(name, '.');
+	if (ext == NULL || strchr(ext, '/') != NULL) return "application/octet-stream";
+	ext++;
+
+	for (size_t i = 0; i < sizeof(contentTypes) / sizeof(contentTypes[0]); i++)
+		if (!strcasecmp(ext, contentTypes[i].ext)) return contentTypes[i].type;
+
+	return "application/octet-stream";
+}
+
+/**
+ * FNV-1a hash of the path.
+ */
+static uint32_t httpFileHash(const char *key, size_t len)
+{
+	uint32_t hash = 2166136261u;
+	for (size_t i = 0; i < len; i++) {
+		hash ^= (unsigned char)key[i];
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+int initHTTPFileCache(struct httpFileCache *cache, const char *root, size_t capacity)
+{
+	memset(cache, 0, sizeof(struct httpFileCache));
+	cache->capacity = capacity;
+
+	// Buckets are twice the capacity, so chains stay short.
+	cache->bucketsc = 16;
+	while (cache->bucketsc < capacity * 2) cache->bucketsc <<= 1;
+
+	cache->buckets = calloc(cache->bucketsc, sizeof(struct httpFile *));
+	if (cache->buckets == NULL) return -1;
+
+	cache->rootfd = open(root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (cache->rootfd == -1) goto error;
+
+	if ((errno = pthread_mutex_init(&cache->lock, NULL)) != 0) {
+		close(cache->rootfd);
+		goto error;
+	}
+
+	return 0;
+
+error:
+	free(cache->buckets);
+	cache->buckets = NULL;
+	return -1;
+}
+
+static void releaseHTTPFile(void *ctx)
+{
+	struct httpFile *file = ctx;
+
+	if (__atomic_sub_fetch(&file->refs, 1, __ATOMIC_ACQ_REL) != 0) return;
+
+	close(file->fd);
+	free(file->key);
+	free(file);
+}
+
+/**
+ * Removes @file from the cache and drops the cache reference. Cache lock should be held.
+ */
+static void evictHTTPFile(struct httpFileCache *cache, struct httpFile *file)
+{
+	struct httpFile **link = &cache->buckets[file->hash & (cache->bucketsc - 1)];
+	while (*link != file) link = &(*link)->hashNext;
+	*link = file->hashNext;
+
+	if (file->lruPrev != NULL) file->lruPrev->lruNext = file->lruNext;
+	else cache->lruHead = file->lruNext;
+	if (file->lruNext != NULL) file->lruNext->lruPrev = file->lruPrev;
+	else cache->lruTail = file->lruPrev;
+
+	file->cached = 0;
+	cache->size--;
+
+	releaseHTTPFile(file);
+}
+
+static void touchHTTPFile(struct httpFileCache *cache, struct httpFile *file)
+{
+	if (cache->lruHead == file) return;
+
+	file->lruPrev->lruNext = file->lruNext;
+	if (file->lruNext != NULL) file->lruNext->lruPrev = file->lruPrev;
+	else cache->lruTail = file->lruPrev;
+
+	file->lruPrev = NULL;
+	file->lruNext = cache->lruHead;
+	cache->lruHead->lruPrev = file;
+	cache->lruHead = file;
+}
+
+void destroyHTTPFileCache(struct httpFileCache *cache)
+{
+	while (cache->lruHead != NULL)
+		evictHTTPFile(cache, cache->lruHead);
+
+	free(cache->buckets);
+	cache->buckets = NULL;
+	close(cache->rootfd);
+	pthread_mutex_destroy(&cache->lock);
+}
+
+static int hexDigit(char c)
+{
+	if (c >= '0' && c <= '9') return c - '0';
+	if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+	return -1;
+}
+
+/**
+ * Decodes @path of @len bytes into relative path @out of HTTP_FILE_PATH_MAX bytes. Empty segments are dropped,
+ * trailing '/' is kept: it tells the path is a directory.
+ *
+ * @Returns length of the path, -1 if it is malformed, has NUL or dot segments or is too long.
+ */
+static ssize_t normalizeHTTPFilePath(const char *path, size_t len, char *out)
+{
+	for (size_t i = 0; i < len; i++)
+		if (path[i] == '?' || path[i] == '#') len = i;
+
+	size_t outLen = 0;
+	// Start of the current segment in @out.
+	size_t seg = 0;
+	int dir = 0;
+
+	// Position @len closes the last segment.
+	for (size_t i = 0; i <= len; i++) {
+		char c = '/';
+
+		if (i < len) {
+			c = path[i];
+			if (c == '%') {
+				int hi = i + 2 < len ? hexDigit(path[i + 1]) : -1;
+				int lo = hi != -1 ? hexDigit(path[i + 2]) : -1;
+				if (lo == -1) return -1;
+
+				c = hi << 4 | lo;
+				i += 2;
+			}
+			if (c == '\0') return -1;
+
+			dir = c == '/';
+		}
+
+		if (outLen + 1 >= HTTP_FILE_PATH_MAX) return -1;
+
+		if (c != '/') {
+			out[outLen++] = c;
+			continue;
+		}
+
+		size_t segLen = outLen - seg;
+		if (	(segLen == 1 && out[seg] == '.') ||
+			(segLen == 2 && out[seg] == '.' && out[seg + 1] == '.'))
+			return -1;
+
+		if (segLen != 0) {
+			out[outLen++] = '/';
+			seg = outLen;
+		}
+	}
+
+	// Each segment is followed by '/', the last one is dropped unless a directory is requested.
+	if (outLen != 0 && !dir) outLen--;
+	out[outLen] = '\0';
+
+	return outLen;
+}
+
+/**
+ * Opens @name beneath the served directory: neither ".." nor symbolic links may leave it.
+ *
+ * @Returns file descriptor, -1 + errno otherwise.
+ */
+static int openHTTPFileBeneath(struct httpFileCache *cache, const char *name)
+{
+	struct open_how how = {
+		.flags = O_RDONLY | O_CLOEXEC | O_NONBLOCK,
+		.resolve = RESOLVE_BENEATH | RESOLVE_NO_MAGICLINKS,
+	};
+
+	int fd = syscall(SYS_openat2, cache->rootfd, name, &how, sizeof(how));
+	if (fd != -1 || errno != ENOSYS) return fd;
+
+	// Kernel before 5.6: the path has no dot segments, but symbolic links are followed.
+	return openat(cache->rootfd, name, O_RDONLY | O_CLOEXEC | O_NONBLOCK);
+}
+
+/**
+ * Opens the file of normalized path @key, index.html of the directory if it is one.
+ *
+ * @Returns the file with one reference, NULL + errno otherwise.
+ */
+static struct httpFile *openHTTPFile(struct httpFileCache *cache, const char *key, size_t keyLen)
+{
+	static const char index[] = "index.html";
+
+	struct httpFile *file = calloc(1, sizeof(struct httpFile));
+	if (file == NULL) return NULL;
+	file->fd = -1;
+
+	// Name is stored after the key, it may be key + "/" + index.
+	char *storage = malloc(keyLen * 2 + sizeof(index) + 2);
+	if (storage == NULL) goto error;
+
+	memcpy(storage, key, keyLen + 1);
+	file->key = storage;
+	file->keyLen = keyLen;
+	file->name = storage + keyLen + 1;
+
+	memcpy(file->name, key, keyLen);
+	size_t nameLen = keyLen;
+	if (keyLen == 0 || key[keyLen - 1] == '/') {
+		memcpy(file->name + nameLen, index, sizeof(index));
+		nameLen += sizeof(index) - 1;
+	} else {
+		file->name[nameLen] = '\0';
+	}
+
+	file->fd = openHTTPFileBeneath(cache, file->name);
+	if (file->fd == -1 || fstat(file->fd, &file->st)) goto error;
+
+	if (S_ISDIR(file->st.st_mode) && nameLen == keyLen) {
+		close(file->fd);
+
+		file->name[nameLen++] = '/';
+		memcpy(file->name + nameLen, index, sizeof(index));
+
+		file->fd = openHTTPFileBeneath(cache, file->name);
+		if (file->fd == -1 || fstat(file->fd, &file->st)) goto error;
+	}
+
+	// Devices, sockets and FIFOs are not served.
+	if (!S_ISREG(file->st.st_mode)) {
+		errno = ENOENT;
+		goto error;
+	}
+
+	file->contentType = httpFileContentType(file->name);
+	file->hash = httpFileHash(key, keyLen);
+	file->refs = 1;
+
+	struct tm tm;
+	gmtime_r(&file->st.st_mtim.tv_sec, &tm);
+	strftime(file->lastModified, sizeof(file->lastModified), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+
+	return file;
+
+error:
+	int err = errno;
+	if (file->fd != -1) close(file->fd);
+	free(storage);
+	free(file);
+	errno = err;
+	return NULL;
+}
+
+/**
+ * @Returns 1 if the file on disk is not the one opened, e.g. it is replaced or modified.
+ */
+static int httpFileChanged(struct httpFileCache *cache, struct httpFile *file)
+{
+	struct stat st;
+	if (fstatat(cache->rootfd, file->name, &st, 0)) return 1;
+
+	return	st.st_ino != file->st.st_ino || st.st_dev != file->st.st_dev || st.st_size != file->st.st_size ||
+		st.st_mtim.tv_sec != file->st.st_mtim.tv_sec || st.st_mtim.tv_nsec != file->st.st_mtim.tv_nsec;
+}
+
+/**
+ * Finds cached file of @key, checking it is not changed once HTTP_FILE_CACHE_VALID passes. Cache lock should be held.
+ */
+static struct httpFile *lookupHTTPFile(struct httpFileCache *cache, const char *key, size_t keyLen, uint32_t hash)
+{
+	struct httpFile *file = cache->buckets[hash & (cache->bucketsc - 1)];
+	while (file != NULL && (file->hash != hash || file->keyLen != keyLen || memcmp(file->key, key, keyLen)))
+		file = file->hashNext;
+
+	if (file == NULL) return NULL;
+
+	uint64_t now = timerNow();
+	if (now - file->checked >= HTTP_FILE_CACHE_VALID) {
+		if (httpFileChanged(cache, file)) {
+			evictHTTPFile(cache, file);
+			return NULL;
+		}
+
+		file->checked = now;
+	}
+
+	return file;
+}
+
+/**
+ * Adds opened @file to the cache, the least recently used file is evicted if it is full. Cache lock should be held.
+ */
+static void insertHTTPFile(struct httpFileCache *cache, struct httpFile *file)
+{
+	// File could be opened by another request in the meantime.
+	struct httpFile *old = lookupHTTPFile(cache, file->key, file->keyLen, file->hash);
+	if (old != NULL) evictHTTPFile(cache, old);
+
+	if (cache->size == cache->capacity)
+		evictHTTPFile(cache, cache->lruTail);
+
+	struct httpFile **bucket = &cache->buckets[file->hash & (cache->bucketsc - 1)];
+	file->hashNext = *bucket;
+	*bucket = file;
+
+	file->lruPrev = NULL;
+	file->lruNext = cache->lruHead;
+	if (cache->lruHead != NULL) cache->lruHead->lruPrev = file;
+	else cache->lruTail = file;
+	cache->lruHead = file;
+
+	file->cached = 1;
+	file->checked = timerNow();
+	file->refs++;
+	cache->size++;
+}
+
+/**
+ * @Returns the file of @key with a reference for the caller, NULL + errno otherwise.
+ */
+static struct httpFile *acquireHTTPFile(struct httpFileCache *cache, const char *key, size_t keyLen)
+{
+	uint32_t hash = httpFileHash(key, keyLen);
+
+	pthread_mutex_lock(&cache->lock);
+	struct httpFile *file = cache->capacity != 0 ? lookupHTTPFile(cache, key, keyLen, hash) : NULL;
+	if (file != NULL) {
+		// Cache holds its reference, so the file can not be freed concurrently.
+		__atomic_add_fetch(&file->refs, 1, __ATOMIC_ACQ_REL);
+		touchHTTPFile(cache, file);
+		cache->hits++;
+	}
+	pthread_mutex_unlock(&cache->lock);
+
+	if (file != NULL) return file;
+
+	// File is opened out of the lock, so slow lookups do not block the cached files.
+	file = openHTTPFile(cache, key, keyLen);
+	if (file == NULL) return NULL;
+
+	pthread_mutex_lock(&cache->lock);
+	cache->misses++;
+	if (cache->capacity != 0) insertHTTPFile(cache, file);
+	pthread_mutex_unlock(&cache->lock);
+
+	return file;
+}
+
+void serveHTTPFile(struct httpFileCache *cache, struct HTTPRequest *request, struct HTTPResponse *response,
+	const char *path, size_t len)
+{
+	if (request->method != HTTPM_GET && request->method != HTTPM_HEAD) {
+		response->status = HttpStatus_MethodNotAllowed;
+		addKVHTTPHeader_p(&response->headers, "Allow", "GET, HEAD");
+		return;
+	}
+
+	if (path == NULL) {
+		path = request->views ? request->pathv.ptr : request->path;
+		len = request->views ? request->pathv.len : strlen(request->path);
+	}
+
+	char key[HTTP_FILE_PATH_MAX];
+	ssize_t keyLen = normalizeHTTPFilePath(path, len, key);
+	if (keyLen == -1) {
+		response->status = HttpStatus_BadRequest;
+		return;
+	}
+
+	struct httpFile *file = acquireHTTPFile(cache, key, keyLen);
+	if (file == NULL) {
+		switch (errno) {
+		case ENOENT: case ENOTDIR: case ELOOP: case EXDEV: case ENAMETOOLONG:
+			response->status = HttpStatus_NotFound;
+			break;
+		case EACCES: case EPERM:
+			response->status = HttpStatus_Forbidden;
+			break;
+		default:
+			response->status = HttpStatus_InternalServerError;
+		}
+		return;
+	}
+
+	if (	addKVHTTPHeader_p(&response->headers, "Content-Type", file->contentType) ||
+		addKVHTTPHeader_p(&response->headers, "Last-Modified", file->lastModified)) {
+		releaseHTTPFile(file);
+		response->status = HttpStatus_InternalServerError;
+		return;
+	}
+
+	response->status = HttpStatus_OK;
+	response->headOnly = request->method == HTTPM_HEAD;
+	setHTTPResponseFile(response, file->fd, 0, file->st.st_size, releaseHTTPFile, file);
+}
@@ -0,0 +1,107 @@
+#ifndef FILES_H
+#define FILES_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "http.h"
+
+#ifndef HTTP_FILE_CACHE_VALID
+/**
+ * Time in milliseconds a cached file is served without checking whether it is changed on disk.
+ */
+#define HTTP_FILE_CACHE_VALID 1000
+#endif
+
+#ifndef HTTP_FILE_PATH_MAX
+/**
+ * Maximum length of file path relative to the served directory.
+ */
+#define HTTP_FILE_PATH_MAX 1024
+#endif
+
+/**
+ * Open file of the served directory. Cached file is referenced by the cache and by every response sending it,
+ * it is closed when the last reference is released.
+ */
+struct httpFile {
+	// Normalized request path and the path of the opened file, e.g. "docs/" and "docs/index.html".
+	char *key;
+	size_t keyLen;
+	char *name;
+	uint32_t hash;
+
+	int fd;
+	struct stat st;
+	const char *contentType;
+	char lastModified[32];
+	// Time (see timerNow()) the file was checked to be unchanged.
+	uint64_t checked;
+
+	// References are counted atomically: file is released without the cache lock, possibly after the cache is destroyed.
+	int refs;
+	int cached;
+
+	// Least recently used list and hash bucket of the cache.
+	struct httpFile *lruPrev;
+	struct httpFile *lruNext;
+	struct httpFile *hashNext;
+};
+
+/**
+ * Serves files of one directory. Keeps up to @capacity files open, so popular files are sent
+ * without path lookup and open(2). Least recently used file is closed when the cache is full. Thread-safe.
+ */
+struct httpFileCache {
+	int rootfd;
+	pthread_mutex_t lock;
+
+	struct httpFile **buckets;
+	size_t bucketsc;
+	// Most recently used file is the head.
+	struct httpFile *lruHead;
+	struct httpFile *lruTail;
+	size_t size;
+	size_t capacity;
+
+	// Count of requests served from the cache and of files opened.
+	size_t hits;
+	size_t misses;
+};
+
+/**
+ * Opens directory @root to be served.
+ *
+ * @capacity Maximum count of open files kept, 0 disables caching: each file is closed once it is sent.
+ *
+ * @Returns 0 on success, -1 + errno otherwise.
+ */
+int initHTTPFileCache(struct httpFileCache *cache, const char *root, size_t capacity);
+
+/**
+ * Closes the cached files and the directory. Files still being sent are closed once they are released.
+ */
+void destroyHTTPFileCache(struct httpFileCache *cache);
+
+/**
+ * Responds to @request with the file of @path of @len bytes (percent-encoded, query is ignored) relative
+ * to the served directory, or with the request path if @path is NULL. Directory and path ending with '/'
+ * is served by its index.html. Path can not leave the directory, by dot segments nor by symbolic links.
+ * Body is sent by sendfile(2) from the cached file descriptor, HEAD is answered with the head only.
+ *
+ * Responds with 400 on malformed path, 404 if there is no such file, 403 if it is not readable,
+ * 405 on methods other than GET and HEAD and 500 on other errors.
+ */
+void serveHTTPFile(struct httpFileCache *cache, struct HTTPRequest *request, struct HTTPResponse *response,
+	const char *path, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FILES_H */
@@ -0,0 +1,205 @@
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include "flight.h"
+#include "HttpStatusCodes_C.h"
+
+static void defaultHTTPFlightKey(struct HTTPRequest *request, struct httpCacheKey *key, void *ctx)
+{
+	(void)ctx;
+
+	buildHTTPCacheKey(request, NULL, 0, key);
+}
+
+int initHTTPFlightGroup(struct httpFlightGroup *group, httpFlightKey_t keyFunction, void *ctx, unsigned int timeout)
+{
+	memset(group, 0, sizeof(struct httpFlightGroup));
+
+	group->keyFunction = keyFunction != NULL ? keyFunction : defaultHTTPFlightKey;
+	group->keyCtx = ctx;
+	group->timeout = timeout;
+
+	int err = pthread_mutex_init(&group->lock, NULL);
+	if (err != 0) {
+		errno = err;
+		return -1;
+	}
+
+	return 0;
+}
+
+void destroyHTTPFlightGroup(struct httpFlightGroup *group)
+{
+	pthread_mutex_destroy(&group->lock);
+}
+
+/**
+ * @Returns new flight of @key led by request of @method with the reference of the leader, NULL + errno on failure.
+ */
+static struct httpFlight *newHTTPFlight(struct httpCacheKey *key, int method)
+{
+	struct httpFlight *flight = malloc(sizeof(struct httpFlight));
+	if (flight == NULL) return NULL;
+
+	memcpy(flight->key.buf, key->buf, key->len);
+	flight->key.len = key->len;
+	flight->key.hash = key->hash;
+	flight->key.cacheable = 1;
+
+	// Waits are timed by the monotonic clock, as the timers are.
+	pthread_condattr_t attr;
+	int err = pthread_condattr_init(&attr);
+	if (err == 0) {
+		err = pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+		if (err == 0) err = pthread_cond_init(&flight->landed, &attr);
+		pthread_condattr_destroy(&attr);
+	}
+
+	if (err != 0) {
+		free(flight);
+		errno = err;
+		return NULL;
+	}
+
+	flight->method = method;
+	flight->refs = 1;
+	flight->done = 0;
+	flight->entry = NULL;
+	flight->hashNext = NULL;
+
+	return flight;
+}
+
+static void freeHTTPFlight(struct httpFlight *flight)
+{
+	if (flight->entry != NULL) releaseHTTPCacheEntry(flight->entry);
+
+	pthread_cond_destroy(&flight->landed);
+	free(flight);
+}
+
+/**
+ * Waits for @flight to land for the group timeout. Group lock should be held.
+ *
+ * @Returns response of the flight with the reference of the caller, NULL if there is none.
+ */
+static struct httpCacheEntry *awaitHTTPFlight(struct httpFlightGroup *group, struct httpFlight *flight)
+{
+	struct timespec deadline;
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	deadline.tv_sec += group->timeout / 1000;
+	deadline.tv_nsec += (group->timeout % 1000) * 1000000L;
+	if (deadline.tv_nsec >= 1000000000L) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000L;
+	}
+
+	int err = 0;
+	while (!flight->done && err != ETIMEDOUT)
+		err = pthread_cond_timedwait(&flight->landed, &group->lock, &deadline);
+
+	if (!flight->done) {
+		group->timeouts++;
+		return NULL;
+	}
+
+	if (flight->entry == NULL) return NULL;
+
+	group->followers++;
+	__atomic_add_fetch(&flight->entry->refs, 1, __ATOMIC_ACQ_REL);
+
+	return flight->entry;
+}
+
+int joinHTTPFlight(struct httpFlightGroup *group, struct HTTPRequest *request, struct HTTPResponse *response,
+	struct httpFlight **flight)
+{
+	*flight = NULL;
+
+	struct httpCacheKey key;
+	group->keyFunction(request, &key, group->keyCtx);
+	if (!key.cacheable) return 0;
+
+	key.hash = httpCacheHash(key.buf, key.len);
+
+	pthread_mutex_lock(&group->lock);
+
+	struct httpFlight **bucket = &group->buckets[key.hash & (HTTP_FLIGHT_BUCKETS - 1)];
+	struct httpFlight *current = *bucket;
+	while (current != NULL && (current->key.hash != key.hash || current->key.len != key.len ||
+			memcmp(current->key.buf, key.buf, key.len)))
+		current = current->hashNext;
+
+	if (current == NULL) {
+		// Request is processed on its own if the flight can not be started.
+		*flight = newHTTPFlight(&key, request->method);
+		if (*flight != NULL) {
+			(*flight)->hashNext = *bucket;
+			*bucket = *flight;
+			group->flights++;
+		}
+
+		pthread_mutex_unlock(&group->lock);
+		return 0;
+	}
+
+	current->refs++;
+	struct httpCacheEntry *entry = awaitHTTPFlight(group, current);
+	int last = --current->refs == 0;
+
+	pthread_mutex_unlock(&group->lock);
+
+	if (last) freeHTTPFlight(current);
+
+	if (entry == NULL) return 0;
+
+	respondHTTPCacheEntry(request, response, entry);
+
+	return 1;
+}
+
+/**
+ * @Returns 1 if @response of @flight leader can be sent to the clients of other requests.
+ */
+static int httpFlightShares(struct httpFlight *flight, struct HTTPResponse *response)
+{
+	// Leader key may match HEAD and conditional requests: body of their responses may be left out.
+	if (flight->method != HTTPM_GET || response->status == HttpStatus_NotModified) return 0;
+	if (response->rawHeaders != NULL || getHTTPHeader_p(&response->headers, "Set-Cookie") != NULL) return 0;
+
+	const char *cacheControl = getHTTPHeader_p(&response->headers, "Cache-Control");
+	return cacheControl == NULL || strcasestr(cacheControl, "private") == NULL;
+}
+
+void landHTTPFlight(struct httpFlightGroup *group, struct httpFlight *flight, struct HTTPResponse *response)
+{
+	pthread_mutex_lock(&group->lock);
+
+	// Requests joining from now on start their own flight, so the waiting ones are known.
+	struct httpFlight **link = &group->buckets[flight->key.hash & (HTTP_FLIGHT_BUCKETS - 1)];
+	while (*link != flight) link = &(*link)->hashNext;
+	*link = flight->hashNext;
+
+	// Waiting requests hold their references until they wake up, the entry is built without the lock.
+	struct httpCacheEntry *entry = NULL;
+	if (flight->refs > 1 && httpFlightShares(flight, response)) {
+		pthread_mutex_unlock(&group->lock);
+
+		entry = newHTTPCacheEntry(&flight->key, response, getHTTPHeader_p(&response->headers, "ETag"),
+			getHTTPHeader_p(&response->headers, "Cache-Control"), HTTP_FLIGHT_MAX_ENTRY);
+
+		pthread_mutex_lock(&group->lock);
+	}
+
+	flight->done = 1;
+	flight->entry = entry;
+	pthread_cond_broadcast(&flight->landed);
+
+	int last = --flight->refs == 0;
+
+	pthread_mutex_unlock(&group->lock);
+
+	if (last) freeHTTPFlight(flight);
+}
@@ -0,0 +1,114 @@
+#ifndef FLIGHT_H
+#define FLIGHT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "http.h"
+#include "cache.h"
+
+#ifndef HTTP_FLIGHT_BUCKETS
+/**
+ * Count of hash buckets of requests in flight, a power of 2. Requests in flight are bounded by the handler threads.
+ */
+#define HTTP_FLIGHT_BUCKETS 64
+#endif
+
+#ifndef HTTP_FLIGHT_MAX_ENTRY
+/**
+ * Maximum size of response shared with the waiting requests. Larger responses are not copied,
+ * the waiting requests are processed on their own.
+ */
+#define HTTP_FLIGHT_MAX_ENTRY (1 << 20)
+#endif
+
+/**
+ * Builds @key of @request: sets key->buf, key->len and key->cacheable, the hash is computed by the group.
+ * Requests with equal keys are coalesced, requests with key->cacheable unset are processed on their own.
+ */
+typedef void (*httpFlightKey_t)(struct HTTPRequest *request, struct httpCacheKey *key, void *ctx);
+
+/**
+ * Request being processed by the leader thread, with the other threads waiting for its response.
+ */
+struct httpFlight {
+	struct httpCacheKey key;
+	// Method of the leader request. Only response to GET is shared: HEAD one has no body.
+	int method;
+
+	pthread_cond_t landed;
+	int done;
+	// Response of the leader, NULL if it could not be shared.
+	struct httpCacheEntry *entry;
+
+	// References of the leader and of the waiting threads, protected by the group lock.
+	int refs;
+	struct httpFlight *hashNext;
+};
+
+/**
+ * Coalesces concurrent identical requests: the first one is processed, the others wait for it and receive
+ * the same response bytes instead of running the processor again. Response is shared if the leader is a GET request,
+ * its body is in memory, it is not larger than HTTP_FLIGHT_MAX_ENTRY, it is not 304 and it has no Set-Cookie
+ * nor Cache-Control private, otherwise the waiting requests are processed on their own.
+ * Waiting blocks the thread, so only the connection handler (see httpConnetionHandler()) coalesces requests.
+ * Thread-safe.
+ */
+struct httpFlightGroup {
+	pthread_mutex_t lock;
+	struct httpFlight *buckets[HTTP_FLIGHT_BUCKETS];
+
+	httpFlightKey_t keyFunction;
+	void *keyCtx;
+	// Time in milliseconds a request waits for the leader before it is processed on its own.
+	unsigned int timeout;
+
+	// Count of flights started, of requests answered by their responses and of timed out waits.
+	size_t flights;
+	size_t followers;
+	size_t timeouts;
+};
+
+/**
+ * Initializes the group.
+ *
+ * @keyFunction Key of requests, NULL means method and path of GET and HEAD requests without Authorization
+ * (see buildHTTPCacheKey()).
+ * @ctx Context of @keyFunction.
+ * @timeout Time in milliseconds a request waits for the identical one being processed.
+ *
+ * @Returns 0 on success, -1 + errno otherwise.
+ */
+int initHTTPFlightGroup(struct httpFlightGroup *group, httpFlightKey_t keyFunction, void *ctx, unsigned int timeout);
+
+/**
+ * Frees the group. No request should be in flight.
+ */
+void destroyHTTPFlightGroup(struct httpFlightGroup *group);
+
+/**
+ * Waits for the identical request in flight and answers @request by its response, or starts the flight of @request.
+ *
+ * @flight Set to the flight @request leads, which should be landed by landHTTPFlight() once it is processed.
+ * NULL if there is none.
+ *
+ * @Returns 1 if @response is set, 0 if the request should be processed.
+ */
+int joinHTTPFlight(struct httpFlightGroup *group, struct HTTPRequest *request, struct HTTPResponse *response,
+	struct httpFlight **flight);
+
+/**
+ * Shares @response to @flight with the requests waiting for it and ends the flight.
+ * Response is copied only if there are requests waiting.
+ */
+void landHTTPFlight(struct httpFlightGroup *group, struct httpFlight *flight, struct HTTPResponse *response);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FLIGHT_H */
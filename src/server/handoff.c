@@ -0,0 +1,408 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "handoff.h"
+#include "server.h"
+
+int adoptSocket(struct ssock *res, int fd)
+{
+	int listening = 0;
+	int type = 0;
+	socklen_t optlen = sizeof(int);
+
+	if (getsockopt(fd, SOL_SOCKET, SO_ACCEPTCONN, &listening, &optlen))
+		goto error;
+
+	optlen = sizeof(int);
+	if (getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &optlen))
+		goto error;
+
+	if (!listening || type != SOCK_STREAM) {
+		errno = EINVAL;
+		goto error;
+	}
+
+	struct sockaddr_storage *addr = calloc(1, sizeof(struct sockaddr_storage));
+	if (addr == NULL) goto error;
+
+	socklen_t addrlen = sizeof(struct sockaddr_storage);
+	if (getsockname(fd, (struct sockaddr *)addr, &addrlen)) {
+		int err = errno;
+		free(addr);
+		errno = err;
+		goto error;
+	}
+
+	memset(res, 0, sizeof(struct ssock));
+	res->fd = fd;
+	res->addr = (struct sockaddr *)addr;
+	res->addrlen = addrlen;
+	res->cpu = -1;
+
+	return 0;
+error:
+	return -1;
+}
+
+int sendSockets(int chan, const int *fds, size_t n)
+{
+	if (n > HANDOFF_MAX_SOCKS) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	// Count is sent as data: SCM_RIGHTS message must carry at least one byte.
+	uint32_t count = n;
+	struct iovec iov = { .iov_base = &count, .iov_len = sizeof(count) };
+
+	char cbuf[CMSG_SPACE(sizeof(int) * HANDOFF_MAX_SOCKS)];
+	memset(cbuf, 0, sizeof(cbuf));
+
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+	};
+
+	if (n > 0) {
+		msg.msg_control = cbuf;
+		msg.msg_controllen = CMSG_SPACE(sizeof(int) * n);
+
+		struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int) * n);
+		memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * n);
+	}
+
+	ssize_t sent;
+	do {
+		sent = sendmsg(chan, &msg, MSG_NOSIGNAL);
+	} while (sent == -1 && errno == EINTR);
+
+	if (sent != sizeof(count)) {
+		if (sent >= 0) errno = EIO;
+		return -1;
+	}
+
+	return 0;
+}
+
+int recvSockets(int chan, int *fds, size_t maxn)
+{
+	uint32_t count = 0;
+	struct iovec iov = { .iov_base = &count, .iov_len = sizeof(count) };
+
+	char cbuf[CMSG_SPACE(sizeof(int) * HANDOFF_MAX_SOCKS)];
+	memset(cbuf, 0, sizeof(cbuf));
+
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = cbuf,
+		.msg_controllen = sizeof(cbuf),
+	};
+
+	ssize_t received;
+	do {
+		received = recvmsg(chan, &msg, MSG_CMSG_CLOEXEC);
+	} while (received == -1 && errno == EINTR);
+
+	if (received == -1) return -1;
+
+	size_t n = 0;
+	for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) continue;
+
+		size_t cn = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+		int *cfds = (int *)CMSG_DATA(cmsg);
+
+		for (size_t i = 0; i < cn; i++) {
+			if (n < maxn) fds[n++] = cfds[i];
+			else close(cfds[i]);
+		}
+	}
+
+	if (received != sizeof(count) || (msg.msg_flags & MSG_CTRUNC) || count != n) {
+		for (size_t i = 0; i < n; i++)
+			close(fds[i]);
+
+		errno = EPROTO;
+		return -1;
+	}
+
+	return n;
+}
+
+int contextInheritSockets(struct ApplicationContext *context)
+{
+	const char *fdsEnv = getenv("LISTEN_FDS");
+	const char *pidEnv = getenv("LISTEN_PID");
+	if (fdsEnv == NULL) return 0;
+
+	char *end;
+	long nfds = strtol(fdsEnv, &end, 10);
+	if (*fdsEnv == '\0' || *end != '\0' || nfds < 0 || nfds > HANDOFF_MAX_SOCKS) {
+		errno = EINVAL;
+		goto error;
+	}
+
+	// Variables are meant for another process, e.g. the parent did not unset them.
+	if (pidEnv != NULL && strtol(pidEnv, NULL, 10) != getpid())
+		return 0;
+
+	unsetenv("LISTEN_FDS");
+	unsetenv("LISTEN_PID");
+	unsetenv("LISTEN_FDNAMES");
+
+	for (int fd = LISTEN_FDS_START; fd < LISTEN_FDS_START + nfds; fd++) {
+		struct ssock sock;
+		if (adoptSocket(&sock, fd)) {
+			fprintf(stderr, "Unable to inherit socket %d: %s\n", fd, strerror(errno));
+			goto error;
+		}
+
+		if (fcntl(fd, F_SETFD, FD_CLOEXEC)) {
+			free(sock.addr);
+			goto error;
+		}
+
+		sock.inherited = 1;
+		contextRegisterSocket(context, sock);
+	}
+
+	return nfds;
+error:
+	return -1;
+}
+
+/**
+ * Fills unix socket address. @Returns 0 on success, -1 + errno if @path is too long.
+ */
+static int handoffAddr(struct sockaddr_un *addr, const char *path)
+{
+	memset(addr, 0, sizeof(struct sockaddr_un));
+	addr->sun_family = AF_UNIX;
+
+	if (strlen(path) >= sizeof(addr->sun_path)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+
+	strcpy(addr->sun_path, path);
+	return 0;
+}
+
+int contextTakeoverSockets(struct ApplicationContext *context, const char *path)
+{
+	struct sockaddr_un addr;
+	if (handoffAddr(&addr, path)) goto error;
+
+	int chan = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (chan == -1) goto error;
+
+	if (connect(chan, (struct sockaddr *)&addr, sizeof(addr))) {
+		int err = errno;
+		close(chan);
+
+		// No predecessor is running: stale socket file or the first start.
+		if (err == ENOENT || err == ECONNREFUSED)
+			return 0;
+
+		errno = err;
+		goto error;
+	}
+
+	int fds[HANDOFF_MAX_SOCKS];
+	int n = recvSockets(chan, fds, HANDOFF_MAX_SOCKS);
+	if (n == -1) {
+		int err = errno;
+		close(chan);
+		errno = err;
+		goto error;
+	}
+
+	for (int i = 0; i < n; i++) {
+		struct ssock sock;
+		if (adoptSocket(&sock, fds[i])) {
+			int err = errno;
+			for (int j = i; j < n; j++)
+				close(fds[j]);
+			close(chan);
+			errno = err;
+			goto error;
+		}
+
+		sock.takenOver = 1;
+		contextRegisterSocket(context, sock);
+	}
+
+	// Takeover is acknowledged by contextCommitTakeover(), closed channel aborts it.
+	context->takeoverFd = chan;
+
+	return n;
+error:
+	return -1;
+}
+
+int contextCommitTakeover(struct ApplicationContext *context)
+{
+	int chan = context->takeoverFd;
+	if (chan == -1) return 0;
+
+	context->takeoverFd = -1;
+
+	char ack = 1;
+	if (send(chan, &ack, 1, MSG_NOSIGNAL) != 1) {
+		int err = errno;
+		close(chan);
+		errno = err;
+		return -1;
+	}
+
+	close(chan);
+
+	return 0;
+}
+
+/**
+ * Passes listening sockets to successor connected on @chan.
+ *
+ * @Returns 1 if successor took the sockets over, 0 otherwise.
+ */
+static int handoffSockets(struct ApplicationContext *context, int chan)
+{
+	struct ucred cred;
+	socklen_t credlen = sizeof(cred);
+
+	// Listeners are passed only to the processes of the same user.
+	if (getsockopt(chan, SOL_SOCKET, SO_PEERCRED, &cred, &credlen) || cred.uid != geteuid()) {
+		fprintf(stderr, "Handoff refused: peer is not owned by the server user\n");
+		return 0;
+	}
+
+	int fds[HANDOFF_MAX_SOCKS];
+	size_t n = 0;
+
+	// Shards are owned by the workers of this process, successor creates its own ones.
+	for (size_t i = 0; i < context->socks.size; i++) {
+		struct ssock *sock = vectorGetEl(&context->socks, i);
+		if (sock == NULL || sock->cpu > 0) continue;
+
+		if (n == HANDOFF_MAX_SOCKS) {
+			fprintf(stderr, "Handoff refused: too many listening sockets\n");
+			return 0;
+		}
+
+		fds[n++] = sock->fd;
+	}
+
+	if (sendSockets(chan, fds, n)) {
+		perror("Unable to pass listening sockets");
+		return 0;
+	}
+
+	char ack;
+	ssize_t rd;
+	do {
+		rd = recv(chan, &ack, 1, 0);
+	} while (rd == -1 && errno == EINTR);
+
+	return rd == 1;
+}
+
+/**
+ * Thread callback that accepts successors on the handoff socket.
+ */
+static void *handoffListener(void *rawcontext)
+{
+	struct ApplicationContext *context = rawcontext;
+
+	// Closing signals are handled by other threads: closeServer() joins this one.
+	setCloseSignalsBlocked(1);
+
+	while (1) {
+		int chan = accept4(context->handoffFd, NULL, NULL, SOCK_CLOEXEC);
+		if (chan == -1) {
+			if (errno == EINTR || errno == ECONNABORTED) continue;
+
+			perror("Unable to accept successor");
+			break;
+		}
+
+		int handedOff = handoffSockets(context, chan);
+		close(chan);
+
+		if (handedOff) {
+			printf("Listening sockets are passed to the successor\n");
+			__atomic_store_n(&context->handedOff, 1, __ATOMIC_RELEASE);
+			kill(getpid(), SIGINT);
+			break;
+		}
+	}
+
+	return NULL;
+}
+
+int contextServeHandoff(struct ApplicationContext *context, const char *path)
+{
+	struct sockaddr_un addr;
+	if (handoffAddr(&addr, path)) goto error;
+
+	context->handoffPath = strdup(path);
+	if (context->handoffPath == NULL) goto error;
+
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd == -1) goto path_error;
+
+	// Socket file is left by the predecessor or by crashed process.
+	unlink(path);
+
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) || listen(fd, 1)) {
+		int err = errno;
+		close(fd);
+		errno = err;
+		goto path_error;
+	}
+
+	context->handoffFd = fd;
+
+	if (pthread_create(&context->handoffThread, NULL, handoffListener, context)) {
+		int err = errno;
+		close(fd);
+		unlink(path);
+		errno = err;
+		goto path_error;
+	}
+
+	return 0;
+
+path_error:
+	free(context->handoffPath);
+	context->handoffPath = NULL;
+error:
+	return -1;
+}
+
+void contextStopHandoff(struct ApplicationContext *context)
+{
+	if (context->handoffPath == NULL) return;
+
+	pthread_cancel(context->handoffThread);
+	pthread_join(context->handoffThread, NULL);
+	close(context->handoffFd);
+
+	// Successor listens on the path now.
+	if (!context->handedOff)
+		unlink(context->handoffPath);
+
+	free(context->handoffPath);
+	context->handoffPath = NULL;
+}
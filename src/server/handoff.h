@@ -0,0 +1,92 @@
+#ifndef HANDOFF_H
+#define HANDOFF_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <sys/types.h>
+#include "server.h"
+
+/**
+ * First file descriptor passed with LISTEN_FDS protocol.
+ */
+#define LISTEN_FDS_START 3
+
+#ifndef HANDOFF_MAX_SOCKS
+/**
+ * Maximum count of listening sockets passed to the successor in one handoff.
+ */
+#define HANDOFF_MAX_SOCKS 64
+#endif
+
+/**
+ * Creates struct ssock for already bound listening socket @fd. Address is taken from getsockname(2).
+ *
+ * @Returns 0 on success, -1 + errno otherwise. EINVAL if @fd is not a listening stream socket.
+ */
+int adoptSocket(struct ssock *res, int fd);
+
+/**
+ * Sends @n file descriptors over unix socket @chan with SCM_RIGHTS.
+ *
+ * @Returns 0 on success, -1 + errno otherwise.
+ */
+int sendSockets(int chan, const int *fds, size_t n);
+
+/**
+ * Receives file descriptors sent by sendSockets(). Received descriptors are close-on-exec.
+ *
+ * @maxn Capacity of @fds.
+ *
+ * @Returns count of received descriptors, -1 + errno otherwise.
+ */
+int recvSockets(int chan, int *fds, size_t maxn);
+
+/**
+ * Registers listening sockets passed by the service manager with LISTEN_FDS protocol:
+ * LISTEN_FDS holds count of sockets starting from LISTEN_FDS_START, LISTEN_PID is the process
+ * they are passed to. Variables are unset, so children do not inherit them.
+ * Inherited unix sockets are not unlinked on close: they are owned by the service manager.
+ *
+ * @Returns count of registered sockets, -1 + errno otherwise.
+ */
+int contextInheritSockets(struct ApplicationContext *context);
+
+/**
+ * Connects to the running predecessor listening for successors on unix socket @path
+ * (see contextServeHandoff()) and takes over its listening sockets. Predecessor keeps serving until
+ * the takeover is committed by startServer(), so the sockets are not lost if the successor fails to start:
+ * closeServer() aborts the takeover.
+ *
+ * @Returns count of registered sockets, 0 if there is no predecessor, -1 + errno otherwise.
+ */
+int contextTakeoverSockets(struct ApplicationContext *context, const char *path);
+
+/**
+ * Commits the takeover of contextTakeoverSockets(): predecessor stops accepting and closes gracefully.
+ * Called by startServer() once the listeners run. Does nothing if there is no takeover.
+ *
+ * @Returns 0 on success, -1 + errno otherwise.
+ */
+int contextCommitTakeover(struct ApplicationContext *context);
+
+/**
+ * Starts thread listening for successors on unix socket @path. Successor receives all the
+ * context listening sockets except reuseport shards, then the server is closed gracefully as
+ * on SIGINT. Unix sockets passed to the successor are not unlinked on close.
+ *
+ * @Returns 0 on success, -1 + errno otherwise.
+ */
+int contextServeHandoff(struct ApplicationContext *context, const char *path);
+
+/**
+ * Stops handoff thread. Called by closeServer().
+ */
+void contextStopHandoff(struct ApplicationContext *context);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HANDOFF_H */
@@ -1,16 +1,22 @@
 #include "http.h"
+#include "server.h"
+#include "scan.h"
+#include "router.h"
+#include "cache.h"
+#include "flight.h"
 #include <string.h>
+#include <strings.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <pthread.h>
 #include "HttpStatusCodes_C.h"
 
 
-#define HEADPROCESS_METHOD 1
-#define HEADPROCESS_PATH 2
-#define HEADPROCESS_HTTPV 3
-#define HEADPROCESS_END 4
-
 ssize_t deleteNLSignature(char *line) {
 	size_t lineLen = strlen(line);
 	if (line[lineLen - 2] == '\r' && line[lineLen - 1] == '\n') {
@@ -162,47 +168,215 @@ void destroyHTTPHeader(struct HTTPHeader *header) {
 	free(header->key);
 }	
 
-inline int createHTTPHeaderVector(struct vector_p *headers) {
-	return initVector_p(headers, sizeof(struct HTTPHeader), 2);
+/**
+ * Perfect hash of well-known header names: no two of them collide, so lookup takes one probe and one comparison.
+ * @c0, @cm and @cl are lowercase first, middle (len / 2) and last characters of name.
+ */
+#define HTTP_HEADER_HASH(len, c0, cm, cl) (((len) + (c0) * 2 + (cm) + (cl) * 28) & 63)
+
+static const unsigned char wellKnownHeaders[64] = {
+	[HTTP_HEADER_HASH(4, 'h', 's', 't')] = HTTPH_HOST,
+	[HTTP_HEADER_HASH(14, 'c', '-', 'h')] = HTTPH_CONTENT_LENGTH,
+	[HTTP_HEADER_HASH(12, 'c', 't', 'e')] = HTTPH_CONTENT_TYPE,
+	[HTTP_HEADER_HASH(16, 'c', 'e', 'g')] = HTTPH_CONTENT_ENCODING,
+	[HTTP_HEADER_HASH(10, 'c', 'c', 'n')] = HTTPH_CONNECTION,
+	[HTTP_HEADER_HASH(10, 'k', 'a', 'e')] = HTTPH_KEEP_ALIVE,
+	[HTTP_HEADER_HASH(17, 't', '-', 'g')] = HTTPH_TRANSFER_ENCODING,
+	[HTTP_HEADER_HASH(6, 'e', 'e', 't')] = HTTPH_EXPECT,
+	[HTTP_HEADER_HASH(7, 'u', 'r', 'e')] = HTTPH_UPGRADE,
+	[HTTP_HEADER_HASH(10, 'u', 'a', 't')] = HTTPH_USER_AGENT,
+	[HTTP_HEADER_HASH(6, 'a', 'e', 't')] = HTTPH_ACCEPT,
+	[HTTP_HEADER_HASH(15, 'a', 'e', 'g')] = HTTPH_ACCEPT_ENCODING,
+	[HTTP_HEADER_HASH(15, 'a', 'l', 'e')] = HTTPH_ACCEPT_LANGUAGE,
+	[HTTP_HEADER_HASH(13, 'a', 'i', 'n')] = HTTPH_AUTHORIZATION,
+	[HTTP_HEADER_HASH(6, 'c', 'k', 'e')] = HTTPH_COOKIE,
+	[HTTP_HEADER_HASH(10, 's', 'o', 'e')] = HTTPH_SET_COOKIE,
+	[HTTP_HEADER_HASH(7, 'r', 'e', 'r')] = HTTPH_REFERER,
+	[HTTP_HEADER_HASH(4, 'd', 't', 'e')] = HTTPH_DATE,
+	[HTTP_HEADER_HASH(6, 's', 'v', 'r')] = HTTPH_SERVER,
+	[HTTP_HEADER_HASH(8, 'l', 't', 'n')] = HTTPH_LOCATION,
+	[HTTP_HEADER_HASH(5, 'r', 'n', 'e')] = HTTPH_RANGE,
+	[HTTP_HEADER_HASH(4, 'e', 'a', 'g')] = HTTPH_ETAG,
+	[HTTP_HEADER_HASH(13, 'i', 'e', 'h')] = HTTPH_IF_NONE_MATCH,
+	[HTTP_HEADER_HASH(17, 'i', 'i', 'e')] = HTTPH_IF_MODIFIED_SINCE,
+	[HTTP_HEADER_HASH(13, 'l', 'o', 'd')] = HTTPH_LAST_MODIFIED,
+	[HTTP_HEADER_HASH(13, 'c', 'c', 'l')] = HTTPH_CACHE_CONTROL,
+};
+
+#define HTTP_HEADER_NAME(name) { name, sizeof(name) - 1 }
+
+static const struct httpSlice headerNames[HTTPH_COUNT] = {
+	[HTTPH_HOST] = HTTP_HEADER_NAME("Host"),
+	[HTTPH_CONTENT_LENGTH] = HTTP_HEADER_NAME("Content-Length"),
+	[HTTPH_CONTENT_TYPE] = HTTP_HEADER_NAME("Content-Type"),
+	[HTTPH_CONTENT_ENCODING] = HTTP_HEADER_NAME("Content-Encoding"),
+	[HTTPH_CONNECTION] = HTTP_HEADER_NAME("Connection"),
+	[HTTPH_KEEP_ALIVE] = HTTP_HEADER_NAME("Keep-Alive"),
+	[HTTPH_TRANSFER_ENCODING] = HTTP_HEADER_NAME("Transfer-Encoding"),
+	[HTTPH_EXPECT] = HTTP_HEADER_NAME("Expect"),
+	[HTTPH_UPGRADE] = HTTP_HEADER_NAME("Upgrade"),
+	[HTTPH_USER_AGENT] = HTTP_HEADER_NAME("User-Agent"),
+	[HTTPH_ACCEPT] = HTTP_HEADER_NAME("Accept"),
+	[HTTPH_ACCEPT_ENCODING] = HTTP_HEADER_NAME("Accept-Encoding"),
+	[HTTPH_ACCEPT_LANGUAGE] = HTTP_HEADER_NAME("Accept-Language"),
+	[HTTPH_AUTHORIZATION] = HTTP_HEADER_NAME("Authorization"),
+	[HTTPH_COOKIE] = HTTP_HEADER_NAME("Cookie"),
+	[HTTPH_SET_COOKIE] = HTTP_HEADER_NAME("Set-Cookie"),
+	[HTTPH_REFERER] = HTTP_HEADER_NAME("Referer"),
+	[HTTPH_DATE] = HTTP_HEADER_NAME("Date"),
+	[HTTPH_SERVER] = HTTP_HEADER_NAME("Server"),
+	[HTTPH_LOCATION] = HTTP_HEADER_NAME("Location"),
+	[HTTPH_RANGE] = HTTP_HEADER_NAME("Range"),
+	[HTTPH_ETAG] = HTTP_HEADER_NAME("ETag"),
+	[HTTPH_IF_NONE_MATCH] = HTTP_HEADER_NAME("If-None-Match"),
+	[HTTPH_IF_MODIFIED_SINCE] = HTTP_HEADER_NAME("If-Modified-Since"),
+	[HTTPH_LAST_MODIFIED] = HTTP_HEADER_NAME("Last-Modified"),
+	[HTTPH_CACHE_CONTROL] = HTTP_HEADER_NAME("Cache-Control"),
+};
+
+static inline unsigned char lowerChar(unsigned char c)
+{
+	return c >= 'A' && c <= 'Z' ? c | 0x20 : c;
 }
 
-ssize_t findHTTPHeader_p(struct vector_p *headers, const char *key) {
-	for (size_t i = 0; i < headers->size; i++) {
-		struct HTTPHeader header;
-		vectorCopyEl_p(headers, i, (char *)&header);
-		if (!strcmp(header.key, key)) {
-			return i;
+int httpHeaderId(const char *name, size_t len)
+{
+	if (len == 0) return HTTPH_OTHER;
+
+	int id = wellKnownHeaders[HTTP_HEADER_HASH(len,
+		lowerChar(name[0]), lowerChar(name[len / 2]), lowerChar(name[len - 1]))];
+
+	if (id == HTTPH_OTHER || headerNames[id].len != len || strncasecmp(headerNames[id].ptr, name, len))
+		return HTTPH_OTHER;
+
+	return id;
+}
+
+const char *httpHeaderName(int id)
+{
+	if (id <= HTTPH_OTHER || id >= HTTPH_COUNT) return NULL;
+
+	return headerNames[id].ptr;
+}
+
+/**
+ * FNV-1a hash of lowercase @name.
+ */
+static unsigned headerNameHash(const char *name, size_t len)
+{
+	unsigned hash = 2166136261u;
+	for (size_t i = 0; i < len; i++) {
+		hash ^= lowerChar(name[i]);
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+void initHTTPHeaderIndex(struct httpHeaderIndex *index)
+{
+	memset(index->known, 0, sizeof(index->known));
+	memset(index->slots, 0, sizeof(index->slots));
+	index->entriesc = 0;
+}
+
+/**
+ * Looks up header name that is not a well-known one.
+ *
+ * @Returns slot with the name or empty slot where the name should be inserted.
+ */
+static unsigned char *headerIndexSlot(struct httpHeaderIndex *index, const char *key, size_t len, unsigned hash)
+{
+	for (size_t i = hash;; i++) {
+		unsigned char *slot = &index->slots[i & (HTTP_HEADER_SLOTS - 1)];
+		if (*slot == 0) return slot;
+
+		struct httpHeaderEntry *entry = &index->entries[*slot - 1];
+		if (entry->hash == hash && entry->keylen == len && !strncasecmp(entry->key, key, len))
+			return slot;
+	}
+}
+
+/**
+ * Same as httpHeaderIndexSet() for header with known HTTPH_ @id.
+ */
+static int headerIndexSetId(struct httpHeaderIndex *index, int id, const char *key, size_t len, size_t pos)
+{
+	if (id != HTTPH_OTHER) {
+		index->known[id] = pos + 1;
+		return 0;
+	}
+
+	unsigned hash = headerNameHash(key, len);
+	unsigned char *slot = headerIndexSlot(index, key, len, hash);
+
+	if (*slot == 0) {
+		if (index->entriesc == HTTP_MAX_HEADERS) {
+			errno = E2BIG;
+			return -1;
 		}
+
+		*slot = ++index->entriesc;
 	}
 
-	return -1;
+	index->entries[*slot - 1] = (struct httpHeaderEntry){ .key = key, .keylen = len, .hash = hash, .pos = pos };
+	return 0;
+}
+
+int httpHeaderIndexSet(struct httpHeaderIndex *index, const char *key, size_t len, size_t pos)
+{
+	return headerIndexSetId(index, httpHeaderId(key, len), key, len, pos);
+}
+
+ssize_t httpHeaderIndexFind(struct httpHeaderIndex *index, const char *key, size_t len)
+{
+	int id = httpHeaderId(key, len);
+	if (id != HTTPH_OTHER) return (ssize_t)index->known[id] - 1;
+
+	unsigned char *slot = headerIndexSlot(index, key, len, headerNameHash(key, len));
+	if (*slot == 0) return -1;
+
+	return index->entries[*slot - 1].pos;
+}
+
+inline int createHTTPHeaderVector(struct HTTPHeaders *headers) {
+	initHTTPHeaderIndex(&headers->index);
+	return initLocalVector_p(&headers->vec, sizeof(struct HTTPHeader), 2);
 }
-char *getHTTPHeader_p(struct vector_p *headers, const char *key) {
+
+ssize_t findHTTPHeader_p(struct HTTPHeaders *headers, const char *key) {
+	return httpHeaderIndexFind(&headers->index, key, strlen(key));
+}
+char *getHTTPHeader_p(struct HTTPHeaders *headers, const char *key) {
 	ssize_t i = findHTTPHeader_p(headers, key);
 	if (i == -1) {
 		return NULL;
 	}
-	struct HTTPHeader header;
-	vectorCopyEl_p(headers, i, (char *)&header);
 
-	return header.value;
+	// Vector is local: element is read in place.
+	return ((struct HTTPHeader *)vectorElPtr_p(&headers->vec, i))->value;
 }
 
-int addHTTPHeader_p(struct vector_p *headers, struct HTTPHeader *header) {
-	ssize_t i = findHTTPHeader_p(headers, header->key);
+int addHTTPHeader_p(struct HTTPHeaders *headers, struct HTTPHeader *header) {
+	size_t keylen = strlen(header->key);
+
+	ssize_t i = httpHeaderIndexFind(&headers->index, header->key, keylen);
 	if (i != -1) {
-		struct HTTPHeader oldHeader;
-		vectorCopyEl_p(headers, i, (char *)&oldHeader);
-		destroyHTTPHeader(&oldHeader);
+		// Index should point to the new key before the old one is freed.
+		httpHeaderIndexSet(&headers->index, header->key, keylen, i);
 
-		vectorSetEl_p(headers, i, (char *)header);
+		destroyHTTPHeader((struct HTTPHeader *)vectorElPtr_p(&headers->vec, i));
+		vectorSetEl_p(&headers->vec, i, (char *)header);
 	} else {
-		vectorInsertEl_p(headers, (char *)header);
+		if (httpHeaderIndexSet(&headers->index, header->key, keylen, headers->vec.size))
+			return -1;
+
+		vectorInsertEl_p(&headers->vec, (char *)header);
 	}
 
 	return 0;
 }
-inline int addKVHTTPHeader_p(struct vector_p *headers, const char *key, const char *value) {
+inline int addKVHTTPHeader_p(struct HTTPHeaders *headers, const char *key, const char *value) {
 	struct HTTPHeader header;
 	if (buildHTTPHeader(&header, key, value))
 		return -1;
@@ -214,14 +388,11 @@ inline int addKVHTTPHeader_p(struct vector_p *headers, const char *key, const ch
 	return 0;
 }
 
-int deleteHTTPHeader_p(struct vector_p *headers, const char *key) {
+int deleteHTTPHeader_p(struct HTTPHeaders *headers, const char *key) {
 	ssize_t i = findHTTPHeader_p(headers, key);
 	if (i != -1) {
-		struct HTTPHeader header;
 		// Since header is defined as contiguous char line (name\0value\0) this action is safe.
-		vectorCopyEl_p(headers, i, (char *)&header);
-		header.value = NULL;
-		vectorSetEl_p(headers, i, (char *)&header);
+		((struct HTTPHeader *)vectorElPtr_p(&headers->vec, i))->value = NULL;
 
 		return 0;
 	} else {
@@ -229,26 +400,380 @@ int deleteHTTPHeader_p(struct vector_p *headers, const char *key) {
 	}
 }
 
-void destroyHTTPHeaderVector(struct vector_p *headers) {
-	for (size_t i = 0; i < headers->size; i++) {
+void destroyHTTPHeaderVector(struct HTTPHeaders *headers) {
+	for (size_t i = 0; i < headers->vec.size; i++) {
 		struct HTTPHeader header;
-		vectorCopyEl_p(headers, i, (char *)&header);
+		vectorCopyEl_p(&headers->vec, i, (char *)&header);
 		destroyHTTPHeader(&header);	
 	}
-	vectorDestroy_p(headers);
+	vectorDestroy_p(&headers->vec);
+	initHTTPHeaderIndex(&headers->index);
+}
+
+
+void initHTTPChunkedDecoder(struct httpChunkedDecoder *dec)
+{
+	dec->state = HTTPCHUNK_SIZE;
+	dec->remaining = 0;
+	dec->total = 0;
+	dec->limit = HTTP_MAX_BODY_SIZE;
+	dec->offset = 0;
+	dec->trailerOff = 0;
+	dec->trailerSize = 0;
+	dec->error = 0;
+}
+
+/**
+ * Finds line of at most @limit bytes at the start of @buf.
+ *
+ * @linelen Length of the line content.
+ * @next Offset of the next line.
+ *
+ * @Returns 1 if line is found, 0 if it is not received completely, -1 if it is too long.
+ */
+static int chunkedLine(const char *buf, size_t len, size_t limit, size_t *linelen, size_t *next)
+{
+	const char *lf = memchr(buf, '\n', len < limit + 2 ? len : limit + 2);
+	if (lf == NULL) return len < limit + 2 ? 0 : -1;
+
+	*next = lf - buf + 1;
+	*linelen = lf - buf;
+	if (*linelen != 0 && buf[*linelen - 1] == '\r') (*linelen)--;
+
+	return *linelen <= limit ? 1 : -1;
+}
+
+static int hexDigit(char c)
+{
+	if (c >= '0' && c <= '9') return c - '0';
+	if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+	return -1;
+}
+
+int httpChunkedFeed(struct httpChunkedDecoder *dec, const char *buf, size_t len, size_t max,
+	size_t *consumed, struct HTTPHeaderView *out)
+{
+	const struct httpScanner *scan = httpScanner();
+
+	size_t i = 0;
+	size_t linelen, next;
+	int found, status;
+
+	while (1) switch (dec->state) {
+	case HTTPCHUNK_SIZE: {
+		found = chunkedLine(buf + i, len - i, HTTP_MAX_CHUNK_LINE, &linelen, &next);
+		if (found == 0) goto needMore;
+		if (found == -1) goto error;
+
+		const char *line = buf + i;
+		if (scan->value(line, linelen) != linelen) goto error;
+
+		size_t size = 0, d = 0;
+		for (int digit; d < linelen && (digit = hexDigit(line[d])) != -1; d++) {
+			if (size > (SIZE_MAX >> 4)) goto error;
+			size = (size << 4) | digit;
+		}
+		if (d == 0) goto error;
+
+		// Chunk extensions are ignored.
+		while (d < linelen && (line[d] == ' ' || line[d] == '\t')) d++;
+		if (d != linelen && line[d] != ';') goto error;
+
+		if (size > dec->limit - dec->total) {
+			dec->error = EFBIG;
+			goto failed;
+		}
+
+		i += next;
+		dec->remaining = size;
+		if (size != 0) {
+			dec->state = HTTPCHUNK_DATA;
+		} else {
+			dec->state = HTTPCHUNK_TRAILER;
+			dec->trailerOff = dec->offset + i;
+		}
+		break;
+	}
+	case HTTPCHUNK_DATA: {
+		size_t n = len - i;
+		if (n > dec->remaining) n = dec->remaining;
+		if (n > max) n = max;
+		if (n == 0) goto needMore;
+
+		out->key = (struct httpSlice){ .ptr = NULL, .len = 0 };
+		out->value = (struct httpSlice){ .ptr = buf + i, .len = n };
+
+		i += n;
+		dec->remaining -= n;
+		dec->total += n;
+		if (dec->remaining == 0) dec->state = HTTPCHUNK_DATA_END;
+
+		status = HTTPPARSE_DATA;
+		goto done;
+	}
+	case HTTPCHUNK_DATA_END:
+		// Data is followed by a line break only.
+		if (i == len) goto needMore;
+		if (buf[i] == '\r') {
+			if (i + 1 == len) goto needMore;
+			i++;
+		}
+		if (buf[i] != '\n') goto error;
+
+		i++;
+
+		dec->state = HTTPCHUNK_SIZE;
+		break;
+
+	case HTTPCHUNK_TRAILER: {
+		found = chunkedLine(buf + i, len - i, HTTP_MAX_HEAD_SIZE - dec->trailerSize, &linelen, &next);
+		if (found == 0) goto needMore;
+		if (found == -1) goto error;
+
+		const char *line = buf + i;
+		i += next;
+		dec->trailerSize += next;
+
+		if (linelen == 0) {
+			dec->state = HTTPCHUNK_DONE;
+			break;
+		}
+
+		size_t name = scan->token(line, linelen);
+		if (name == 0 || name == linelen || line[name] != ':') goto error;
+		if (scan->value(line, linelen) != linelen) goto error;
+
+		size_t vs = name + 1, ve = linelen;
+		while (vs < ve && (line[vs] == ' ' || line[vs] == '\t')) vs++;
+		while (ve > vs && (line[ve - 1] == ' ' || line[ve - 1] == '\t')) ve--;
+
+		out->key = (struct httpSlice){ .ptr = line, .len = name };
+		out->value = (struct httpSlice){ .ptr = line + vs, .len = ve - vs };
+
+		status = HTTPPARSE_TRAILER;
+		goto done;
+	}
+	case HTTPCHUNK_ERROR:
+		goto failed;
+
+	default:
+		status = HTTPPARSE_DONE;
+		goto done;
+	}
+
+needMore:
+	status = HTTPPARSE_NEED_MORE;
+done:
+	dec->offset += i;
+	*consumed = i;
+	return status;
+error:
+	dec->error = EINVAL;
+failed:
+	dec->state = HTTPCHUNK_ERROR;
+	errno = dec->error;
+	return HTTPPARSE_ERROR;
+}
+
+/**
+ * Adds copy of trailer @field to @*trailers, they are allocated by the first call.
+ *
+ * @Returns 0 on success, -1 + errno otherwise.
+ */
+static int addHTTPTrailer(struct HTTPHeaders **trailers, struct HTTPHeaderView *field)
+{
+	if (*trailers == NULL) {
+		*trailers = malloc(sizeof(struct HTTPHeaders));
+		if (*trailers == NULL) return -1;
+
+		createHTTPHeaderVector(*trailers);
+	}
+
+	// Header is contiguous key value line, as built by buildHTTPHeader().
+	struct HTTPHeader header;
+	header.key = malloc(field->key.len + field->value.len + 2);
+	if (header.key == NULL) return -1;
+
+	memcpy(header.key, field->key.ptr, field->key.len);
+	header.key[field->key.len] = '\0';
+
+	header.value = header.key + field->key.len + 1;
+	memcpy(header.value, field->value.ptr, field->value.len);
+	header.value[field->value.len] = '\0';
+
+	if (addHTTPHeader_p(*trailers, &header)) {
+		destroyHTTPHeader(&header);
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * Decodes up to @n bytes of chunked body from @io, blocks until some data is received.
+ *
+ * @Returns count of decoded bytes, 0 at the end of body, -1 + errno on error.
+ */
+static ssize_t readChunkedBody(struct connIO *io, struct httpChunkedDecoder *dec, char *buf, size_t n,
+	struct HTTPHeaders **trailers)
+{
+	size_t readc = 0;
+
+	while (readc < n && dec->state != HTTPCHUNK_DONE) {
+		size_t avail, consumed;
+		const char *data = connIOPeek(io, &avail);
+
+		struct HTTPHeaderView out;
+		int status = httpChunkedFeed(dec, data, avail, n - readc, &consumed, &out);
+		// Data decoded before the failure is returned, the decoder keeps the error for the next call.
+		// Body beyond the limit is reported by the caller.
+		if (status == HTTPPARSE_ERROR) {
+			if (readc != 0) break;
+			if (errno != EFBIG) printf("Invalid chunked body\n");
+			return -1;
+		}
+
+		if (status == HTTPPARSE_DATA) {
+			memcpy(buf + readc, out.value.ptr, out.value.len);
+			readc += out.value.len;
+		} else if (status == HTTPPARSE_TRAILER && addHTTPTrailer(trailers, &out)) {
+			return -1;
+		}
+
+		connIOConsume(io, consumed);
+		connProgress(consumed);
+
+		if (status != HTTPPARSE_NEED_MORE) continue;
+
+		// Data received so far is returned without waiting for the rest.
+		if (readc != 0) break;
+
+		// Incomplete line fills the buffer: trailer lines are bounded by HTTP_MAX_HEAD_SIZE.
+		if (io->rlen == io->rcap && connIOReserve(io, io->rcap * 2))
+			return -1;
+
+		ssize_t rd = connIOFill(io);
+		if (rd == -1) return -1;
+		if (rd == 0) {
+			printf("Chunked body is truncated\n");
+			errno = EPIPE;
+			return -1;
+		}
+	}
+
+	return readc;
+}
+
+/**
+ * Decodes chunked body from @buf into @body after its @*bodyc decoded bytes. @body may point into @buf
+ * before the encoded bytes, the data is moved then. Resumes decoding with state of @dec.
+ *
+ * @consumed Count of bytes of @buf decoded.
+ *
+ * @Returns HTTPPARSE_DONE, HTTPPARSE_NEED_MORE or HTTPPARSE_ERROR + errno. Trailer fields are skipped.
+ */
+static int decodeChunkedBuffer(struct httpChunkedDecoder *dec, const char *buf, size_t len,
+	char *body, size_t *bodyc, size_t *consumed)
+{
+	size_t i = 0;
+
+	while (1) {
+		size_t n;
+		struct HTTPHeaderView out;
+		int status = httpChunkedFeed(dec, buf + i, len - i, SIZE_MAX, &n, &out);
+		if (status == HTTPPARSE_ERROR) return status;
+
+		i += n;
+
+		if (status == HTTPPARSE_DATA) {
+			memmove(body + *bodyc, out.value.ptr, out.value.len);
+			*bodyc += out.value.len;
+		} else if (status != HTTPPARSE_TRAILER) {
+			*consumed = i;
+			return status;
+		}
+	}
+}
+
+/**
+ * Copies fields of trailer section @buf of decoded chunked body to @*trailers.
+ *
+ * @Returns 0 on success, -1 + errno otherwise.
+ */
+static int collectHTTPTrailers(const char *buf, size_t len, struct HTTPHeaders **trailers)
+{
+	struct httpChunkedDecoder dec;
+	initHTTPChunkedDecoder(&dec);
+	dec.state = HTTPCHUNK_TRAILER;
+
+	for (size_t i = 0; i < len;) {
+		size_t n;
+		struct HTTPHeaderView out;
+		if (httpChunkedFeed(&dec, buf + i, len - i, 0, &n, &out) != HTTPPARSE_TRAILER) break;
+
+		if (addHTTPTrailer(trailers, &out)) return -1;
+		i += n;
+	}
+
+	return 0;
+}
+
+/**
+ * Parses value of Content-Length header.
+ *
+ * @Returns 0 on success, -1 if value is not a number or is too large.
+ */
+static int parseContentLength(const char *v, size_t len, size_t *res)
+{
+	if (len == 0) return -1;
+
+	size_t contentSZ = 0;
+	for (size_t i = 0; i < len; i++) {
+		if (v[i] < '0' || v[i] > '9') return -1;
+		if (contentSZ > (SSIZE_MAX - HTTP_MAX_HEAD_SIZE) / 10) return -1;
+
+		contentSZ = contentSZ * 10 + (v[i] - '0');
+	}
+
+	*res = contentSZ;
+	return 0;
+}
+
+/**
+ * Checks Content-Length @header against the one already in @headers: repeated Content-Length is accepted
+ * only with the same value (RFC 9112, section 6.3).
+ *
+ * @Returns 1 if @header conflicts with @headers, 0 otherwise.
+ */
+static int conflictingContentLength(struct HTTPHeaders *headers, struct HTTPHeader *header)
+{
+	if (strcasecmp(header->key, "Content-Length")) return 0;
+
+	char *prev = getHTTPHeader_p(headers, "Content-Length");
+	if (prev == NULL) return 0;
+
+	size_t first, length;
+	if (parseContentLength(prev, strlen(prev), &first) || parseContentLength(header->value, strlen(header->value), &length))
+		return 1;
+
+	return first != length;
 }
 
-#define HTTPHEAD_PROCESSING 0
-#define HTTPHEADERS_PROCESSING 1
-#define HTTPBODY_PROCESSING 2
-#define HTTPPROCESSING_END 100
+/**
+ * Size of chunks request body is read by. Blocking reads report progress by whole chunks,
+ * so the chunk should be small compared to the minimum body rate.
+ */
+#define HTTP_BODY_CHUNK 1024
 
-int parseHTTPRequest(FILE *stream, struct HTTPRequest *res)
+int parseHTTPRequest(struct connIO *io, struct HTTPRequest *res)
 {
 	memset(res, 0, sizeof(struct HTTPRequest));
+	res->bodyfd = -1;
 
 	struct HTTPHead head;
-	struct vector_p headers;
+	struct HTTPHeaders headers;
+	struct HTTPHeaders *trailers = NULL;
 	char *body;
 	size_t bodyc;
 
@@ -258,12 +783,13 @@ int parseHTTPRequest(FILE *stream, struct HTTPRequest *res)
 	size_t nlineLen = 0;
 
 	int processing_state = HTTPHEAD_PROCESSING;  
-	while(getline(&line, &nlineLen, stream) != -1) {
+	while(connIOGetLine(io, &line, &nlineLen) != -1) {
 		if (processing_state == HTTPHEAD_PROCESSING) {
 			if (parseHTTPHead(line, &head)) {
 				printf("Unable to parse head\n");
 				goto error;
 			} else {
+				connSetPhase(CONN_PHASE_HEAD);
 				processing_state++;
 			}
 		} else if (processing_state == HTTPHEADERS_PROCESSING) {
@@ -274,13 +800,19 @@ int parseHTTPRequest(FILE *stream, struct HTTPRequest *res)
 			} else if (parseHTTPHeader(line, &header)) {
 				printf("Unable to parse header string: %s", line);
 				goto error;
-			} else {
-				addHTTPHeader_p(&headers, &header);
+			} else if (conflictingContentLength(&headers, &header)) {
+				destroyHTTPHeader(&header);
+				printf("Conflicting Content-Length\n");
+				goto error;
+			} else if (addHTTPHeader_p(&headers, &header)) {
+				destroyHTTPHeader(&header);
+				printf("Too many headers\n");
+				goto error;
 			}
 		} 
 	}
 
-	if (feof(stream) && processing_state == HTTPHEAD_PROCESSING) {
+	if (io->eof && processing_state == HTTPHEAD_PROCESSING) {
 		free(line);
 		destroyHTTPHeaderVector(&headers);
 		return HTTPREQ_EOF;
@@ -291,30 +823,82 @@ int parseHTTPRequest(FILE *stream, struct HTTPRequest *res)
 keepProcess:
 	bodyc = 0;
 
+	char *transferEncoding = getHTTPHeader_p(&headers, "Transfer-Encoding");
+	if (transferEncoding != NULL) {
+		if (strcasecmp(transferEncoding, "chunked") || getHTTPHeader_p(&headers, "Content-Length") != NULL) {
+			printf("Unsupported Transfer-Encoding\n");
+			goto error;
+		}
+
+		connSetPhase(CONN_PHASE_BODY);
+
+		struct httpChunkedDecoder dec;
+		initHTTPChunkedDecoder(&dec);
+		// Decoded body is kept in memory, so it is bounded by the memory limit.
+		if (dec.limit > HTTP_BODY_MEMORY_LIMIT) dec.limit = HTTP_BODY_MEMORY_LIMIT;
+
+		size_t cap = HTTP_BODY_CHUNK;
+		body = malloc(cap + 1);
+		if (body == NULL) goto error;
+
+		ssize_t rd;
+		while ((rd = readChunkedBody(io, &dec, body + bodyc, cap - bodyc, &trailers)) > 0) {
+			bodyc += rd;
+			if (bodyc < cap) continue;
+
+			char *grown = realloc(body, cap * 2 + 1);
+			if (grown == NULL) break;
+
+			body = grown;
+			cap *= 2;
+		}
+
+		if (rd != 0) {
+			free(body);
+			if (errno == EFBIG) goto tooLarge;
+			goto error;
+		}
+
+		body[bodyc] = '\0';
+		res->chunked = 1;
+		goto processed;
+	}
+
 	char *contentSizeH = getHTTPHeader_p(&headers, "Content-Length");
 	if (contentSizeH == NULL) goto processBody;
 
-	char *end;
-	long contentSZ = strtoll(contentSizeH, &end, 10);
-
-	if (end - contentSizeH != strlen(contentSizeH))
+	if (parseContentLength(contentSizeH, strlen(contentSizeH), &bodyc)) {
+		printf("Invalid Content-Length\n");
 		goto error;
+	}
 
-	bodyc = contentSZ;
+	// Body is allocated before it is received, so its size is bounded by the memory limit.
+	if (bodyc > HTTP_MAX_BODY_SIZE || bodyc > HTTP_BODY_MEMORY_LIMIT) goto tooLarge;
 
 processBody:
 	if (bodyc != 0) {
 		body = malloc(sizeof(char) * (bodyc + 1));
 		if (body == NULL) goto error;
 
-		if (fread(body, sizeof(char), bodyc, stream) != bodyc) {
-			free(body);
-			printf("Unable to read %zu bytes of data\n", bodyc);
-			goto error;
+		connSetPhase(CONN_PHASE_BODY);
+
+		// Body is read by chunks, so the transfer rate can be tracked.
+		for (size_t readc = 0; readc < bodyc;) {
+			size_t chunk = bodyc - readc < HTTP_BODY_CHUNK ? bodyc - readc : HTTP_BODY_CHUNK;
+
+			if (connIORead(io, body + readc, chunk) != chunk) {
+				free(body);
+				printf("Unable to read %zu bytes of data\n", bodyc);
+				goto error;
+			}
+
+			readc += chunk;
+			connProgress(chunk);
 		}
 		body[bodyc] = '\0';
 	} else body = NULL;
 
+processed:
 	processing_state = HTTPPROCESSING_END;
 
 	res->method = head.method;
@@ -323,141 +907,1589 @@ processBody:
 	res->headers = headers;
 	res->body = body;
 	res->bodyc = bodyc;
+	res->trailers = trailers;
 
 	free(line);
 	return HTTPREQ_SUCCESS;
 
+tooLarge:
+	res->httpver = head.httpver;
+	destroyHTTPHead(&head);
+	free(line);
+	destroyHTTPHeaderVector(&headers);
+	if (trailers != NULL) {
+		destroyHTTPHeaderVector(trailers);
+		free(trailers);
+	}
+	return HTTPREQ_TOO_LARGE;
+
 error:
+	// Head is allocated once it is parsed.
+	if (processing_state != HTTPHEAD_PROCESSING) destroyHTTPHead(&head);
 	free(line);
 	destroyHTTPHeaderVector(&headers);
+	if (trailers != NULL) {
+		destroyHTTPHeaderVector(trailers);
+		free(trailers);
+	}
 	return HTTPREQ_FAILED;
 }
 
-void destroyHTTPRequest(struct HTTPRequest *req)
+void initHTTPParser(struct httpParser *parser)
 {
-	for (size_t i = 0; i < req->headers.size; i++) {
-		struct HTTPHeader header;
-		vectorCopyEl_p(&req->headers, i, (char *)&header);
-
-		destroyHTTPHeader(&header);
-	}
-	free(req->body);
-	vectorDestroy_p(&req->headers);
-	free(req->path);
+	parser->state = HTTPHEAD_PROCESSING;
+	parser->step = HEADPROCESS_METHOD;
+	parser->parsed = 0;
+	parser->token = 0;
+	parser->headersc = 0;
+	parser->headlen = 0;
+	parser->bodyc = 0;
+	parser->chunked = 0;
 }
 
-int initHTTPResponse(struct HTTPResponse *response, int httpver) {
-	memset(response, 0, sizeof(struct HTTPResponse));
+/**
+ * Checks line break at @*i, where the scanner stopped.
+ *
+ * @le End of the line content.
+ *
+ * @Returns 1 and moves @*i past the line break, 0 if line break is not received completely, -1 if byte is not a line break.
+ */
+static int httpLineBreak(const char *buf, size_t len, size_t *i, size_t *le)
+{
+	*le = *i;
 
-	if (createHTTPHeaderVector(&response->headers))
-		return -1;
+	if (buf[*i] == '\n') {
+		*i += 1;
+		return 1;
+	}
 
-	response->httpver = httpver;
-	response->bodyc = 0;
-	response->body = NULL;
+	if (buf[*i] != '\r') return -1;
+	if (*i + 1 == len) return 0;
+	if (buf[*i + 1] != '\n') return -1;
 
-	return 0;
-}
-void destroyHTTPResponse(struct HTTPResponse *response) {
-	destroyHTTPHeaderVector(&response->headers);
+	*i += 2;
+	return 1;
 }
 
-int writeHTTPResponse(struct HTTPResponse *response, FILE *stream) 
+int httpParserFeed(struct httpParser *parser, const char *buf, size_t len, size_t *consumed)
 {
-	const char *httpvs = HTTPVersionToString(response->httpver);
-	if (httpvs == NULL) {
-		errno = EINVAL;
-		goto error;
-	}
-	if (response->status == 0) {
-		errno = EINVAL;
-		goto error;
-	}
+	const struct httpScanner *scan = httpScanner();
+
+	size_t i = parser->parsed;
+	size_t le;
+
+	// Parsed bytes are dropped from the buffer.
+	if (i > len) goto error;
+
+	while (parser->state == HTTPHEAD_PROCESSING || parser->state == HTTPHEADERS_PROCESSING) {
+		if (i == len) goto needMore;
+
+		int lb;
+		if (parser->state == HTTPHEAD_PROCESSING) switch (parser->step) {
+		case HEADPROCESS_METHOD:
+			i += scan->token(buf + i, len - i);
+			if (i == len) goto needMore;
+			if (buf[i] != ' ' || i == parser->token) goto error;
+
+			parser->methodOff = parser->token;
+			parser->methodLen = i - parser->token;
+			parser->method = httpMethodId(buf + parser->methodOff, parser->methodLen);
+			if (parser->method == HTTPM_FAILED) goto error;
+
+			parser->token = ++i;
+			parser->step = HEADPROCESS_PATH;
+			break;
+
+		case HEADPROCESS_PATH:
+			i += scan->target(buf + i, len - i);
+			if (i == len) goto needMore;
+			if (buf[i] != ' ' || i == parser->token) goto error;
+
+			parser->pathOff = parser->token;
+			parser->pathLen = i - parser->token;
+
+			parser->token = ++i;
+			parser->step = HEADPROCESS_HTTPV;
+			break;
+
+		case HEADPROCESS_HTTPV:
+			i += scan->value(buf + i, len - i);
+			if (i == len) goto needMore;
+
+			lb = httpLineBreak(buf, len, &i, &le);
+			if (lb == 0) goto needMore;
+			if (lb == -1) goto error;
+
+			parser->httpver = httpVersionId(buf + parser->token, le - parser->token);
+			if (parser->httpver == HTTPV_INVAL) goto error;
+
+			parser->token = i;
+			parser->state = HTTPHEADERS_PROCESSING;
+			parser->step = HEADERPROCESS_NAME;
+			break;
+		} else if (parser->step == HEADERPROCESS_NAME) {
+			// Empty line terminates head.
+			if (i == parser->token && (buf[i] == '\r' || buf[i] == '\n')) {
+				lb = httpLineBreak(buf, len, &i, &le);
+				if (lb == 0) goto needMore;
+				if (lb == -1) goto error;
+
+				parser->headlen = i;
+				parser->state = HTTPBODY_PROCESSING;
+				break;
+			}
 
-	const char *statusDesc = HttpStatus_reasonPhrase(response->status);
+			i += scan->token(buf + i, len - i);
+			if (i == len) goto needMore;
+			if (buf[i] != ':' || i == parser->token) goto error;
 
-	if (statusDesc != NULL) {
-		fprintf(stream, "%s %d %s\r\n", httpvs, response->status, statusDesc);
-	} else {
-		fprintf(stream, "%s %d\r\n", httpvs, response->status);
+			if (parser->headersc == HTTP_MAX_HEADERS) {
+				printf("Too many headers\n");
+				goto error;
+			}
+
+			struct httpHeaderOffsets *header = &parser->headers[parser->headersc];
+			header->key = parser->token;
+			header->keylen = i - parser->token;
+			header->id = httpHeaderId(buf + header->key, header->keylen);
+
+			parser->token = ++i;
+			parser->step = HEADERPROCESS_VALUE;
+		} else {
+			i += scan->value(buf + i, len - i);
+			if (i == len) goto needMore;
+
+			lb = httpLineBreak(buf, len, &i, &le);
+			if (lb == 0) goto needMore;
+			if (lb == -1) goto error;
+
+			// Optional whitespace around the value is not a part of it.
+			size_t vs = parser->token;
+			while (vs < le && (buf[vs] == ' ' || buf[vs] == '\t')) vs++;
+			while (le > vs && (buf[le - 1] == ' ' || buf[le - 1] == '\t')) le--;
+
+			struct httpHeaderOffsets *header = &parser->headers[parser->headersc++];
+			header->value = vs;
+			header->valuelen = le - vs;
+
+			if (header->id == HTTPH_CONTENT_LENGTH) {
+				size_t length;
+				if (parseContentLength(buf + vs, le - vs, &length)) {
+					printf("Invalid Content-Length\n");
+					goto error;
+				}
+
+				// Repeated Content-Length is accepted only with the same value (RFC 9112, section 6.3).
+				for (size_t h = 0; h + 1 < parser->headersc; h++)
+					if (parser->headers[h].id == HTTPH_CONTENT_LENGTH && parser->bodyc != length) {
+						printf("Conflicting Content-Length\n");
+						goto error;
+					}
+
+				parser->bodyc = length;
+			}
+
+			// Other codings leave the body length unknown, they are not supported.
+			if (header->id == HTTPH_TRANSFER_ENCODING) {
+				if (le - vs != 7 || strncasecmp(buf + vs, "chunked", 7)) {
+					printf("Unsupported Transfer-Encoding\n");
+					goto error;
+				}
+
+				parser->chunked = 1;
+			}
+
+			parser->token = i;
+			parser->step = HEADERPROCESS_NAME;
+		}
 	}
 
-	// https://www.w3.org/Protocols/HTTP/1.0/draft-ietf-http-spec.html#BodyLength
-	char bodycs[24];
-	sprintf(bodycs, "%zu", response->bodyc);
-	addKVHTTPHeader_p(&response->headers, "Content-Length", bodycs);
+	if (parser->headlen > HTTP_MAX_HEAD_SIZE) goto error;
 
-	for (size_t i = 0; i < response->headers.size; i++) {
-		struct HTTPHeader header;
-		vectorCopyEl_p(&response->headers, i, (char *)&header);
-		fprintf(stream, "%s: %s\r\n", header.key, header.value);
+	if (parser->chunked) {
+		// Content-Length along with chunked coding is a request smuggling attempt.
+		for (size_t h = 0; h < parser->headersc; h++)
+			if (parser->headers[h].id == HTTPH_CONTENT_LENGTH) {
+				printf("Content-Length of chunked request\n");
+				goto error;
+			}
+
+		parser->bodyc = 0;
 	}
-	fprintf(stream, "\r\n");
 
-	if (response->bodyc != 0) 
-		if (fwrite(response->body, sizeof(char), response->bodyc, stream) < response->bodyc)
-			goto error;
+	// Body is not scanned, only its size is checked.
+	if (len - parser->headlen < parser->bodyc) {
+		parser->parsed = len;
+		*consumed = len;
+		return HTTPPARSE_NEED_MORE;
+	}
 
-	fflush(stream);
+	parser->state = HTTPPROCESSING_END;
+	parser->parsed = parser->headlen + parser->bodyc;
+	*consumed = parser->parsed;
+	return HTTPPARSE_DONE;
 
-	return 0;
+needMore:
+	if (i > HTTP_MAX_HEAD_SIZE) goto error;
 
+	parser->parsed = i;
+	*consumed = i;
+	return HTTPPARSE_NEED_MORE;
 error:
-	return -1;
+	errno = EINVAL;
+	return HTTPPARSE_ERROR;
 }
 
+void httpParserRequest(struct httpParser *parser, const char *buf, struct HTTPRequest *req)
+{
+	memset(req, 0, sizeof(struct HTTPRequest));
+	req->views = 1;
+	req->bodyfd = -1;
+
+	req->method = parser->method;
+	req->httpver = parser->httpver;
+	req->methodv = (struct httpSlice){ .ptr = buf + parser->methodOff, .len = parser->methodLen };
+	req->pathv = (struct httpSlice){ .ptr = buf + parser->pathOff, .len = parser->pathLen };
+
+	for (size_t i = 0; i < parser->headersc; i++) {
+		struct httpHeaderOffsets *header = &parser->headers[i];
+		req->headerv[i].key = (struct httpSlice){ .ptr = buf + header->key, .len = header->keylen };
+		req->headerv[i].value = (struct httpSlice){ .ptr = buf + header->value, .len = header->valuelen };
+
+		// Parser holds at most HTTP_MAX_HEADERS headers, so the index has room for them. The last header wins.
+		headerIndexSetId(&req->headers.index, header->id, buf + header->key, header->keylen, i);
+	}
+	req->headervc = parser->headersc;
+	req->chunked = parser->chunked;
 
+	if (parser->state == HTTPPROCESSING_END) {
+		req->bodyc = parser->bodyc;
+		req->body = parser->bodyc != 0 ? (char *)buf + parser->headlen : NULL;
+	}
+}
 
-#define HTTPHEAD_PROCESSING 0
-#define HTTPHEADERS_PROCESSING 1
-#define HTTPBODY_PROCESSING 2
-#define HTTPPROCESSING_END 100
-
-void httpConnetionHandler(FILE *stream, void *rawargs)
+ssize_t httpRequestLength(const char *buf, size_t len)
 {
-	struct HTTPConnectionHandlerArgs *args = rawargs;
+	struct httpParser parser;
+	initHTTPParser(&parser);
+
+	size_t reqlen;
+	int status = httpParserFeed(&parser, buf, len, &reqlen);
+	if (status == HTTPPARSE_ERROR) return -1;
+	if (status == HTTPPARSE_NEED_MORE) return 0;
+	if (!parser.chunked) return reqlen;
+
+	// Chunked body is scanned by the decoder to find its end.
+	struct httpChunkedDecoder dec;
+	initHTTPChunkedDecoder(&dec);
+
+	while (1) {
+		size_t consumed;
+		struct HTTPHeaderView out;
+		status = httpChunkedFeed(&dec, buf + reqlen, len - reqlen, SIZE_MAX, &consumed, &out);
+		reqlen += consumed;
+
+		if (status == HTTPPARSE_ERROR) return -1;
+		if (status == HTTPPARSE_NEED_MORE) return 0;
+		if (status == HTTPPARSE_DONE) return reqlen;
+	}
+}
 
-	while (!feof(stream)) {
-		struct HTTPRequest req;
-		int status = parseHTTPRequest(stream, &req);
+int parseHTTPRequestBuffer(const char *buf, size_t headlen, size_t len, struct HTTPRequest *res)
+{
+	struct httpParser parser;
+	initHTTPParser(&parser);
 
-		if (status == HTTPREQ_FAILED) {
-			destroyHTTPRequest(&req);
+	size_t consumed;
+	int status = httpParserFeed(&parser, buf, headlen, &consumed);
 
-			printf("Cannot parse request\n");
-			goto closeHandler;
-	
-		} else if (status == HTTPREQ_EOF) {
-			destroyHTTPRequest(&req);
-			goto closeHandler;
-		}
+	memset(res, 0, sizeof(struct HTTPRequest));
+	res->views = 1;
+	res->bodyfd = -1;
 
-		struct HTTPResponse resp;
+	if (status == HTTPPARSE_ERROR || parser.state < HTTPBODY_PROCESSING || parser.headlen != headlen) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	httpParserRequest(&parser, buf, res);
+
+	if (!res->chunked) {
+		res->bodyc = len - headlen;
+		res->body = res->bodyc != 0 ? (char *)buf + headlen : NULL;
+		return 0;
+	}
+
+	// Decoded body is copied, the buffer is not modified.
+	res->storage = malloc(len - headlen + 1);
+	if (res->storage == NULL) return -1;
+
+	struct httpChunkedDecoder dec;
+	initHTTPChunkedDecoder(&dec);
+
+	status = decodeChunkedBuffer(&dec, buf + headlen, len - headlen, res->storage, &res->bodyc, &consumed);
+	if (status != HTTPPARSE_DONE || consumed != len - headlen) {
+		destroyHTTPRequest(res);
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (collectHTTPTrailers(buf + headlen + dec.trailerOff, consumed - dec.trailerOff, &res->trailers)) {
+		destroyHTTPRequest(res);
+		return -1;
+	}
+
+	res->storage[res->bodyc] = '\0';
+	res->body = res->bodyc != 0 ? res->storage : NULL;
+
+	return 0;
+}
+
+const char *getHTTPRequestHeader(struct HTTPRequest *req, const char *key, size_t *len)
+{
+	if (!req->views) {
+		const char *value = getHTTPHeader_p(&req->headers, key);
+		if (value != NULL && len != NULL) *len = strlen(value);
+
+		return value;
+	}
+
+	ssize_t i = httpHeaderIndexFind(&req->headers.index, key, strlen(key));
+	if (i == -1) return NULL;
+
+	if (len != NULL) *len = req->headerv[i].value.len;
+	return req->headerv[i].value.ptr;
+}
+
+/**
+ * Moves request views from buffer @from to its copy @to.
+ */
+static void rebaseHTTPRequestViews(struct HTTPRequest *req, const char *from, char *to)
+{
+	req->methodv.ptr = to + (req->methodv.ptr - from);
+	req->pathv.ptr = to + (req->pathv.ptr - from);
+
+	for (size_t i = 0; i < req->headervc; i++) {
+		req->headerv[i].key.ptr = to + (req->headerv[i].key.ptr - from);
+		req->headerv[i].value.ptr = to + (req->headerv[i].value.ptr - from);
+	}
+
+	struct httpHeaderIndex *index = &req->headers.index;
+	for (size_t i = 0; i < index->entriesc; i++)
+		index->entries[i].key = to + (index->entries[i].key - from);
+}
+
+static const struct HTTPBodyLimits defaultBodyLimits = {
+	.memory = HTTP_BODY_MEMORY_LIMIT,
+	.max = HTTP_MAX_BODY_SIZE,
+};
+
+/**
+ * @Returns body limits of handler @args, defaults are taken for zero fields.
+ */
+static struct HTTPBodyLimits httpBodyLimits(struct HTTPConnectionHandlerArgs *args)
+{
+	struct HTTPBodyLimits limits = args->bodyLimits;
+	if (limits.memory == 0) limits.memory = defaultBodyLimits.memory;
+	if (limits.max == 0) limits.max = defaultBodyLimits.max;
+
+	return limits;
+}
+
+size_t httpInputLimit(struct HTTPConnectionHandlerArgs *args)
+{
+	return HTTP_MAX_HEAD_SIZE * 2 + httpBodyLimits(args).memory + HTTP_MAX_CHUNK_LINE;
+}
+
+/**
+ * Same as parseHTTPRequestView() with body @limits. If @wait is not set, returns HTTPREQ_AGAIN instead of
+ * waiting for input when the request is not received completely.
+ */
+static int readHTTPRequestView(struct connIO *io, struct HTTPRequest *res, int wait, const struct HTTPBodyLimits *limits)
+{
+	// Request is cleared by httpParserRequest(), destroyHTTPRequest() needs only these.
+	res->views = 1;
+	res->io = NULL;
+	res->storage = NULL;
+	res->trailers = NULL;
+	res->bodyfd = -1;
+
+	// Filled bytes are appended contiguously to the head.
+	if (connIOCompact(io)) goto error;
+
+	struct httpParser parser;
+	initHTTPParser(&parser);
+
+	const char *data;
+	size_t avail;
+	int started = 0;
+
+	while (1) {
+		data = connIOPeek(io, &avail);
+
+		if (avail != 0 && !started) {
+			connSetPhase(CONN_PHASE_HEAD);
+			started = 1;
+		}
+
+		size_t consumed;
+		if (httpParserFeed(&parser, data, avail, &consumed) == HTTPPARSE_ERROR) {
+			printf("Invalid request head\n");
+			goto error;
+		}
+
+		// Body is read below: it may not fit the buffer.
+		if (parser.state >= HTTPBODY_PROCESSING) break;
+
+		if (!wait) return HTTPREQ_AGAIN;
+
+		// Head is bounded by HTTP_MAX_HEAD_SIZE, so the buffer grows only for the large ones.
+		if (avail == io->rcap && connIOReserve(io, io->rcap * 2))
+			goto error;
+
+		ssize_t rd = connIOFill(io);
+		if (rd == -1) goto error;
+		if (rd == 0) {
+			if (avail == 0) return HTTPREQ_EOF;
+
+			printf("Request processing failed\n");
+			goto error;
+		}
+	}
+
+	size_t headlen = parser.headlen;
+	size_t bodyc = parser.bodyc;
+	int streamed = parser.chunked || bodyc > limits->memory || bodyc > limits->max;
+
+	if (!wait && !streamed && avail < headlen + bodyc) return HTTPREQ_AGAIN;
+
+	httpParserRequest(&parser, data, res);
+
+	if (bodyc > limits->max) return HTTPREQ_TOO_LARGE;
+
+	if (streamed) {
+		// Body is read while the request is processed: head is copied, so the read buffer holds only the body.
+		res->storage = malloc(headlen);
+		if (res->storage == NULL) goto error;
+
+		memcpy(res->storage, data, headlen);
+		rebaseHTTPRequestViews(res, data, res->storage);
+		connIOConsume(io, headlen);
+
+		initHTTPChunkedDecoder(&res->decoder);
+		res->decoder.limit = limits->max;
+		res->bodyio = io;
+		res->body = NULL;
+		res->bodyc = bodyc;
+
+		return HTTPREQ_SUCCESS;
+	}
+
+	if (bodyc != 0) connSetPhase(CONN_PHASE_BODY);
+
+	if (headlen + bodyc <= io->rcap) {
+		connProgress(avail - headlen < bodyc ? avail - headlen : bodyc);
+
+		while (io->rlen < headlen + bodyc) {
+			ssize_t rd = connIOFill(io);
+			if (rd <= 0) {
+				printf("Unable to read %zu bytes of data\n", bodyc);
+				goto error;
+			}
+
+			connProgress(rd);
+		}
+
+		res->body = bodyc != 0 ? (char *)data + headlen : NULL;
+		res->io = io;
+		res->held = headlen + bodyc;
+	} else {
+		// Body does not fit the read buffer: the request is copied.
+		res->storage = malloc(headlen + bodyc + 1);
+		if (res->storage == NULL) goto error;
+
+		memcpy(res->storage, data, headlen);
+		rebaseHTTPRequestViews(res, data, res->storage);
+		connIOConsume(io, headlen);
+
+		char *body = res->storage + headlen;
+		for (size_t readc = 0; readc < bodyc;) {
+			size_t chunk = bodyc - readc < HTTP_BODY_CHUNK ? bodyc - readc : HTTP_BODY_CHUNK;
+
+			if (connIORead(io, body + readc, chunk) != chunk) {
+				printf("Unable to read %zu bytes of data\n", bodyc);
+				goto error;
+			}
+
+			readc += chunk;
+			connProgress(chunk);
+		}
+
+		body[bodyc] = '\0';
+		res->body = body;
+	}
+
+	res->bodyc = bodyc;
+
+	return HTTPREQ_SUCCESS;
+error:
+	return HTTPREQ_FAILED;
+}
+
+int parseHTTPRequestView(struct connIO *io, struct HTTPRequest *res)
+{
+	return readHTTPRequestView(io, res, 1, &defaultBodyLimits);
+}
+
+/**
+ * Reads up to @n bytes of body from @io, blocks until some data is received.
+ *
+ * @Returns count of read bytes, -1 + errno on error.
+ */
+static ssize_t readSizedBody(struct connIO *io, char *buf, size_t n)
+{
+	size_t avail;
+	const char *data = connIOPeek(io, &avail);
+
+	if (avail == 0) {
+		ssize_t rd = connIOFill(io);
+		if (rd == -1) return -1;
+		if (rd == 0) {
+			printf("Request body is truncated\n");
+			errno = EPIPE;
+			return -1;
+		}
+
+		data = connIOPeek(io, &avail);
+	}
+
+	if (n > avail) n = avail;
+
+	memcpy(buf, data, n);
+	connIOConsume(io, n);
+	connProgress(n);
+
+	return n;
+}
+
+ssize_t readHTTPRequestBody(struct HTTPRequest *req, char *buf, size_t n)
+{
+	size_t left = req->bodyc - req->bodyRead;
+
+	if (req->bodyio != NULL) {
+		ssize_t rd;
+		if (req->chunked) rd = readChunkedBody(req->bodyio, &req->decoder, buf, n, &req->trailers);
+		else rd = left != 0 && n != 0 ? readSizedBody(req->bodyio, buf, n < left ? n : left) : 0;
+
+		if (rd > 0) req->bodyRead += rd;
+		return rd;
+	}
+
+	if (n > left) n = left;
+	if (n == 0) return 0;
+
+	if (req->bodyfd != -1) {
+		ssize_t rd = pread(req->bodyfd, buf, n, req->bodyRead);
+		if (rd > 0) req->bodyRead += rd;
+
+		return rd;
+	}
+
+	memcpy(buf, req->body + req->bodyRead, n);
+	req->bodyRead += n;
+
+	return n;
+}
+
+int discardHTTPRequestBody(struct HTTPRequest *req)
+{
+	char buf[HTTP_BODY_CHUNK];
+
+	ssize_t rd;
+	while ((rd = readHTTPRequestBody(req, buf, sizeof(buf))) > 0);
+
+	return rd == -1 ? -1 : 0;
+}
+
+const char *getHTTPRequestTrailer(struct HTTPRequest *req, const char *key)
+{
+	if (req->trailers == NULL) return NULL;
+
+	return getHTTPHeader_p(req->trailers, key);
+}
+
+void destroyHTTPRequest(struct HTTPRequest *req)
+{
+	if (req->bodyfd != -1) {
+		close(req->bodyfd);
+		req->bodyfd = -1;
+	}
+
+	if (req->trailers != NULL) {
+		destroyHTTPHeaderVector(req->trailers);
+		free(req->trailers);
+		req->trailers = NULL;
+	}
+
+	if (req->views) {
+		if (req->io != NULL) connIOConsume(req->io, req->held);
+		free(req->storage);
+
+		req->io = NULL;
+		req->storage = NULL;
+		return;
+	}
+
+	destroyHTTPHeaderVector(&req->headers);
+	free(req->body);
+	free(req->path);
+}
+
+int initHTTPResponse(struct HTTPResponse *response, int httpver) {
+	memset(response, 0, sizeof(struct HTTPResponse));
+
+	if (createHTTPHeaderVector(&response->headers))
+		return -1;
+
+	response->httpver = httpver;
+	response->bodyc = 0;
+	response->body = NULL;
+	response->bodyType = HTTP_BODY_BUFFER;
+
+	return 0;
+}
+
+/**
+ * Releases the body source and sets the new one.
+ */
+static void setHTTPResponseSource(struct HTTPResponse *response, int type, void (*release)(void *ctx), void *ctx)
+{
+	if (response->bodyRelease != NULL) response->bodyRelease(response->bodyCtx);
+
+	response->bodyType = type;
+	response->bodyRelease = release;
+	response->bodyCtx = ctx;
+}
+
+void destroyHTTPResponse(struct HTTPResponse *response) {
+	destroyHTTPHeaderVector(&response->headers);
+
+	setHTTPResponseSource(response, HTTP_BODY_BUFFER, NULL, NULL);
+}
+
+void setHTTPResponseProducer(struct HTTPResponse *response, httpBodyProducer_t producer, void *ctx,
+	void (*freeCtx)(void *ctx))
+{
+	setHTTPResponseSource(response, HTTP_BODY_PRODUCER, freeCtx, ctx);
+	response->source.producer = producer;
+}
+
+void setHTTPResponseFile(struct HTTPResponse *response, int fd, off_t offset, size_t len,
+	void (*release)(void *ctx), void *ctx)
+{
+	setHTTPResponseSource(response, HTTP_BODY_FILE, release, ctx);
+	response->source.file.fd = fd;
+	response->source.file.offset = offset;
+	response->bodyc = len;
+}
+
+void setHTTPResponseIovec(struct HTTPResponse *response, const struct iovec *iov, int iovc,
+	void (*release)(void *ctx), void *ctx)
+{
+	setHTTPResponseSource(response, HTTP_BODY_IOVEC, release, ctx);
+	response->source.iov.iov = iov;
+	response->source.iov.iovc = iovc;
+
+	response->bodyc = 0;
+	for (int i = 0; i < iovc; i++)
+		response->bodyc += iov[i].iov_len;
+}
+
+/**
+ * Serialized response head. Bytes that do not fit @cap are only counted.
+ */
+struct headWriter {
+	char *buf;
+	size_t cap;
+	size_t len;
+};
+
+static void headPut(struct headWriter *w, const char *s, size_t n)
+{
+	if (w->len + n <= w->cap) memcpy(w->buf + w->len, s, n);
+	w->len += n;
+}
+
+/**
+ * Writes decimal @n without printf(3).
+ */
+static void headPutSize(struct headWriter *w, size_t n)
+{
+	char digits[20];
+	size_t len = sizeof(digits);
+
+	do {
+		digits[--len] = '0' + n % 10;
+		n /= 10;
+	} while (n != 0);
+
+	headPut(w, digits + len, sizeof(digits) - len);
+}
+
+/**
+ * Writes length of the body. Streamed body has chunked coding, it is delimited by connection close for HTTP/1.0.
+ */
+static void headPutBodyLength(struct headWriter *w, struct HTTPResponse *response)
+{
+	if (response->bodyType == HTTP_BODY_PRODUCER) {
+		if (response->httpver == HTTPV_11) headPut(w, "Transfer-Encoding: chunked\r\n", 28);
+		return;
+	}
+
+	headPut(w, "Content-Length: ", 16);
+	headPutSize(w, response->bodyc);
+	headPut(w, "\r\n", 2);
+}
+
+ssize_t renderHTTPResponseHead(struct HTTPResponse *response, char *buf, size_t cap)
+{
+	const char *httpvs = HTTPVersionToString(response->httpver);
+	if (httpvs == NULL || response->status < 100 || response->status > 999) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	struct headWriter w = { .buf = buf, .cap = cap, .len = 0 };
+
+	size_t statuslen;
+	const char *statusLine = httpStatusLine(response->httpver, response->status, &statuslen);
+
+	if (statusLine != NULL) {
+		headPut(&w, statusLine, statuslen);
+	} else {
+		headPut(&w, httpvs, 8);
+		headPut(&w, " ", 1);
+		headPutSize(&w, response->status);
+		headPut(&w, "\r\n", 2);
+	}
+
+	// https://www.w3.org/Protocols/HTTP/1.0/draft-ietf-http-spec.html#BodyLength
+	// Content-Length set by the processor is replaced by the actual body size.
+	ssize_t clpos = httpHeaderIndexFind(&response->headers.index, "Content-Length", 14);
+
+	for (size_t i = 0; i < response->headers.vec.size; i++) {
+		// Vector is local: headers are read in place.
+		struct HTTPHeader *header = (struct HTTPHeader *)vectorElPtr_p(&response->headers.vec, i);
+
+		if (i == clpos) {
+			headPutBodyLength(&w, response);
+			continue;
+		}
+
+		// Deleted header.
+		if (header->value == NULL) continue;
+
+		headPut(&w, header->key, strlen(header->key));
+		headPut(&w, ": ", 2);
+		headPut(&w, header->value, strlen(header->value));
+		headPut(&w, "\r\n", 2);
+	}
+
+	if (response->rawHeaders != NULL) headPut(&w, response->rawHeaders, response->rawHeadersc);
+
+	if (clpos == -1) headPutBodyLength(&w, response);
+
+	headPut(&w, "\r\n", 2);
+
+	return w.len;
+}
+
+/**
+ * Serializes response head in place into the output buffer.
+ *
+ * @Returns 0 on success, -1 + errno otherwise.
+ */
+static int bufferHTTPResponseHead(struct HTTPResponse *response, struct connIO *io)
+{
+	ssize_t headlen = renderHTTPResponseHead(response, NULL, 0);
+	if (headlen == -1) return -1;
+
+	char *head = connIOWriteReserve(io, headlen);
+	if (head == NULL) return -1;
+
+	renderHTTPResponseHead(response, head, headlen);
+	connIOWriteCommit(io, headlen);
+
+	return 0;
+}
+
+/**
+ * Chunk of streamed body is framed in place: its size is padded to fixed width, so the size line
+ * is reserved before the data is produced.
+ */
+#define HTTP_CHUNK_HEAD 10
+#define HTTP_STREAM_FRAME (HTTP_CHUNK_HEAD + HTTP_STREAM_CHUNK + 2)
+
+/**
+ * Produces the next part of streamed body into @out of HTTP_STREAM_FRAME bytes.
+ *
+ * @chunked Part is framed as a chunk. The last chunk is written when the body is done.
+ * @done Set when the body is done.
+ *
+ * @Returns size of the part, -1 on producer error.
+ */
+static ssize_t produceHTTPBody(httpBodyProducer_t producer, void *ctx, int chunked, char *out, int *done)
+{
+	char *data = chunked ? out + HTTP_CHUNK_HEAD : out;
+
+	ssize_t n = producer(ctx, data, HTTP_STREAM_CHUNK);
+	if (n < 0 || n > HTTP_STREAM_CHUNK) return -1;
+
+	*done = n == 0;
+	if (!chunked) return n;
+
+	if (n == 0) {
+		memcpy(out, "0\r\n\r\n", 5);
+		return 5;
+	}
+
+	static const char hex[] = "0123456789abcdef";
+	for (int i = 0; i < 8; i++)
+		out[i] = hex[(n >> ((7 - i) * 4)) & 15];
+	out[8] = '\r';
+	out[9] = '\n';
+
+	data[n] = '\r';
+	data[n + 1] = '\n';
+
+	return HTTP_CHUNK_HEAD + n + 2;
+}
+
+/**
+ * Sends response with streamed body. Output is sent by parts of the buffer size, so only a part of the body
+ * is in memory.
+ *
+ * @Returns 0 on success, -1 + errno otherwise.
+ */
+static int streamHTTPResponse(struct HTTPResponse *response, struct connIO *io)
+{
+	if (bufferHTTPResponseHead(response, io))
+		return -1;
+
+	int chunked = response->httpver == HTTPV_11;
+
+	for (int done = 0; !done;) {
+		char *out = connIOWriteReserve(io, HTTP_STREAM_FRAME);
+		if (out == NULL) return -1;
+
+		ssize_t n = produceHTTPBody(response->source.producer, response->bodyCtx, chunked, out, &done);
+		if (n == -1) {
+			printf("Response body producer failed\n");
+			return -1;
+		}
+
+		connIOWriteCommit(io, n);
+
+		if (io->wlen >= CONN_IO_BUFSZ && connIOFlush(io))
+			return -1;
+	}
+
+	return connIOFlush(io);
+}
+
+int writeHTTPResponse(struct HTTPResponse *response, struct connIO *io) 
+{
+	if (response->headOnly) {
+		if (bufferHTTPResponseHead(response, io)) goto error;
+
+		return connIOFlush(io);
+	}
+
+	if (response->bodyType == HTTP_BODY_PRODUCER)
+		return streamHTTPResponse(response, io);
+
+	// Head is sent along with the body (and the output buffered before) by one write.
+	if (bufferHTTPResponseHead(response, io))
+		goto error;
+
+	switch (response->bodyType) {
+	case HTTP_BODY_IOVEC:
+		return connIOSendv(io, response->source.iov.iov, response->source.iov.iovc);
+	case HTTP_BODY_FILE:
+		return connIOSendFile(io, response->source.file.fd, response->source.file.offset, response->bodyc);
+	}
+
+	if (connIOSend(io, response->body, response->bodyc))
+		goto error;
+
+	return 0;
+
+error:
+	return -1;
+}
+
+/**
+ * Buffers the whole response without sending it, see HTTP_PIPELINE_DEPTH.
+ *
+ * @Returns 0 on success, -1 + errno otherwise.
+ */
+static int bufferHTTPResponse(struct HTTPResponse *response, struct connIO *io)
+{
+	if (bufferHTTPResponseHead(response, io))
+		return -1;
+
+	if (response->headOnly) return 0;
+
+	if (response->bodyType != HTTP_BODY_IOVEC)
+		return connIOWrite(io, response->body, response->bodyc);
+
+	for (int i = 0; i < response->source.iov.iovc; i++)
+		if (connIOWrite(io, response->source.iov.iov[i].iov_base, response->source.iov.iov[i].iov_len)) return -1;
+
+	return 0;
+}
+
+/**
+ * Processes @req by the router of handler @args or by its processor.
+ *
+ * @coalesce Request may wait for the identical one in flight, the thread is blocked meanwhile.
+ */
+static void processHTTPRequest(struct HTTPConnectionHandlerArgs *args, struct HTTPRequest *req, struct HTTPResponse *resp,
+	int coalesce)
+{
+	struct httpCacheKey key;
+	if (args->cache != NULL && lookupHTTPCache(args->cache, req, resp, &key)) return;
+
+	struct httpFlight *flight = NULL;
+	if (coalesce && args->flights != NULL && joinHTTPFlight(args->flights, req, resp, &flight)) return;
+
+	if (args->router != NULL) routeHTTPRequest(args->router, req, resp);
+	else args->httpRequestProcessor(req, resp);
+
+	// Response is shared as the processor has made it, before the cache adds ETag or replaces it by 304.
+	if (flight != NULL) landHTTPFlight(args->flights, flight, resp);
+	if (args->cache != NULL) storeHTTPCache(args->cache, &key, req, resp);
+}
+
+/**
+ * Sends response with empty body and @status, the connection is closed after it.
+ *
+ * @Returns 0 on success, -1 + errno otherwise.
+ */
+static int writeHTTPStatus(struct connIO *io, int httpver, int status)
+{
+	struct HTTPResponse resp;
+	if (initHTTPResponse(&resp, httpver)) return -1;
+
+	resp.status = status;
+	addKVHTTPHeader_p(&resp.headers, "Connection", "close");
+
+	int ret = writeHTTPResponse(&resp, io);
+	destroyHTTPResponse(&resp);
+
+	return ret;
+}
+
+void httpConnetionHandler(struct connIO *io, void *rawargs)
+{
+	struct HTTPConnectionHandlerArgs *args = rawargs;
+	struct HTTPBodyLimits limits = httpBodyLimits(args);
+
+	// Count of responses buffered but not sent yet.
+	size_t batched = 0;
+
+	while (!io->eof || io->rlen != 0) {
+		struct HTTPRequest req;
+		// Requests received along with the previous one are processed without waiting for input.
+		int status = readHTTPRequestView(io, &req, batched == 0, &limits);
+
+		if (status == HTTPREQ_AGAIN) {
+			// The rest of pipeline is not received yet: buffered responses are sent by one write.
+			if (connIOFlush(io)) goto closeHandler;
+
+			batched = 0;
+			continue;
+		} else if (status == HTTPREQ_FAILED) {
+			destroyHTTPRequest(&req);
+
+			printf("Cannot parse request\n");
+			goto closeHandler;
+	
+		} else if (status == HTTPREQ_EOF) {
+			destroyHTTPRequest(&req);
+			goto closeHandler;
+		} else if (status == HTTPREQ_TOO_LARGE) {
+			// Body is not received: the connection is closed after the status.
+			printf("Request body is too large\n");
+			writeHTTPStatus(io, req.httpver, HttpStatus_ContentTooLarge);
+			destroyHTTPRequest(&req);
+
+			batched = 0;
+			goto closeHandler;
+		}
+
+		// Streamed body is received while the request is processed, so the body rate is tracked.
+		if (req.bodyio != NULL) {
+			connSetPhase(CONN_PHASE_BODY);
+
+			// Client may wait for the responses before sending the body.
+			if (batched != 0) {
+				batched = 0;
+				if (connIOFlush(io)) {
+					destroyHTTPRequest(&req);
+					goto closeHandler;
+				}
+			}
+		} else connSetPhase(CONN_PHASE_PROCESSING);
+
+		struct HTTPResponse resp;
 		if (initHTTPResponse(&resp, req.httpver)) {
 			destroyHTTPRequest(&req);
 			goto closeHandler;
 		}
 
-		args->httpRequestProcessor(&req, &resp);
+		processHTTPRequest(args, &req, &resp, 1);
+
+		// The next request follows the part of body the processor has not read.
+		if (req.bodyio != NULL && discardHTTPRequestBody(&req)) {
+			// Chunked body has exceeded the limit: the response of processor is replaced.
+			if (errno == EFBIG) {
+				printf("Request body is too large\n");
+				writeHTTPStatus(io, req.httpver, HttpStatus_ContentTooLarge);
+			}
+
+			destroyHTTPRequest(&req);
+			destroyHTTPResponse(&resp);
+			goto closeHandler;
+		}
 		destroyHTTPRequest(&req);
 
-		if (writeHTTPResponse(&resp, stream)) {
+		// Server is closing: the client should not send the next request.
+		int draining = connDraining();
+		if (draining)
+			addKVHTTPHeader_p(&resp.headers, "Connection", "close");
+
+		int keepAlive = !draining && req.httpver == HTTPV_11;
+
+		// The next pipelined request is received already: response is sent along with the following ones.
+		// Large bodies are sent right away instead of being copied to the buffer.
+		if (	keepAlive && io->rlen != 0 && batched + 1 < HTTP_PIPELINE_DEPTH &&
+			resp.bodyType <= HTTP_BODY_IOVEC && resp.bodyc <= CONN_IO_BUFSZ) {
+			status = bufferHTTPResponse(&resp, io);
+			batched++;
+		} else {
+			status = writeHTTPResponse(&resp, io);
+			batched = 0;
+		}
+		destroyHTTPResponse(&resp);
+
+		if (status) {
 			printf("HTTP Response is invalid: %s\n", strerror(errno));
 			goto closeHandler;
 		}
-		destroyHTTPResponse(&resp);
 
-		if (req.httpver == HTTPV_10) break;
-		else if (req.httpver == HTTPV_11) continue;
-		else break;
+		if (!keepAlive) break;
+
+		connSetPhase(CONN_PHASE_IDLE);
+
+		// Worker is not held while the client keeps the connection open without requests.
+		if (io->rlen == 0 && !io->eof && connPark()) return;
 	}
 
 
 closeHandler:
+	// Responses to the requests preceding the failed one.
+	if (batched != 0) connIOFlush(io);
+
 	return; 
 }
 
 
+/**
+ * Request partially received by httpEventHandler(), kept between events.
+ */
+struct httpEventState {
+	struct httpParser parser;
+
+	/**
+	 * Chunked body is decoded in place: @bodyc decoded bytes follow the head,
+	 * encoded bytes from @bodyRead are not decoded yet. @bodyRead is 0 until the head is received.
+	 * Body larger than memory limit is received the same way, @spilled bytes preceding the in-memory ones
+	 * are moved to memory file @bodyfd (-1 until it is created).
+	 */
+	struct httpChunkedDecoder decoder;
+	size_t bodyc;
+	size_t bodyRead;
+	size_t spilled;
+	int bodyfd;
+
+	/**
+	 * Producer of response body being streamed, NULL if there is none. Head of the response is sent already.
+	 * Body is chunked if @chunked is set, otherwise the connection is closed after it. It is also closed if @closing is set.
+	 * File body is sent by sendfile(2) if @sendfile is set, then the producer context is struct httpFileBody.
+	 */
+	httpBodyProducer_t producer;
+	void *producerCtx;
+	void (*producerFree)(void *ctx);
+	int chunked;
+	int closing;
+	int sendfile;
+};
+
+/**
+ * File range of response body sent by the event handler.
+ */
+struct httpFileBody {
+	int fd;
+	off_t offset;
+	size_t left;
+	void *ctx;
+	void (*release)(void *ctx);
+};
+
+static void freeHTTPFileBody(void *ctx)
+{
+	struct httpFileBody *file = ctx;
+
+	if (file->release != NULL) file->release(file->ctx);
+	free(file);
+}
+
+/**
+ * Producer of file body: io_uring loop has no sendfile, the file is read into the output instead.
+ */
+static ssize_t readHTTPFileBody(void *ctx, char *buf, size_t len)
+{
+	struct httpFileBody *file = ctx;
+
+	if (len > file->left) len = file->left;
+	if (len == 0) return 0;
+
+	if (readFileRange(file->fd, buf, len, file->offset)) return -1;
+
+	file->offset += len;
+	file->left -= len;
+
+	return len;
+}
+
+static void freeHTTPEventState(void *rawstate)
+{
+	struct httpEventState *state = rawstate;
+
+	if (state->producerFree != NULL) state->producerFree(state->producerCtx);
+	if (state->bodyfd != -1) close(state->bodyfd);
+
+	free(state);
+}
+
+/**
+ * Moves the in-memory part of body to the memory file, so the input buffer holds at most memory limit of it.
+ *
+ * @Returns 0 on success, -1 + errno otherwise.
+ */
+static int spillHTTPEventBody(struct eventConn *conn, struct httpEventState *state)
+{
+	if (state->bodyfd == -1) {
+		state->bodyfd = memfd_create("chttp-body", MFD_CLOEXEC);
+		if (state->bodyfd == -1) return -1;
+	}
+
+	size_t headlen = state->parser.headlen;
+	for (size_t off = 0; off < state->bodyc;) {
+		ssize_t wr = write(state->bodyfd, conn->rbuf + headlen + off, state->bodyc - off);
+		if (wr == -1) {
+			if (errno == EINTR) continue;
+			return -1;
+		}
+
+		off += wr;
+	}
+
+	eventConnCut(conn, headlen, state->bodyc);
+	state->bodyRead -= state->bodyc;
+	state->spilled += state->bodyc;
+	state->bodyc = 0;
+
+	return 0;
+}
+
+/**
+ * Receives chunked body or body larger than memory limit @memory, see struct httpEventState.
+ *
+ * @Returns HTTPPARSE_DONE when the body is received, HTTPPARSE_NEED_MORE or HTTPPARSE_ERROR + errno.
+ */
+static int receiveHTTPEventBody(struct eventConn *conn, struct httpEventState *state, size_t memory)
+{
+	struct httpParser *parser = &state->parser;
+
+	int status;
+	if (parser->chunked) {
+		size_t consumed;
+		status = decodeChunkedBuffer(&state->decoder, conn->rbuf + state->bodyRead, conn->rlen - state->bodyRead,
+			conn->rbuf + parser->headlen, &state->bodyc, &consumed);
+		if (status == HTTPPARSE_ERROR) return status;
+
+		state->bodyRead += consumed;
+	} else {
+		size_t left = parser->bodyc - state->spilled - state->bodyc;
+		size_t avail = conn->rlen - state->bodyRead;
+		size_t n = avail < left ? avail : left;
+
+		state->bodyc += n;
+		state->bodyRead += n;
+		status = n == left ? HTTPPARSE_DONE : HTTPPARSE_NEED_MORE;
+	}
+
+	if (	(state->bodyfd != -1 || state->bodyc > memory || parser->bodyc > memory) &&
+		spillHTTPEventBody(conn, state))
+		return HTTPPARSE_ERROR;
+
+	return status;
+}
+
+/**
+ * Appends response with empty body and @status to the connection output.
+ *
+ * @Returns CONNEV_CLOSE, the connection is closed after the response. CONNEV_ABORT on failure.
+ */
+static int rejectHTTPEventRequest(struct eventConn *conn, int httpver, int status)
+{
+	struct HTTPResponse resp;
+	if (initHTTPResponse(&resp, httpver)) return CONNEV_ABORT;
+
+	resp.status = status;
+	addKVHTTPHeader_p(&resp.headers, "Connection", "close");
+
+	ssize_t headlen = renderHTTPResponseHead(&resp, NULL, 0);
+	char *out = headlen != -1 ? eventConnAppend(conn, headlen) : NULL;
+	if (out != NULL) renderHTTPResponseHead(&resp, out, headlen);
+
+	destroyHTTPResponse(&resp);
+
+	return out != NULL ? CONNEV_CLOSE : CONNEV_ABORT;
+}
+
+/**
+ * Output produced by one run of the handler, it is sent before the next run.
+ */
+#define HTTP_STREAM_BATCH (HTTP_STREAM_CHUNK * 4)
+
+/**
+ * Appends the next parts of streamed response body to the connection output.
+ *
+ * @Returns 1 when the body is done, 0 if it should be continued once the output is sent, -1 on error.
+ */
+static int streamHTTPEventBody(struct eventConn *conn, struct httpEventState *state)
+{
+	int done = 0;
+
+	if (state->sendfile) {
+		struct httpFileBody *file = state->producerCtx;
+
+		// File is sent after the head, so the output is flushed before.
+		while (conn->wlen == 0 && file->left != 0) {
+			ssize_t n = eventConnSendFile(conn, file->fd, &file->offset, file->left);
+			if (n == -1) {
+				if (errno == EAGAIN) break;
+				return -1;
+			}
+			if (n == 0) {
+				printf("File of response body is truncated\n");
+				return -1;
+			}
+
+			file->left -= n;
+		}
+
+		done = file->left == 0;
+	}
+
+	while (!done && !state->sendfile && conn->wlen < HTTP_STREAM_BATCH) {
+		char *out = eventConnAppend(conn, HTTP_STREAM_FRAME);
+		if (out == NULL) return -1;
+
+		ssize_t n = produceHTTPBody(state->producer, state->producerCtx, state->chunked, out, &done);
+		if (n == -1) {
+			printf("Response body producer failed\n");
+			return -1;
+		}
+
+		eventConnTrim(conn, HTTP_STREAM_FRAME - n);
+	}
+
+	conn->producing = !done;
+	if (!done) return 0;
+
+	if (state->producerFree != NULL) state->producerFree(state->producerCtx);
+	state->producer = NULL;
+	state->producerFree = NULL;
+	state->sendfile = 0;
+
+	return 1;
+}
+
+int httpEventHandler(struct eventConn *conn, void *rawargs)
+{
+	struct HTTPConnectionHandlerArgs *args = rawargs;
+	struct HTTPBodyLimits limits = httpBodyLimits(args);
+
+	struct httpEventState *state = conn->handlerState;
+	if (state == NULL) {
+		state = malloc(sizeof(struct httpEventState));
+		if (state == NULL) return CONNEV_ABORT;
+
+		initHTTPParser(&state->parser);
+		state->bodyRead = 0;
+		state->bodyfd = -1;
+		state->producer = NULL;
+		state->producerFree = NULL;
+		state->sendfile = 0;
+		conn->handlerState = state;
+		conn->handlerStateFree = freeHTTPEventState;
+	}
+
+	struct httpParser *parser = &state->parser;
+
+	// Requests received while the response body is streamed wait for its end.
+	if (state->producer != NULL) {
+		int status = streamHTTPEventBody(conn, state);
+		if (status == -1) return CONNEV_ABORT;
+		if (status == 0) return CONNEV_KEEP;
+		if (state->closing) return CONNEV_CLOSE;
+	}
+
+	conn->phase = CONN_PHASE_IDLE;
+
+	for (size_t depth = 0; conn->rlen != 0; depth++) {
+		// Responses to the processed requests are sent first. The loop runs the handler again after that.
+		if (depth == HTTP_PIPELINE_DEPTH) return CONNEV_KEEP;
+
+		size_t reqlen;
+		int status = HTTPPARSE_NEED_MORE;
+
+		// Head is parsed until the body is received by receiveHTTPEventBody().
+		if (state->bodyRead == 0) {
+			status = httpParserFeed(parser, conn->rbuf, conn->rlen, &reqlen);
+			if (status == HTTPPARSE_ERROR) {
+				printf("Cannot parse request\n");
+				return CONNEV_ABORT;
+			} else if (status == HTTPPARSE_NEED_MORE && parser->state != HTTPBODY_PROCESSING) {
+				conn->phase = CONN_PHASE_HEAD;
+				return CONNEV_KEEP;
+			}
+
+			if (parser->bodyc > limits.max) {
+				printf("Request body is too large\n");
+				return rejectHTTPEventRequest(conn, parser->httpver, HttpStatus_ContentTooLarge);
+			}
+		}
+
+		// Handler does not block, so chunked and large bodies are received completely before the request is processed.
+		// Small ones are received in the input buffer.
+		int received = parser->chunked || parser->bodyc > limits.memory;
+		if (!received && status == HTTPPARSE_NEED_MORE) {
+			conn->phase = CONN_PHASE_BODY;
+			return CONNEV_KEEP;
+		}
+
+		if (received) {
+			if (state->bodyRead == 0) {
+				initHTTPChunkedDecoder(&state->decoder);
+				state->decoder.limit = limits.max;
+				state->bodyc = 0;
+				state->spilled = 0;
+				state->bodyRead = parser->headlen;
+			}
+
+			status = receiveHTTPEventBody(conn, state, limits.memory);
+			if (status == HTTPPARSE_ERROR) {
+				if (errno == EFBIG) {
+					printf("Request body is too large\n");
+					return rejectHTTPEventRequest(conn, parser->httpver, HttpStatus_ContentTooLarge);
+				}
+
+				printf("Cannot receive request body: %s\n", strerror(errno));
+				return CONNEV_ABORT;
+			} else if (status == HTTPPARSE_NEED_MORE) {
+				conn->phase = CONN_PHASE_BODY;
+				return CONNEV_KEEP;
+			}
+
+			reqlen = state->bodyRead;
+		}
+
+		// Request is complete and stays in the input buffer until it is processed.
+		struct HTTPRequest req;
+		httpParserRequest(parser, conn->rbuf, &req);
+
+		if (received) {
+			req.bodyc = state->spilled + state->bodyc;
+			req.body = state->bodyc != 0 ? conn->rbuf + parser->headlen : NULL;
+
+			// The whole body is in the memory file once it is spilled.
+			if (state->bodyfd != -1) {
+				req.bodyfd = state->bodyfd;
+				state->bodyfd = -1;
+			}
+		}
+
+		if (parser->chunked) {
+			// Trailer section is after the decoded data, it is not moved.
+			size_t trailers = reqlen - (state->decoder.offset - state->decoder.trailerOff);
+			if (collectHTTPTrailers(conn->rbuf + trailers, reqlen - trailers, &req.trailers)) {
+				destroyHTTPRequest(&req);
+				return CONNEV_ABORT;
+			}
+		}
+
+		initHTTPParser(parser);
+		state->bodyRead = 0;
+
+		int httpver = req.httpver;
+
+		struct HTTPResponse resp;
+		if (initHTTPResponse(&resp, httpver)) {
+			destroyHTTPRequest(&req);
+			return CONNEV_ABORT;
+		}
+
+		// Event loop thread is not blocked by waits for requests in flight.
+		processHTTPRequest(args, &req, &resp, 0);
+		destroyHTTPRequest(&req);
+		eventConnConsume(conn, reqlen);
+
+		int draining = eventConnDraining(conn);
+		if (draining)
+			addKVHTTPHeader_p(&resp.headers, "Connection", "close");
+
+		// Response is serialized in place into the connection output and sent when the handler returns.
+		// Streamed and file bodies are sent after the head.
+		size_t bodyc = resp.bodyType <= HTTP_BODY_IOVEC && !resp.headOnly ? resp.bodyc : 0;
+
+		ssize_t headlen = renderHTTPResponseHead(&resp, NULL, 0);
+		char *out = headlen != -1 ? eventConnAppend(conn, headlen + bodyc) : NULL;
+		if (out == NULL) {
+			printf("HTTP Response is invalid: %s\n", strerror(errno));
+			destroyHTTPResponse(&resp);
+			return CONNEV_ABORT;
+		}
+
+		renderHTTPResponseHead(&resp, out, headlen);
+
+		if (!resp.headOnly && resp.bodyType == HTTP_BODY_FILE && resp.bodyc != 0) {
+			struct httpFileBody *file = malloc(sizeof(struct httpFileBody));
+			if (file == NULL) {
+				destroyHTTPResponse(&resp);
+				return CONNEV_ABORT;
+			}
+
+			// File is released along with the handler state.
+			file->fd = resp.source.file.fd;
+			file->offset = resp.source.file.offset;
+			file->left = resp.bodyc;
+			file->ctx = resp.bodyCtx;
+			file->release = resp.bodyRelease;
+			resp.bodyRelease = NULL;
+
+			state->producer = readHTTPFileBody;
+			state->producerCtx = file;
+			state->producerFree = freeHTTPFileBody;
+			state->chunked = 0;
+			state->closing = httpver != HTTPV_11 || draining;
+			state->sendfile = conn->loop->uring == NULL;
+		} else if (!resp.headOnly && resp.bodyType == HTTP_BODY_PRODUCER) {
+			// Body is produced while the output is sent, the handler keeps the producer.
+			state->producer = resp.source.producer;
+			state->producerCtx = resp.bodyCtx;
+			state->producerFree = resp.bodyRelease;
+			state->chunked = httpver == HTTPV_11;
+			state->closing = !state->chunked || draining;
+			state->sendfile = 0;
+
+			resp.bodyRelease = NULL;
+		}
+
+		if (state->producer != NULL) {
+			destroyHTTPResponse(&resp);
+
+			conn->phase = CONN_PHASE_PROCESSING;
+
+			int status = streamHTTPEventBody(conn, state);
+			if (status == -1) return CONNEV_ABORT;
+			if (status == 0) return CONNEV_KEEP;
+			if (state->closing) return CONNEV_CLOSE;
+
+			conn->phase = CONN_PHASE_IDLE;
+			continue;
+		}
+
+		if (bodyc != 0 && resp.bodyType == HTTP_BODY_BUFFER) memcpy(out + headlen, resp.body, bodyc);
+
+		// Output is a copy anyway: parts are gathered into it.
+		for (int i = 0; bodyc != 0 && resp.bodyType == HTTP_BODY_IOVEC && i < resp.source.iov.iovc; i++) {
+			memcpy(out + headlen, resp.source.iov.iov[i].iov_base, resp.source.iov.iov[i].iov_len);
+			headlen += resp.source.iov.iov[i].iov_len;
+		}
+		destroyHTTPResponse(&resp);
+
+		if (httpver != HTTPV_11 || draining) return CONNEV_CLOSE;
+	}
+
+	return CONNEV_KEEP;
+}
+
+/**
+ * Method names padded to machine word. Word of each method is at HTTP_METHOD_HASH() of its first two characters,
+ * all methods are at least 3 characters long.
+ */
+#define HTTP_METHOD_HASH(c0, c1) (((c0) + (c1) * 9) & 15)
+
+struct httpMethodWord {
+	char word[8];
+	size_t len;
+	int method;
+};
+
+static const struct httpMethodWord methodWords[16] = {
+	[HTTP_METHOD_HASH('G', 'E')] = { "GET", 3, HTTPM_GET },
+	[HTTP_METHOD_HASH('H', 'E')] = { "HEAD", 4, HTTPM_HEAD },
+	[HTTP_METHOD_HASH('P', 'O')] = { "POST", 4, HTTPM_POST },
+	[HTTP_METHOD_HASH('P', 'U')] = { "PUT", 3, HTTPM_PUT },
+	[HTTP_METHOD_HASH('D', 'E')] = { "DELETE", 6, HTTPM_DELETE },
+	[HTTP_METHOD_HASH('C', 'O')] = { "CONNECT", 7, HTTPM_CONNECT },
+	[HTTP_METHOD_HASH('O', 'P')] = { "OPTIONS", 7, HTTPM_OPTIONS },
+	[HTTP_METHOD_HASH('T', 'R')] = { "TRACE", 5, HTTPM_TRACE },
+	[HTTP_METHOD_HASH('P', 'A')] = { "PATCH", 5, HTTPM_PATCH },
+};
+
+/**
+ * Loads up to 8 bytes of @str into machine word padded with zeroes.
+ */
+static inline uint64_t loadWord(const char *str, size_t len)
+{
+	uint64_t word = 0;
+	memcpy(&word, str, len);
+
+	return word;
+}
+
+int httpMethodId(const char *method, size_t len)
+{
+	if (len < 3 || len > 7) goto error;
+
+	const struct httpMethodWord *mw = &methodWords[HTTP_METHOD_HASH(
+		(unsigned char)method[0], (unsigned char)method[1])];
+
+	if (mw->len != len || loadWord(method, len) != loadWord(mw->word, sizeof(mw->word)))
+		goto error;
+
+	return mw->method;
+error:
+	errno = EINVAL;
+	return HTTPM_FAILED;
+}
+
 int parseHTTPMethod(const char *method_str)
 {
 	errno = 0;
@@ -465,28 +2497,31 @@ int parseHTTPMethod(const char *method_str)
 	if (method_str == NULL) {
 		errno = EINVAL;
 		return HTTPM_FAILED;
-	} else if (!strcmp(method_str, "GET")) {
-		return HTTPM_GET;
-	} else if (!strcmp(method_str, "HEAD")) {
-		return HTTPM_HEAD;
-	} else if (!strcmp(method_str, "POST")) {
-		return HTTPM_POST;
-	} else if (!strcmp(method_str, "PUT")) {
-		return HTTPM_POST;
-	} else if (!strcmp(method_str, "DELETE")) {
-		return HTTPM_POST;
-	} else if (!strcmp(method_str, "CONNECT")) {
-		return HTTPM_POST;
-	} else if (!strcmp(method_str, "OPTIONS")) {
-		return HTTPM_POST;
-	} else if (!strcmp(method_str, "TRACE")) {
-		return HTTPM_POST;
-	} else if (!strcmp(method_str, "PATCH")) {
-		return HTTPM_POST;
-	} else {
-		errno = EINVAL;
-		return HTTPM_FAILED;
 	}
+
+	return httpMethodId(method_str, strnlen(method_str, 8));
+}
+
+const char *HTTPMethodToString(int method)
+{
+	for (size_t i = 0; i < sizeof(methodWords) / sizeof(methodWords[0]); i++)
+		if (methodWords[i].len != 0 && methodWords[i].method == method)
+			return methodWords[i].word;
+
+	return NULL;
+}
+
+int httpVersionId(const char *version, size_t len)
+{
+	if (len == 8) {
+		uint64_t word = loadWord(version, len);
+
+		if (word == loadWord("HTTP/1.1", 8)) return HTTPV_11;
+		if (word == loadWord("HTTP/1.0", 8)) return HTTPV_10;
+	}
+
+	errno = EINVAL;
+	return HTTPV_INVAL;
 }
 
 int parseHTTPVersion(const char *version_str)
@@ -496,14 +2531,9 @@ int parseHTTPVersion(const char *version_str)
 	if (version_str == NULL) {
 		errno = EINVAL;
 		return HTTPV_INVAL;
-	} else if (!strcmp(version_str, "HTTP/1.0")) {
-		return HTTPV_10;
-	} else if (!strcmp(version_str, "HTTP/1.1")) {
-		return HTTPV_11;
-	} else {
-		errno = EINVAL;
-		return HTTPM_FAILED;
 	}
+
+	return httpVersionId(version_str, strnlen(version_str, 9));
 }
 
 const char *HTTPVersionToString(int version)
@@ -517,4 +2547,51 @@ const char *HTTPVersionToString(int version)
 	}
 }
 
+#define HTTP_STATUS_MIN 100
+#define HTTP_STATUS_MAX 599
 
+/**
+ * Serialized status lines of HTTP/1.0 and HTTP/1.1 by status code, see httpStatusLine().
+ */
+static struct httpSlice statusLines[2][HTTP_STATUS_MAX - HTTP_STATUS_MIN + 1];
+static pthread_once_t statusLinesOnce = PTHREAD_ONCE_INIT;
+
+static void initStatusLines(void)
+{
+	size_t size = 0;
+	for (int status = HTTP_STATUS_MIN; status <= HTTP_STATUS_MAX; status++) {
+		const char *reason = HttpStatus_reasonPhrase(status);
+		if (reason != NULL) size += strlen("HTTP/1.x 000 \r\n") + strlen(reason);
+	}
+
+	// Lines live until exit.
+	char *arena = malloc(size * 2 + 1);
+	if (arena == NULL) return;
+
+	for (int v = 0; v < 2; v++) {
+		const char *httpvs = HTTPVersionToString(v ? HTTPV_11 : HTTPV_10);
+
+		for (int status = HTTP_STATUS_MIN; status <= HTTP_STATUS_MAX; status++) {
+			const char *reason = HttpStatus_reasonPhrase(status);
+			if (reason == NULL) continue;
+
+			int len = sprintf(arena, "%s %d %s\r\n", httpvs, status, reason);
+			statusLines[v][status - HTTP_STATUS_MIN] = (struct httpSlice){ .ptr = arena, .len = len };
+			arena += len;
+		}
+	}
+}
+
+const char *httpStatusLine(int version, int status, size_t *len)
+{
+	if (	(version != HTTPV_10 && version != HTTPV_11) ||
+		status < HTTP_STATUS_MIN || status > HTTP_STATUS_MAX)
+		return NULL;
+
+	pthread_once(&statusLinesOnce, initStatusLines);
+
+	struct httpSlice *line = &statusLines[version == HTTPV_11][status - HTTP_STATUS_MIN];
+	*len = line->len;
+
+	return line->ptr;
+}
@@ -37,8 +37,25 @@ extern "C" {
 */
 int parseHTTPMethod(const char *method_str);
 
+#include <stddef.h>
+
+/**
+ * Same as parseHTTPMethod() for method that is not null-terminated (e.g. in read buffer).
+ * Method is found by perfect hash of its first characters and compared as one machine word.
+ *
+ * @Returns HTTPM_FAILED on failure or one of HTTPM_ defined values otherwise.
+ */
+int httpMethodId(const char *method, size_t len);
+
+/**
+ * @Returns name of method @method or NULL if it is not one of HTTPM_ defined values.
+ */
+const char *HTTPMethodToString(int method);
+
 #include <search.h>
 #include "utils.h"
+#include "eventloop.h"
+#include "connio.h"
 #include <stdio.h>
 #include <sys/types.h>
 /**
@@ -60,11 +77,28 @@ int parseHTTPMethod(const char *method_str);
 */
 int parseHTTPVersion(const char *version_str);
 
+/**
+ * Same as parseHTTPVersion() for version that is not null-terminated. Version is compared as one machine word.
+ *
+ * @Returns HTTPV_INVAL on failure or one of HTTPV_ defined values otherwise.
+ */
+int httpVersionId(const char *version, size_t len);
+
 /**
  * @Retruns string version from one provided with defines. (NULL if version not valid).
  */
 const char *HTTPVersionToString(int version);
 
+/**
+ * Returns serialized status line of response, e.g. "HTTP/1.1 200 OK\r\n". Lines of all the codes
+ * with known reason phrase are built once for each version.
+ *
+ * @len Length of the line.
+ *
+ * @Returns status line or NULL if version is invalid or status code has no reason phrase.
+ */
+const char *httpStatusLine(int version, int status, size_t *len);
+
 struct HTTPHead {
 	int method;
 	char *path;
@@ -135,44 +169,245 @@ int buildHTTPHeader(struct HTTPHeader *res, const char *key, const char *value);
 void destroyHTTPHeader(struct HTTPHeader *header);
 
 /**
- * Initializes storage for HTTP Headers.
+ * Well-known header names interned to integer IDs, see httpHeaderId().
+ */
+#define HTTPH_OTHER 0
+#define HTTPH_HOST 1
+#define HTTPH_CONTENT_LENGTH 2
+#define HTTPH_CONTENT_TYPE 3
+#define HTTPH_CONTENT_ENCODING 4
+#define HTTPH_CONNECTION 5
+#define HTTPH_KEEP_ALIVE 6
+#define HTTPH_TRANSFER_ENCODING 7
+#define HTTPH_EXPECT 8
+#define HTTPH_UPGRADE 9
+#define HTTPH_USER_AGENT 10
+#define HTTPH_ACCEPT 11
+#define HTTPH_ACCEPT_ENCODING 12
+#define HTTPH_ACCEPT_LANGUAGE 13
+#define HTTPH_AUTHORIZATION 14
+#define HTTPH_COOKIE 15
+#define HTTPH_SET_COOKIE 16
+#define HTTPH_REFERER 17
+#define HTTPH_DATE 18
+#define HTTPH_SERVER 19
+#define HTTPH_LOCATION 20
+#define HTTPH_RANGE 21
+#define HTTPH_ETAG 22
+#define HTTPH_IF_NONE_MATCH 23
+#define HTTPH_IF_MODIFIED_SINCE 24
+#define HTTPH_LAST_MODIFIED 25
+#define HTTPH_CACHE_CONTROL 26
+#define HTTPH_COUNT 27
+
+/**
+ * Looks up header name among well-known ones. Comparison is case-insensitive (RFC 9110).
+ *
+ * @name Header name, not null-terminated.
+ *
+ * @Returns one of HTTPH_ IDs, HTTPH_OTHER if name is not a well-known one.
+ */
+int httpHeaderId(const char *name, size_t len);
+
+/**
+ * @Returns canonical name of well-known header @id or NULL for HTTPH_OTHER and invalid IDs.
+ */
+const char *httpHeaderName(int id);
+
+#ifndef HTTP_MAX_HEADERS
+/**
+ * Maximum count of headers in request parsed by parseHTTPRequestView()
+ * and of distinct header names in struct httpHeaderIndex.
+ */
+#define HTTP_MAX_HEADERS 64
+#endif
+
+#if HTTP_MAX_HEADERS > 128
+#error "HTTP_MAX_HEADERS should not exceed 128: slots of struct httpHeaderIndex are single bytes"
+#endif
+
+/**
+ * Count of slots of struct httpHeaderIndex hash table, at least twice as much as HTTP_MAX_HEADERS.
+ */
+#define HTTP_HEADER_SLOTS 256
+
+/**
+ * Header of struct httpHeaderIndex with name that is not a well-known one.
+ */
+struct httpHeaderEntry {
+	const char *key;
+	size_t keylen;
+	unsigned hash;
+	size_t pos;
+};
+
+/**
+ * Index of headers by name, case-insensitive. Headers with well-known names are found by their ID
+ * with one array access, other names are looked up in hash table. Index only maps names to positions
+ * of headers in their storage, so the storage is not touched by lookup.
+ */
+struct httpHeaderIndex {
+	// Position + 1 of header with well-known name, 0 if the header is absent.
+	size_t known[HTTPH_COUNT];
+	// Open addressing table: entry + 1, 0 for empty slot.
+	unsigned char slots[HTTP_HEADER_SLOTS];
+	struct httpHeaderEntry entries[HTTP_MAX_HEADERS];
+	size_t entriesc;
+};
+
+void initHTTPHeaderIndex(struct httpHeaderIndex *index);
+
+/**
+ * @Returns position of header with name @key of @len bytes or -1 if there is no such header.
+ */
+ssize_t httpHeaderIndexFind(struct httpHeaderIndex *index, const char *key, size_t len);
+
+/**
+ * Sets position of header with name @key of @len bytes. Position of header with the same name is replaced.
+ * @key should be valid while it is in the index.
+ *
+ * @Returns 0 on success, -1 + errno otherwise. E2BIG if there are HTTP_MAX_HEADERS names already.
+ */
+int httpHeaderIndexSet(struct httpHeaderIndex *index, const char *key, size_t len, size_t pos);
+
+/**
+ * Headers of one request or response.
+ */
+struct HTTPHeaders {
+	/**
+	 * Vector of struct HTTPHeader 
+	 */
+	struct vector_p vec;
+	struct httpHeaderIndex index;
+};
+
+/**
+ * Initializes storage for HTTP Headers. Headers belong to one request or response,
+ * so the vector is unsynchronized (see initLocalVector_p()).
  */
-int createHTTPHeaderVector(struct vector_p *headers);
+int createHTTPHeaderVector(struct HTTPHeaders *headers);
 
 /**
- * Returns index of header with key in headers vector. Designed for thread-safety for internal use.
+ * Returns index of header with key in headers vector.
  * When element is not found returns -1.
  */
-ssize_t findHTTPHeader_p(struct vector_p *headers, const char *key);
+ssize_t findHTTPHeader_p(struct HTTPHeaders *headers, const char *key);
 /**
  * Returns matching http header.
  *
- * @headers vector_p of HTTPHeader structures.
+ * @headers Headers storage.
  * @key Header key
  *
  * @Returns HTTP header value or NULL if header is undefined.
  */
-char *getHTTPHeader_p(struct vector_p *headers, const char *key);
+char *getHTTPHeader_p(struct HTTPHeaders *headers, const char *key);
 /**
  * Inserts HTTPHeader structure into headers vector. 
  * If header key is already specified resets it.
+ *
+ * @Returns 0 on success, -1 + errno otherwise. E2BIG if there are HTTP_MAX_HEADERS names already.
  */
-int addHTTPHeader_p(struct vector_p *headers, struct HTTPHeader *header);
+int addHTTPHeader_p(struct HTTPHeaders *headers, struct HTTPHeader *header);
 /**
  * Adds http header to headers array but also constructs it from key-value pair.
  */
-int addKVHTTPHeader_p(struct vector_p *headers, const char *key, const char *value);
+int addKVHTTPHeader_p(struct HTTPHeaders *headers, const char *key, const char *value);
 /**
  * Deletes HTTPHeader from headers array. (In fact setts header value to NULL).
  * @Returns 0 on successfull delete, -1 if element was not found.
  */
-int deleteHTTPHeader_p(struct vector_p *headers, const char *key);
+int deleteHTTPHeader_p(struct HTTPHeaders *headers, const char *key);
 /**
  *
  * Frees space for HTTP Header vector including the vector itself. 
  * Notice that this function is not thread-safe!
  */
-void destroyHTTPHeaderVector(struct vector_p *headers);
+void destroyHTTPHeaderVector(struct HTTPHeaders *headers);
+
+/**
+ * Bytes of the buffer owned by someone else. Not null-terminated.
+ */
+struct httpSlice {
+	const char *ptr;
+	size_t len;
+};
+
+/**
+ * HTTP header parsed in place, see parseHTTPRequestView().
+ */
+struct HTTPHeaderView {
+	struct httpSlice key;
+	struct httpSlice value;
+};
+
+#ifndef HTTP_MAX_BODY_SIZE
+/**
+ * Default maximum size of request body, larger requests are rejected with 413.
+ */
+#define HTTP_MAX_BODY_SIZE (64 << 20)
+#endif
+
+#ifndef HTTP_BODY_MEMORY_LIMIT
+/**
+ * Default size of request body kept in memory. Larger bodies are streamed to the processor
+ * or spilled to a memory file, parseHTTPRequest() rejects them.
+ */
+#define HTTP_BODY_MEMORY_LIMIT (1 << 20)
+#endif
+
+/**
+ * Limits of request body, zero fields take defaults.
+ */
+struct HTTPBodyLimits {
+	// Size of body kept in memory, HTTP_BODY_MEMORY_LIMIT by default.
+	size_t memory;
+	// Maximum size of body, HTTP_MAX_BODY_SIZE by default.
+	size_t max;
+};
+
+#ifndef HTTP_MAX_CHUNK_LINE
+/**
+ * Maximum length of chunk size line including chunk extensions.
+ */
+#define HTTP_MAX_CHUNK_LINE 4096
+#endif
+
+/**
+ * States of struct httpChunkedDecoder.
+ */
+#define HTTPCHUNK_SIZE 0
+#define HTTPCHUNK_DATA 1
+#define HTTPCHUNK_DATA_END 2
+#define HTTPCHUNK_TRAILER 3
+#define HTTPCHUNK_DONE 4
+// Body is malformed or too large, the error is returned by every following call.
+#define HTTPCHUNK_ERROR 5
+
+/**
+ * Streaming decoder of chunked transfer coding (RFC 9112 section 7.1). Works on buffer segments
+ * and returns decoded data in place, so the body does not need to be in memory as a whole.
+ */
+struct httpChunkedDecoder {
+	// One of HTTPCHUNK_ states.
+	int state;
+	// Bytes of the current chunk not decoded yet.
+	size_t remaining;
+	// Count of decoded body bytes, bounded by @limit (HTTP_MAX_BODY_SIZE by default): EFBIG beyond it.
+	size_t total;
+	size_t limit;
+	// Count of encoded bytes consumed.
+	size_t offset;
+	// Offset of trailer section in encoded body and its size, bounded by HTTP_MAX_HEAD_SIZE.
+	size_t trailerOff;
+	size_t trailerSize;
+	// errno of HTTPCHUNK_ERROR state.
+	int error;
+};
+
+struct httpRouteMatch;
+struct httpRouter;
+struct httpCache;
+struct httpFlightGroup;
 
 struct HTTPRequest {
 	int method;
@@ -180,12 +415,49 @@ struct HTTPRequest {
 	int httpver;
 
 	/**
-	 * Vector of struct HTTPHeader 
+	 * Headers of request. Request parsed into views has only index set, its positions refer to headerv.
 	 */
-	struct vector_p headers;
+	struct HTTPHeaders headers;
 
 	char *body;
 	size_t bodyc;
+
+	/**
+	 * Request is parsed by parseHTTPRequestView(): path and headers are not allocated, the views
+	 * below are set instead and body points to the read buffer (it is not null-terminated).
+	 */
+	int views;
+	struct httpSlice methodv;
+	struct httpSlice pathv;
+	struct HTTPHeaderView headerv[HTTP_MAX_HEADERS];
+	size_t headervc;
+
+	// Connection the views point into and count of its buffered bytes released by destroyHTTPRequest().
+	struct connIO *io;
+	size_t held;
+	// Copy of the request when it does not fit the read buffer, otherwise NULL.
+	char *storage;
+
+	// Body is sent with chunked transfer coding.
+	int chunked;
+	/**
+	 * Connection the body is being read from by readHTTPRequestBody(), NULL if the body is received.
+	 * Set by parseHTTPRequestView() for chunked body and body larger than memory limit: the body
+	 * is streamed to the processor instead of being buffered. @bodyc is the declared size of not chunked body.
+	 */
+	struct connIO *bodyio;
+	struct httpChunkedDecoder decoder;
+	/**
+	 * Memory file holding body of @bodyc bytes larger than memory limit, -1 if the body is not spilled.
+	 * Set by the event-driven handler, @body is NULL then.
+	 */
+	int bodyfd;
+	// Count of body bytes returned by readHTTPRequestBody().
+	size_t bodyRead;
+	// Route of the request set by routeHTTPRequest() while it is processed, NULL if the request is not routed.
+	const struct httpRouteMatch *route;
+	// Trailer fields of chunked body, NULL if there are none (or they are not received yet).
+	struct HTTPHeaders *trailers;
 };
 
 /**
@@ -194,31 +466,306 @@ struct HTTPRequest {
 #define HTTPREQ_EOF 1
 #define HTTPREQ_SUCCESS 0
 #define HTTPREQ_FAILED -1
+/**
+ * Request is not received completely and the caller asked not to wait for it.
+ */
+#define HTTPREQ_AGAIN 2
+/**
+ * Request body exceeds the size limit, the request should be rejected with 413.
+ */
+#define HTTPREQ_TOO_LARGE 3
+
+#ifndef HTTP_PIPELINE_DEPTH
+/**
+ * Maximum count of pipelined requests processed before their responses are sent.
+ * Responses to requests already received together are coalesced into one write.
+ */
+#define HTTP_PIPELINE_DEPTH 16
+#endif
 
 /**
- * Reads for HTTP request in stream. 
+ * Reads for HTTP request in connection. 
  *
- * @stream "r"-flagged stdio stream. Notice that the cursor position will be changed. 
- * After request handling it will be pointing to the start of next HTTP request. Function is blocking and waiting for input.
+ * @io Connection I/O. Request bytes are consumed from the read buffer, so after request handling
+ * it starts with the next HTTP request. Function is blocking and waiting for input.
  *
  * @req A pointer to HTTPRequest structure where new request is stored.
  *
+ * Body is read into memory, so request with body larger than HTTP_BODY_MEMORY_LIMIT (or HTTP_MAX_BODY_SIZE)
+ * is not received: HTTPREQ_TOO_LARGE is returned. Chunked body is rejected once its decoded size exceeds the limit.
+ * parseHTTPRequestView() streams such bodies instead.
+ *
  * @Returns One of HTTPREQ_ defines statuses. 
  */
-int parseHTTPRequest(FILE *stream, struct HTTPRequest *res);
+int parseHTTPRequest(struct connIO *io, struct HTTPRequest *res);
 
 /**
- * Frees HTTPRequest structure.
+ * Same as parseHTTPRequest(), but nothing is copied: method, path, header names and values are
+ * slices of the connection read buffer. The request bytes stay buffered until destroyHTTPRequest(),
+ * so the views are valid until the request is destroyed. Only request with body that does not
+ * fit the read buffer is copied. Body larger than HTTP_BODY_MEMORY_LIMIT is streamed by readHTTPRequestBody().
+ *
+ * @Returns One of HTTPREQ_ defines statuses. 
+ */
+int parseHTTPRequestView(struct connIO *io, struct HTTPRequest *res);
+
+/**
+ * Phases of request parsing, see struct httpParser.
+ */
+#define HTTPHEAD_PROCESSING 0
+#define HTTPHEADERS_PROCESSING 1
+#define HTTPBODY_PROCESSING 2
+#define HTTPPROCESSING_END 100
+
+/**
+ * Steps of request line parsing.
+ */
+#define HEADPROCESS_METHOD 1
+#define HEADPROCESS_PATH 2
+#define HEADPROCESS_HTTPV 3
+#define HEADPROCESS_END 4
+
+/**
+ * Steps of header line parsing.
+ */
+#define HEADERPROCESS_NAME 1
+#define HEADERPROCESS_VALUE 2
+
+/**
+ * Statuses of httpParserFeed().
+ */
+#define HTTPPARSE_NEED_MORE 0
+#define HTTPPARSE_DONE 1
+#define HTTPPARSE_ERROR -1
+/**
+ * Statuses of httpChunkedFeed() only.
+ */
+#define HTTPPARSE_DATA 2
+#define HTTPPARSE_TRAILER 3
+
+/**
+ * Header found by struct httpParser. Offsets are counted from the request start,
+ * because the buffer may be moved between feeds.
+ */
+struct httpHeaderOffsets {
+	// One of HTTPH_ IDs.
+	int id;
+	size_t key;
+	size_t keylen;
+	size_t value;
+	size_t valuelen;
+};
+
+/**
+ * Resumable HTTP request parser. Request may arrive by arbitrary segments:
+ * the parser keeps its position between feeds and never scans the same bytes twice.
+ */
+struct httpParser {
+	// One of HTTP*_PROCESSING phases.
+	int state;
+	// HEADPROCESS_ step in HTTPHEAD_PROCESSING phase, HEADERPROCESS_ step in HTTPHEADERS_PROCESSING phase.
+	int step;
+	// Count of request bytes already parsed. The next feed resumes from here.
+	size_t parsed;
+	// Start of the token being parsed.
+	size_t token;
+
+	int method;
+	int httpver;
+	size_t methodOff, methodLen;
+	size_t pathOff, pathLen;
+
+	struct httpHeaderOffsets headers[HTTP_MAX_HEADERS];
+	size_t headersc;
+
+	// Size of head, valid since HTTPBODY_PROCESSING phase.
+	size_t headlen;
+	// Size of body declared by Content-Length.
+	size_t bodyc;
+	// Body is chunked: its size is not known, the request is done at the end of head.
+	int chunked;
+};
+
+/**
+ * Prepares parser for the next request.
+ */
+void initHTTPParser(struct httpParser *parser);
+
+/**
+ * Parses request bytes received so far.
+ *
+ * @buf Buffer starting with the request. Every feed passes the same request bytes followed
+ * by the newly received ones, the buffer itself may be moved.
+ * @len Count of bytes in @buf.
+ * @consumed Size of the request (head and body) on HTTPPARSE_DONE, count of parsed bytes on HTTPPARSE_NEED_MORE.
+ * Chunked body is not parsed: the request is done at the end of head and the body should be decoded
+ * by struct httpChunkedDecoder from the following bytes.
+ *
+ * @Returns One of HTTPPARSE_ statuses. Bytes after the request (next pipelined one) are not touched.
+ */
+int httpParserFeed(struct httpParser *parser, const char *buf, size_t len, size_t *consumed);
+
+void initHTTPChunkedDecoder(struct httpChunkedDecoder *dec);
+
+/**
+ * Decodes chunked body. Should be called until it returns HTTPPARSE_NEED_MORE, HTTPPARSE_DONE or HTTPPARSE_ERROR.
+ *
+ * @buf Encoded bytes following the ones consumed by the previous calls.
+ * @max Maximum count of data bytes returned by one call.
+ * @consumed Count of bytes of @buf decoded. Incomplete line is not consumed, it should be passed again with more bytes.
+ * @out Data (value) on HTTPPARSE_DATA or trailer field on HTTPPARSE_TRAILER. Points into @buf.
+ *
+ * @Returns HTTPPARSE_DATA or HTTPPARSE_TRAILER when @out is set, HTTPPARSE_NEED_MORE if @buf is exhausted,
+ * HTTPPARSE_DONE after the trailer section, HTTPPARSE_ERROR + errno on malformed body or exceeded limits.
+ */
+int httpChunkedFeed(struct httpChunkedDecoder *dec, const char *buf, size_t len, size_t max,
+	size_t *consumed, struct HTTPHeaderView *out);
+
+/**
+ * Fills @req with views of the request parsed by @parser. Body is set only if the request is complete.
+ *
+ * @buf Buffer passed to the last httpParserFeed(). Views point into it.
+ */
+void httpParserRequest(struct httpParser *parser, const char *buf, struct HTTPRequest *req);
+
+/**
+ * Parses complete request received in buffer into views, see parseHTTPRequestView().
+ *
+ * @buf Buffer with request head and body, e.g. measured by httpRequestLength(). Views point into it.
+ * @headlen Size of request head.
+ * @len Size of request head and body.
+ *
+ * @Returns 0 on success, -1 + errno otherwise.
+ */
+int parseHTTPRequestBuffer(const char *buf, size_t headlen, size_t len, struct HTTPRequest *res);
+
+/**
+ * Returns value of request header with @key, case-insensitive. Works with both parsing modes.
+ *
+ * @len Length of the value. May be NULL.
+ *
+ * @Returns Header value (null-terminated only if request is not parsed into views) or NULL if header is undefined.
+ */
+const char *getHTTPRequestHeader(struct HTTPRequest *req, const char *key, size_t *len);
+
+/**
+ * Reads up to @n bytes of request body, wherever it is: in memory, in a memory file or in the connection.
+ * Streamed body of request parsed by parseHTTPRequestView() is read (and decoded if it is chunked)
+ * from the connection as it arrives, so the processor may handle large uploads by parts. Trailer fields
+ * are available after the whole body is read.
+ *
+ * @Returns count of read bytes, 0 at the end of body, -1 + errno on error. EFBIG if body exceeds the size limit.
+ */
+ssize_t readHTTPRequestBody(struct HTTPRequest *req, char *buf, size_t n);
+
+/**
+ * Reads the rest of request body, so the next request may be parsed.
+ *
+ * @Returns 0 on success, -1 + errno otherwise.
+ */
+int discardHTTPRequestBody(struct HTTPRequest *req);
+
+/**
+ * Returns value of trailer field of chunked request body, see getHTTPHeader_p().
+ */
+const char *getHTTPRequestTrailer(struct HTTPRequest *req, const char *key);
+
+/**
+ * Maximum size of HTTP request head (request line and headers) accepted by the event-driven handler.
+ */
+#ifndef HTTP_MAX_HEAD_SIZE
+#define HTTP_MAX_HEAD_SIZE 65536
+#endif
+
+/**
+ * Determines the size of the first HTTP request in buffer without parsing it.
+ * Used by non-blocking handlers to check if the whole request is already received.
+ *
+ * @buf Buffer with raw request bytes. Not null-terminated.
+ * @len Count of bytes in buffer.
+ *
+ * @Returns Size of request (head and body) in bytes, 0 if request is incomplete, -1 if request is malformed.
+ */
+ssize_t httpRequestLength(const char *buf, size_t len);
+
+/**
+ * Response sent to the client that did not send the request in time. See struct ConnTimeouts.
+ */
+#define HTTP_TIMEOUT_RESPONSE "HTTP/1.1 408 Request Timeout\r\nConnection: close\r\nContent-Length: 0\r\n\r\n"
+
+/**
+ * Frees HTTPRequest structure. Request parsed into views releases its bytes of the read buffer.
  */
 void destroyHTTPRequest(struct HTTPRequest *req);
 
 
+#ifndef HTTP_STREAM_CHUNK
+/**
+ * Maximum size of chunk requested from response body producer.
+ */
+#define HTTP_STREAM_CHUNK 16384
+#endif
+
+/**
+ * Producer of streamed response body. Writes the next part of the body into @buf.
+ * Runs on the event loop thread in event-driven modes, so it should not block there.
+ *
+ * @n Size of @buf, at most HTTP_STREAM_CHUNK.
+ *
+ * @Returns count of written bytes, 0 at the end of body, -1 on error: the response is cut and the connection is closed.
+ */
+typedef ssize_t (*httpBodyProducer_t)(void *ctx, char *buf, size_t n);
+
+/**
+ * Sources of response body. Each one is sent by the cheapest way the connection allows.
+ */
+// @body buffer, borrowed by the response: it should outlive the response. Sent by one gathered write along with the head.
+#define HTTP_BODY_BUFFER 0
+// Scatter list of buffers, e.g. parts of a template, sent by gathered writes without concatenation.
+#define HTTP_BODY_IOVEC 1
+// File range sent by sendfile(2), or by splice(2) from a pipe: the bytes do not enter user space.
+#define HTTP_BODY_FILE 2
+/**
+ * Pull generator of streamed body. Streamed body is sent with chunked transfer coding to HTTP/1.1 clients
+ * and is delimited by connection close for HTTP/1.0 ones.
+ */
+#define HTTP_BODY_PRODUCER 3
+
 struct HTTPResponse {
 	int httpver;
 	int status;
-	struct vector_p headers;
+	struct HTTPHeaders headers;
+	// Length of the body, of any source but the producer.
 	size_t bodyc;
 	const char *body;
+
+	/**
+	 * Source of the body, one of HTTP_BODY_ defines. HTTP_BODY_BUFFER uses @body, the others are set
+	 * by setHTTPResponse*() functions along with their @source.
+	 */
+	int bodyType;
+	union {
+		struct {
+			const struct iovec *iov;
+			int iovc;
+		} iov;
+		struct {
+			int fd;
+			off_t offset;
+		} file;
+		httpBodyProducer_t producer;
+	} source;
+	// Context of the source (e.g. of the producer), released by @bodyRelease when the body is sent or
+	// the connection is closed. @bodyRelease may be NULL.
+	void *bodyCtx;
+	void (*bodyRelease)(void *ctx);
+
+	// Only the head is sent, e.g. response to HEAD request: @bodyc is the length of the body not sent.
+	int headOnly;
+
+	// Serialized header lines ("Name: value\r\n") sent after @headers, e.g. of the cached response. May be NULL.
+	const char *rawHeaders;
+	size_t rawHeadersc;
 };
 
 /**
@@ -234,22 +781,75 @@ int initHTTPResponse(struct HTTPResponse *response, int httpver);
  * Deallocates memory of http response structure.
  */
 void destroyHTTPResponse(struct HTTPResponse *response);
+
+/**
+ * Makes the response body streamed: it is generated by @producer with @ctx while it is sent,
+ * so it does not have to be in memory as a whole. Producer is owned by the response after the call.
+ */
+void setHTTPResponseProducer(struct HTTPResponse *response, httpBodyProducer_t producer, void *ctx,
+	void (*freeCtx)(void *ctx));
+/**
+ * Makes the response body @len bytes of file @fd from @offset. The file is not read by the server,
+ * it is sent with sendfile(2). @ctx is released by @release (may be NULL) once the range is sent.
+ * Pipe is sent from its current position by splice(2), @offset is ignored then.
+ */
+void setHTTPResponseFile(struct HTTPResponse *response, int fd, off_t offset, size_t len,
+	void (*release)(void *ctx), void *ctx);
 /**
- * Writes HTTPResponse to stream. Notice that on errors buffer may be corrupted (semi-writte).
+ * Makes the response body concatenation of @iovc buffers of @iov. The array and the buffers are borrowed:
+ * they should live until @ctx is released by @release (may be NULL).
+ */
+void setHTTPResponseIovec(struct HTTPResponse *response, const struct iovec *iov, int iovc,
+	void (*release)(void *ctx), void *ctx);
+/**
+ * Writes HTTPResponse to connection and flushes it. Notice that on errors buffer may be corrupted (semi-writte).
+ * Head is serialized into the connection output buffer and sent along with the body by one gathered write,
+ * the body is not copied. File body is sent after the head by sendfile(2). Streamed body is sent by parts as it is produced.
  *
  * @Returns HTTPResponse writing status: 0 on success, -1 otherwise.
  */
-int writeHTTPResponse(struct HTTPResponse *response, FILE *stream);
+int writeHTTPResponse(struct HTTPResponse *response, struct connIO *io);
+
+/**
+ * Serializes response head: status line, headers, Content-Length of the body (or Transfer-Encoding of streamed one)
+ * and the empty line.
+ * Nothing is allocated and numbers are formatted without printf(3).
+ *
+ * @buf Destination of @cap bytes, may be NULL if @cap is 0.
+ *
+ * @Returns size of the head (it is not written completely if the size exceeds @cap), -1 + errno if response is invalid.
+ */
+ssize_t renderHTTPResponseHead(struct HTTPResponse *response, char *buf, size_t cap);
 
 typedef void (*httpProcessor_t)(struct HTTPRequest *request, struct HTTPResponse *response);
 
 struct HTTPConnectionHandlerArgs {
 	httpProcessor_t httpRequestProcessor;
+	struct HTTPBodyLimits bodyLimits;
+	// Requests are dispatched by the router if it is set, @httpRequestProcessor is not used then.
+	struct httpRouter *router;
+	// Responses are cached if it is set, see struct httpCache.
+	struct httpCache *cache;
+	// Concurrent identical requests of httpConnetionHandler() are coalesced if it is set, see struct httpFlightGroup.
+	struct httpFlightGroup *flights;
 };
+/**
+ * @Returns input limit of event-driven connection (see ServerOptions.inputLimit) fitting every request
+ * of handler @args: head, body kept in memory, chunk size line and trailers.
+ */
+size_t httpInputLimit(struct HTTPConnectionHandlerArgs *args);
 /**
  * Handler for http connections used to pass as connhandler_t for server. 
+ * Pipelined requests already received are processed in order and their responses are sent by one write.
+ * Idle keep-alive connection is parked between requests, see connPark().
+ */
+void httpConnetionHandler(struct connIO *io, void *args);
+/**
+ * Handler for http connections used to pass as connevhandler_t for event-driven server modes.
+ * Processes complete requests in connection input buffer by batches of HTTP_PIPELINE_DEPTH
+ * and sets phase of the incomplete one.
  */
-void httpConnetionHandler(FILE *stream, void *args);
+int httpEventHandler(struct eventConn *conn, void *args);
 #ifdef __cplusplus
 }
 #endif
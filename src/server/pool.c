@@ -0,0 +1,271 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "pool.h"
+
+/**
+ * Worker running on the current thread. Tasks submitted by the worker itself go to its own deque.
+ */
+static __thread struct poolWorker *currentWorker;
+
+int initPoolDeque(struct poolDeque *deque, size_t startCapacity)
+{
+	memset(deque, 0, sizeof(struct poolDeque));
+	deque->capacity = startCapacity;
+
+	deque->tasks = malloc(sizeof(struct poolTask) * startCapacity);
+
+	if (deque->tasks == NULL || pthread_mutex_init(&deque->lock, NULL)) {
+		free(deque->tasks);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int growPoolDeque(struct poolDeque *deque)
+{
+	size_t ncap = deque->capacity * 2;
+	struct poolTask *tmp = malloc(sizeof(struct poolTask) * ncap);
+	if (tmp == NULL) return -1;
+
+	// Unwrap ring buffer so the oldest task is at index 0.
+	for (size_t i = 0; i < deque->size; i++)
+		tmp[i] = deque->tasks[(deque->top + i) % deque->capacity];
+
+	free(deque->tasks);
+	deque->tasks = tmp;
+	deque->capacity = ncap;
+	deque->top = 0;
+
+	return 0;
+}
+
+int poolDequePush(struct poolDeque *deque, struct poolTask task)
+{
+	pthread_mutex_lock(&deque->lock);
+
+	if (deque->size == deque->capacity && growPoolDeque(deque)) {
+		pthread_mutex_unlock(&deque->lock);
+		return -1;
+	}
+
+	deque->tasks[(deque->top + deque->size) % deque->capacity] = task;
+	deque->size++;
+
+	pthread_mutex_unlock(&deque->lock);
+
+	return 0;
+}
+
+int poolDequePop(struct poolDeque *deque, struct poolTask *res)
+{
+	pthread_mutex_lock(&deque->lock);
+
+	if (deque->size == 0) {
+		pthread_mutex_unlock(&deque->lock);
+		return 0;
+	}
+
+	deque->size--;
+	*res = deque->tasks[(deque->top + deque->size) % deque->capacity];
+
+	pthread_mutex_unlock(&deque->lock);
+
+	return 1;
+}
+
+int poolDequeSteal(struct poolDeque *deque, struct poolTask *res)
+{
+	pthread_mutex_lock(&deque->lock);
+
+	if (deque->size == 0) {
+		pthread_mutex_unlock(&deque->lock);
+		return 0;
+	}
+
+	*res = deque->tasks[deque->top];
+	deque->top = (deque->top + 1) % deque->capacity;
+	deque->size--;
+
+	pthread_mutex_unlock(&deque->lock);
+
+	return 1;
+}
+
+void destroyPoolDeque(struct poolDeque *deque)
+{
+	free(deque->tasks);
+	pthread_mutex_destroy(&deque->lock);
+
+	deque->tasks = NULL;
+	deque->size = 0;
+	deque->capacity = 0;
+}
+
+/**
+ * Takes the task from own deque or steals it from the other workers.
+ *
+ * @Returns 1 if task was taken, 0 if all the deques are empty.
+ */
+static int poolTake(struct poolWorker *worker, struct poolTask *res)
+{
+	struct workerPool *pool = worker->pool;
+
+	int taken = poolDequePop(&worker->deque, res);
+
+	for (size_t i = 1; !taken && i < pool->workersc; i++) {
+		struct poolWorker *victim = pool->workers + (worker->id + i) % pool->workersc;
+		taken = poolDequeSteal(&victim->deque, res);
+	}
+
+	if (taken)
+		__atomic_sub_fetch(&pool->queued, 1, __ATOMIC_ACQ_REL);
+
+	return taken;
+}
+
+static void *poolWorkerRunner(void *rawworker)
+{
+	struct poolWorker *worker = rawworker;
+	struct workerPool *pool = worker->pool;
+	currentWorker = worker;
+
+	while (1) {
+		struct poolTask task;
+
+		if (poolTake(worker, &task)) {
+			task.fn(task.arg, task.data);
+			continue;
+		}
+
+		pthread_mutex_lock(&pool->idleLock);
+		while (	__atomic_load_n(&pool->queued, __ATOMIC_ACQUIRE) == 0 &&
+			!pool->stop)
+			pthread_cond_wait(&pool->idleCond, &pool->idleLock);
+
+		// Pool stops only when all the queued tasks are done.
+		int stop = pool->stop && __atomic_load_n(&pool->queued, __ATOMIC_ACQUIRE) == 0;
+		pthread_mutex_unlock(&pool->idleLock);
+
+		if (stop) break;
+	}
+
+	return NULL;
+}
+
+int initWorkerPool(struct workerPool *pool, size_t workers)
+{
+	memset(pool, 0, sizeof(struct workerPool));
+
+	if (workers == 0) {
+		long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+		workers = ncpu > 0 ? ncpu : 1;
+	}
+
+	if (	pthread_mutex_init(&pool->idleLock, NULL) ||
+		pthread_cond_init(&pool->idleCond, NULL))
+		return -1;
+
+	pool->workers = calloc(workers, sizeof(struct poolWorker));
+	if (pool->workers == NULL)
+		goto error;
+
+	for (size_t i = 0; i < workers; i++) {
+		struct poolWorker *worker = pool->workers + i;
+		worker->pool = pool;
+		worker->id = i;
+
+		if (initPoolDeque(&worker->deque, 16))
+			goto error;
+
+		pool->workersc++;
+	}
+
+	size_t started = 0;
+	for (; started < workers; started++) {
+		struct poolWorker *worker = pool->workers + started;
+
+		if (pthread_create(&worker->thread, NULL, poolWorkerRunner, worker)) {
+			perror("Unable to create thread");
+			break;
+		}
+	}
+
+	if (started != workers) {
+		pthread_mutex_lock(&pool->idleLock);
+		pool->stop = 1;
+		pthread_cond_broadcast(&pool->idleCond);
+		pthread_mutex_unlock(&pool->idleLock);
+
+		for (size_t i = 0; i < started; i++)
+			pthread_join(pool->workers[i].thread, NULL);
+
+		goto error;
+	}
+
+	return 0;
+
+error:;
+	int err = errno;
+	for (size_t i = 0; i < pool->workersc; i++)
+		destroyPoolDeque(&pool->workers[i].deque);
+	free(pool->workers);
+	pool->workers = NULL;
+	pool->workersc = 0;
+	pthread_mutex_destroy(&pool->idleLock);
+	pthread_cond_destroy(&pool->idleCond);
+	errno = err;
+	return -1;
+}
+
+int poolSubmit(struct workerPool *pool, pooltask_t fn, void *arg, uint64_t data)
+{
+	struct poolTask task = { .fn = fn, .arg = arg, .data = data };
+
+	// Counted before push, so the counter never goes below zero when the task is taken right away.
+	__atomic_add_fetch(&pool->queued, 1, __ATOMIC_ACQ_REL);
+
+	struct poolWorker *worker = currentWorker;
+	if (worker == NULL || worker->pool != pool) {
+		size_t wi = __atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED) % pool->workersc;
+		worker = pool->workers + wi;
+	}
+
+	if (poolDequePush(&worker->deque, task)) {
+		__atomic_sub_fetch(&pool->queued, 1, __ATOMIC_ACQ_REL);
+		errno = ENOMEM;
+		return -1;
+	}
+
+	// Signal under the lock: worker checks queued counter under the same lock, so wakeup is not lost.
+	pthread_mutex_lock(&pool->idleLock);
+	pthread_cond_signal(&pool->idleCond);
+	pthread_mutex_unlock(&pool->idleLock);
+
+	return 0;
+}
+
+void destroyWorkerPool(struct workerPool *pool)
+{
+	pthread_mutex_lock(&pool->idleLock);
+	pool->stop = 1;
+	pthread_cond_broadcast(&pool->idleCond);
+	pthread_mutex_unlock(&pool->idleLock);
+
+	for (size_t i = 0; i < pool->workersc; i++)
+		pthread_join(pool->workers[i].thread, NULL);
+
+	for (size_t i = 0; i < pool->workersc; i++)
+		destroyPoolDeque(&pool->workers[i].deque);
+
+	free(pool->workers);
+	pool->workers = NULL;
+	pool->workersc = 0;
+
+	pthread_mutex_destroy(&pool->idleLock);
+	pthread_cond_destroy(&pool->idleCond);
+}
@@ -0,0 +1,114 @@
+#ifndef POOL_H
+#define POOL_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <pthread.h>
+#include <sys/types.h>
+#include <stdint.h>
+
+/**
+ * Task callback executed by pool worker.
+ *
+ * @arg Pointer passed on submission.
+ * @data Integer passed on submission. Allows to pass an index or a handle without allocation of arguments structure.
+ */
+typedef void (*pooltask_t)(void *arg, uint64_t data);
+
+struct poolTask {
+	pooltask_t fn;
+	void *arg;
+	uint64_t data;
+};
+
+/**
+ * Double-ended queue of tasks. Owner worker pushes and pops tasks on the bottom end,
+ * other workers steal tasks from the top end.
+ */
+struct poolDeque {
+	// Ring buffer of tasks.
+	struct poolTask *tasks;
+	size_t capacity;
+	// Index of the oldest task (steal end).
+	size_t top;
+	// Count of tasks in deque.
+	size_t size;
+	pthread_mutex_t lock;
+};
+
+struct workerPool;
+
+struct poolWorker {
+	pthread_t thread;
+	struct poolDeque deque;
+	struct workerPool *pool;
+	size_t id;
+};
+
+/**
+ * Fixed pool of pre-spawned worker threads with per-worker work-stealing deques.
+ */
+struct workerPool {
+	struct poolWorker *workers;
+	size_t workersc;
+
+	// Count of queued tasks in all deques.
+	size_t queued;
+	// Round-robin counter used to distribute submissions.
+	size_t next;
+
+	int stop;
+	pthread_mutex_t idleLock;
+	pthread_cond_t idleCond;
+};
+
+/**
+ * Creates pool and spawns worker threads.
+ *
+ * @workers Count of workers. 0 means one worker per online CPU core.
+ *
+ * @Returns Initialization status: 0 on success, -1 + errno otherwise.
+ */
+int initWorkerPool(struct workerPool *pool, size_t workers);
+
+/**
+ * Schedules task on one of the pool workers. Thread-safe.
+ * External submissions are distributed round-robin, tasks submitted from a worker are queued in its own deque.
+ *
+ * @Returns 0 on success, -1 + errno otherwise.
+ */
+int poolSubmit(struct workerPool *pool, pooltask_t fn, void *arg, uint64_t data);
+
+/**
+ * Waits for all the queued tasks to complete, stops workers and deallocates the pool.
+ */
+void destroyWorkerPool(struct workerPool *pool);
+
+int initPoolDeque(struct poolDeque *deque, size_t startCapacity);
+/**
+ * Pushes task to the bottom (owner) end of deque.
+ *
+ * @Returns 0 on success, -1 on allocation failure.
+ */
+int poolDequePush(struct poolDeque *deque, struct poolTask task);
+/**
+ * Pops the newest task from the bottom (owner) end of deque.
+ *
+ * @Returns 1 if task was popped, 0 if deque is empty.
+ */
+int poolDequePop(struct poolDeque *deque, struct poolTask *res);
+/**
+ * Steals the oldest task from the top end of deque.
+ *
+ * @Returns 1 if task was stolen, 0 if deque is empty.
+ */
+int poolDequeSteal(struct poolDeque *deque, struct poolTask *res);
+void destroyPoolDeque(struct poolDeque *deque);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* POOL_H */
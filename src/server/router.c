@@ -0,0 +1,419 @@
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include "router.h"
+#include "HttpStatusCodes_C.h"
+
+int initHTTPRouter(struct httpRouter *router)
+{
+	memset(router, 0, sizeof(struct httpRouter));
+
+	return 0;
+}
+
+static void destroyHTTPRouteNode(struct httpRouteNode *node)
+{
+	for (size_t i = 0; i < node->childrenc; i++) {
+		destroyHTTPRouteNode(node->children[i]);
+		free(node->children[i]);
+	}
+
+	if (node->param != NULL) {
+		destroyHTTPRouteNode(node->param);
+		free(node->param);
+	}
+
+	if (node->wildcard != NULL) {
+		destroyHTTPRouteNode(node->wildcard);
+		free(node->wildcard);
+	}
+
+	free(node->children);
+	free(node->prefix);
+	free(node->name);
+}
+
+void destroyHTTPRouter(struct httpRouter *router)
+{
+	destroyHTTPRouteNode(&router->root);
+	memset(router, 0, sizeof(struct httpRouter));
+}
+
+/**
+ * Finds static child of @node starting with byte @c.
+ *
+ * @Returns index of the child or the index it should be inserted at, @*found is set if it exists.
+ */
+static size_t findHTTPRouteChild(const struct httpRouteNode *node, unsigned char c, int *found)
+{
+	size_t lo = 0, hi = node->childrenc;
+
+	while (lo < hi) {
+		size_t mid = (lo + hi) / 2;
+		unsigned char mc = node->children[mid]->prefix[0];
+
+		if (mc == c) {
+			*found = 1;
+			return mid;
+		}
+
+		if (mc < c) lo = mid + 1;
+		else hi = mid;
+	}
+
+	*found = 0;
+	return lo;
+}
+
+static struct httpRouteNode *newHTTPRouteNode(const char *prefix, size_t prefixLen)
+{
+	struct httpRouteNode *node = calloc(1, sizeof(struct httpRouteNode));
+	if (node == NULL) return NULL;
+
+	if (prefixLen != 0) {
+		node->prefix = strndup(prefix, prefixLen);
+		if (node->prefix == NULL) {
+			free(node);
+			return NULL;
+		}
+		node->prefixLen = prefixLen;
+	}
+
+	return node;
+}
+
+/**
+ * Splits @node after @k bytes of its prefix: the rest of the node becomes its only child.
+ *
+ * @Returns 0 on success, -1 + errno otherwise.
+ */
+static int splitHTTPRouteNode(struct httpRouteNode *node, size_t k)
+{
+	struct httpRouteNode *rest = newHTTPRouteNode(node->prefix + k, node->prefixLen - k);
+	if (rest == NULL) return -1;
+
+	struct httpRouteNode **children = malloc(sizeof(struct httpRouteNode *));
+	if (children == NULL) {
+		destroyHTTPRouteNode(rest);
+		free(rest);
+		return -1;
+	}
+
+	rest->children = node->children;
+	rest->childrenc = node->childrenc;
+	rest->param = node->param;
+	rest->wildcard = node->wildcard;
+	memcpy(rest->processors, node->processors, sizeof(node->processors));
+
+	children[0] = rest;
+	node->children = children;
+	node->childrenc = 1;
+	node->param = NULL;
+	node->wildcard = NULL;
+	memset(node->processors, 0, sizeof(node->processors));
+
+	node->prefixLen = k;
+	node->prefix[k] = '\0';
+
+	return 0;
+}
+
+/**
+ * Inserts static part @s of @len bytes of pattern below @node.
+ *
+ * @Returns node @s ends at, NULL + errno on failure.
+ */
+static struct httpRouteNode *insertHTTPRouteStatic(struct httpRouteNode *node, const char *s, size_t len)
+{
+	while (len != 0) {
+		int found;
+		size_t idx = findHTTPRouteChild(node, s[0], &found);
+
+		if (!found) {
+			struct httpRouteNode *child = newHTTPRouteNode(s, len);
+			if (child == NULL) return NULL;
+
+			struct httpRouteNode **children = realloc(node->children, (node->childrenc + 1) * sizeof(struct httpRouteNode *));
+			if (children == NULL) {
+				destroyHTTPRouteNode(child);
+				free(child);
+				return NULL;
+			}
+
+			memmove(children + idx + 1, children + idx, (node->childrenc - idx) * sizeof(struct httpRouteNode *));
+			children[idx] = child;
+			node->children = children;
+			node->childrenc++;
+
+			return child;
+		}
+
+		struct httpRouteNode *child = node->children[idx];
+
+		size_t k = 0;
+		while (k < child->prefixLen && k < len && child->prefix[k] == s[k]) k++;
+
+		if (k < child->prefixLen && splitHTTPRouteNode(child, k))
+			return NULL;
+
+		node = child;
+		s += k;
+		len -= k;
+	}
+
+	return node;
+}
+
+/**
+ * Gets parameter or wildcard child @*slot named @name of @len bytes, it is created if there is none.
+ *
+ * @Returns the child, NULL + errno on failure. EINVAL if the child has another name.
+ */
+static struct httpRouteNode *insertHTTPRouteParam(struct httpRouteNode **slot, const char *name, size_t len)
+{
+	if (*slot != NULL) {
+		if ((*slot)->nameLen != len || memcmp((*slot)->name, name, len)) {
+			errno = EINVAL;
+			return NULL;
+		}
+
+		return *slot;
+	}
+
+	struct httpRouteNode *node = newHTTPRouteNode(NULL, 0);
+	if (node == NULL) return NULL;
+
+	node->name = strndup(name, len);
+	if (node->name == NULL) {
+		free(node);
+		return NULL;
+	}
+	node->nameLen = len;
+
+	*slot = node;
+	return node;
+}
+
+int addHTTPRoute(struct httpRouter *router, int method, const char *pattern, httpProcessor_t processor)
+{
+	if (method <= HTTPM_NULL || method >= HTTP_ROUTE_METHODS || processor == NULL || pattern[0] != '/')
+		goto invalid;
+
+	// Parameters are checked before anything is inserted, so lookups never overflow the match.
+	size_t paramsc = 0;
+	for (size_t i = 1; pattern[i] != '\0'; i++)
+		if (pattern[i - 1] == '/' && (pattern[i] == ':' || pattern[i] == '*')) paramsc++;
+
+	if (paramsc > HTTP_MAX_ROUTE_PARAMS) goto invalid;
+
+	struct httpRouteNode *node = &router->root;
+	size_t i = 0;
+
+	while (1) {
+		// Parameters start segments, ':' and '*' inside of segment are plain bytes.
+		size_t j = i;
+		while (pattern[j] != '\0' && !(j != 0 && pattern[j - 1] == '/' && (pattern[j] == ':' || pattern[j] == '*')))
+			j++;
+
+		node = insertHTTPRouteStatic(node, pattern + i, j - i);
+		if (node == NULL) return -1;
+
+		if (pattern[j] == '\0') break;
+
+		size_t k = j + 1;
+		while (pattern[k] != '\0' && pattern[k] != '/') k++;
+		if (k == j + 1) goto invalid;
+
+		if (pattern[j] == '*') {
+			// Wildcard takes the rest of path.
+			if (pattern[k] != '\0') goto invalid;
+
+			node = insertHTTPRouteParam(&node->wildcard, pattern + j + 1, k - j - 1);
+			if (node == NULL) return -1;
+			break;
+		}
+
+		node = insertHTTPRouteParam(&node->param, pattern + j + 1, k - j - 1);
+		if (node == NULL) return -1;
+
+		i = k;
+	}
+
+	if (node->processors[method] != NULL) {
+		errno = EEXIST;
+		return -1;
+	}
+
+	node->processors[method] = processor;
+	router->routesc++;
+
+	return 0;
+invalid:
+	errno = EINVAL;
+	return -1;
+}
+
+static int hasHTTPRouteProcessors(const struct httpRouteNode *node)
+{
+	for (int m = 0; m < HTTP_ROUTE_METHODS; m++)
+		if (node->processors[m] != NULL) return 1;
+
+	return 0;
+}
+
+/**
+ * Matches @path of @len bytes following the prefix of @node. Backtracks from static children to the parameter
+ * and the wildcard.
+ *
+ * @Returns One of HTTPROUTE_ statuses. HTTPROUTE_METHOD is returned only if no route matches with @method.
+ */
+static int matchHTTPRouteNode(const struct httpRouteNode *node, int method, const char *path, size_t len,
+	struct httpRouteMatch *match)
+{
+	int status = HTTPROUTE_NOT_FOUND;
+
+	if (len == 0) {
+		if (node->processors[method] != NULL) {
+			match->processor = node->processors[method];
+			match->node = node;
+			return HTTPROUTE_FOUND;
+		}
+
+		if (hasHTTPRouteProcessors(node)) {
+			match->node = node;
+			status = HTTPROUTE_METHOD;
+		}
+	} else if (node->childrenc != 0) {
+		int found;
+		size_t idx = findHTTPRouteChild(node, path[0], &found);
+		const struct httpRouteNode *child = found ? node->children[idx] : NULL;
+
+		if (child != NULL && child->prefixLen <= len && !memcmp(child->prefix, path, child->prefixLen)) {
+			int st = matchHTTPRouteNode(child, method, path + child->prefixLen, len - child->prefixLen, match);
+			if (st == HTTPROUTE_FOUND) return st;
+			if (st == HTTPROUTE_METHOD) status = st;
+		}
+	}
+
+	if (node->param != NULL && len != 0) {
+		const char *slash = memchr(path, '/', len);
+		size_t seglen = slash != NULL ? (size_t)(slash - path) : len;
+
+		if (seglen != 0) {
+			struct httpRouteParam *param = &match->params[match->paramsc++];
+			param->name = (struct httpSlice){ .ptr = node->param->name, .len = node->param->nameLen };
+			param->value = (struct httpSlice){ .ptr = path, .len = seglen };
+
+			int st = matchHTTPRouteNode(node->param, method, path + seglen, len - seglen, match);
+			if (st == HTTPROUTE_FOUND) return st;
+			if (st == HTTPROUTE_METHOD) status = st;
+
+			match->paramsc--;
+		}
+	}
+
+	if (node->wildcard != NULL) {
+		const struct httpRouteNode *wildcard = node->wildcard;
+
+		if (wildcard->processors[method] != NULL) {
+			struct httpRouteParam *param = &match->params[match->paramsc++];
+			param->name = (struct httpSlice){ .ptr = wildcard->name, .len = wildcard->nameLen };
+			param->value = (struct httpSlice){ .ptr = path, .len = len };
+
+			match->processor = wildcard->processors[method];
+			match->node = wildcard;
+			return HTTPROUTE_FOUND;
+		}
+
+		if (hasHTTPRouteProcessors(wildcard)) {
+			match->node = wildcard;
+			status = HTTPROUTE_METHOD;
+		}
+	}
+
+	return status;
+}
+
+int matchHTTPRoute(const struct httpRouter *router, int method, const char *path, size_t len, struct httpRouteMatch *match)
+{
+	match->processor = NULL;
+	match->node = NULL;
+	match->paramsc = 0;
+
+	if (method <= HTTPM_NULL || method >= HTTP_ROUTE_METHODS) return HTTPROUTE_NOT_FOUND;
+
+	const char *query = memchr(path, '?', len);
+	if (query != NULL) len = query - path;
+
+	return matchHTTPRouteNode(&router->root, method, path, len, match);
+}
+
+/**
+ * Responds with 405 and methods allowed for the path of @node.
+ */
+static void rejectHTTPRouteMethod(const struct httpRouteNode *node, struct HTTPResponse *response)
+{
+	char allow[96];
+	size_t len = 0;
+
+	for (int m = 0; m < HTTP_ROUTE_METHODS; m++) {
+		const char *name = HTTPMethodToString(m);
+		if (node->processors[m] == NULL || name == NULL) continue;
+
+		size_t nlen = strlen(name);
+		if (len + nlen + 3 > sizeof(allow)) break;
+
+		if (len != 0) {
+			memcpy(allow + len, ", ", 2);
+			len += 2;
+		}
+		memcpy(allow + len, name, nlen);
+		len += nlen;
+	}
+	allow[len] = '\0';
+
+	response->status = HttpStatus_MethodNotAllowed;
+	addKVHTTPHeader_p(&response->headers, "Allow", allow);
+}
+
+void routeHTTPRequest(const struct httpRouter *router, struct HTTPRequest *request, struct HTTPResponse *response)
+{
+	const char *path = request->views ? request->pathv.ptr : request->path;
+	size_t len = request->views ? request->pathv.len : strlen(request->path);
+
+	struct httpRouteMatch match;
+	int status = matchHTTPRoute(router, request->method, path, len, &match);
+
+	if (status == HTTPROUTE_FOUND) {
+		request->route = &match;
+		match.processor(request, response);
+		request->route = NULL;
+		return;
+	}
+
+	if (router->fallback != NULL) {
+		router->fallback(request, response);
+		return;
+	}
+
+	if (status == HTTPROUTE_METHOD) rejectHTTPRouteMethod(match.node, response);
+	else response->status = HttpStatus_NotFound;
+}
+
+const char *getHTTPRequestParam(struct HTTPRequest *request, const char *name, size_t *len)
+{
+	const struct httpRouteMatch *match = request->route;
+	if (match == NULL) return NULL;
+
+	size_t nlen = strlen(name);
+	for (size_t i = 0; i < match->paramsc; i++) {
+		const struct httpRouteParam *param = &match->params[i];
+
+		if (param->name.len == nlen && !memcmp(param->name.ptr, name, nlen)) {
+			if (len != NULL) *len = param->value.len;
+			return param->value.ptr;
+		}
+	}
+
+	return NULL;
+}
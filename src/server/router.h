@@ -0,0 +1,120 @@
+#ifndef ROUTER_H
+#define ROUTER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include "http.h"
+
+/**
+ * Count of method slots of route: HTTPM_ defines are below it.
+ */
+#define HTTP_ROUTE_METHODS (HTTPM_PATCH + 1)
+
+#ifndef HTTP_MAX_ROUTE_PARAMS
+/**
+ * Maximum count of parameters captured by one route.
+ */
+#define HTTP_MAX_ROUTE_PARAMS 8
+#endif
+
+/**
+ * Node of router radix tree. Static children are compressed: each holds the longest common prefix of its routes,
+ * first bytes of siblings differ. Parameter and wildcard children match path segments instead of bytes.
+ */
+struct httpRouteNode {
+	char *prefix;
+	size_t prefixLen;
+
+	// Static children sorted by the first byte of prefix.
+	struct httpRouteNode **children;
+	size_t childrenc;
+
+	// ":name" child matches one non-empty segment, "*name" child matches the rest of path.
+	struct httpRouteNode *param;
+	struct httpRouteNode *wildcard;
+	// Name of parameter or wildcard node.
+	char *name;
+	size_t nameLen;
+
+	// Processors of route ending at this node by method, NULL if there is no route.
+	httpProcessor_t processors[HTTP_ROUTE_METHODS];
+};
+
+/**
+ * Maps method + path patterns to processors. Routes are added before the server is started:
+ * lookups are not synchronized with additions.
+ */
+struct httpRouter {
+	struct httpRouteNode root;
+	size_t routesc;
+
+	// Processor of requests matching no route, 404 response is sent if it is NULL.
+	httpProcessor_t fallback;
+};
+
+struct httpRouteParam {
+	struct httpSlice name;
+	struct httpSlice value;
+};
+
+/**
+ * Result of route lookup. Parameters are slices of the pattern and the request path, nothing is allocated.
+ */
+struct httpRouteMatch {
+	httpProcessor_t processor;
+	// Node the path ends at, set on HTTPROUTE_FOUND and HTTPROUTE_METHOD: its processors tell the allowed methods.
+	const struct httpRouteNode *node;
+	struct httpRouteParam params[HTTP_MAX_ROUTE_PARAMS];
+	size_t paramsc;
+};
+
+/**
+ * Statuses of matchHTTPRoute().
+ */
+#define HTTPROUTE_FOUND 0
+#define HTTPROUTE_NOT_FOUND 1
+// Path matches a route, but not with the request method.
+#define HTTPROUTE_METHOD 2
+
+int initHTTPRouter(struct httpRouter *router);
+
+void destroyHTTPRouter(struct httpRouter *router);
+
+/**
+ * Adds route of @method and @pattern. Pattern is an absolute path, its segments may be
+ * ":name" parameters matching one segment. The last segment may be "*name" wildcard matching the rest of path.
+ *
+ * @Returns 0 on success, -1 + errno otherwise. EINVAL on malformed pattern or parameter name conflicting
+ * with the existing route, EEXIST if the route is added already.
+ */
+int addHTTPRoute(struct httpRouter *router, int method, const char *pattern, httpProcessor_t processor);
+
+/**
+ * Finds route of @method and @path of @len bytes (query is ignored). Static segments take precedence
+ * over parameters and parameters over wildcards.
+ *
+ * @Returns One of HTTPROUTE_ statuses, @match is set on HTTPROUTE_FOUND (only its node on HTTPROUTE_METHOD).
+ */
+int matchHTTPRoute(const struct httpRouter *router, int method, const char *path, size_t len, struct httpRouteMatch *match);
+
+/**
+ * Processes @request by the processor of its route. The route is available to the processor by request->route.
+ * Responds with 404 or 405 (along with Allow header) if there is no route and no fallback.
+ */
+void routeHTTPRequest(const struct httpRouter *router, struct HTTPRequest *request, struct HTTPResponse *response);
+
+/**
+ * @Returns value of route parameter @name of the processed request (not null-terminated), NULL if there is none.
+ *
+ * @len Length of the value. May be NULL.
+ */
+const char *getHTTPRequestParam(struct HTTPRequest *request, const char *name, size_t *len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ROUTER_H */
@@ -0,0 +1,328 @@
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include "scan.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HTTP_SCAN_X86 1
+#include <immintrin.h>
+#endif
+
+#define CHAR_TOKEN 1
+#define CHAR_TARGET 2
+#define CHAR_VALUE 4
+
+/**
+ * Classes of bytes, CHAR_ flags.
+ */
+static unsigned char charClass[256];
+
+/**
+ * Nibble tables of token characters: byte is a token character
+ * if tokenLo[byte & 0xF] & tokenHi[byte >> 4] is non-zero. Repeated twice for 256-bit lanes.
+ */
+static unsigned char tokenLo[32] __attribute__((aligned(32)));
+static unsigned char tokenHi[32] __attribute__((aligned(32)));
+
+static const struct httpScanner *activeScanner;
+static pthread_once_t scannerOnce = PTHREAD_ONCE_INIT;
+
+/**
+ * @Returns offset of the first byte of @buf without class @cls, or @len.
+ */
+static size_t scanClass(const char *buf, size_t len, unsigned char cls)
+{
+	const unsigned char *p = (const unsigned char *)buf;
+
+	size_t i = 0;
+	for (; i + 4 <= len; i += 4) {
+		if (!(charClass[p[i]] & cls)) return i;
+		if (!(charClass[p[i + 1]] & cls)) return i + 1;
+		if (!(charClass[p[i + 2]] & cls)) return i + 2;
+		if (!(charClass[p[i + 3]] & cls)) return i + 3;
+	}
+
+	for (; i < len; i++)
+		if (!(charClass[p[i]] & cls)) return i;
+
+	return len;
+}
+
+static size_t scalarToken(const char *buf, size_t len)
+{
+	return scanClass(buf, len, CHAR_TOKEN);
+}
+
+static size_t scalarTarget(const char *buf, size_t len)
+{
+	return scanClass(buf, len, CHAR_TARGET);
+}
+
+static size_t scalarValue(const char *buf, size_t len)
+{
+	return scanClass(buf, len, CHAR_VALUE);
+}
+
+static const struct httpScanner scalarScanner = {
+	.name = "scalar",
+	.token = scalarToken,
+	.target = scalarTarget,
+	.value = scalarValue,
+};
+
+#ifdef HTTP_SCAN_X86
+
+/**
+ * Byte ranges matched by pcmpestri: pairs of the first and the last byte of range.
+ * Token ranges are wider than non-token characters ('!' is included), so matches are checked by charClass.
+ */
+static const char tokenRanges[16] = "\x00\x22()\x2c\x2c//:@[]{}\x7f\xff";
+static const char targetRanges[16] = "\x00\x20\x7f\x7f";
+static const char valueRanges[16] = "\x00\x08\x0a\x1f\x7f\x7f";
+
+/**
+ * Scans @buf by 16-byte blocks for the first byte in @ranges that has no class @cls.
+ */
+__attribute__((target("sse4.2")))
+static size_t sse42Scan(const char *buf, size_t len, const char *ranges, int rangesLen, unsigned char cls)
+{
+	__m128i r = _mm_loadu_si128((const __m128i *)ranges);
+
+	size_t i = 0;
+	while (i + 16 <= len) {
+		__m128i b = _mm_loadu_si128((const __m128i *)(buf + i));
+		int idx = _mm_cmpestri(r, rangesLen, b, 16, _SIDD_UBYTE_OPS | _SIDD_CMP_RANGES | _SIDD_LEAST_SIGNIFICANT);
+
+		if (idx == 16) {
+			i += 16;
+			continue;
+		}
+
+		if (!(charClass[(unsigned char)buf[i + idx]] & cls))
+			return i + idx;
+
+		i += idx + 1;
+	}
+
+	return i + scanClass(buf + i, len - i, cls);
+}
+
+static size_t sse42Token(const char *buf, size_t len)
+{
+	return sse42Scan(buf, len, tokenRanges, 16, CHAR_TOKEN);
+}
+
+static size_t sse42Target(const char *buf, size_t len)
+{
+	return sse42Scan(buf, len, targetRanges, 4, CHAR_TARGET);
+}
+
+static size_t sse42Value(const char *buf, size_t len)
+{
+	return sse42Scan(buf, len, valueRanges, 6, CHAR_VALUE);
+}
+
+static const struct httpScanner sse42Scanner = {
+	.name = "sse4.2",
+	.token = sse42Token,
+	.target = sse42Target,
+	.value = sse42Value,
+};
+
+/**
+ * Token characters of 32-byte block: nibble classification with two shuffles.
+ *
+ * @Returns mask of bytes that are not token characters.
+ */
+__attribute__((target("avx2")))
+static unsigned avx2TokenMask(__m256i v)
+{
+	const __m256i lo = _mm256_load_si256((const __m256i *)tokenLo);
+	const __m256i hi = _mm256_load_si256((const __m256i *)tokenHi);
+	const __m256i nibble = _mm256_set1_epi8(0x0f);
+
+	__m256i lon = _mm256_and_si256(v, nibble);
+	__m256i hin = _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble);
+	__m256i cls = _mm256_and_si256(_mm256_shuffle_epi8(lo, lon), _mm256_shuffle_epi8(hi, hin));
+
+	return _mm256_movemask_epi8(_mm256_cmpeq_epi8(cls, _mm256_setzero_si256()));
+}
+
+/**
+ * Same as avx2TokenMask() for 16-byte block.
+ */
+__attribute__((target("avx2")))
+static unsigned avx2TokenMask16(__m128i v)
+{
+	const __m128i lo = _mm_load_si128((const __m128i *)tokenLo);
+	const __m128i hi = _mm_load_si128((const __m128i *)tokenHi);
+	const __m128i nibble = _mm_set1_epi8(0x0f);
+
+	__m128i lon = _mm_and_si128(v, nibble);
+	__m128i hin = _mm_and_si128(_mm_srli_epi16(v, 4), nibble);
+	__m128i cls = _mm_and_si128(_mm_shuffle_epi8(lo, lon), _mm_shuffle_epi8(hi, hin));
+
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(cls, _mm_setzero_si128()));
+}
+
+/**
+ * Control characters of 32-byte block: bytes below @ctlEnd (signed compare excludes bytes above 0x7f) and DEL.
+ * HTAB is allowed if @tab is set.
+ *
+ * @Returns mask of control characters.
+ */
+__attribute__((target("avx2")))
+static unsigned avx2CtlMask(__m256i v, char ctlEnd, int tab)
+{
+	__m256i ctl = _mm256_and_si256(
+		_mm256_cmpgt_epi8(v, _mm256_set1_epi8(-1)),
+		_mm256_cmpgt_epi8(_mm256_set1_epi8(ctlEnd), v));
+
+	if (tab) ctl = _mm256_andnot_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t')), ctl);
+
+	ctl = _mm256_or_si256(ctl, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(0x7f)));
+
+	return _mm256_movemask_epi8(ctl);
+}
+
+__attribute__((target("avx2")))
+static unsigned avx2CtlMask16(__m128i v, char ctlEnd, int tab)
+{
+	__m128i ctl = _mm_and_si128(
+		_mm_cmpgt_epi8(v, _mm_set1_epi8(-1)),
+		_mm_cmpgt_epi8(_mm_set1_epi8(ctlEnd), v));
+
+	if (tab) ctl = _mm_andnot_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\t')), ctl);
+
+	ctl = _mm_or_si128(ctl, _mm_cmpeq_epi8(v, _mm_set1_epi8(0x7f)));
+
+	return _mm_movemask_epi8(ctl);
+}
+
+__attribute__((target("avx2")))
+static size_t avx2Token(const char *buf, size_t len)
+{
+	size_t i = 0;
+	for (; i + 32 <= len; i += 32) {
+		unsigned m = avx2TokenMask(_mm256_loadu_si256((const __m256i *)(buf + i)));
+		if (m) return i + __builtin_ctz(m);
+	}
+
+	if (i + 16 <= len) {
+		unsigned m = avx2TokenMask16(_mm_loadu_si128((const __m128i *)(buf + i)));
+		if (m) return i + __builtin_ctz(m);
+		i += 16;
+	}
+
+	return i + scanClass(buf + i, len - i, CHAR_TOKEN);
+}
+
+__attribute__((target("avx2")))
+static size_t avx2Ctl(const char *buf, size_t len, char ctlEnd, int tab, unsigned char cls)
+{
+	size_t i = 0;
+	for (; i + 32 <= len; i += 32) {
+		unsigned m = avx2CtlMask(_mm256_loadu_si256((const __m256i *)(buf + i)), ctlEnd, tab);
+		if (m) return i + __builtin_ctz(m);
+	}
+
+	if (i + 16 <= len) {
+		unsigned m = avx2CtlMask16(_mm_loadu_si128((const __m128i *)(buf + i)), ctlEnd, tab);
+		if (m) return i + __builtin_ctz(m);
+		i += 16;
+	}
+
+	return i + scanClass(buf + i, len - i, cls);
+}
+
+static size_t avx2Target(const char *buf, size_t len)
+{
+	return avx2Ctl(buf, len, 0x21, 0, CHAR_TARGET);
+}
+
+static size_t avx2Value(const char *buf, size_t len)
+{
+	return avx2Ctl(buf, len, 0x20, 1, CHAR_VALUE);
+}
+
+static const struct httpScanner avx2Scanner = {
+	.name = "avx2",
+	.token = avx2Token,
+	.target = avx2Target,
+	.value = avx2Value,
+};
+
+#endif /* HTTP_SCAN_X86 */
+
+static void initScanner(void)
+{
+	const char *tokenSpecials = "!#$%&'*+-.^_`|~";
+
+	for (int c = 0; c < 256; c++) {
+		unsigned char cls = 0;
+
+		if (c > 0x20 && c != 0x7f) cls |= CHAR_TARGET;
+		if ((c >= 0x20 || c == '\t') && c != 0x7f) cls |= CHAR_VALUE;
+
+		if (	(c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+			(c != 0 && c < 0x80 && strchr(tokenSpecials, c) != NULL))
+			cls |= CHAR_TOKEN;
+
+		charClass[c] = cls;
+	}
+
+	for (int hi = 0; hi < 8; hi++) {
+		tokenHi[hi] = tokenHi[hi + 16] = 1 << hi;
+
+		for (int lo = 0; lo < 16; lo++)
+			if (charClass[(hi << 4) | lo] & CHAR_TOKEN) {
+				tokenLo[lo] |= 1 << hi;
+				tokenLo[lo + 16] |= 1 << hi;
+			}
+	}
+
+	activeScanner = &scalarScanner;
+
+#ifdef HTTP_SCAN_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) activeScanner = &avx2Scanner;
+	else if (__builtin_cpu_supports("sse4.2")) activeScanner = &sse42Scanner;
+#endif
+}
+
+const struct httpScanner *httpScanner(void)
+{
+	pthread_once(&scannerOnce, initScanner);
+
+	return __atomic_load_n(&activeScanner, __ATOMIC_ACQUIRE);
+}
+
+const struct httpScanner *httpScannerImpl(int impl)
+{
+	pthread_once(&scannerOnce, initScanner);
+
+	switch (impl) {
+	case HTTP_SCAN_SCALAR:
+		return &scalarScanner;
+#ifdef HTTP_SCAN_X86
+	case HTTP_SCAN_SSE42:
+		return __builtin_cpu_supports("sse4.2") ? &sse42Scanner : NULL;
+	case HTTP_SCAN_AVX2:
+		return __builtin_cpu_supports("avx2") ? &avx2Scanner : NULL;
+#endif
+	default:
+		return NULL;
+	}
+}
+
+int httpSelectScanner(int impl)
+{
+	const struct httpScanner *scanner = httpScannerImpl(impl);
+	if (scanner == NULL) {
+		errno = ENOTSUP;
+		return -1;
+	}
+
+	__atomic_store_n(&activeScanner, scanner, __ATOMIC_RELEASE);
+	return 0;
+}
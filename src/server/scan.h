@@ -0,0 +1,60 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+
+/**
+ * Implementations of HTTP scanner. Vectorized ones are available only if CPU supports them.
+ */
+#define HTTP_SCAN_SCALAR 0
+#define HTTP_SCAN_SSE42 1
+#define HTTP_SCAN_AVX2 2
+#define HTTP_SCAN_COUNT 3
+
+/**
+ * Scanner of HTTP request head. Each function scans @len bytes of @buf by blocks
+ * and returns offset of the first byte not allowed in the scanned element, or @len if all bytes are allowed.
+ */
+struct httpScanner {
+	const char *name;
+
+	/**
+	 * Token characters (tchar of RFC 9110): method and header name. Stops at SP or ':'.
+	 */
+	size_t (*token)(const char *buf, size_t len);
+	/**
+	 * Request target: anything except CTL and SP. Stops at SP before HTTP version.
+	 */
+	size_t (*target)(const char *buf, size_t len);
+	/**
+	 * Field value or request line: anything except CTL, HTAB is allowed. Stops at CR or LF.
+	 */
+	size_t (*value)(const char *buf, size_t len);
+};
+
+/**
+ * @Returns the scanner used by HTTP parser. The fastest one supported by CPU is chosen on the first call.
+ */
+const struct httpScanner *httpScanner(void);
+
+/**
+ * @Returns scanner implementation @impl (one of HTTP_SCAN_ defines) or NULL if CPU does not support it.
+ */
+const struct httpScanner *httpScannerImpl(int impl);
+
+/**
+ * Makes HTTP parser use scanner implementation @impl. Used by tests and benchmarks.
+ *
+ * @Returns 0 on success, -1 + errno otherwise. ENOTSUP if CPU does not support it.
+ */
+int httpSelectScanner(int impl);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SCAN_H */
@@ -7,11 +7,23 @@
 #include <string.h>
 #include <unistd.h>
 #include <signal.h>
+#include <fcntl.h>
 #include <pthread.h>      
+#include <sched.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
+#include <linux/filter.h>
 #include "utils.h"
 #include "server.h"
+#include "eventloop.h"
+#include "uring.h"
+#include "pool.h"
+#include "timer.h"
+#include "handoff.h"
 
 #ifndef LISTEN_BACKLOG
 /**
@@ -20,6 +32,20 @@
 #define LISTEN_BACKLOG 1000
 #endif
 
+#ifndef MAX_CONNECTIONS
+/**
+* Capacity of connections table: maximum count of simultaneously served blocking connections.
+*/
+#define MAX_CONNECTIONS 65536
+#endif
+
+#ifndef PARK_MAX_EVENTS
+/**
+* Count of parked connections submitted to the pool per epoll_wait(2) of the parker.
+*/
+#define PARK_MAX_EVENTS 64
+#endif
+
 /**
 * Global variable that maintains multiple ApplicationContexts. Used for fast close of an entire application 
 * which may contain multiple Servers on.
@@ -27,7 +53,8 @@
 struct vector registeredApplications;
 
 /**
-* Specifies basic thread attributes for connection and socket threads.
+* Specifies basic thread attributes for connection threads: joinable, so closeServer() can wait for
+* the forcibly closed ones. Other connection threads detach themselves.
 */
 pthread_attr_t baseThreadAttr;
 
@@ -37,7 +64,7 @@ pthread_attr_t baseThreadAttr;
 int initApplication() {
 
 	if (	pthread_attr_init(&baseThreadAttr) || 
-		pthread_attr_setdetachstate(&baseThreadAttr, PTHREAD_CREATE_DETACHED)) {
+		pthread_attr_setdetachstate(&baseThreadAttr, PTHREAD_CREATE_JOINABLE)) {
 
 		perror("Unable to init attrs");
 		goto error;
@@ -57,14 +84,22 @@ int initContext(struct ApplicationContext *context, connhandler_t connhander, vo
 	memset(context, 0, sizeof(struct ApplicationContext));
 	if (	initVector(&context->socks, 2) ||
 		initVector(&context->socksThreads, 2) || 
-		initVector(&context->conns, 2) || 
-		pthread_mutex_init(&context->closeLock, NULL)) {
+		initSlotTable(&context->conns, sizeof(struct connData), MAX_CONNECTIONS) || 
+		pthread_mutex_init(&context->closeLock, NULL) ||
+		pthread_mutex_init(&context->timersLock, NULL) ||
+		pthread_cond_init(&context->timersCond, NULL) ||
+		pthread_mutex_init(&context->drainLock, NULL) ||
+		pthread_cond_init(&context->drainCond, NULL) ||
+		sem_init(&context->listenersExited, 0, 0)) {
 
 		goto error;
 	}
 
 	context->connhandler = connhander;
 	context->connhandlerArgs = connhandlerArgs;
+	context->parkfd = -1;
+	context->parkWakefd = -1;
+	context->takeoverFd = -1;
 
 	return 0;
 
@@ -72,10 +107,224 @@ error:
 	return -1;
 }
 
-int startServer(struct ApplicationContext *context)
+int contextSetEventHandler(struct ApplicationContext *context, connevhandler_t connevhandler)
+{
+	if (connevhandler == NULL) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	context->connevhandler = connevhandler;
+	return 0;
+}
+
+static int onlineCPUs()
+{
+	long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	return ncpu > 0 ? ncpu : 1;
+}
+
+static void pinThread(pthread_t thr, int cpu)
+{
+	cpu_set_t cpus;
+	CPU_ZERO(&cpus);
+	CPU_SET(cpu % onlineCPUs(), &cpus);
+
+	int err = pthread_setaffinity_np(thr, sizeof(cpus), &cpus);
+	if (err) 
+		fprintf(stderr, "Unable to pin thread to CPU %d: %s\n", cpu, strerror(err));
+}
+
+/**
+ * Splits each TCP socket of the context into @shards SO_REUSEPORT sockets.
+ * Sockets are listen(2)-ed in the order of shards, so index of socket in reuseport group is its CPU.
+ */
+static int shardSockets(struct ApplicationContext *context, int shards, int steer)
+{
+	size_t sz = context->socks.size;
+
+	for (size_t i = 0; i < sz; i++) {
+		struct ssock *sock = vectorGetEl(&context->socks, i);
+		if (sock == NULL || sock->cpu != -1 || sock->addr->sa_family != AF_INET) continue;
+
+		sock->cpu = 0;
+		if (listen(sock->fd, LISTEN_BACKLOG)) {
+			perror("Unable to listen socket");
+			goto error;
+		}
+
+		for (int cpu = 1; cpu < shards; cpu++) {
+			struct ssock shard;
+			if (createReuseportShard(&shard, sock, cpu)) 
+				goto error;
+
+			if (listen(shard.fd, LISTEN_BACKLOG)) {
+				perror("Unable to listen socket");
+				close(shard.fd);
+				free(shard.addr);
+				goto error;
+			}
+
+			contextRegisterSocket(context, shard);
+		}
+
+		if (steer && attachReuseportCPUSteering(sock->fd))
+			perror("Unable to attach reuseport CPU steering program");
+	}
+
+	return 0;
+error:
+	return -1;
+}
+
+/**
+ * Thread callback that expires deadlines of blocking connections.
+ */
+static void *timersRunner(void *rawcontext)
+{
+	struct ApplicationContext *context = rawcontext;
+
+	pthread_mutex_lock(&context->timersLock);
+
+	while (!context->timersStop) {
+		pthread_mutex_unlock(&context->timersLock);
+
+		uint64_t now = timerNow();
+		int timeout = TIMER_TICK_MS;
+
+		for (size_t i = 0; i < context->timersc; i++) {
+			struct timerShard *shard = context->timers + i;
+
+			pthread_mutex_lock(&shard->lock);
+			timerWheelAdvance(&shard->wheel, now);
+			int shardTimeout = timerWheelTimeout(&shard->wheel, now);
+			pthread_mutex_unlock(&shard->lock);
+
+			if (shardTimeout >= 0 && shardTimeout < timeout) timeout = shardTimeout;
+		}
+
+		pthread_mutex_lock(&context->timersLock);
+		if (context->timersStop) break;
+
+		struct timespec ts;
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_sec += timeout / 1000;
+		ts.tv_nsec += (long)(timeout % 1000) * 1000000;
+		if (ts.tv_nsec >= 1000000000) {
+			ts.tv_sec++;
+			ts.tv_nsec -= 1000000000;
+		}
+
+		pthread_cond_timedwait(&context->timersCond, &context->timersLock, &ts);
+	}
+
+	pthread_mutex_unlock(&context->timersLock);
+
+	return NULL;
+}
+
+/**
+ * Frees the first @count shards of deadlines.
+ */
+static void freeTimers(struct ApplicationContext *context, size_t count)
+{
+	for (size_t i = 0; i < count; i++)
+		pthread_mutex_destroy(&context->timers[i].lock);
+
+	free(context->timers);
+	context->timers = NULL;
+	context->timersc = 0;
+}
+
+static int startTimers(struct ApplicationContext *context)
+{
+	size_t shards = onlineCPUs();
+	context->timers = malloc(sizeof(struct timerShard) * shards);
+	if (context->timers == NULL) return -1;
+
+	uint64_t now = timerNow();
+	for (size_t i = 0; i < shards; i++) {
+		int err = pthread_mutex_init(&context->timers[i].lock, NULL);
+		if (err != 0) {
+			freeTimers(context, i);
+			errno = err;
+			return -1;
+		}
+
+		initTimerWheel(&context->timers[i].wheel, now);
+	}
+	context->timersc = shards;
+
+	const struct ConnTimeouts *t = &context->timeouts;
+	if (t->idle == 0 && t->head == 0 && t->bodyMinRate == 0)
+		return 0;
+
+	if (pthread_create(&context->timersThread, NULL, timersRunner, context)) {
+		perror("Unable to create thread");
+		freeTimers(context, shards);
+		return -1;
+	}
+	context->timersRunning = 1;
+
+	return 0;
+}
+
+// Parker thread callback, defined along with the connections it closes on failure.
+static void *parkRunner(void *rawcontext);
+
+/**
+ * Creates epoll of parked connections and starts the parker thread.
+ *
+ * @Returns 0 on success, -1 + errno otherwise.
+ */
+static int startParker(struct ApplicationContext *context)
+{
+	context->parkFailed = 0;
+	context->parkfd = epoll_create1(EPOLL_CLOEXEC);
+	if (context->parkfd == -1) return -1;
+
+	context->parkWakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	struct epoll_event ev = { .events = EPOLLIN, .data.u64 = SLOTHANDLE_INVAL };
+	if (	context->parkWakefd == -1 ||
+		epoll_ctl(context->parkfd, EPOLL_CTL_ADD, context->parkWakefd, &ev) ||
+		pthread_create(&context->parkThread, NULL, parkRunner, context)) {
+
+		int err = errno;
+		if (context->parkWakefd != -1) close(context->parkWakefd);
+		close(context->parkfd);
+		context->parkfd = -1;
+		context->parkWakefd = -1;
+		errno = err;
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * Stops the parker thread. No connections should be parked.
+ */
+static void stopParker(struct ApplicationContext *context)
+{
+	uint64_t one = 1;
+	if (write(context->parkWakefd, &one, sizeof(one)) == -1)
+		perror("Unable to wake parker");
+
+	pthread_join(context->parkThread, NULL);
+
+	close(context->parkWakefd);
+	close(context->parkfd);
+	context->parkfd = -1;
+	context->parkWakefd = -1;
+}
+
+static int startThreadsServer(struct ApplicationContext *context)
 {
 	size_t sz = context->socks.size;
 
+	if (startTimers(context))
+		goto error;
+
 	for (size_t i = 0; i < sz; i++) {
 		struct SocketListenerContext *slContext = malloc(sizeof(struct SocketListenerContext));
 		slContext->context = context;
@@ -83,23 +332,192 @@ int startServer(struct ApplicationContext *context)
 
 		pthread_t *thr = malloc(sizeof(pthread_t));
 
+		__atomic_add_fetch(&context->listening, 1, __ATOMIC_ACQ_REL);
+
 		if (pthread_create(thr, NULL, socketListener, slContext)) {
 			perror("Unable to create thread");
+			__atomic_sub_fetch(&context->listening, 1, __ATOMIC_ACQ_REL);
 			goto error;
 		}
 
+		struct ssock *sock = vectorGetEl(&context->socks, i);
+		// Connection threads inherit affinity of the listener, so connections stay on the CPU.
+		if (context->pinThreads && sock != NULL && sock->cpu != -1)
+			pinThread(*thr, sock->cpu);
+
 		insertVector(&context->socksThreads, thr);
 	}
 
-	for (size_t i = 0; i < context->socksThreads.size; i++) {
-		pthread_t *thr = vectorGetEl(&context->socksThreads, i);
-		if (thr == NULL) continue;
-		
-		pthread_join(*thr, NULL);
+	// Predecessor stops accepting only once the listeners run.
+	if (contextCommitTakeover(context))
+		perror("Unable to commit takeover");
+
+	setCloseSignalsBlocked(0);
+
+	// Listeners are joined by closeServer(), which may run concurrently.
+	while (__atomic_load_n(&context->listening, __ATOMIC_ACQUIRE) != 0)
+		sem_wait(&context->listenersExited);
+
+	return 0;
+error:
+	setCloseSignalsBlocked(0);
+	return -1;
+}
+
+static int startLoopsServer(struct ApplicationContext *context, int mode, int threads)
+{
+	if (context->connevhandler == NULL) {
+		fprintf(stderr, "Event handler is not set for the event-driven server\n");
+		errno = EINVAL;
+		goto error;
+	}
+
+	for (size_t i = 0; i < context->socks.size; i++) {
+		struct ssock *sock = vectorGetEl(&context->socks, i);
+		if (sock == NULL) continue;
+
+		int flags = fcntl(sock->fd, F_GETFL);
+		if (	listen(sock->fd, LISTEN_BACKLOG) || flags == -1 ||
+			fcntl(sock->fd, F_SETFL, flags | O_NONBLOCK)) {
+
+			perror("Unable to listen socket");
+			goto error;
+		}
+	}
+
+	struct eventLoop *loops = calloc(threads, sizeof(struct eventLoop));
+	if (loops == NULL) goto error;
+
+	// Copy of thread ids: closeServer() may deallocate loops while we are joining.
+	pthread_t *thrs = malloc(sizeof(pthread_t) * threads);
+	if (thrs == NULL) {
+		free(loops);
+		goto error;
+	}
+
+	size_t started = 0;
+	for (; started < threads; started++) {
+		struct eventLoop *loop = loops + started;
+
+		int status = mode == SERVER_MODE_URING ? 
+			initUringEventLoop(loop, context, started) : initEventLoop(loop, context, started);
+		if (status) {
+			perror("Unable to init event loop");
+			break;
+		}
+
+		void *(*runner)(void *) = mode == SERVER_MODE_URING ? uringLoopRunner : eventLoopRunner;
+		if (pthread_create(&loop->thread, NULL, runner, loop)) {
+			perror("Unable to create thread");
+			destroyEventLoop(loop);
+			break;
+		}
+
+		if (context->pinThreads)
+			pinThread(loop->thread, started);
+
+		thrs[started] = loop->thread;
 	}
 
+	context->loops = loops;
+	context->loopsc = started;
+
+	if (started != threads) {
+		free(thrs);
+		goto error;
+	}
+
+	// Predecessor stops accepting only once the loops run.
+	if (contextCommitTakeover(context))
+		perror("Unable to commit takeover");
+
+	setCloseSignalsBlocked(0);
+
+	for (size_t i = 0; i < started; i++)
+		pthread_join(thrs[i], NULL);
+
+	free(thrs);
+
 	return 0;
 error:
+	setCloseSignalsBlocked(0);
+	return -1;
+}
+
+/**
+ * Applies default to ServerOptions timeout: 0 means default, negative value means disabled (0).
+ */
+static int resolveTimeout(int value, int def)
+{
+	if (value == 0) return def;
+	if (value < 0) return 0;
+	return value;
+}
+
+int startServer(struct ApplicationContext *context, const struct ServerOptions *options)
+{
+	struct ServerOptions opts = { .mode = SERVER_MODE_THREADS };
+	if (options != NULL) opts = *options;
+
+	int mode = opts.mode;
+	if (mode == SERVER_MODE_URING && !uringSupported()) {
+		fprintf(stderr, "io_uring backend is not supported by the kernel, falling back to epoll\n");
+		mode = SERVER_MODE_EPOLL;
+	}
+
+	context->mode = mode;
+	context->pinThreads = opts.pinThreads;
+
+	context->timeouts = opts.timeouts;
+	context->timeouts.idle = resolveTimeout(opts.timeouts.idle, CONN_IDLE_TIMEOUT);
+	context->timeouts.head = resolveTimeout(opts.timeouts.head, CONN_HEAD_TIMEOUT);
+	context->timeouts.bodyMinRate = resolveTimeout(opts.timeouts.bodyMinRate, CONN_BODY_MIN_RATE);
+	context->timeouts.bodyGrace = resolveTimeout(opts.timeouts.bodyGrace, CONN_BODY_GRACE);
+	context->drainTimeout = resolveTimeout(opts.drainTimeout, CONN_DRAIN_TIMEOUT);
+	context->inputLimit = opts.inputLimit != 0 ? opts.inputLimit : CONN_INPUT_LIMIT;
+
+	int threads = opts.threads > 0 ? opts.threads : onlineCPUs();
+	int eventDriven = mode == SERVER_MODE_EPOLL || mode == SERVER_MODE_URING;
+
+	if (opts.reuseport) {
+		// Each event loop owns a shard, blocking listeners get a shard per core.
+		int shards = eventDriven ? threads : onlineCPUs();
+		if (shardSockets(context, shards, opts.steerCPU))
+			return -1;
+	}
+
+	// Server threads inherit the mask. Unblocked by the runners before they wait for the threads.
+	setCloseSignalsBlocked(1);
+
+	if (mode == SERVER_MODE_THREADS) {
+		return startThreadsServer(context);
+	} else if (mode == SERVER_MODE_POOL) {
+		struct workerPool *pool = malloc(sizeof(struct workerPool));
+		if (pool == NULL) goto error;
+
+		if (initWorkerPool(pool, threads)) {
+			perror("Unable to init worker pool");
+			free(pool);
+			goto error;
+		}
+
+		context->pool = pool;
+
+		if (startParker(context)) {
+			perror("Unable to start parker");
+			goto error;
+		}
+
+		return startThreadsServer(context);
+	} else if (eventDriven) {
+		return startLoopsServer(context, mode, threads);
+	} else {
+		errno = EINVAL;
+		goto error;
+	}
+
+error:
+	setCloseSignalsBlocked(0);
 	return -1;
 }
 
@@ -121,6 +539,7 @@ int createSocket(struct ssock *res, struct isock sockdata)
 	res->fd = fd;
 	res->addr = sockdata.addr;
 	res->addrlen = sockdata.addrlen;
+	res->cpu = -1;
 
 	return 0;
 error:
@@ -237,6 +656,60 @@ error:
 
 
 
+int createReuseportShard(struct ssock *res, const struct ssock *sock, int cpu)
+{
+	struct sockaddr *addr = malloc(sock->addrlen);
+	if (addr == NULL) goto error;
+	memcpy(addr, sock->addr, sock->addrlen);
+
+	struct isock sockdata = {
+		.socket_family = addr->sa_family,
+		.socket_type = SOCK_STREAM,
+		.protocol = 0,
+		.addr = addr,
+		.addrlen = sock->addrlen
+	};
+
+	if (createSocket(res, sockdata)) {
+		free(addr);
+		goto error;
+	}
+
+	int reuse = 1;
+	if (
+		setsockopt(res->fd, SOL_SOCKET, SO_REUSEADDR, (const char *)&reuse, sizeof(reuse)) ||
+		setsockopt(res->fd, SOL_SOCKET, SO_REUSEPORT, (const char *)&reuse, sizeof(reuse)) || 
+		bindSocket(*res)
+	) {
+		int err = errno;
+		close(res->fd);
+		free(addr);
+		errno = err;
+		goto error;
+	}
+
+	res->cpu = cpu;
+
+	return 0;
+error:
+	return -1;
+}
+
+int attachReuseportCPUSteering(int fd)
+{
+	// Returns index of socket in reuseport group: the CPU which handles the packet.
+	struct sock_filter code[] = {
+		{ BPF_LD | BPF_W | BPF_ABS, 0, 0, SKF_AD_OFF + SKF_AD_CPU },
+		{ BPF_RET | BPF_A, 0, 0, 0 },
+	};
+	struct sock_fprog prog = {
+		.len = sizeof(code) / sizeof(code[0]),
+		.filter = code
+	};
+
+	return setsockopt(fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog));
+}
+
 int contextRegisterSocket(struct ApplicationContext *context, struct ssock sock)
 {
 	struct ssock *sockp = malloc(sizeof(struct ssock));
@@ -247,44 +720,443 @@ int contextRegisterSocket(struct ApplicationContext *context, struct ssock sock)
 	return 0;
 }
 
-void *connListener(void *rawCLContext)
+int contextHasUnixSocket(struct ApplicationContext *context, const char *sockpath)
 {
-	if (rawCLContext == NULL) return NULL;
-	struct ConnectionListenerContext *clContextp = rawCLContext;
-	struct ConnectionListenerContext clContext = *clContextp;
-	free(rawCLContext);
+	for (size_t i = 0; i < context->socks.size; i++) {
+		struct ssock *sock = vectorGetEl(&context->socks, i);
+		if (sock == NULL || sock->addr->sa_family != AF_UNIX) continue;
 
-	struct ApplicationContext *context = clContext.context;
-	size_t ci = clContext.cip;
+		struct sockaddr_un *addr = (struct sockaddr_un *)sock->addr;
+		if (!strcmp(addr->sun_path, sockpath))
+			return 1;
+	}
 
-	struct connData *conn = vectorGetEl(&context->conns, ci);
-	if (conn == NULL) return NULL;
+	return 0;
+}
 
-	FILE *stream = conn->connStream;
-	
-	context->connhandler(stream, context->connhandlerArgs);
+int contextHasTCPSocket(struct ApplicationContext *context, in_port_t sin_port, struct in_addr sin_addr)
+{
+	for (size_t i = 0; i < context->socks.size; i++) {
+		struct ssock *sock = vectorGetEl(&context->socks, i);
+		if (sock == NULL || sock->addr->sa_family != AF_INET) continue;
+
+		struct sockaddr_in *addr = (struct sockaddr_in *)sock->addr;
+		if (addr->sin_port == htons(sin_port) && addr->sin_addr.s_addr == sin_addr.s_addr)
+			return 1;
+	}
+
+	return 0;
+}
+
+/**
+ * Deadline state of blocking connection. Allocated on accept, so deadlines are enforced while the connection
+ * is parked, and freed by serveConn() when the connection is closed.
+ */
+struct connTimer {
+	struct connDeadline deadline;
+	struct ApplicationContext *context;
+	// Shard of context.timers the deadline is armed in.
+	struct timerShard *shard;
+	int fd;
+	// Connection has started a request. Fresh connection gets CONN_DRAIN_GRACE on drain.
+	int served;
+	// Handler has returned to wait for the next request in the parker, see connPark().
+	int parked;
+	// Connection waits for a pool worker: one of CONN_ states, 0 while it is served. Taken under drainLock, see claimConn().
+	int waiting;
+};
+
+/**
+ * States of connection waiting for a pool worker.
+ */
+// Waits for the next request in the parker.
+#define CONN_PARKED 1
+// Task of the connection is submitted to the pool.
+#define CONN_SUBMITTED 2
+
+/**
+ * Connection served by the current thread.
+ */
+static __thread struct connTimer *currentConnTimer;
+
+/**
+ * Deadline of blocking connection expired. Called by timersRunner() with the shard lock held.
+ * Shutting the socket down interrupts reads blocked in the handler.
+ */
+static void connExpired(struct timer *timer)
+{
+	struct connTimer *ct = timer->arg;
+	struct ApplicationContext *context = ct->context;
+
+	int verdict = connDeadlineExpired(&ct->shard->wheel, &ct->deadline, &context->timeouts, timerNow());
+	if (verdict == CONNDL_KEEP) return;
+
+	const char *response = context->timeouts.response;
+	if (verdict == CONNDL_REJECT && response != NULL) {
+		// Best effort: socket buffer of a stalled client is normally empty.
+		if (send(ct->fd, response, strlen(response), MSG_NOSIGNAL | MSG_DONTWAIT) == -1) {}
+	}
+
+	shutdown(ct->fd, SHUT_RDWR);
+}
+
+/**
+ * Closes idle connection after drain started. Called with the shard lock held.
+ */
+static void drainConnTimer(struct connTimer *ct)
+{
+	struct ApplicationContext *context = ct->context;
+	if (ct->deadline.phase != CONN_PHASE_IDLE) return;
+
+	// The blocked read of the next request returns EOF.
+	if (ct->served)
+		shutdown(ct->fd, SHUT_RD);
+	else if (context->timersRunning)
+		timerArm(&ct->shard->wheel, &ct->deadline.timer, timerNow(), CONN_DRAIN_GRACE);
+}
+
+/**
+ * Sets phase of connection @ct and arms its deadline.
+ */
+static void setConnTimerPhase(struct connTimer *ct, int phase)
+{
+	struct ApplicationContext *context = ct->context;
+
+	pthread_mutex_lock(&ct->shard->lock);
+
+	connDeadlineUpdate(&ct->shard->wheel, &ct->deadline, &context->timeouts, phase, timerNow());
+
+	if (phase != CONN_PHASE_IDLE)
+		ct->served = 1;
+
+	if (__atomic_load_n(&context->draining, __ATOMIC_ACQUIRE))
+		drainConnTimer(ct);
+
+	pthread_mutex_unlock(&ct->shard->lock);
+}
+
+void connSetPhase(int phase)
+{
+	struct connTimer *ct = currentConnTimer;
+	if (ct == NULL) return;
+
+	setConnTimerPhase(ct, phase);
+}
+
+int connDraining()
+{
+	struct connTimer *ct = currentConnTimer;
+	if (ct == NULL) return 0;
+
+	return __atomic_load_n(&ct->context->draining, __ATOMIC_ACQUIRE);
+}
+
+void connProgress(size_t n)
+{
+	struct connTimer *ct = currentConnTimer;
+	if (ct == NULL) return;
+
+	// Read by the timer thread on rate checks, so body chunks take no lock.
+	__atomic_add_fetch(&ct->deadline.progress, n, __ATOMIC_RELAXED);
+}
+
+int connPark()
+{
+	struct connTimer *ct = currentConnTimer;
+	if (ct == NULL || ct->context->parkfd == -1) return 0;
+	if (__atomic_load_n(&ct->context->parkFailed, __ATOMIC_ACQUIRE)) return 0;
+
+	ct->parked = 1;
+	return 1;
+}
+
+/**
+ * Allocates deadline of accepted connection @fd and arms it for the idle phase.
+ *
+ * @Returns the timer on success, NULL + errno otherwise.
+ */
+static struct connTimer *newConnTimer(struct ApplicationContext *context, int fd)
+{
+	struct connTimer *ct = calloc(1, sizeof(struct connTimer));
+	if (ct == NULL) return NULL;
+
+	ct->context = context;
+	ct->shard = context->timers + fd % context->timersc;
+	ct->fd = fd;
+	initConnDeadline(&ct->deadline, connExpired, ct);
+	setConnTimerPhase(ct, CONN_PHASE_IDLE);
+
+	return ct;
+}
+
+/**
+ * Disarms deadline of the connection and frees it.
+ */
+static void freeConnTimer(struct connTimer *ct)
+{
+	pthread_mutex_lock(&ct->shard->lock);
+	timerCancel(&ct->shard->wheel, &ct->deadline.timer);
+	pthread_mutex_unlock(&ct->shard->lock);
+
+	free(ct);
+}
+
+/**
+ * Allocates buffered I/O for accepted connection @fd.
+ *
+ * @Returns connIO on success, NULL + errno otherwise.
+ */
+static struct connIO *openConnIO(int fd)
+{
+	struct connIO *io = malloc(sizeof(struct connIO));
+	if (io == NULL) return NULL;
+
+	if (initConnIO(io, fd, CONN_IO_BUFSZ, CONN_IO_BUFSZ)) {
+		int err = errno;
+		free(io);
+		errno = err;
+		return NULL;
+	}
+
+	return io;
+}
+
+/**
+ * Closes connection socket and frees its connIO.
+ */
+static void closeConnIO(struct connIO *io)
+{
+	close(io->fd);
+	destroyConnIO(io);
+	free(io);
+}
+
+/**
+ * Waits for the next request on idle connection with handle @ch and timer @ct in the parker,
+ * or in a pool worker if the parker has failed.
+ * The connection must not be touched after it is parked: a pool worker may be serving it already.
+ *
+ * @Returns 0 on success, -1 + errno otherwise.
+ */
+static int parkConn(struct ApplicationContext *context, slothandle_t ch, struct connTimer *ct)
+{
+	// One-shot: the connection is submitted once, the worker re-arms it when the handler parks it again.
+	struct epoll_event ev = { .events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT, .data.u64 = ch };
+	int status;
+
+	// Under drainLock: connection parked before the parker fails is closed by dropParkedConns().
+	pthread_mutex_lock(&context->drainLock);
+	ct->waiting = context->parkFailed ? CONN_SUBMITTED : CONN_PARKED;
+
+	if (context->parkFailed) {
+		status = poolSubmit(context->pool, connTask, context, ch);
+	} else {
+		status = epoll_ctl(context->parkfd, EPOLL_CTL_MOD, ct->fd, &ev);
+		if (status && errno == ENOENT) status = epoll_ctl(context->parkfd, EPOLL_CTL_ADD, ct->fd, &ev);
+	}
+
+	int err = errno;
+	if (status) ct->waiting = 0;
+	pthread_mutex_unlock(&context->drainLock);
+	errno = err;
+
+	return status;
+}
+
+/**
+ * Takes connection with handle @ch waiting for a pool worker, so no other thread serves or closes it.
+ * drainLock should be held.
+ *
+ * @Returns 0 and copies the connection to @conn on success, -1 if it is closed or taken by another thread.
+ */
+static int claimConn(struct ApplicationContext *context, slothandle_t ch, struct connData *conn)
+{
+	if (slotTableCopyEl(&context->conns, ch, (char *)conn) || !conn->timer->waiting) return -1;
+
+	conn->timer->waiting = 0;
+	return 0;
+}
+
+/**
+ * Removes connection with handle @ch from the table and closes it.
+ *
+ * @Returns 1 if the thread of the connection is joined by closeServer(), 0 otherwise.
+ */
+static int releaseConn(struct ApplicationContext *context, slothandle_t ch, struct connData *conn)
+{
+	// Removed before the timer is freed: drainConnVisitor() may arm it while the connection is in the table.
+	struct connData removed = { 0 };
+	slotTableRemove(&context->conns, ch, (char *)&removed);
+
+	freeConnTimer(conn->timer);
+	closeConnIO(conn->io);
+
+	if (__atomic_load_n(&context->draining, __ATOMIC_ACQUIRE)) {
+		pthread_mutex_lock(&context->drainLock);
+		if (!removed.forced) context->drained++;
+		pthread_cond_broadcast(&context->drainCond);
+		pthread_mutex_unlock(&context->drainLock);
+	}
+
+	return removed.joined;
+}
+
+/**
+ * Shuts connection with handle @ch waiting for a pool worker down and closes it without serving.
+ */
+static void dropConn(struct ApplicationContext *context, slothandle_t ch)
+{
+	struct connData conn;
+
+	pthread_mutex_lock(&context->drainLock);
+	int status = claimConn(context, ch, &conn);
+	pthread_mutex_unlock(&context->drainLock);
+
+	if (status) return;
+
+	shutdown(conn.fd, SHUT_RDWR);
+	releaseConn(context, ch, &conn);
+}
+
+struct parkedConns {
+	slothandle_t *handles;
+	size_t count;
+};
+
+/**
+ * Collects parked connections. Called by slotTableForEach() with table lock held.
+ */
+static int parkedConnVisitor(slothandle_t ch, char *el, void *arg)
+{
+	struct parkedConns *parked = arg;
+	struct connData *conn = (struct connData *)el;
+
+	if (conn->timer->waiting == CONN_PARKED) parked->handles[parked->count++] = ch;
+
+	return 0;
+}
+
+/**
+ * Stops parking once the parker has failed: parked connections are closed, so closeServer() does not wait
+ * for them, and the following connections wait for the next request in pool workers.
+ */
+static void dropParkedConns(struct ApplicationContext *context)
+{
+	struct parkedConns parked = { .handles = malloc(sizeof(slothandle_t) * context->conns.capacity) };
+
+	// Connections are collected after parking stops, so none is parked later.
+	pthread_mutex_lock(&context->drainLock);
+	__atomic_store_n(&context->parkFailed, 1, __ATOMIC_RELEASE);
+	if (parked.handles != NULL) slotTableForEach(&context->conns, parkedConnVisitor, &parked);
+	pthread_mutex_unlock(&context->drainLock);
+
+	if (parked.handles == NULL) {
+		perror("Unable to close parked connections");
+		return;
+	}
 
-closeConn:
-	vectorSetEl(&context->conns, ci, NULL);
+	for (size_t i = 0; i < parked.count; i++)
+		dropConn(context, parked.handles[i]);
+	free(parked.handles);
+}
 
-	pthread_mutex_t *lock = conn->lock;
-	if (lock == NULL) return NULL;
+/**
+ * Thread callback that submits readable parked connections to the pool.
+ */
+static void *parkRunner(void *rawcontext)
+{
+	struct ApplicationContext *context = rawcontext;
+	struct epoll_event events[PARK_MAX_EVENTS];
+
+	while (1) {
+		int n = epoll_wait(context->parkfd, events, PARK_MAX_EVENTS, -1);
+		if (n == -1 && errno == EINTR) continue;
+		if (n == -1) {
+			perror("Unable to wait for parked connections");
+			dropParkedConns(context);
+			break;
+		}
 
-	pthread_mutex_lock(lock);
+		for (int i = 0; i < n; i++) {
+			slothandle_t ch = events[i].data.u64;
+			if (ch == SLOTHANDLE_INVAL) return NULL;
 
-	fclose(stream);
-	conn->connStream = NULL;
-	free(conn->connThread);
-	conn->lock = NULL;
-	free(conn);
+			// Submitted connection is left to its worker if the parker fails. Parked one is in the table.
+			struct connData conn;
+			if (slotTableCopyEl(&context->conns, ch, (char *)&conn)) continue;
+			conn.timer->waiting = CONN_SUBMITTED;
 
-	pthread_mutex_unlock(lock);
-	pthread_mutex_destroy(lock);
-	free(lock);
+			// Serving it here would block the parker on the request.
+			if (poolSubmit(context->pool, connTask, context, ch)) {
+				perror("Unable to submit parked connection");
+				dropConn(context, ch);
+			}
+		}
+	}
 
 	return NULL;
 }
 
+/**
+ * Runs connection handler on connection with handle ch in context.conns table and closes the connection,
+ * unless the handler has parked it. Connection is removed from the table only here, closeServer() shuts
+ * forcibly closed ones down.
+ *
+ * @thread Connection is served by its own thread, not by the worker pool.
+ *
+ * @Returns 1 if the thread of the connection is joined by closeServer(), 0 otherwise.
+ */
+static int serveConn(struct ApplicationContext *context, slothandle_t ch, int thread)
+{
+	struct connData conn;
+
+	// Thread is published in the table, so closeServer() can join it.
+	// Under drainLock, so forced flag set by closeConnVisitor() is not overwritten.
+	pthread_mutex_lock(&context->drainLock);
+	int status = thread ? slotTableCopyEl(&context->conns, ch, (char *)&conn) : claimConn(context, ch, &conn);
+	if (status == 0 && thread) {
+		conn.connThread = pthread_self();
+		conn.hasThread = 1;
+		slotTableSetEl(&context->conns, ch, (char *)&conn);
+	}
+	pthread_mutex_unlock(&context->drainLock);
+
+	if (status) return 0;
+
+	struct connTimer *ct = conn.timer;
+	ct->parked = 0;
+	currentConnTimer = ct;
+
+	context->connhandler(conn.io, context->connhandlerArgs);
+
+	currentConnTimer = NULL;
+
+	if (ct->parked) {
+		if (parkConn(context, ch, ct) == 0) return 0;
+		perror("Unable to park connection");
+	}
+
+	return releaseConn(context, ch, &conn);
+}
+
+void *connListener(void *rawCLContext)
+{
+	if (rawCLContext == NULL) return NULL;
+	struct ConnectionListenerContext *clContextp = rawCLContext;
+	struct ConnectionListenerContext clContext = *clContextp;
+	free(rawCLContext);
+
+	if (!serveConn(clContext.context, clContext.ch, 1))
+		pthread_detach(pthread_self());
+
+	return NULL;
+}
+
+void connTask(void *context, uint64_t ch)
+{
+	serveConn(context, ch, 0);
+}
+
 void *socketListener(void *rawSLContext)
 {
 	if (rawSLContext == NULL) return NULL;
@@ -295,45 +1167,83 @@ void *socketListener(void *rawSLContext)
 	size_t si = slContext.sip;
 
 	struct ssock *sockp = vectorGetEl(&context->socks, si);
-	if (sockp == NULL) return NULL;
+	if (sockp == NULL) goto error;
 	struct ssock sock = *sockp;
 
 
-	if (listen(sock.fd, LISTEN_BACKLOG)) {
+	// Socket may be shared with the predecessor or successor process, so accept(2) should not block.
+	int flags = fcntl(sock.fd, F_GETFL);
+	if (	listen(sock.fd, LISTEN_BACKLOG) || flags == -1 ||
+		fcntl(sock.fd, F_SETFL, flags | O_NONBLOCK)) {
 		perror("Unable to listen socket");
 		goto error;
 	}
 
 
 	while (1) {
+		// poll(2) is the only cancellation point: canceled accept(2) may lose the accepted connection.
+		struct pollfd pfd = { .fd = sock.fd, .events = POLLIN };
+		pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+		int ready = poll(&pfd, 1, -1);
+		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+
+		if (ready == -1 && errno != EINTR)
+			goto connError;
+
 		int nfd = accept(sock.fd, sock.addr, &sock.addrlen);
 
+		// Connection is taken by another listener of the socket.
+		if (nfd == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR || errno == ECONNABORTED))
+			continue;
+
 		if (nfd == -1)
 			goto connError;
 
-		FILE *rwstream = fdopen(nfd, "r+");
-		if (rwstream == NULL)
+		struct connIO *io = openConnIO(nfd);
+		if (io == NULL) {
+			close(nfd);
 			goto connError;
-		
+		}
 
-		pthread_t *cthread = malloc(sizeof(pthread_t));
-		pthread_mutex_t *connLock = malloc(sizeof(pthread_mutex_t));
-		if (pthread_mutex_init(connLock, NULL))
+		struct connData conn = { .io = io, .fd = nfd, .timer = newConnTimer(context, nfd) };
+		if (conn.timer == NULL) {
+			closeConnIO(io);
 			goto connError;
+		}
+
+		slothandle_t ch = slotTableInsert(&context->conns, (char *)&conn);
+		if (ch == SLOTHANDLE_INVAL) {
+			fprintf(stderr, "Too many connections, dropping the new one\n");
+			freeConnTimer(conn.timer);
+			closeConnIO(io);
+			continue;
+		}
 
-		struct connData *conn = calloc(sizeof(struct connData), sizeof(char));
-		conn->connThread = cthread;
-		conn->connStream = rwstream;
-		conn->lock = connLock;
+		// Pool worker is taken once the request arrives.
+		if (context->pool != NULL) {
+			if (parkConn(context, ch, conn.timer)) {
+				slotTableRemove(&context->conns, ch, NULL);
+				freeConnTimer(conn.timer);
+				closeConnIO(io);
+				goto connError;
+			}
+
+			continue;
+		}
 
-		size_t ci = insertVector(&context->conns, conn);
 		struct ConnectionListenerContext *clContext = malloc(sizeof(struct ConnectionListenerContext));
-		clContext->cip = ci;
+		clContext->ch = ch;
 		clContext->context = context;
 
-		if (pthread_create(cthread, &baseThreadAttr, connListener, clContext))
+		pthread_t cthread;
+		// Thread publishes itself in the table, see serveConn().
+		if (pthread_create(&cthread, &baseThreadAttr, connListener, clContext)) {
+			free(clContext);
+			slotTableRemove(&context->conns, ch, NULL);
+			freeConnTimer(conn.timer);
+			closeConnIO(io);
 			goto connError;
-
+		}
 
 		continue;
 
@@ -343,9 +1253,88 @@ connError:
 	}
 
 error:
+	// Canceled listeners are accounted by closeServer().
+	__atomic_sub_fetch(&context->listening, 1, __ATOMIC_ACQ_REL);
+	sem_post(&context->listenersExited);
+
 	return NULL;
 }
 
+/**
+ * Closes idle keep-alive connection on drain start. Called by slotTableForEach() with table lock held.
+ */
+static int drainConnVisitor(slothandle_t ch, char *el, void *arg)
+{
+	struct connData *conn = (struct connData *)el;
+
+	// Timer lives while the connection is in the table. Phase is updated under the shard lock.
+	struct timerShard *shard = conn->timer->shard;
+	pthread_mutex_lock(&shard->lock);
+	drainConnTimer(conn->timer);
+	pthread_mutex_unlock(&shard->lock);
+
+	return 0;
+}
+
+struct closeConnsContext {
+	struct ApplicationContext *context;
+	// Threads of forcibly closed connections to join, NULL if they should detach themselves.
+	pthread_t *threads;
+	size_t threadsc;
+};
+
+/**
+ * Shuts live connection left after drain down: its thread or pool worker closes it once the handler fails.
+ * Called by slotTableForEach() with table lock and drainLock held.
+ */
+static int closeConnVisitor(slothandle_t ch, char *el, void *arg)
+{
+	struct closeConnsContext *ccContext = arg;
+	struct connData *conn = (struct connData *)el;
+
+	ccContext->context->forced++;
+
+	conn->forced = 1;
+	shutdown(conn->fd, SHUT_RDWR);
+
+	if (conn->hasThread && ccContext->threads != NULL) {
+		conn->joined = 1;
+		ccContext->threads[ccContext->threadsc++] = conn->connThread;
+	}
+
+	return 0;
+}
+
+/**
+ * Lets blocking connections finish their current requests until @deadline.
+ */
+static void drainConns(struct ApplicationContext *context, uint64_t deadline)
+{
+	__atomic_store_n(&context->draining, 1, __ATOMIC_RELEASE);
+
+	slotTableForEach(&context->conns, drainConnVisitor, context);
+
+	pthread_mutex_lock(&context->drainLock);
+
+	uint64_t now = timerNow();
+	while (__atomic_load_n(&context->conns.size, __ATOMIC_ACQUIRE) != 0 && now < deadline) {
+		struct timespec ts;
+		clock_gettime(CLOCK_REALTIME, &ts);
+		uint64_t left = deadline - now;
+		ts.tv_sec += left / 1000;
+		ts.tv_nsec += (long)(left % 1000) * 1000000;
+		if (ts.tv_nsec >= 1000000000) {
+			ts.tv_sec++;
+			ts.tv_nsec -= 1000000000;
+		}
+
+		pthread_cond_timedwait(&context->drainCond, &context->drainLock, &ts);
+		now = timerNow();
+	}
+
+	pthread_mutex_unlock(&context->drainLock);
+}
+
 int closeServer(struct ClosingContext closeContext)
 {
 	struct ApplicationContext *context = closeContext.context;
@@ -356,6 +1345,8 @@ int closeServer(struct ClosingContext closeContext)
 
 	printf("Closing...\n");
 
+	contextStopHandoff(context);
+
 	for (size_t i = 0; i < context->socksThreads.size; i++) {
 		pthread_t **scpt = (pthread_t **) context->socksThreads.arr + i;
 		pthread_t *sockThread = *scpt;
@@ -368,6 +1359,31 @@ int closeServer(struct ClosingContext closeContext)
 		*scpt = NULL;
 	}
 
+	// Wakes startThreadsServer().
+	__atomic_store_n(&context->listening, 0, __ATOMIC_RELEASE);
+	sem_post(&context->listenersExited);
+
+	uint64_t drainDeadline = timerNow() + context->drainTimeout;
+
+	// Loops drain concurrently.
+	for (size_t i = 0; i < context->loopsc; i++) {
+		if (drainEventLoop(context->loops + i, drainDeadline))
+			perror("Unable to interrupt event loop");
+	}
+
+	for (size_t i = 0; i < context->loopsc; i++) {
+		struct eventLoop *loop = context->loops + i;
+
+		waitEventLoop(loop);
+		context->drained += loop->drained;
+		context->forced += loop->forced;
+		destroyEventLoop(loop);
+	}
+
+	free(context->loops);
+	context->loops = NULL;
+	context->loopsc = 0;
+
 	printf("Closed listeners\n");
 
 	for (size_t i = 0; i < context->socks.size; i++) {
@@ -378,7 +1394,10 @@ int closeServer(struct ClosingContext closeContext)
 
 		close(sock->fd);
 
-		if (sock->addr->sa_family == AF_UNIX) {
+		// Inherited and handed off socket files are owned by another process.
+		// Socket file of aborted takeover is owned by the predecessor.
+		if (	sock->addr->sa_family == AF_UNIX && !sock->inherited && !context->handedOff &&
+			!(sock->takenOver && context->takeoverFd != -1)) {
 			if (unlink(sock->addr->sa_data)) {
 				err = errno;
 				fprintf(stderr, "Unable to unbind unix socket %s: %s\n", sock->addr->sa_data, strerror(errno));
@@ -391,41 +1410,60 @@ int closeServer(struct ClosingContext closeContext)
 		*sockp = NULL;
 	}
 
+	// Takeover is aborted: predecessor keeps serving and owns the socket files.
+	if (context->takeoverFd != -1) {
+		close(context->takeoverFd);
+		context->takeoverFd = -1;
+	}
+
 	printf("Closed socks\n");
 
-	for (size_t i = 0; i < context->conns.size; i++) {
-		struct connData *cd = vectorGetEl(&context->conns, i);
+	drainConns(context, drainDeadline);
 
-		if (cd == NULL) continue;
-		struct connData ccd = *cd;
+	if (context->timersRunning) {
+		pthread_mutex_lock(&context->timersLock);
+		context->timersStop = 1;
+		pthread_cond_signal(&context->timersCond);
+		pthread_mutex_unlock(&context->timersLock);
 
-		if (ccd.lock == NULL || pthread_mutex_lock(ccd.lock))
-			continue;
+		pthread_join(context->timersThread, NULL);
+	}
 
-		if (vectorGetEl(&context->conns, i) == NULL) continue;
-		cd->lock = NULL;
+	// Listeners are stopped, so the table does not grow.
+	struct closeConnsContext ccContext = { .context = context };
+	ccContext.threads = malloc(sizeof(pthread_t) * (context->conns.size + 1));
 
-		pthread_mutex_t *lock = ccd.lock;
+	pthread_mutex_lock(&context->drainLock);
+	slotTableForEach(&context->conns, closeConnVisitor, &ccContext);
+	pthread_mutex_unlock(&context->drainLock);
 
-		pthread_t *connThread = ccd.connThread;
-		pthread_cancel(*connThread);
-		free(ccd.connThread);
+	for (size_t i = 0; i < ccContext.threadsc; i++)
+		pthread_join(ccContext.threads[i], NULL);
+	free(ccContext.threads);
 
-		printf("Closing connection file %d\n", fileno(ccd.connStream));
-		fclose(ccd.connStream);
+	// Pool workers and threads started after the visitor close their connections by themselves.
+	pthread_mutex_lock(&context->drainLock);
+	while (__atomic_load_n(&context->conns.size, __ATOMIC_ACQUIRE) != 0)
+		pthread_cond_wait(&context->drainCond, &context->drainLock);
+	pthread_mutex_unlock(&context->drainLock);
 
-		free(cd);
-		vectorSetEl(&context->conns, i, NULL);
+	// Parked connections are shut down, so the parker has submitted all of them.
+	if (context->parkfd != -1)
+		stopParker(context);
 
-		pthread_mutex_unlock(lock);
-		pthread_mutex_destroy(lock);
+	if (context->pool != NULL) {
+		destroyWorkerPool(context->pool);
+		free(context->pool);
+		context->pool = NULL;
 	}
 
+	freeTimers(context, context->timersc);
+
 	free(context->socksThreads.arr);
 	free(context->socks.arr);
-	free(context->conns.arr);
+	destroySlotTable(&context->conns);
 
-	printf("Closed all connections\n");
+	printf("Closed all connections: %zu drained, %zu closed forcibly\n", context->drained, context->forced);
 
 	if (errno == 0 && (sig == SIGINT || sig == 0)) {
 		printf("Interrupted!\n");
@@ -486,19 +1524,38 @@ error:
 	exit(EXIT_FAILURE);
 }
 
+/**
+ * Signals handled by handlerCallback().
+ */
+static const int closeSignals[] = { SIGINT, SIGTERM, SIGCHLD, SIGALRM };
+
 int initSighandler() {
 	struct sigaction act;
 	memset(&act, 0, sizeof(act));
 	act.sa_handler = handlerCallback;
 
-	if (	sigaction(SIGINT, &act, NULL) == -1 || 
-		sigaction(SIGTERM, &act, NULL) == -1 || 
-		sigaction(SIGCHLD, &act, NULL) == -1  || 
-		sigaction(SIGALRM, &act, NULL) == -1 ) {
+	for (size_t i = 0; i < sizeof(closeSignals) / sizeof(closeSignals[0]); i++) {
+		if (sigaction(closeSignals[i], &act, NULL) == -1) {
+			perror("sigaction");
+			return -1;
+		}
+	}
 
-		perror("sigaction");
+	// sendfile(2) has no MSG_NOSIGNAL: closed peer should be reported by EPIPE instead of killing the server.
+	if (signal(SIGPIPE, SIG_IGN) == SIG_ERR) {
+		perror("signal");
 		return -1;
 	}
 
 	return 0;
 }
+
+void setCloseSignalsBlocked(int block) {
+	sigset_t set;
+	sigemptyset(&set);
+
+	for (size_t i = 0; i < sizeof(closeSignals) / sizeof(closeSignals[0]); i++)
+		sigaddset(&set, closeSignals[i]);
+
+	pthread_sigmask(block ? SIG_BLOCK : SIG_UNBLOCK, &set, NULL);
+}
@@ -8,7 +8,12 @@ extern "C" {
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <stdio.h>
+#include <semaphore.h>
 #include "utils.h"
+#include "eventloop.h"
+#include "pool.h"
+#include "timer.h"
+#include "connio.h"
 
 /**
  * Represents a ready (created) socket.
@@ -18,6 +23,14 @@ struct ssock {
 
 	struct sockaddr *addr;
 	socklen_t addrlen;
+
+	// CPU of SO_REUSEPORT shard this socket belongs to. -1 if socket is shared by all the listeners.
+	int cpu;
+
+	// Socket is inherited from the service manager: unix socket file is not unlinked on close.
+	int inherited;
+	// Socket is taken over from the predecessor, which owns the unix socket file until the takeover is committed.
+	int takenOver;
 };
 
 /**
@@ -36,23 +49,42 @@ struct isock {
 	socklen_t addrlen;
 };
 
+struct connTimer;
+
 /**
  * Represents a connection.
  */
 struct connData {
-	pthread_t *connThread;
-	FILE *connStream;
-	pthread_mutex_t *lock;
+	// Thread of the connection. Valid only if hasThread is set: never set if connection is handled by worker pool.
+	pthread_t connThread;
+	int hasThread;
+	struct connIO *io;
+	int fd;
+
+	// Phase and deadline state of the connection. Set on accept, freed when the connection is closed.
+	struct connTimer *timer;
+	// Connection was closed forcibly on shutdown.
+	int forced;
+	// Connection thread is joined by closeServer(), otherwise it detaches itself.
+	int joined;
 };
 
 
 /**
  * Callback function that is called on each connection.
  *
- * @connStream Conntection stream file to be processed.
+ * @io Buffered I/O of the connection to be processed.
  * @args Additional args specified by each handler.
  */
-typedef void (*connhandler_t)(FILE *connStream, void *args);
+typedef void (*connhandler_t)(struct connIO *io, void *args);
+
+/**
+ * Wheel of blocking connection deadlines with its own lock, so connections of different shards do not contend.
+ */
+struct timerShard {
+	pthread_mutex_t lock;
+	struct timerWheel wheel;
+};
 
 /**
  * Context for an entire server.
@@ -69,9 +101,9 @@ struct ApplicationContext {
 	struct vector socksThreads;
 
 	/**
-	* Vector of struct connData
+	* Table of live struct connData. Handles of the table identify connections.
 	*/
-	struct vector conns;
+	struct slotTable conns;
 
 	/**
 	 * Locks close function. 
@@ -83,12 +115,221 @@ struct ApplicationContext {
 	 */
 	connhandler_t connhandler;
 
+	/**
+	 * Callback for connections in event-driven modes (e.g. SERVER_MODE_EPOLL).
+	 */
+	connevhandler_t connevhandler;
+
 	/**
 	 * Context user specified arguments passed to the connection handler function.
 	 */
 	void *connhandlerArgs;
+
+	/**
+	 * Mode the server was started in. One of SERVER_MODE_ defines.
+	 */
+	int mode;
+
+	/**
+	 * Listener threads and event loops are pinned to CPUs. See ServerOptions.
+	 */
+	int pinThreads;
+
+	/**
+	 * Array of event loops. Used in SERVER_MODE_EPOLL and SERVER_MODE_URING.
+	 */
+	struct eventLoop *loops;
+	size_t loopsc;
+
+	/**
+	 * Worker pool. Used in SERVER_MODE_POOL.
+	 */
+	struct workerPool *pool;
+	/**
+	 * Idle keep-alive connections of SERVER_MODE_POOL wait for the next request in epoll @parkfd
+	 * instead of holding pool workers. Parker thread submits them to the pool once they are readable,
+	 * it is stopped by an event of @parkWakefd. -1 in other modes. See connPark().
+	 */
+	int parkfd;
+	int parkWakefd;
+	pthread_t parkThread;
+	// Parker has stopped on failure: connections wait for the next request in pool workers. Set under drainLock.
+	int parkFailed;
+
+	/**
+	 * Connection deadlines with defaults applied. 0 means deadline is disabled.
+	 */
+	struct ConnTimeouts timeouts;
+
+	/**
+	 * Deadlines of blocking connections, a shard per online CPU core. Event loops own their wheels.
+	 * Timer thread expires them if any deadline is enabled (@timersRunning), otherwise the wheels
+	 * only keep the phases. timersLock protects @timersStop.
+	 */
+	struct timerShard *timers;
+	size_t timersc;
+	int timersRunning;
+	pthread_mutex_t timersLock;
+	pthread_cond_t timersCond;
+	pthread_t timersThread;
+	int timersStop;
+
+	/**
+	 * Time given to in-flight requests on close in milliseconds. See ServerOptions.
+	 */
+	int drainTimeout;
+	/**
+	 * Input buffered by event-driven connection in bytes. See ServerOptions.
+	 */
+	size_t inputLimit;
+	/**
+	 * Server is closing: connections are closed after their current request.
+	 */
+	int draining;
+	/**
+	 * Count of connections closed gracefully while draining and closed forcibly after drain deadline.
+	 */
+	size_t drained;
+	size_t forced;
+	pthread_mutex_t drainLock;
+	pthread_cond_t drainCond;
+	/**
+	 * Count of running socket listeners of blocking modes, posted to listenersExited when one exits.
+	 * Semaphore, not drainCond: startThreadsServer() waits with close signals unblocked and a condition
+	 * waiter interrupted by the handler for good would block every later broadcast.
+	 */
+	size_t listening;
+	sem_t listenersExited;
+
+	/**
+	 * Socket and thread accepting successors. Used only if handoffPath is set, see contextServeHandoff().
+	 */
+	char *handoffPath;
+	int handoffFd;
+	pthread_t handoffThread;
+	/**
+	 * Listening sockets were passed to the successor, so unix socket files are not unlinked on close.
+	 */
+	int handedOff;
+	/**
+	 * Channel to the predecessor whose sockets are taken over, until startServer() commits the takeover.
+	 * -1 otherwise.
+	 */
+	int takeoverFd;
+};
+
+/**
+ * This section lists server modes.
+ */
+/**
+ * Blocking mode. Each connection is handled by the connhandler_t in its own thread.
+ */
+#define SERVER_MODE_THREADS 0
+/**
+ * Edge-triggered epoll reactor. Connections are non-blocking and are handled by connevhandler_t
+ * in one of event loop threads.
+ */
+#define SERVER_MODE_EPOLL 1
+/**
+ * io_uring backend. Same as SERVER_MODE_EPOLL, but connections are accepted with multishot accept,
+ * read with multishot recv into provided buffers ring and written with linked sends.
+ * Falls back to SERVER_MODE_EPOLL when kernel does not support it.
+ */
+#define SERVER_MODE_URING 2
+/**
+ * Blocking mode. Connections are handled by the connhandler_t on a fixed pool of pre-spawned workers
+ * instead of a thread per connection. Connections are queued when all the workers are busy.
+ * New and idle keep-alive connections do not hold workers: they are submitted once they are readable,
+ * if the handler calls connPark(). Clients sending their requests slowly hold workers until their deadlines.
+ */
+#define SERVER_MODE_POOL 3
+
+/**
+ * Options passed to startServer().
+ */
+struct ServerOptions {
+	// One of SERVER_MODE_ defines.
+	int mode;
+	// Count of event loop threads or pool workers. 0 means one thread per online CPU core.
+	int threads;
+
+	/**
+	 * Opens one SO_REUSEPORT listening socket per core for each TCP socket, so accepts are not serialized
+	 * on one socket. In event-driven modes each loop owns one shard, otherwise each shard gets its own
+	 * listener thread.
+	 */
+	int reuseport;
+	// Pins listener and event loop threads to the CPU of their shard.
+	int pinThreads;
+	/**
+	 * Attaches reuseport BPF program that steers each connection to the shard of the CPU
+	 * that received it. Requires shard per online CPU, otherwise kernel falls back to hashing.
+	 */
+	int steerCPU;
+
+	/**
+	 * Connection deadlines. 0 means the default (CONN_*_TIMEOUT defines), negative value disables the deadline.
+	 */
+	struct ConnTimeouts timeouts;
+
+	/**
+	 * Time in milliseconds given to in-flight requests by closeServer(): listeners are stopped,
+	 * idle keep-alive connections are closed and the rest are closed after their current response.
+	 * Connections left after the timeout are closed forcibly. 0 means CONN_DRAIN_TIMEOUT,
+	 * negative value means connections are closed right away.
+	 */
+	int drainTimeout;
+
+	/**
+	 * Bytes of input an event-driven connection buffers until the handler consumes them. Reading stops
+	 * at the limit, so it should fit the largest request the handler waits for (see httpInputLimit()).
+	 * 0 means CONN_INPUT_LIMIT.
+	 */
+	size_t inputLimit;
 };
 
+#ifndef CONN_IDLE_TIMEOUT
+/**
+ * Default keep-alive idle timeout in milliseconds.
+ */
+#define CONN_IDLE_TIMEOUT 15000
+#endif
+
+#ifndef CONN_HEAD_TIMEOUT
+/**
+ * Default request head timeout in milliseconds.
+ */
+#define CONN_HEAD_TIMEOUT 10000
+#endif
+
+#ifndef CONN_BODY_MIN_RATE
+/**
+ * Default minimum request body rate in bytes per second.
+ */
+#define CONN_BODY_MIN_RATE 1024
+#endif
+
+#ifndef CONN_DRAIN_TIMEOUT
+/**
+ * Default drain timeout in milliseconds.
+ */
+#define CONN_DRAIN_TIMEOUT 10000
+#endif
+
+#ifndef CONN_INPUT_LIMIT
+/**
+ * Default input buffered by event-driven connection in bytes. Fits requests of the default HTTP limits.
+ */
+#define CONN_INPUT_LIMIT (2 << 20)
+#endif
+
+#ifndef CONN_BODY_GRACE
+/**
+ * Default time in milliseconds before minimum body rate is enforced.
+ */
+#define CONN_BODY_GRACE 5000
+#endif
+
 /**
  * Initializes multiple contexts handler. MUST be called on application startup.
  */
@@ -109,6 +350,13 @@ int closeApplication(int sig);
  * @Returns Context creation status: 0 on success, -1 + errno otherwise.
  */
 int initContext(struct ApplicationContext *context, connhandler_t connhandler, void *connhandlerArgs);
+
+/**
+ * Sets handler used by event-driven server modes. Handler receives the same connhandlerArgs as connhandler_t.
+ *
+ * @Returns 0 on success, -1 + errno otherwise.
+ */
+int contextSetEventHandler(struct ApplicationContext *context, connevhandler_t connevhandler);
 //
 // /**
 //  * @Returns current application context.
@@ -119,9 +367,11 @@ int initContext(struct ApplicationContext *context, connhandler_t connhandler, v
  * Starts the server. A blocking function mainly used to start the server listeners.
  * After startup the context should be cleared manually (via closeServer())
  *
+ * @options Server options. NULL means SERVER_MODE_THREADS.
+ *
  * @Returns Server starting status: 0 on success, -1 + errno otherwise.
  */
-int startServer(struct ApplicationContext *context);
+int startServer(struct ApplicationContext *context, const struct ServerOptions *options);
 
 /**
  * Create new socket.
@@ -163,6 +413,26 @@ int bindUnixSocket(struct ssock *res, const char *sockpath);
  */
 int bindTCPSocket(struct ssock *res, in_port_t sin_port, struct in_addr sin_addr);
 
+/**
+ * Creates one more socket bound to the same address as @sock. Both sockets should have SO_REUSEPORT
+ * set, so kernel distributes incoming connections between them.
+ *
+ * @res A pointer to sock to be created.
+ * @sock Socket being sharded.
+ * @cpu CPU of the shard.
+ *
+ * @Returns Socket creation status: 0 on success, -1 + errno otherwise.
+ */
+int createReuseportShard(struct ssock *res, const struct ssock *sock, int cpu);
+
+/**
+ * Attaches classic BPF program to SO_REUSEPORT group of the socket. The program selects
+ * socket with index equal to the CPU that handles incoming connection.
+ *
+ * @Returns 0 on success, -1 + errno otherwise.
+ */
+int attachReuseportCPUSteering(int fd);
+
 /**
  * Registers socket in context.
  *
@@ -170,18 +440,72 @@ int bindTCPSocket(struct ssock *res, in_port_t sin_port, struct in_addr sin_addr
  */
 int contextRegisterSocket(struct ApplicationContext *context, struct ssock sock);
 
+/**
+ * Checks whether the unix socket bound to @sockpath is already registered in context (e.g. inherited).
+ *
+ * @Returns 1 if registered, 0 otherwise.
+ */
+int contextHasUnixSocket(struct ApplicationContext *context, const char *sockpath);
+
+/**
+ * Checks whether the TCP socket bound to @sin_addr:@sin_port is already registered in context (e.g. inherited).
+ *
+ * @Returns 1 if registered, 0 otherwise.
+ */
+int contextHasTCPSocket(struct ApplicationContext *context, in_port_t sin_port, struct in_addr sin_addr);
+
 struct ConnectionListenerContext {
 	struct ApplicationContext *context;
-	// size_t variable which represents an index of struct connData in context.conns vector.
-	size_t cip;
+	// Handle of struct connData in context.conns table.
+	slothandle_t ch;
 };
 /**
  * Thread callback that listens on one connection.
  *
- * @cip A pointer to a ConnectionListenerContext structure  
+ * @clContext A pointer to a ConnectionListenerContext structure  
  */
 void *connListener(void *clContext);
-	
+
+/**
+ * Pool task that handles one connection. Same as connListener(), used in SERVER_MODE_POOL.
+ *
+ * @context A pointer to ApplicationContext structure.
+ * @ch Handle of struct connData in context.conns table.
+ */
+void connTask(void *context, uint64_t ch);
+
+/**
+ * Sets phase of the request being received on the connection served by the current thread.
+ * Used by blocking handlers (connhandler_t), so deadline of the phase is enforced:
+ * on expiry the connection is shut down, so blocked reads return.
+ * Does nothing when called outside of connection thread or pool task.
+ *
+ * @phase One of CONN_PHASE_ defines.
+ */
+void connSetPhase(int phase);
+
+/**
+ * Counts @n request body bytes received on the connection served by the current thread.
+ * Used to enforce minimum body rate. Does nothing when called outside of connection thread or pool task.
+ */
+void connProgress(size_t n);
+
+/**
+ * @Returns 1 if server is draining, so the connection served by the current thread should be closed
+ * after the current response, 0 otherwise.
+ */
+int connDraining();
+
+/**
+ * Parks the connection served by the current thread until it is readable, so the worker is free to serve
+ * other connections. Called by blocking handlers (connhandler_t) when the connection is idle and nothing
+ * is buffered: if parked, the handler should return, it is called again with the same connIO on the next request.
+ *
+ * @Returns 1 if the connection is parked (SERVER_MODE_POOL), 0 if the handler should wait for the request by itself
+ * (other modes or the parker has failed).
+ */
+int connPark();
+
 struct SocketListenerContext {
 	struct ApplicationContext *context;
 	// size_t variable which represents an index of struct ssock in context.socks vector.
@@ -201,6 +525,7 @@ struct ClosingContext {
 };
 /**
  * Base function that closes an entire server: all the threads and context.
+ * Connections are drained first, see ServerOptions.drainTimeout.
  * Should be run in the separate thread (or main thread) to escape crashes.
  *
  * @closeContext ClosingContext structure.
@@ -226,6 +551,13 @@ void handlerCallback(int sig);
  */
 int initSighandler();
 
+/**
+ * Blocks (@block = 1) or unblocks on the calling thread the signals handled by handlerCallback().
+ * Server threads are created with the signals blocked: handlerCallback() waits for closeServer(),
+ * which in turn waits for server threads, so the signals are handled only by the thread that runs startServer().
+ */
+void setCloseSignalsBlocked(int block);
+
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,218 @@
+#include <string.h>
+#include <time.h>
+#include "timer.h"
+
+#ifndef CONN_RATE_CHECK_MS
+/**
+ * Interval of body transfer rate checks after grace period.
+ */
+#define CONN_RATE_CHECK_MS 1000
+#endif
+
+uint64_t timerNow()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+void initTimerWheel(struct timerWheel *wheel, uint64_t now)
+{
+	memset(wheel, 0, sizeof(struct timerWheel));
+	wheel->base = now;
+
+	for (int l = 0; l < TIMER_LEVELS; l++) {
+		for (int s = 0; s < TIMER_SLOTS; s++) {
+			struct timer *head = &wheel->slots[l][s];
+			head->prev = head;
+			head->next = head;
+		}
+	}
+}
+
+void initTimer(struct timer *timer, timercb_t fn, void *arg)
+{
+	memset(timer, 0, sizeof(struct timer));
+	timer->fn = fn;
+	timer->arg = arg;
+}
+
+/**
+ * Links timer into the slot that covers its expiration tick.
+ */
+static void timerPlace(struct timerWheel *wheel, struct timer *timer)
+{
+	uint64_t delta = timer->expires - wheel->current;
+
+	int level = 0;
+	while (level < TIMER_LEVELS - 1 && delta >= (1ULL << (TIMER_LEVEL_BITS * (level + 1))))
+		level++;
+
+	uint64_t maxDelta = (1ULL << (TIMER_LEVEL_BITS * TIMER_LEVELS)) - 1;
+	if (delta > maxDelta)
+		timer->expires = wheel->current + maxDelta;
+
+	int slot = (timer->expires >> (TIMER_LEVEL_BITS * level)) & (TIMER_SLOTS - 1);
+	struct timer *head = &wheel->slots[level][slot];
+
+	timer->next = head->next;
+	timer->prev = head;
+	head->next->prev = timer;
+	head->next = timer;
+}
+
+static void timerUnlink(struct timer *timer)
+{
+	timer->prev->next = timer->next;
+	timer->next->prev = timer->prev;
+	timer->prev = NULL;
+	timer->next = NULL;
+}
+
+void timerArm(struct timerWheel *wheel, struct timer *timer, uint64_t now, uint64_t timeout)
+{
+	if (timerArmed(timer))
+		timerUnlink(timer);
+	else
+		wheel->armed++;
+
+	uint64_t at = now + timeout;
+	uint64_t expires = at > wheel->base ? (at - wheel->base + TIMER_TICK_MS - 1) / TIMER_TICK_MS : 0;
+
+	// Tick of current is already processed.
+	if (expires <= wheel->current)
+		expires = wheel->current + 1;
+
+	timer->expires = expires;
+	timerPlace(wheel, timer);
+}
+
+void timerCancel(struct timerWheel *wheel, struct timer *timer)
+{
+	if (!timerArmed(timer)) return;
+
+	timerUnlink(timer);
+	wheel->armed--;
+}
+
+/**
+ * Moves timers of the higher level slot to the lower levels.
+ */
+static void timerCascade(struct timerWheel *wheel, int level)
+{
+	int slot = (wheel->current >> (TIMER_LEVEL_BITS * level)) & (TIMER_SLOTS - 1);
+	struct timer *head = &wheel->slots[level][slot];
+
+	while (head->next != head) {
+		struct timer *timer = head->next;
+		timerUnlink(timer);
+		timerPlace(wheel, timer);
+	}
+}
+
+static void timerWheelTick(struct timerWheel *wheel)
+{
+	wheel->current++;
+
+	// Highest level whose slot boundary is crossed on this tick.
+	int level = 0;
+	while (	level < TIMER_LEVELS - 1 &&
+		(wheel->current & ((1ULL << (TIMER_LEVEL_BITS * (level + 1))) - 1)) == 0)
+		level++;
+
+	for (; level > 0; level--)
+		timerCascade(wheel, level);
+
+	struct timer *head = &wheel->slots[0][wheel->current & (TIMER_SLOTS - 1)];
+
+	// Callbacks may arm timers, but never into the slot of the current tick.
+	while (head->next != head) {
+		struct timer *timer = head->next;
+		timerUnlink(timer);
+		wheel->armed--;
+
+		timer->fn(timer);
+	}
+}
+
+void timerWheelAdvance(struct timerWheel *wheel, uint64_t now)
+{
+	if (now < wheel->base) return;
+	uint64_t target = (now - wheel->base) / TIMER_TICK_MS;
+
+	// Nothing to expire: skip idle ticks at once.
+	if (wheel->armed == 0 && target > wheel->current) {
+		wheel->current = target;
+		return;
+	}
+
+	while (wheel->current < target) {
+		timerWheelTick(wheel);
+
+		if (wheel->armed == 0 && target > wheel->current)
+			wheel->current = target;
+	}
+}
+
+int timerWheelTimeout(struct timerWheel *wheel, uint64_t now)
+{
+	if (wheel->armed == 0) return -1;
+
+	uint64_t next = wheel->base + (wheel->current + 1) * TIMER_TICK_MS;
+	if (next <= now) return 0;
+
+	return next - now;
+}
+
+void initConnDeadline(struct connDeadline *dl, timercb_t fn, void *arg)
+{
+	memset(dl, 0, sizeof(struct connDeadline));
+	initTimer(&dl->timer, fn, arg);
+	dl->phase = CONN_PHASE_IDLE;
+}
+
+void connDeadlineUpdate(struct timerWheel *wheel, struct connDeadline *dl,
+	const struct ConnTimeouts *timeouts, int phase, uint64_t now)
+{
+	if (phase == dl->phase && phase != CONN_PHASE_IDLE && timerArmed(&dl->timer))
+		return;
+
+	if (phase != dl->phase) {
+		dl->phase = phase;
+		dl->phaseStart = now;
+		__atomic_store_n(&dl->progress, 0, __ATOMIC_RELAXED);
+	}
+
+	int timeout = 0;
+	if (phase == CONN_PHASE_IDLE) {
+		timeout = timeouts->idle;
+	} else if (phase == CONN_PHASE_HEAD) {
+		timeout = timeouts->head;
+	} else if (phase == CONN_PHASE_BODY && timeouts->bodyMinRate > 0) {
+		timeout = timeouts->bodyGrace > 0 ? timeouts->bodyGrace : CONN_RATE_CHECK_MS;
+	}
+
+	if (timeout > 0)
+		timerArm(wheel, &dl->timer, now, timeout);
+	else
+		timerCancel(wheel, &dl->timer);
+}
+
+int connDeadlineExpired(struct timerWheel *wheel, struct connDeadline *dl,
+	const struct ConnTimeouts *timeouts, uint64_t now)
+{
+	if (dl->phase == CONN_PHASE_IDLE)
+		return CONNDL_CLOSE;
+	else if (dl->phase == CONN_PHASE_HEAD)
+		return CONNDL_REJECT;
+
+	uint64_t elapsed = now - dl->phaseStart;
+	uint64_t grace = timeouts->bodyGrace > 0 ? timeouts->bodyGrace : 0;
+	uint64_t required = elapsed > grace ? (elapsed - grace) * timeouts->bodyMinRate / 1000 : 0;
+
+	if (__atomic_load_n(&dl->progress, __ATOMIC_RELAXED) < required)
+		return CONNDL_REJECT;
+
+	timerArm(wheel, &dl->timer, now, CONN_RATE_CHECK_MS);
+	return CONNDL_KEEP;
+}
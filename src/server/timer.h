@@ -0,0 +1,195 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#ifndef TIMER_TICK_MS
+/**
+ * Resolution of timer wheel in milliseconds.
+ */
+#define TIMER_TICK_MS 100
+#endif
+
+/**
+ * Wheel has TIMER_LEVELS levels of TIMER_SLOTS slots. Each next level slot covers
+ * TIMER_SLOTS slots of the previous one, so the range is TIMER_SLOTS ^ TIMER_LEVELS ticks.
+ */
+#define TIMER_LEVEL_BITS 6
+#define TIMER_SLOTS (1 << TIMER_LEVEL_BITS)
+#define TIMER_LEVELS 4
+
+struct timer;
+
+/**
+ * Callback called when timer expires. Timer is already disarmed, so callback may arm it again or free it.
+ */
+typedef void (*timercb_t)(struct timer *timer);
+
+/**
+ * Intrusive timer. Memory is owned by the user and MUST stay valid while timer is armed.
+ */
+struct timer {
+	// Tick on which the timer expires.
+	uint64_t expires;
+	timercb_t fn;
+	void *arg;
+
+	// Links in the slot list. prev is NULL when timer is not armed.
+	struct timer *prev;
+	struct timer *next;
+};
+
+/**
+ * Hierarchical timer wheel. Arm and cancel are O(1), advance is O(1) per tick plus expired timers.
+ * Not thread-safe: wheel is owned by one thread or protected by the caller.
+ */
+struct timerWheel {
+	// Slot lists. Head of each list is a sentinel.
+	struct timer slots[TIMER_LEVELS][TIMER_SLOTS];
+
+	// Time of tick 0 in milliseconds.
+	uint64_t base;
+	// Last processed tick.
+	uint64_t current;
+	// Count of armed timers.
+	size_t armed;
+};
+
+/**
+ * @Returns monotonic time in milliseconds.
+ */
+uint64_t timerNow();
+
+void initTimerWheel(struct timerWheel *wheel, uint64_t now);
+
+/**
+ * Initializes timer. Should be called once before the first timerArm().
+ */
+void initTimer(struct timer *timer, timercb_t fn, void *arg);
+
+/**
+ * Arms the timer to expire in @timeout milliseconds after @now. Re-arms already armed timer.
+ */
+void timerArm(struct timerWheel *wheel, struct timer *timer, uint64_t now, uint64_t timeout);
+
+/**
+ * Disarms the timer. Does nothing if timer is not armed.
+ */
+void timerCancel(struct timerWheel *wheel, struct timer *timer);
+
+static inline int timerArmed(const struct timer *timer)
+{
+	return timer->prev != NULL;
+}
+
+/**
+ * Processes all the ticks up to @now and calls callbacks of expired timers.
+ */
+void timerWheelAdvance(struct timerWheel *wheel, uint64_t now);
+
+/**
+ * @Returns milliseconds until the next tick, -1 if no timers are armed. Suitable for epoll_wait(2) timeout.
+ */
+int timerWheelTimeout(struct timerWheel *wheel, uint64_t now);
+
+/**
+ * This section lists phases of the request being received on the connection.
+ * Each phase has its own deadline, see struct ConnTimeouts.
+ */
+/**
+ * Waiting for the next request.
+ */
+#define CONN_PHASE_IDLE 0
+/**
+ * Receiving request line and headers.
+ */
+#define CONN_PHASE_HEAD 1
+/**
+ * Receiving request body.
+ */
+#define CONN_PHASE_BODY 2
+/**
+ * Request is being processed. No deadline is enforced.
+ */
+#define CONN_PHASE_PROCESSING 3
+
+#ifndef CONN_DRAIN_GRACE
+/**
+ * Time in milliseconds given on drain to connections that have not received a request yet:
+ * their first request may be already in flight. Silent connections are closed after it.
+ */
+#define CONN_DRAIN_GRACE 500
+#endif
+
+/**
+ * Connection deadlines. All the values are in milliseconds, 0 disables the deadline.
+ */
+struct ConnTimeouts {
+	// Keep-alive idle timeout: maximum time between requests. Also limits output stalls.
+	int idle;
+	// Time to receive the whole request head since the phase started.
+	int head;
+	// Minimum average body transfer rate in bytes per second, enforced after bodyGrace.
+	int bodyMinRate;
+	int bodyGrace;
+
+	// Sent to the client before closing on head or body timeout. NULL means connection is just closed.
+	const char *response;
+};
+
+/**
+ * Deadline state of one connection.
+ */
+struct connDeadline {
+	struct timer timer;
+	int phase;
+	// Time when the current phase started.
+	uint64_t phaseStart;
+	// Count of body bytes received in the current phase. Added by blocking connections without the wheel lock,
+	// so it is accessed atomically.
+	size_t progress;
+};
+
+/**
+ * Verdicts of connDeadlineExpired().
+ */
+/**
+ * Deadline is met, timer is re-armed.
+ */
+#define CONNDL_KEEP 0
+/**
+ * Connection is idle and should be closed.
+ */
+#define CONNDL_CLOSE 1
+/**
+ * Request is too slow. ConnTimeouts.response should be sent and connection closed.
+ */
+#define CONNDL_REJECT 2
+
+void initConnDeadline(struct connDeadline *dl, timercb_t fn, void *arg);
+
+/**
+ * Updates connection phase and arms its deadline. Idle deadline is restarted on each call,
+ * head and body deadlines only when the phase changes.
+ */
+void connDeadlineUpdate(struct timerWheel *wheel, struct connDeadline *dl,
+	const struct ConnTimeouts *timeouts, int phase, uint64_t now);
+
+/**
+ * Decides what to do with connection whose timer expired.
+ *
+ * @Returns One of CONNDL_ verdicts.
+ */
+int connDeadlineExpired(struct timerWheel *wheel, struct connDeadline *dl,
+	const struct ConnTimeouts *timeouts, uint64_t now);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TIMER_H */
@@ -0,0 +1,880 @@
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <linux/io_uring.h>
+#include "utils.h"
+#include "server.h"
+#include "eventloop.h"
+#include "uring.h"
+
+/*
+ * io_uring is used directly via syscalls, so the library does not depend on liburing.
+ * IORING_RECV_MULTISHOT is the newest feature used by the backend: if kernel headers
+ * do not provide it, the backend is compiled as a stub.
+ */
+#ifdef IORING_RECV_MULTISHOT
+
+/**
+ * Operation tag stored in lower bits of sqe user_data. Upper bits hold a pointer to
+ * struct eventSource (accept), struct eventConn (recv, send, shutdown) or struct eventLoop (wake).
+ */
+#define URING_OP_ACCEPT 1
+#define URING_OP_RECV 2
+#define URING_OP_SEND 3
+#define URING_OP_SHUTDOWN 4
+#define URING_OP_WAKE 5
+#define URING_OP_CANCEL 6
+#define URING_OP_MASK 7ULL
+
+/**
+ * Provided buffers group id.
+ */
+#define URING_BGID 0
+
+struct uring {
+	int fd;
+
+	void *sqRing;
+	size_t sqRingSz;
+	unsigned *sqHead;
+	unsigned *sqTail;
+	unsigned *sqArray;
+	unsigned sqMask;
+	unsigned sqEntries;
+	// Tail with filled but not yet published entries.
+	unsigned sqLocalTail;
+
+	struct io_uring_sqe *sqes;
+	size_t sqesSz;
+
+	void *cqRing;
+	size_t cqRingSz;
+	unsigned *cqHead;
+	unsigned *cqTail;
+	unsigned cqMask;
+	struct io_uring_cqe *cqes;
+
+	struct io_uring_buf_ring *bufRing;
+	size_t bufRingSz;
+	char *bufs;
+	// Tail of provided buffers ring, published with uringPublishBufs().
+	unsigned short bufTail;
+
+	// Destination of wake eventfd reads.
+	uint64_t wakeval;
+	// Count of armed multishot accepts.
+	int accepting;
+};
+
+static int sysUringSetup(unsigned entries, struct io_uring_params *p)
+{
+	return syscall(__NR_io_uring_setup, entries, p);
+}
+
+/**
+ * @timeout Maximum time to wait for completions in milliseconds, -1 means no limit.
+ */
+static int sysUringEnter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags, int timeout)
+{
+	if (timeout < 0 || !(flags & IORING_ENTER_GETEVENTS))
+		return syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, NULL, 0);
+
+	struct __kernel_timespec ts = {
+		.tv_sec = timeout / 1000,
+		.tv_nsec = (long long)(timeout % 1000) * 1000000
+	};
+	struct io_uring_getevents_arg arg;
+	memset(&arg, 0, sizeof(arg));
+	arg.ts = (uint64_t)(uintptr_t)&ts;
+
+	return syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, 
+		flags | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+}
+
+static int sysUringRegister(int fd, unsigned opcode, void *arg, unsigned nrArgs)
+{
+	return syscall(__NR_io_uring_register, fd, opcode, arg, nrArgs);
+}
+
+void destroyUring(struct uring *ring)
+{
+	if (ring == NULL) return;
+
+	// Closing ring cancels all in-flight operations.
+	if (ring->fd != -1) close(ring->fd);
+
+	if (ring->sqes != NULL) munmap(ring->sqes, ring->sqesSz);
+	if (ring->cqRing != NULL && ring->cqRing != ring->sqRing) munmap(ring->cqRing, ring->cqRingSz);
+	if (ring->sqRing != NULL) munmap(ring->sqRing, ring->sqRingSz);
+	if (ring->bufRing != NULL) munmap(ring->bufRing, ring->bufRingSz);
+	free(ring->bufs);
+	free(ring);
+}
+
+static void uringRecycleBuf(struct uring *ring, unsigned short bid)
+{
+	struct io_uring_buf *buf = &ring->bufRing->bufs[ring->bufTail & (URING_BUFS - 1)];
+	buf->addr = (uint64_t)(uintptr_t)(ring->bufs + (size_t)bid * URING_BUFSZ);
+	buf->len = URING_BUFSZ;
+	buf->bid = bid;
+	ring->bufTail++;
+}
+
+static void uringPublishBufs(struct uring *ring)
+{
+	__atomic_store_n(&ring->bufRing->tail, ring->bufTail, __ATOMIC_RELEASE);
+}
+
+static struct uring *createUring()
+{
+	struct uring *ring = calloc(1, sizeof(struct uring));
+	if (ring == NULL) return NULL;
+	ring->fd = -1;
+
+	struct io_uring_params p;
+	memset(&p, 0, sizeof(p));
+	p.flags = IORING_SETUP_CQSIZE | IORING_SETUP_COOP_TASKRUN;
+	// Multishot operations post many completions per submission.
+	p.cq_entries = URING_ENTRIES * 16;
+
+	ring->fd = sysUringSetup(URING_ENTRIES, &p);
+	if (ring->fd == -1 && errno == EINVAL) {
+		// IORING_SETUP_COOP_TASKRUN is not supported by kernel.
+		memset(&p, 0, sizeof(p));
+		p.flags = IORING_SETUP_CQSIZE;
+		p.cq_entries = URING_ENTRIES * 16;
+		ring->fd = sysUringSetup(URING_ENTRIES, &p);
+	}
+	if (ring->fd == -1) goto error;
+
+	ring->sqRingSz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	ring->cqRingSz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (ring->cqRingSz > ring->sqRingSz) ring->sqRingSz = ring->cqRingSz;
+		ring->cqRingSz = ring->sqRingSz;
+	}
+
+	ring->sqRing = mmap(NULL, ring->sqRingSz, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	if (ring->sqRing == MAP_FAILED) {
+		ring->sqRing = NULL;
+		goto error;
+	}
+
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		ring->cqRing = ring->sqRing;
+	} else {
+		ring->cqRing = mmap(NULL, ring->cqRingSz, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+		if (ring->cqRing == MAP_FAILED) {
+			ring->cqRing = NULL;
+			goto error;
+		}
+	}
+
+	ring->sqesSz = p.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = mmap(NULL, ring->sqesSz, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED) {
+		ring->sqes = NULL;
+		goto error;
+	}
+
+	char *sq = ring->sqRing;
+	ring->sqHead = (unsigned *)(sq + p.sq_off.head);
+	ring->sqTail = (unsigned *)(sq + p.sq_off.tail);
+	ring->sqArray = (unsigned *)(sq + p.sq_off.array);
+	ring->sqMask = *(unsigned *)(sq + p.sq_off.ring_mask);
+	ring->sqEntries = p.sq_entries;
+	ring->sqLocalTail = *ring->sqTail;
+
+	char *cq = ring->cqRing;
+	ring->cqHead = (unsigned *)(cq + p.cq_off.head);
+	ring->cqTail = (unsigned *)(cq + p.cq_off.tail);
+	ring->cqMask = *(unsigned *)(cq + p.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+	// Buffer ring MUST be page aligned.
+	ring->bufRingSz = URING_BUFS * sizeof(struct io_uring_buf);
+	ring->bufRing = mmap(NULL, ring->bufRingSz, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (ring->bufRing == MAP_FAILED) {
+		ring->bufRing = NULL;
+		goto error;
+	}
+
+	ring->bufs = malloc((size_t)URING_BUFS * URING_BUFSZ);
+	if (ring->bufs == NULL) goto error;
+
+	struct io_uring_buf_reg reg;
+	memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = (uint64_t)(uintptr_t)ring->bufRing;
+	reg.ring_entries = URING_BUFS;
+	reg.bgid = URING_BGID;
+
+	if (sysUringRegister(ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1))
+		goto error;
+
+	for (unsigned i = 0; i < URING_BUFS; i++)
+		uringRecycleBuf(ring, i);
+	uringPublishBufs(ring);
+
+	return ring;
+
+error:;
+	int err = errno;
+	destroyUring(ring);
+	errno = err;
+	return NULL;
+}
+
+/**
+ * Submits all the filled entries. Waits for at least @wait completions, but no longer than @timeout ms.
+ *
+ * @Returns 0 on success, -1 + errno otherwise. errno is ETIME when timeout expired.
+ */
+static int uringSubmit(struct uring *ring, unsigned wait, int timeout)
+{
+	__atomic_store_n(ring->sqTail, ring->sqLocalTail, __ATOMIC_RELEASE);
+
+	unsigned toSubmit = ring->sqLocalTail - __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE);
+	if (toSubmit == 0 && wait == 0) return 0;
+
+	if (sysUringEnter(ring->fd, toSubmit, wait, wait ? IORING_ENTER_GETEVENTS : 0, timeout) == -1)
+		return -1;
+
+	return 0;
+}
+
+/**
+ * Makes sure that at least @count entries may be filled without submission.
+ * Entries filled after this call are submitted together, so they may be linked.
+ *
+ * @Returns 0 on success, -1 if submission queue is full.
+ */
+static int uringReserve(struct uring *ring, unsigned count)
+{
+	unsigned used = ring->sqLocalTail - __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE);
+	if (ring->sqEntries - used >= count) return 0;
+
+	if (uringSubmit(ring, 0, -1) && errno != EINTR && errno != EBUSY) return -1;
+
+	used = ring->sqLocalTail - __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE);
+	if (ring->sqEntries - used >= count) return 0;
+
+	errno = EBUSY;
+	return -1;
+}
+
+static struct io_uring_sqe *uringGetSqe(struct uring *ring)
+{
+	if (uringReserve(ring, 1)) return NULL;
+
+	unsigned idx = ring->sqLocalTail & ring->sqMask;
+	struct io_uring_sqe *sqe = &ring->sqes[idx];
+	ring->sqArray[idx] = idx;
+	ring->sqLocalTail++;
+
+	memset(sqe, 0, sizeof(*sqe));
+	return sqe;
+}
+
+static int uringArmAccept(struct eventLoop *loop, struct eventSource *lsrc)
+{
+	struct io_uring_sqe *sqe = uringGetSqe(loop->uring);
+	if (sqe == NULL) return -1;
+
+	sqe->opcode = IORING_OP_ACCEPT;
+	sqe->fd = lsrc->fd;
+	sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+	sqe->accept_flags = SOCK_CLOEXEC;
+	sqe->user_data = (uint64_t)(uintptr_t)lsrc | URING_OP_ACCEPT;
+
+	loop->uring->accepting++;
+	return 0;
+}
+
+static int uringArmWake(struct eventLoop *loop)
+{
+	struct io_uring_sqe *sqe = uringGetSqe(loop->uring);
+	if (sqe == NULL) return -1;
+
+	sqe->opcode = IORING_OP_READ;
+	sqe->fd = loop->wake.fd;
+	sqe->addr = (uint64_t)(uintptr_t)&loop->uring->wakeval;
+	sqe->len = sizeof(loop->uring->wakeval);
+	sqe->user_data = (uint64_t)(uintptr_t)loop | URING_OP_WAKE;
+
+	return 0;
+}
+
+static int uringArmRecv(struct eventConn *conn)
+{
+	struct io_uring_sqe *sqe = uringGetSqe(conn->loop->uring);
+	if (sqe == NULL) return -1;
+
+	sqe->opcode = IORING_OP_RECV;
+	sqe->fd = conn->src.fd;
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = URING_BGID;
+	sqe->user_data = (uint64_t)(uintptr_t)conn | URING_OP_RECV;
+
+	conn->receiving = 1;
+	conn->readable = 0;
+	conn->pending++;
+	return 0;
+}
+
+/**
+ * Cancels multishot receive of the connection: its input reached the input limit. Receive is armed again
+ * by uringResumeRecv() once the handler consumes the input.
+ */
+static int uringPauseRecv(struct eventConn *conn)
+{
+	if (conn->readable || !conn->receiving) return 0;
+
+	struct io_uring_sqe *sqe = uringGetSqe(conn->loop->uring);
+	if (sqe == NULL) return -1;
+
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->addr = (uint64_t)(uintptr_t)conn | URING_OP_RECV;
+	sqe->user_data = URING_OP_CANCEL;
+
+	// Receive is stopped with input left unread.
+	conn->readable = 1;
+	return 0;
+}
+
+/**
+ * Arms receive of live connection unless it is armed or the input is at the input limit.
+ * Called after each completion: input consumed by the handler makes room for paused receive.
+ */
+static int uringResumeRecv(struct eventConn *conn)
+{
+	if (	conn->shut || conn->eof || conn->closing || conn->receiving ||
+		conn->rlen >= conn->loop->context->inputLimit)
+		return 0;
+
+	return uringArmRecv(conn);
+}
+
+/**
+ * Sends pending output. If connection is closing, send is linked with shutdown
+ * so the connection is shut down right after the last byte is sent.
+ */
+static int uringArmSend(struct eventConn *conn)
+{
+	struct uring *ring = conn->loop->uring;
+	if (uringReserve(ring, conn->closing ? 2 : 1)) return -1;
+
+	struct io_uring_sqe *sqe = uringGetSqe(ring);
+	sqe->opcode = IORING_OP_SEND;
+	sqe->fd = conn->src.fd;
+	sqe->addr = (uint64_t)(uintptr_t)(conn->wbuf + conn->woff);
+	sqe->len = conn->wlen - conn->woff;
+	// Short send fails the request, so linked shutdown is canceled and send is resubmitted.
+	sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+	sqe->user_data = (uint64_t)(uintptr_t)conn | URING_OP_SEND;
+
+	conn->sending = 1;
+	conn->pending++;
+
+	if (conn->closing) {
+		sqe->flags |= IOSQE_IO_LINK;
+
+		sqe = uringGetSqe(ring);
+		sqe->opcode = IORING_OP_SHUTDOWN;
+		sqe->fd = conn->src.fd;
+		sqe->len = SHUT_RDWR;
+		sqe->user_data = (uint64_t)(uintptr_t)conn | URING_OP_SHUTDOWN;
+
+		conn->pending++;
+	}
+
+	return 0;
+}
+
+static void uringCancelAccepts(struct eventLoop *loop)
+{
+	for (size_t i = 0; i < loop->listenersc; i++) {
+		struct io_uring_sqe *sqe = uringGetSqe(loop->uring);
+		if (sqe == NULL) return;
+
+		sqe->opcode = IORING_OP_ASYNC_CANCEL;
+		sqe->addr = (uint64_t)(uintptr_t)(loop->listeners + i) | URING_OP_ACCEPT;
+		sqe->user_data = URING_OP_CANCEL;
+	}
+}
+
+/**
+ * Shuts connection down. In-flight operations complete with errors, and connection is freed
+ * by uringReleaseConn() after the last of them.
+ */
+static void uringCloseConn(struct eventConn *conn)
+{
+	if (conn->shut) return;
+	conn->shut = 1;
+
+	timerCancel(&conn->loop->timers, &conn->deadline.timer);
+
+	shutdown(conn->src.fd, SHUT_RDWR);
+}
+
+/**
+ * Frees shut down connection if it has no in-flight operations.
+ * Connection MUST NOT be used after this call.
+ */
+static void uringReleaseConn(struct eventConn *conn)
+{
+	if (!conn->shut || conn->pending != 0) return;
+
+	struct eventLoop *loop = conn->loop;
+
+	if (loop->stop) loop->drained++;
+
+	if (conn->prev != NULL) conn->prev->next = conn->next;
+	else loop->conns = conn->next;
+	if (conn->next != NULL) conn->next->prev = conn->prev;
+	loop->connsc--;
+
+	close(conn->src.fd);
+	free(conn->rbuf);
+	free(conn->wbuf);
+	eventConnFreeState(conn);
+	free(conn);
+}
+
+/**
+ * Runs connection handler on received input or to produce more output. Handler is not called while output
+ * is being sent, since it may reallocate output buffer. It is called again when send completes.
+ */
+static void uringRunHandler(struct eventConn *conn)
+{
+	if (conn->shut || conn->sending || conn->closing || (conn->rlen == 0 && !conn->producing)) return;
+
+	struct ApplicationContext *context = conn->loop->context;
+	int status = context->connevhandler(conn, context->connhandlerArgs);
+
+	if (status == CONNEV_ABORT) {
+		uringCloseConn(conn);
+		return;
+	} else if (status == CONNEV_CLOSE) {
+		conn->closing = 1;
+	}
+
+	if (conn->wlen > conn->woff) {
+		if (uringArmSend(conn)) uringCloseConn(conn);
+	} else if ((conn->closing || conn->eof) && !conn->producing) {
+		uringCloseConn(conn);
+	} else if (conn->rlen >= context->inputLimit && !conn->producing) {
+		// Handler waits for more input than the limit allows, e.g. for a request larger than it.
+		printf("Connection input limit is reached\n");
+		uringCloseConn(conn);
+	}
+}
+
+/**
+ * Restarts deadline of the connection phase. Called after each completion on live connection.
+ * While draining closes the connection once it becomes idle.
+ */
+static void uringUpdateDeadline(struct eventConn *conn)
+{
+	if (conn->shut) return;
+
+	if (conn->loop->stop && eventConnIdle(conn)) {
+		uringCloseConn(conn);
+		return;
+	}
+
+	struct eventLoop *loop = conn->loop;
+	connDeadlineUpdate(&loop->timers, &conn->deadline, &loop->context->timeouts, conn->phase, loop->now);
+}
+
+/**
+ * Deadline of the connection expired: closes it or rejects the slow request.
+ */
+static void uringConnExpired(struct timer *timer)
+{
+	struct eventConn *conn = timer->arg;
+	struct eventLoop *loop = conn->loop;
+	const struct ConnTimeouts *timeouts = &loop->context->timeouts;
+
+	int verdict = connDeadlineExpired(&loop->timers, &conn->deadline, timeouts, loop->now);
+	if (verdict == CONNDL_KEEP) return;
+
+	// Output buffer can not be touched while send is in flight, so the response is sent only on idle output.
+	if (	verdict == CONNDL_REJECT && timeouts->response != NULL && 
+		!conn->closing && !conn->sending) {
+
+		conn->closing = 1;
+		// Idle deadline bounds the time given to send the response.
+		conn->phase = CONN_PHASE_IDLE;
+		uringUpdateDeadline(conn);
+
+		if (	eventConnWrite(conn, timeouts->response, strlen(timeouts->response)) == 0 &&
+			uringArmSend(conn) == 0)
+			return;
+	}
+
+	uringCloseConn(conn);
+	uringReleaseConn(conn);
+}
+
+static void uringHandleAccept(struct eventLoop *loop, struct eventSource *lsrc, int res, unsigned flags)
+{
+	struct uring *ring = loop->uring;
+
+	if (!(flags & IORING_CQE_F_MORE)) {
+		ring->accepting--;
+
+		if (!loop->stop && uringArmAccept(loop, lsrc))
+			perror("Unable to accept new connection");
+	}
+
+	if (res < 0) {
+		if (res != -ECANCELED) {
+			errno = -res;
+			perror("Unable to accept new connection");
+		}
+		return;
+	}
+
+	// Connection accepted before accepts were canceled is served: its request may be already sent.
+	struct eventConn *conn = calloc(1, sizeof(struct eventConn));
+	if (conn == NULL) {
+		close(res);
+		return;
+	}
+
+	conn->src.type = EVSOURCE_CONN;
+	conn->src.fd = res;
+	conn->loop = loop;
+	initConnDeadline(&conn->deadline, uringConnExpired, conn);
+
+	conn->next = loop->conns;
+	if (loop->conns != NULL) loop->conns->prev = conn;
+	loop->conns = conn;
+	loop->connsc++;
+
+	if (uringArmRecv(conn)) {
+		uringCloseConn(conn);
+		uringReleaseConn(conn);
+		return;
+	}
+
+	uringUpdateDeadline(conn);
+}
+
+static void uringHandleRecv(struct eventConn *conn, int res, unsigned flags)
+{
+	struct uring *ring = conn->loop->uring;
+
+	if (!(flags & IORING_CQE_F_MORE)) {
+		conn->receiving = 0;
+		conn->pending--;
+	}
+
+	if (res > 0) {
+		unsigned short bid = flags >> IORING_CQE_BUFFER_SHIFT;
+
+		if (!conn->shut) {
+			if (eventConnReserve(conn, res)) {
+				uringCloseConn(conn);
+			} else {
+				memcpy(conn->rbuf + conn->rlen, ring->bufs + (size_t)bid * URING_BUFSZ, res);
+				conn->rlen += res;
+				conn->received += res;
+
+				if (conn->deadline.phase == CONN_PHASE_BODY)
+					conn->deadline.progress += res;
+
+				// Completions already posted still arrive, so the input may exceed the limit by a few buffers.
+				if (conn->rlen >= conn->loop->context->inputLimit && uringPauseRecv(conn))
+					uringCloseConn(conn);
+			}
+		}
+
+		uringRecycleBuf(ring, bid);
+		uringPublishBufs(ring);
+
+		uringRunHandler(conn);
+	} else if (res == 0) {
+		conn->eof = 1;
+	} else if (res != -ENOBUFS && !(res == -ECANCELED && conn->readable)) {
+		// ENOBUFS means that all provided buffers are in use. Receive is just rearmed.
+		// Receive canceled by uringPauseRecv() is rearmed once the input is consumed.
+		uringCloseConn(conn);
+	}
+
+	if (!conn->shut && conn->eof && !conn->sending && !conn->producing)
+		uringCloseConn(conn);
+
+	if (uringResumeRecv(conn))
+		uringCloseConn(conn);
+
+	uringUpdateDeadline(conn);
+	uringReleaseConn(conn);
+}
+
+static void uringHandleSend(struct eventConn *conn, int res)
+{
+	conn->pending--;
+	conn->sending = 0;
+
+	if (res < 0) {
+		uringCloseConn(conn);
+	} else {
+		conn->woff += res;
+
+		if (conn->shut) {
+			// Nothing to do. Waiting for the rest of operations.
+		} else if (conn->woff < conn->wlen) {
+			if (uringArmSend(conn)) uringCloseConn(conn);
+		} else {
+			conn->woff = 0;
+			conn->wlen = 0;
+
+			// When connection is closing linked shutdown finishes it.
+			// Requests received before EOF may be left by the handler for the next run.
+			if (!conn->closing) {
+				if (conn->eof && conn->rlen == 0 && !conn->producing) uringCloseConn(conn);
+				else uringRunHandler(conn);
+			}
+		}
+	}
+
+	if (uringResumeRecv(conn))
+		uringCloseConn(conn);
+
+	uringUpdateDeadline(conn);
+	uringReleaseConn(conn);
+}
+
+static void uringHandleShutdown(struct eventConn *conn, int res)
+{
+	conn->pending--;
+
+	// Canceled when linked send was short. Send will be resubmitted with a new shutdown.
+	if (res != -ECANCELED || conn->shut)
+		uringCloseConn(conn);
+
+	uringReleaseConn(conn);
+}
+
+/**
+ * Starts draining: accepts are canceled and idle connections are closed.
+ */
+static void uringHandleStop(struct eventLoop *loop)
+{
+	loop->stop = 1;
+	uringCancelAccepts(loop);
+
+	struct eventConn *conn = loop->conns;
+	while (conn != NULL) {
+		struct eventConn *next = conn->next;
+
+		if (eventConnIdle(conn)) {
+			uringCloseConn(conn);
+			uringReleaseConn(conn);
+		} else if (conn->received == 0) {
+			timerArm(&loop->timers, &conn->deadline.timer, loop->now, CONN_DRAIN_GRACE);
+		}
+
+		conn = next;
+	}
+}
+
+static void uringReapCompletions(struct eventLoop *loop)
+{
+	struct uring *ring = loop->uring;
+
+	unsigned head = *ring->cqHead;
+	unsigned tail = __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE);
+
+	for (; head != tail; head++) {
+		struct io_uring_cqe *cqe = &ring->cqes[head & ring->cqMask];
+		uint64_t udata = cqe->user_data;
+		int res = cqe->res;
+		unsigned flags = cqe->flags;
+
+		// Free the slot right away: handlers may submit new operations.
+		__atomic_store_n(ring->cqHead, head + 1, __ATOMIC_RELEASE);
+
+		void *ptr = (void *)(uintptr_t)(udata & ~URING_OP_MASK);
+		switch (udata & URING_OP_MASK) {
+			case URING_OP_ACCEPT:
+				uringHandleAccept(loop, ptr, res, flags);
+				break;
+			case URING_OP_RECV:
+				uringHandleRecv(ptr, res, flags);
+				break;
+			case URING_OP_SEND:
+				uringHandleSend(ptr, res);
+				break;
+			case URING_OP_SHUTDOWN:
+				uringHandleShutdown(ptr, res);
+				break;
+			case URING_OP_WAKE:
+				uringHandleStop(loop);
+				break;
+			default:
+				break;
+		}
+	}
+}
+
+int uringSupported()
+{
+	struct uring *ring = createUring();
+	if (ring == NULL) return 0;
+
+	destroyUring(ring);
+	return 1;
+}
+
+int initUringEventLoop(struct eventLoop *loop, struct ApplicationContext *context, int id)
+{
+	memset(loop, 0, sizeof(struct eventLoop));
+	loop->context = context;
+	loop->epfd = -1;
+	loop->wake.fd = -1;
+	loop->wake.type = EVSOURCE_WAKE;
+	loop->now = timerNow();
+	initTimerWheel(&loop->timers, loop->now);
+
+	loop->uring = createUring();
+	if (loop->uring == NULL)
+		goto error;
+
+	loop->wake.fd = eventfd(0, EFD_CLOEXEC);
+	if (loop->wake.fd == -1)
+		goto error;
+
+	size_t sz = context->socks.size;
+	loop->listeners = calloc(sz, sizeof(struct eventSource));
+	if (sz != 0 && loop->listeners == NULL)
+		goto error;
+
+	for (size_t i = 0; i < sz; i++) {
+		struct ssock *sock = vectorGetEl(&context->socks, i);
+		// Reuseport shards are owned by the loop with the same index.
+		if (sock == NULL || (sock->cpu != -1 && sock->cpu != id)) continue;
+
+		struct eventSource *lsrc = loop->listeners + loop->listenersc++;
+		lsrc->type = EVSOURCE_LISTENER;
+		lsrc->fd = sock->fd;
+	}
+
+	if (	pthread_mutex_init(&loop->stopLock, NULL) ||
+		pthread_cond_init(&loop->stopCond, NULL))
+		goto error;
+
+	return 0;
+
+error:;
+	int err = errno;
+	if (loop->wake.fd != -1) close(loop->wake.fd);
+	destroyUring(loop->uring);
+	loop->uring = NULL;
+	free(loop->listeners);
+	loop->listeners = NULL;
+	errno = err;
+	return -1;
+}
+
+void *uringLoopRunner(void *rawloop)
+{
+	struct eventLoop *loop = rawloop;
+	struct uring *ring = loop->uring;
+
+	for (size_t i = 0; i < loop->listenersc; i++) {
+		if (uringArmAccept(loop, loop->listeners + i)) {
+			perror("Unable to listen socket");
+			goto stop;
+		}
+	}
+
+	if (uringArmWake(loop)) {
+		perror("Unable to wait for events");
+		goto stop;
+	}
+
+	while (	!loop->stop || 
+		((loop->conns != NULL || ring->accepting != 0) && loop->now < loop->drainDeadline)) {
+
+		int timeout = timerWheelTimeout(&loop->timers, loop->now);
+		if (loop->stop) {
+			int left = loop->drainDeadline - loop->now;
+			if (timeout == -1 || timeout > left) timeout = left;
+		}
+
+		// One syscall submits the whole batch and waits for completions.
+		int status = uringSubmit(ring, 1, timeout);
+		loop->now = timerNow();
+
+		if (status && errno != EINTR && errno != EBUSY && errno != ETIME) {
+			perror("Unable to wait for events");
+			break;
+		}
+
+		uringReapCompletions(loop);
+		timerWheelAdvance(&loop->timers, loop->now);
+	}
+
+stop:
+	// Connections left after drain deadline. In-flight operations are canceled when the ring is closed.
+	loop->forced += loop->connsc;
+	while (loop->conns != NULL) {
+		struct eventConn *conn = loop->conns;
+		loop->conns = conn->next;
+		loop->connsc--;
+
+		close(conn->src.fd);
+		free(conn->rbuf);
+		free(conn->wbuf);
+		eventConnFreeState(conn);
+		free(conn);
+	}
+
+	pthread_mutex_lock(&loop->stopLock);
+	loop->stopped = 1;
+	pthread_cond_broadcast(&loop->stopCond);
+	pthread_mutex_unlock(&loop->stopLock);
+
+	return NULL;
+}
+
+#else
+
+void destroyUring(struct uring *ring)
+{
+}
+
+int uringSupported()
+{
+	return 0;
+}
+
+int initUringEventLoop(struct eventLoop *loop, struct ApplicationContext *context, int id)
+{
+	memset(loop, 0, sizeof(struct eventLoop));
+	errno = ENOSYS;
+	return -1;
+}
+
+void *uringLoopRunner(void *rawloop)
+{
+	return NULL;
+}
+
+#endif /* IORING_RECV_MULTISHOT */
@@ -0,0 +1,69 @@
+#ifndef URING_H
+#define URING_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "eventloop.h"
+
+#ifndef URING_ENTRIES
+/**
+ * Size of submission queue of each ring.
+ */
+#define URING_ENTRIES 256
+#endif
+
+#ifndef URING_BUFS
+/**
+ * Count of provided receive buffers per ring. MUST be a power of 2.
+ */
+#define URING_BUFS 256
+#endif
+
+#ifndef URING_BUFSZ
+/**
+ * Size of each provided receive buffer.
+ */
+#define URING_BUFSZ 4096
+#endif
+
+/**
+ * io_uring instance owned by one event loop. Contains mmap-ed rings and provided buffers ring.
+ */
+struct uring;
+
+/**
+ * Checks whether the running kernel supports io_uring features used by the backend
+ * (multishot accept, multishot recv and provided buffer rings).
+ *
+ * @Returns 1 if supported, 0 otherwise.
+ */
+int uringSupported();
+
+/**
+ * Initializes event loop with io_uring backend instead of epoll.
+ * Registers all the context shared listening sockets and reuseport shards with cpu equal to @id in it.
+ * Listening sockets should be already listen(2)-ed.
+ *
+ * @Returns Initialization status: 0 on success, -1 + errno otherwise.
+ */
+int initUringEventLoop(struct eventLoop *loop, struct ApplicationContext *context, int id);
+
+/**
+ * Thread callback that runs io_uring event loop until stopEventLoop() is called.
+ *
+ * @rawloop pointer to struct eventLoop.
+ */
+void *uringLoopRunner(void *rawloop);
+
+/**
+ * Deallocates io_uring instance of event loop. Called by destroyEventLoop().
+ */
+void destroyUring(struct uring *ring);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* URING_H */
@@ -5,6 +5,13 @@
 #include <string.h>
 #include <signal.h>
 #include <netinet/in.h>
+#include <sched.h>
+
+/**
+ * Takes vector lock unless the vector is local.
+ */
+#define vectorLock(vec) do { if (!(vec)->local) pthread_mutex_lock(&(vec)->lock); } while (0)
+#define vectorUnlock(vec) do { if (!(vec)->local) pthread_mutex_unlock(&(vec)->lock); } while (0)
 
 int initVector(struct vector *vec, size_t startCapacity) {
 	memset(vec, 0, sizeof(struct vector));
@@ -17,6 +24,14 @@ int initVector(struct vector *vec, size_t startCapacity) {
 	}
 
 
+	return 0;
+}
+int initLocalVector(struct vector *vec, size_t startCapacity) {
+	if (initVector(vec, startCapacity))
+		return -1;
+
+	vec->local = 1;
+
 	return 0;
 }
 void growVector(struct vector *vec) {
@@ -32,7 +47,7 @@ void growVector(struct vector *vec) {
 	vec->arr = tmp;
 }
 size_t insertVector(struct vector *vec, void *el) {
-	pthread_mutex_lock(&vec->lock);
+	vectorLock(vec);
 
 	if (vec->size == vec->capacity) {
 		growVector(vec);
@@ -41,27 +56,27 @@ size_t insertVector(struct vector *vec, void *el) {
 	vec->arr[vec->size] = el;
 	size_t i = vec->size++;
 
-	pthread_mutex_unlock(&vec->lock);
+	vectorUnlock(vec);
 
 	return i;
 }
 void *vectorGetEl(struct vector *vec, size_t i) {
-	pthread_mutex_lock(&vec->lock);
+	vectorLock(vec);
 
 	void *el = vec->arr[i];
 
-	pthread_mutex_unlock(&vec->lock);
+	vectorUnlock(vec);
 
 	return el; 
 }
 
 void vectorSetEl(struct vector *vec, size_t i, void *el) {
-	pthread_mutex_lock(&vec->lock);
+	vectorLock(vec);
 
 	void **elp = vec->arr + i;
 	*elp = el;
 
-	pthread_mutex_unlock(&vec->lock);
+	vectorUnlock(vec);
 }
 
 void vectorDestroy(struct vector *vec) {
@@ -75,7 +90,7 @@ void vectorDestroy(struct vector *vec) {
 
 
 int initVector_p(struct vector_p *vec, size_t elsz, size_t startCapacity) {
-	memset(vec, 0, sizeof(struct vector));
+	memset(vec, 0, sizeof(struct vector_p));
 	vec->capacity = startCapacity;
 	vec->elsz = elsz;
 
@@ -86,6 +101,14 @@ int initVector_p(struct vector_p *vec, size_t elsz, size_t startCapacity) {
 	}
 
 
+	return 0;
+}
+int initLocalVector_p(struct vector_p *vec, size_t elsz, size_t startCapacity) {
+	if (initVector_p(vec, elsz, startCapacity))
+		return -1;
+
+	vec->local = 1;
+
 	return 0;
 }
 void growVector_p(struct vector_p *vec) {
@@ -107,7 +130,7 @@ inline char *vectorElPtr_p(struct vector_p *vec, size_t i)
 }
 
 size_t insertVector_p(struct vector_p *vec, char *el) {
-	pthread_mutex_lock(&vec->lock);
+	vectorLock(vec);
 
 	if (vec->size == vec->capacity) {
 		growVector_p(vec);
@@ -116,35 +139,35 @@ size_t insertVector_p(struct vector_p *vec, char *el) {
 	size_t i = vec->size++;
 	memcpy(vectorElPtr_p(vec, i), el, vec->elsz);
 
-	pthread_mutex_unlock(&vec->lock);
+	vectorUnlock(vec);
 
 	return i;
 }
 char *vectorGetEl_p(struct vector_p *vec, size_t i) {
-	pthread_mutex_lock(&vec->lock);
+	vectorLock(vec);
 
 	char *el = vectorElPtr_p(vec, i);
 
-	pthread_mutex_unlock(&vec->lock);
+	vectorUnlock(vec);
 
 	return el; 
 }
 
 void vectorCopyEl_p(struct vector_p *vec, size_t i, char *buf) {
-	pthread_mutex_lock(&vec->lock);
+	vectorLock(vec);
 
 	char *el = vectorElPtr_p(vec, i);
 	memcpy(buf, el, vec->elsz);
 
-	pthread_mutex_unlock(&vec->lock);
+	vectorUnlock(vec);
 }
 
 void vectorSetEl_p(struct vector_p *vec, size_t i, char *el) {
-	pthread_mutex_lock(&vec->lock);
+	vectorLock(vec);
 
 	memcpy(vectorElPtr_p(vec, i), el, vec->elsz);
 
-	pthread_mutex_unlock(&vec->lock);
+	vectorUnlock(vec);
 }
 
 void vectorDestroy_p(struct vector_p *vec) {
@@ -157,9 +180,377 @@ void vectorDestroy_p(struct vector_p *vec) {
 	vec->capacity = 0;
 }
 
+/**
+ * Epoch critical section state of one thread. Records are never freed: record of exited thread is reused.
+ */
+struct epochReader {
+	/* Epoch observed on enter, 0 if thread is not in critical section */
+	uint64_t epoch;
+	int used;
+	struct epochReader *next;
+};
+
+/**
+ * Global epoch. Starts from 1 since 0 marks inactive readers.
+ */
+static uint64_t globalEpoch = 1;
+static struct epochReader *epochReaders;
+static pthread_key_t epochReaderKey;
+static pthread_once_t epochReaderKeyOnce = PTHREAD_ONCE_INIT;
+static __thread struct epochReader *localReader;
+
+static void releaseEpochReader(void *rawreader) {
+	struct epochReader *reader = rawreader;
+	__atomic_store_n(&reader->epoch, 0, __ATOMIC_RELEASE);
+	__atomic_store_n(&reader->used, 0, __ATOMIC_RELEASE);
+}
+
+static void initEpochReaderKey() {
+	pthread_key_create(&epochReaderKey, releaseEpochReader);
+}
+
+/**
+ * Takes unused reader record or links a new one. Called once per thread.
+ */
+static struct epochReader *acquireEpochReader() {
+	pthread_once(&epochReaderKeyOnce, initEpochReaderKey);
+
+	struct epochReader *reader = __atomic_load_n(&epochReaders, __ATOMIC_ACQUIRE);
+	for (; reader != NULL; reader = reader->next) {
+		int unused = 0;
+		if (__atomic_compare_exchange_n(&reader->used, &unused, 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+			break;
+	}
+
+	if (reader == NULL) {
+		reader = calloc(1, sizeof(struct epochReader));
+		if (reader == NULL) {
+			raise(SIGTERM);
+			return NULL;
+		}
+
+		reader->used = 1;
+		reader->next = __atomic_load_n(&epochReaders, __ATOMIC_RELAXED);
+		while (!__atomic_compare_exchange_n(&epochReaders, &reader->next, reader, 1, 
+			__ATOMIC_RELEASE, __ATOMIC_RELAXED));
+	}
+
+	pthread_setspecific(epochReaderKey, reader);
+
+	return reader;
+}
+
+void epochEnter() {
+	if (localReader == NULL)
+		localReader = acquireEpochReader();
+
+	__atomic_store_n(&localReader->epoch, __atomic_load_n(&globalEpoch, __ATOMIC_ACQUIRE), __ATOMIC_RELAXED);
+	// Epoch store MUST be visible to writers before any load of protected memory.
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+void epochExit() {
+	__atomic_store_n(&localReader->epoch, 0, __ATOMIC_RELEASE);
+}
+
+void epochSynchronize() {
+	uint64_t epoch = __atomic_add_fetch(&globalEpoch, 1, __ATOMIC_SEQ_CST);
+
+	struct epochReader *reader = __atomic_load_n(&epochReaders, __ATOMIC_ACQUIRE);
+	for (; reader != NULL; reader = reader->next) {
+		while (1) {
+			uint64_t re = __atomic_load_n(&reader->epoch, __ATOMIC_ACQUIRE);
+			if (re == 0 || re >= epoch) break;
+
+			sched_yield();
+		}
+	}
+}
+
+struct rcuArray
+{
+	size_t capacity;
+	void *arr[];
+};
+
+static struct rcuArray *allocRcuArray(size_t capacity) {
+	struct rcuArray *arr = malloc(sizeof(struct rcuArray) + sizeof(void *) * capacity);
+	if (arr == NULL) return NULL;
+
+	arr->capacity = capacity;
+	return arr;
+}
+
+int initRcuVector(struct rcuVector *vec, size_t startCapacity) {
+	memset(vec, 0, sizeof(struct rcuVector));
+
+	if (startCapacity == 0) startCapacity = 1;
+
+	vec->cur = allocRcuArray(startCapacity);
+
+	if (vec->cur == NULL || pthread_mutex_init(&vec->lock, NULL)) {
+		free(vec->cur);
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * Replaces array with the twice larger copy and frees the old one after grace period.
+ * Should be called with vector lock held.
+ */
+static void growRcuVector(struct rcuVector *vec) {
+	struct rcuArray *old = vec->cur;
+	struct rcuArray *tmp = allocRcuArray(old->capacity * 2);
+
+	if (tmp == NULL) {
+		raise(SIGTERM);
+		return;
+	}
+
+	memcpy(tmp->arr, old->arr, sizeof(void *) * vec->size);
+	__atomic_store_n(&vec->cur, tmp, __ATOMIC_RELEASE);
+
+	epochSynchronize();
+	free(old);
+}
+
+size_t insertRcuVector(struct rcuVector *vec, void *el) {
+	pthread_mutex_lock(&vec->lock);
+
+	if (vec->size == vec->cur->capacity) {
+		growRcuVector(vec);
+	}
+
+	size_t i = vec->size;
+	__atomic_store_n(&vec->cur->arr[i], el, __ATOMIC_RELAXED);
+	// Element is published before the size.
+	__atomic_store_n(&vec->size, i + 1, __ATOMIC_RELEASE);
+
+	pthread_mutex_unlock(&vec->lock);
+
+	return i;
+}
+
+void *rcuVectorGetEl(struct rcuVector *vec, size_t i) {
+	void *el = NULL;
+
+	epochEnter();
+
+	if (i < __atomic_load_n(&vec->size, __ATOMIC_ACQUIRE)) {
+		struct rcuArray *arr = __atomic_load_n(&vec->cur, __ATOMIC_ACQUIRE);
+		el = __atomic_load_n(&arr->arr[i], __ATOMIC_RELAXED);
+	}
+
+	epochExit();
+
+	return el;
+}
+
+void rcuVectorSetEl(struct rcuVector *vec, size_t i, void *el) {
+	pthread_mutex_lock(&vec->lock);
+
+	__atomic_store_n(&vec->cur->arr[i], el, __ATOMIC_RELEASE);
+
+	pthread_mutex_unlock(&vec->lock);
+}
+
+void rcuVectorDestroy(struct rcuVector *vec) {
+	free(vec->cur);
+	pthread_mutex_destroy(&vec->lock);
+
+	vec->cur = NULL;
+	vec->size = 0;
+}
+
+/**
+ * Marks end of free and live lists.
+ */
+#define SLOT_NONE UINT32_MAX
+
+int initSlotTable(struct slotTable *table, size_t elsz, size_t capacity) {
+	memset(table, 0, sizeof(struct slotTable));
+
+	if (capacity == 0 || capacity >= SLOT_NONE)
+		return -1;
+
+	table->elsz = elsz;
+	table->capacity = capacity;
+	table->liveHead = SLOT_NONE;
+
+	table->arr = malloc(elsz * capacity);
+	table->generations = calloc(capacity, sizeof(uint32_t));
+	table->next = malloc(sizeof(uint32_t) * capacity);
+	table->prev = malloc(sizeof(uint32_t) * capacity);
+
+	if (	table->arr == NULL || table->generations == NULL || 
+		table->next == NULL || table->prev == NULL ||
+		pthread_mutex_init(&table->lock, NULL)) {
+
+		free(table->arr);
+		free(table->generations);
+		free(table->next);
+		free(table->prev);
+		return -1;
+	}
+
+	for (size_t i = 0; i < capacity; i++)
+		table->next[i] = i + 1 < capacity ? i + 1 : SLOT_NONE;
+	table->freeHead = 0;
+
+	return 0;
+}
+
+static inline uint32_t slotIndex(slothandle_t h) {
+	return h & UINT32_MAX;
+}
+
+static inline uint32_t slotGeneration(slothandle_t h) {
+	return h >> 32;
+}
+
+/**
+ * Checks the handle. Should be called with table lock held.
+ */
+static inline int slotValid(struct slotTable *table, slothandle_t h) {
+	uint32_t i = slotIndex(h);
+
+	// Live slots have odd generation, free slots have even one.
+	return 	i < table->capacity && 
+		table->generations[i] == slotGeneration(h) && 
+		(table->generations[i] & 1);
+}
+
+slothandle_t slotTableInsert(struct slotTable *table, const char *el) {
+	pthread_mutex_lock(&table->lock);
+
+	uint32_t i = table->freeHead;
+	if (i == SLOT_NONE) {
+		pthread_mutex_unlock(&table->lock);
+		return SLOTHANDLE_INVAL;
+	}
+	table->freeHead = table->next[i];
+
+	table->generations[i]++;
+	memcpy(table->arr + i * table->elsz, el, table->elsz);
+
+	table->prev[i] = SLOT_NONE;
+	table->next[i] = table->liveHead;
+	if (table->liveHead != SLOT_NONE)
+		table->prev[table->liveHead] = i;
+	table->liveHead = i;
+	table->size++;
+
+	slothandle_t h = ((slothandle_t)table->generations[i] << 32) | i;
+
+	pthread_mutex_unlock(&table->lock);
+
+	return h;
+}
+
+int slotTableCopyEl(struct slotTable *table, slothandle_t h, char *buf) {
+	pthread_mutex_lock(&table->lock);
+
+	if (!slotValid(table, h)) {
+		pthread_mutex_unlock(&table->lock);
+		return -1;
+	}
+
+	memcpy(buf, table->arr + slotIndex(h) * table->elsz, table->elsz);
+
+	pthread_mutex_unlock(&table->lock);
+
+	return 0;
+}
+
+int slotTableSetEl(struct slotTable *table, slothandle_t h, const char *el) {
+	pthread_mutex_lock(&table->lock);
+
+	if (!slotValid(table, h)) {
+		pthread_mutex_unlock(&table->lock);
+		return -1;
+	}
+
+	memcpy(table->arr + slotIndex(h) * table->elsz, el, table->elsz);
+
+	pthread_mutex_unlock(&table->lock);
+
+	return 0;
+}
+
+/**
+ * Unlinks slot from live list and pushes it to free list. Should be called with table lock held.
+ */
+static void slotFree(struct slotTable *table, uint32_t i) {
+	if (table->prev[i] != SLOT_NONE) table->next[table->prev[i]] = table->next[i];
+	else table->liveHead = table->next[i];
+	if (table->next[i] != SLOT_NONE) table->prev[table->next[i]] = table->prev[i];
+
+	table->generations[i]++;
+	table->next[i] = table->freeHead;
+	table->freeHead = i;
+	table->size--;
+}
+
+int slotTableRemove(struct slotTable *table, slothandle_t h, char *buf) {
+	pthread_mutex_lock(&table->lock);
+
+	if (!slotValid(table, h)) {
+		pthread_mutex_unlock(&table->lock);
+		return -1;
+	}
+
+	uint32_t i = slotIndex(h);
+	if (buf != NULL)
+		memcpy(buf, table->arr + i * table->elsz, table->elsz);
+
+	slotFree(table, i);
+
+	pthread_mutex_unlock(&table->lock);
+
+	return 0;
+}
+
+void slotTableForEach(struct slotTable *table, slotvisitor_t fn, void *arg) {
+	pthread_mutex_lock(&table->lock);
+
+	uint32_t i = table->liveHead;
+	while (i != SLOT_NONE) {
+		uint32_t next = table->next[i];
+		slothandle_t h = ((slothandle_t)table->generations[i] << 32) | i;
+
+		if (fn(h, table->arr + i * table->elsz, arg))
+			slotFree(table, i);
+
+		i = next;
+	}
+
+	pthread_mutex_unlock(&table->lock);
+}
+
+void destroySlotTable(struct slotTable *table) {
+	free(table->arr);
+	free(table->generations);
+	free(table->next);
+	free(table->prev);
+	pthread_mutex_destroy(&table->lock);
+
+	table->arr = NULL;
+	table->generations = NULL;
+	table->next = NULL;
+	table->prev = NULL;
+	table->size = 0;
+	table->capacity = 0;
+}
+
 int parseArgs(int argc, const char *argv[], struct args_t *res)
 {
 	memset(res, 0, sizeof(*res));
+	char mode = '\0';
+	int threads = 0;
+	int reuseport = 0;
+	const char *handoffPath = NULL;
 
 	if (argc < 2) 
 		goto nonfree_err;
@@ -227,6 +618,22 @@ int parseArgs(int argc, const char *argv[], struct args_t *res)
 				TCPAddrs[tci++] = iaddr;
 
 				free(addrData);
+			} else if (inType == 'E' || inType == 'R' || inType == 'P') {
+				char *end;
+				long nthreads = strtol(data, &end, 10);
+
+				if (*data == '\0' || *end != '\0' || nthreads < 0 || nthreads > 1024)
+					goto error;
+
+				mode = inType;
+				threads = nthreads;
+			} else if (inType == 'S') {
+				if (!strcmp(data, "on")) reuseport = 1;
+				else if (!strcmp(data, "pin")) reuseport = 2;
+				else if (!strcmp(data, "steer")) reuseport = 3;
+				else goto error;
+			} else if (inType == 'H') {
+				handoffPath = data;
 			} else {
       				goto error;
       			}
@@ -239,6 +646,21 @@ int parseArgs(int argc, const char *argv[], struct args_t *res)
 			} else if (!strcmp(data, "-T")) {
 				inType = 'T';
 				inSched = 1;
+			} else if (!strcmp(data, "-E")) {
+				inType = 'E';
+				inSched = 1;
+			} else if (!strcmp(data, "-R")) {
+				inType = 'R';
+				inSched = 1;
+			} else if (!strcmp(data, "-P")) {
+				inType = 'P';
+				inSched = 1;
+			} else if (!strcmp(data, "-S")) {
+				inType = 'S';
+				inSched = 1;
+			} else if (!strcmp(data, "-H")) {
+				inType = 'H';
+				inSched = 1;
 			} else {
 				goto error;
 			}
@@ -253,6 +675,11 @@ int parseArgs(int argc, const char *argv[], struct args_t *res)
 	res->unixSocks = unixSocks;
 	res->unixc = unixc;
 
+	res->mode = mode;
+	res->threads = threads;
+	res->reuseport = reuseport;
+	res->handoffPath = handoffPath;
+
 	return 0;
 
 error:
@@ -261,9 +688,9 @@ error:
 	free(TCPPorts);
 nonfree_err:
 	if (argc == 0) {
-		fprintf(stderr, "Invalid arguments. Accepted format: [-U </path/to/socket>...] [-T ip_addr:port...]\n");
+		fprintf(stderr, "Invalid arguments. Accepted format: [-U </path/to/socket>...] [-T ip_addr:port...] [-E event_loops | -R uring_loops | -P workers] [-S on|pin|steer] [-H </path/to/handoff.socket>]\n");
 	} else {
-		fprintf(stderr, "Invalid arguments. Accepted format: %s [-U </path/to/socket>...] [-T ip_addr:port...]\n",
+		fprintf(stderr, "Invalid arguments. Accepted format: %s [-U </path/to/socket>...] [-T ip_addr:port...] [-E event_loops | -R uring_loops | -P workers] [-S on|pin|steer] [-H </path/to/handoff.socket>]\n",
 			argv[0]);
 	}
 
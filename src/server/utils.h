@@ -7,6 +7,7 @@ extern "C" {
 #endif
 
 #include <pthread.h>
+#include <stdint.h>
 
 /**
  * A dynamic array
@@ -17,9 +18,16 @@ struct vector
 	size_t size;
 	size_t capacity;
 	pthread_mutex_t lock;
+	/* Vector is used by one thread only, lock is not taken */
+	int local;
 };
 
 int initVector(struct vector *vec, size_t startCapacity);
+/**
+ * Initializes an unsynchronized vector. Same as initVector() but operations do not take the lock,
+ * so vector MUST be accessed by one thread only.
+ */
+int initLocalVector(struct vector *vec, size_t startCapacity);
 void growVector(struct vector *vec);
 size_t insertVector(struct vector *vec, void *el);
 #define vectorInsertEl insertVector 
@@ -42,6 +50,8 @@ struct vector_p
 	size_t size;
 	size_t capacity;
 	pthread_mutex_t lock;
+	/* Vector is used by one thread only, lock is not taken */
+	int local;
 };
 
 /**
@@ -54,6 +64,11 @@ struct vector_p
  * @Returns 0 if vector created sucessfully, -1 otherwise.
  */
 int initVector_p(struct vector_p *vec, size_t elsz, size_t startCapacity);
+/**
+ * Initializes an unsynchronized vector of primitives. Same as initVector_p() but operations do not take the lock,
+ * so vector MUST be accessed by one thread only (e.g. headers of one request).
+ */
+int initLocalVector_p(struct vector_p *vec, size_t elsz, size_t startCapacity);
 void growVector_p(struct vector_p *vec);
 
 /**
@@ -82,6 +97,146 @@ void vectorSetEl_p(struct vector_p *vec, size_t i, char *el);
 void vectorDestroy_p(struct vector_p *vec);
 
 
+/**
+ * Array of rcuVector. Replaced as a whole on grow, so readers never see realloc-ed memory.
+ */
+struct rcuArray;
+
+/**
+ * A dynamic array of pointers with wait-free reads.
+ * Readers do not take any lock: they load the current array inside an epoch critical section.
+ * Writers are serialized by the lock. Array replaced on grow is freed once all the readers
+ * that could see it have left their critical sections (epoch-based reclamation).
+ */
+struct rcuVector
+{
+	struct rcuArray *cur;
+	size_t size;
+	pthread_mutex_t lock;
+};
+
+int initRcuVector(struct rcuVector *vec, size_t startCapacity);
+size_t insertRcuVector(struct rcuVector *vec, void *el);
+#define rcuVectorInsertEl insertRcuVector
+
+/**
+ * Wait-free read of element. Thread-safe.
+ *
+ * @Returns element on position i or NULL if i is out of bounds.
+ */
+void *rcuVectorGetEl(struct rcuVector *vec, size_t i);
+void rcuVectorSetEl(struct rcuVector *vec, size_t i, void *el);
+/**
+ * Deallocates the vector. MUST NOT be called while vector is in use.
+ */
+void rcuVectorDestroy(struct rcuVector *vec);
+
+/**
+ * Enters epoch critical section on the current thread. Memory retired by writers after the call
+ * is not freed until epochExit(). Critical sections MUST NOT be nested and should be short.
+ */
+void epochEnter();
+void epochExit();
+/**
+ * Waits until all the threads that were in critical section at the moment of the call leave it.
+ * After that memory unlinked before the call can be safely freed.
+ */
+void epochSynchronize();
+
+/**
+ * Handle of an element in slotTable. Lower 32 bits hold slot index, upper 32 bits hold slot generation.
+ * Generation is bumped each time the slot is freed, so handles to removed elements are detected as stale.
+ */
+typedef uint64_t slothandle_t;
+
+/**
+ * Invalid handle. Never returned for a live element.
+ */
+#define SLOTHANDLE_INVAL ((slothandle_t)-1)
+
+/**
+ * A fixed-capacity table of primitive elements (non-pointers, fixed size) with a free list.
+ * Insert and remove are O(1) and reuse freed slots, so memory is bounded by capacity.
+ * Live elements are linked, so iteration over them is O(live).
+ */
+struct slotTable
+{
+	char *arr;
+	/* Size of each element */
+	size_t elsz;
+
+	uint32_t *generations;
+	/* Links of free list (next only) and of live list (both) */
+	uint32_t *next;
+	uint32_t *prev;
+
+	uint32_t freeHead;
+	uint32_t liveHead;
+
+	/* Count of live elements */
+	size_t size;
+	size_t capacity;
+	pthread_mutex_t lock;
+};
+
+/**
+ * Initializes a slot table.
+ *
+ * @table pointer to table to be initialized
+ * @elsz size of each element
+ * @capacity Maximum count of live elements. Memory for all of them is allocated at once.
+ *
+ * @Returns 0 if table created sucessfully, -1 otherwise.
+ */
+int initSlotTable(struct slotTable *table, size_t elsz, size_t capacity);
+
+/**
+ * Copies element into a free slot.
+ *
+ * @Returns handle of inserted element or SLOTHANDLE_INVAL if table is full.
+ */
+slothandle_t slotTableInsert(struct slotTable *table, const char *el);
+
+/**
+ * Copies bytes of element to buffer. Thread-safe.
+ *
+ * @Returns 0 on success, -1 if handle is stale.
+ */
+int slotTableCopyEl(struct slotTable *table, slothandle_t h, char *buf);
+
+/**
+ * Rewrites element. Thread-safe.
+ *
+ * @Returns 0 on success, -1 if handle is stale.
+ */
+int slotTableSetEl(struct slotTable *table, slothandle_t h, const char *el);
+
+/**
+ * Removes element and frees its slot. Only one of concurrent removals of the same element succeeds,
+ * so the caller that removed the element may safely release resources it holds.
+ *
+ * @buf If not NULL, removed element is copied to it.
+ *
+ * @Returns 0 on success, -1 if handle is stale.
+ */
+int slotTableRemove(struct slotTable *table, slothandle_t h, char *buf);
+
+/**
+ * Callback for slotTableForEach().
+ *
+ * @el Pointer to element inside the table. Valid only during the call.
+ *
+ * @Returns 1 to remove the element, 0 to keep it.
+ */
+typedef int (*slotvisitor_t)(slothandle_t h, char *el, void *arg);
+
+/**
+ * Calls @fn for each live element, holding table lock. O(live).
+ */
+void slotTableForEach(struct slotTable *table, slotvisitor_t fn, void *arg);
+
+void destroySlotTable(struct slotTable *table);
+
 /**
  * Stores program args.
  */
@@ -92,6 +247,23 @@ struct args_t {
 	struct in_addr *TCPAddrs;
 	int *TCPPorts;
 	int TCPc;
+
+	/* 
+	 * Server mode flag: '\0' for thread per connection, 'E' for epoll event loops,
+	 * 'R' for io_uring event loops, 'P' for worker pool.
+	 */
+	char mode;
+	/* Count of event loops or pool workers. 0 for one thread per core. */
+	int threads;
+
+	/* 
+	 * Per-core SO_REUSEPORT sharding: 0 disabled, 1 enabled ("on"), 2 with pinned threads ("pin"),
+	 * 3 with pinned threads and CPU steering ("steer").
+	 */
+	int reuseport;
+
+	/* Unix socket used to take listening sockets over from the running predecessor and pass them to successor. */
+	const char *handoffPath;
 };
 
 /**
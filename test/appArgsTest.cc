@@ -23,7 +23,62 @@ TEST(ParseArgs, ParsesNormally) {
 	ASSERT_EQ(args.TCPAddrs[0].s_addr, htonl(2130706433U));
 	ASSERT_EQ(args.TCPPorts[0], 8888);
 
+	ASSERT_EQ(args.mode, '\0');
+
+	destroyArgs(&args);
+}
+
+TEST(ParseArgs, ParsesServerMode) {
+	const char *argv[] = {
+		"program",
+		"-T",
+		"127.0.0.1:8888",
+		"-E",
+		"4"
+	};
+
+	int argc = 5;
+
+	struct args_t args;
+	ASSERT_EQ(parseArgs(argc, argv, &args), 0);
+	ASSERT_EQ(args.TCPc, 1);
+	ASSERT_EQ(args.mode, 'E');
+	ASSERT_EQ(args.threads, 4);
 	destroyArgs(&args);
+
+	argv[3] = "-R";
+	ASSERT_EQ(parseArgs(argc, argv, &args), 0);
+	ASSERT_EQ(args.mode, 'R');
+	ASSERT_EQ(args.threads, 4);
+	destroyArgs(&args);
+
+	argv[3] = "-P";
+	argv[4] = "0";
+	ASSERT_EQ(parseArgs(argc, argv, &args), 0);
+	ASSERT_EQ(args.mode, 'P');
+	ASSERT_EQ(args.threads, 0);
+	ASSERT_EQ(args.reuseport, 0);
+	destroyArgs(&args);
+
+	argv[3] = "-S";
+	argv[4] = "steer";
+	ASSERT_EQ(parseArgs(argc, argv, &args), 0);
+	ASSERT_EQ(args.mode, '\0');
+	ASSERT_EQ(args.reuseport, 3);
+	ASSERT_EQ(args.handoffPath, nullptr);
+	destroyArgs(&args);
+
+	argv[3] = "-H";
+	argv[4] = "/tmp/chttp.handoff";
+	ASSERT_EQ(parseArgs(argc, argv, &args), 0);
+	ASSERT_STREQ(args.handoffPath, "/tmp/chttp.handoff");
+	destroyArgs(&args);
+
+	argv[3] = "-S";
+	argv[4] = "-1";
+	testing::internal::CaptureStderr();
+	ASSERT_EQ(parseArgs(argc, argv, &args), -1);
+	testing::internal::GetCapturedStderr();
 }
 
 TEST(ParseArgs, ParseError) {
@@ -40,5 +95,5 @@ TEST(ParseArgs, ParseError) {
 	ASSERT_EQ(parseArgs(argc, argv, &args), -1);
 	std::string errout = testing::internal::GetCapturedStderr();
 
-	ASSERT_STREQ(errout.c_str(), "Invalid arguments. Accepted format: program [-U </path/to/socket>...] [-T ip_addr:port...]\n");
+	ASSERT_STREQ(errout.c_str(), "Invalid arguments. Accepted format: program [-U </path/to/socket>...] [-T ip_addr:port...] [-E event_loops | -R uring_loops | -P workers] [-S on|pin|steer] [-H </path/to/handoff.socket>]\n");
 }
@@ -0,0 +1,290 @@
+#include <gtest/gtest.h>
+#include <string>
+#include <cstring>
+#include <cerrno>
+#include "server/cache.h"
+#include "server/timer.h"
+#include "testUtils.h"
+
+static int processed;
+
+/**
+ * Processor of the tests: body is the path, Cache-Control is the value of X-CC request header,
+ * Vary is the value of X-Vary request header.
+ */
+static void cachedProcessor(struct HTTPRequest *req, struct HTTPResponse *resp)
+{
+	processed++;
+
+	static thread_local std::string body;
+	body = "body of ";
+	body += req->views ? std::string(req->pathv.ptr, req->pathv.len) : std::string(req->path);
+	resp->status = body.find("/missing") != std::string::npos ? 404 : 200;
+
+	size_t len;
+	const char *cc = getHTTPRequestHeader(req, "X-CC", &len);
+	addKVHTTPHeader_p(&resp->headers, "Cache-Control", cc != NULL ? std::string(cc, len).c_str() : "max-age=60");
+	const char *vary = getHTTPRequestHeader(req, "X-Vary", &len);
+	if (vary != NULL) addKVHTTPHeader_p(&resp->headers, "Vary", std::string(vary, len).c_str());
+	const char *lang = getHTTPRequestHeader(req, "Accept-Language", &len);
+	if (lang != NULL) body += " in " + std::string(lang, len);
+
+	resp->body = (char *)body.c_str();
+	resp->bodyc = body.size();
+}
+
+/**
+ * Answers @raw request by the connection handler with @cache and returns the response sent to the socket.
+ */
+static std::string cached(struct httpCache *cache, const std::string &raw)
+{
+	struct HTTPConnectionHandlerArgs args = {};
+	args.httpRequestProcessor = cachedProcessor;
+	args.cache = cache;
+
+	return handleConnection(&args, raw);
+}
+
+TEST(CacheTest, HitsAndMisses) {
+	struct httpCache cache;
+	ASSERT_EQ(initHTTPCache(&cache, 1 << 20, 4), 0);
+	ASSERT_EQ(cache.shardsc, 4);
+	processed = 0;
+
+	std::string first = cached(&cache, "GET /a HTTP/1.1\r\n\r\n");
+	ASSERT_EQ(first.rfind("HTTP/1.1 200 OK\r\n", 0), 0) << first;
+	ASSERT_EQ(responseBody(first), "body of /a");
+	std::string etag = responseHeader(first, "ETag");
+	ASSERT_EQ(etag.size(), 18);
+
+	std::string second = cached(&cache, "GET /a HTTP/1.1\r\n\r\n");
+	ASSERT_EQ(second.rfind("HTTP/1.1 200 OK\r\n", 0), 0) << second;
+	ASSERT_EQ(responseBody(second), "body of /a");
+	ASSERT_EQ(responseHeader(second, "ETag"), etag);
+	ASSERT_EQ(responseHeader(second, "Cache-Control"), "max-age=60");
+	ASSERT_EQ(responseHeader(second, "Content-Length"), "10");
+	ASSERT_EQ(responseHeader(second, "Age"), "0");
+	ASSERT_EQ(processed, 1);
+
+	// HEAD is answered from the GET response.
+	std::string head = cached(&cache, "HEAD /a HTTP/1.1\r\n\r\n");
+	ASSERT_EQ(responseHeader(head, "Content-Length"), "10");
+	ASSERT_EQ(responseBody(head), "");
+
+	ASSERT_EQ(responseBody(cached(&cache, "GET /missing HTTP/1.1\r\n\r\n")), "body of /missing");
+	ASSERT_EQ(cached(&cache, "GET /missing HTTP/1.1\r\n\r\n").rfind("HTTP/1.1 404 ", 0), 0);
+	ASSERT_EQ(processed, 2);
+
+	struct httpCacheStats stats;
+	getHTTPCacheStats(&cache, &stats);
+	ASSERT_EQ(stats.hits, 3);
+	ASSERT_EQ(stats.misses, 2);
+	ASSERT_EQ(stats.entries, 2);
+	ASSERT_GT(stats.size, 0);
+
+	destroyHTTPCache(&cache);
+}
+
+TEST(CacheTest, ConnectionHandler) {
+	struct httpCache cache;
+	ASSERT_EQ(initHTTPCache(&cache, 1 << 20, 1), 0);
+	processed = 0;
+
+	struct HTTPConnectionHandlerArgs args = {};
+	args.httpRequestProcessor = cachedProcessor;
+	args.cache = &cache;
+
+	// Pipelined request is answered by the response stored for the previous one.
+	std::string out = handleConnection(&args, "GET /a HTTP/1.1\r\n\r\nGET /a HTTP/1.1\r\n\r\n");
+	size_t second = out.find("HTTP/1.1 ", 1);
+	ASSERT_NE(second, std::string::npos) << out;
+	ASSERT_EQ(responseHeader(out.substr(0, second), "Age"), "");
+	ASSERT_EQ(responseHeader(out.substr(second), "Age"), "0");
+	ASSERT_EQ(responseBody(out.substr(second)), "body of /a");
+	ASSERT_EQ(processed, 1);
+
+	// Request of another connection is answered with 304 of the stored ETag.
+	std::string etag = responseHeader(out, "ETag");
+	out = handleConnection(&args, "GET /a HTTP/1.1\r\nIf-None-Match: " + etag + "\r\n\r\n");
+	ASSERT_EQ(out.rfind("HTTP/1.1 304 ", 0), 0) << out;
+	ASSERT_EQ(processed, 1);
+
+	// Response to other methods is neither looked up nor stored.
+	handleConnection(&args, "POST /a HTTP/1.1\r\nContent-Length: 0\r\n\r\n");
+	handleConnection(&args, "POST /a HTTP/1.1\r\nContent-Length: 0\r\n\r\n");
+	ASSERT_EQ(processed, 3);
+
+	struct httpCacheStats stats;
+	getHTTPCacheStats(&cache, &stats);
+	ASSERT_EQ(stats.hits, 2);
+	ASSERT_EQ(stats.entries, 1);
+
+	destroyHTTPCache(&cache);
+}
+
+TEST(CacheTest, NotModified) {
+	struct httpCache cache;
+	ASSERT_EQ(initHTTPCache(&cache, 1 << 20, 1), 0);
+	processed = 0;
+
+	// Processed response is replaced by 304 too.
+	std::string first = cached(&cache, "GET /a HTTP/1.1\r\nIf-None-Match: *\r\n\r\n");
+	ASSERT_EQ(first.rfind("HTTP/1.1 304 ", 0), 0) << first;
+	std::string etag = responseHeader(first, "ETag");
+	ASSERT_FALSE(etag.empty());
+
+	std::string raw = "GET /a HTTP/1.1\r\nIf-None-Match: \"x\", W/" + etag + "\r\n\r\n";
+	std::string resp = cached(&cache, raw.c_str());
+	ASSERT_EQ(resp.rfind("HTTP/1.1 304 ", 0), 0) << resp;
+	ASSERT_EQ(responseHeader(resp, "ETag"), etag);
+	ASSERT_EQ(responseHeader(resp, "Cache-Control"), "max-age=60");
+	ASSERT_EQ(responseBody(resp), "");
+
+	resp = cached(&cache, "GET /a HTTP/1.1\r\nIf-None-Match: \"other\"\r\n\r\n");
+	ASSERT_EQ(resp.rfind("HTTP/1.1 200 ", 0), 0) << resp;
+	ASSERT_EQ(responseBody(resp), "body of /a");
+	ASSERT_EQ(processed, 1);
+
+	destroyHTTPCache(&cache);
+}
+
+TEST(CacheTest, Freshness) {
+	struct httpCache cache;
+	ASSERT_EQ(initHTTPCache(&cache, 1 << 20, 1), 0);
+	processed = 0;
+
+	cached(&cache, "GET /a HTTP/1.1\r\n\r\n");
+	cached(&cache, "GET /a HTTP/1.1\r\n\r\n");
+	ASSERT_EQ(processed, 1);
+
+	// Stale entry is dropped.
+	cache.shards[0].lruHead->expires = timerNow();
+	cached(&cache, "GET /a HTTP/1.1\r\n\r\n");
+	ASSERT_EQ(processed, 2);
+
+	struct httpCacheStats stats;
+	getHTTPCacheStats(&cache, &stats);
+	ASSERT_EQ(stats.expirations, 1);
+	ASSERT_EQ(stats.entries, 1);
+
+	// s-maxage takes precedence over max-age.
+	cached(&cache, "GET /b HTTP/1.1\r\nX-CC: public, s-maxage=5, max-age=0\r\n\r\n");
+	ASSERT_EQ(cache.shards[0].lruHead->expires - cache.shards[0].lruHead->stored, 5000);
+
+	// Responses not to be stored.
+	const char *uncacheable[] = {
+		"GET /c HTTP/1.1\r\nX-CC: no-store, max-age=60\r\n\r\n",
+		"GET /c HTTP/1.1\r\nX-CC: max-age=60, Private\r\n\r\n",
+		"GET /c HTTP/1.1\r\nX-CC: no-cache\r\n\r\n",
+		"GET /c HTTP/1.1\r\nX-CC: max-age=0\r\n\r\n",
+		"GET /c HTTP/1.1\r\nX-CC: public\r\n\r\n",
+		"GET /c HTTP/1.1\r\nAuthorization: Basic eDp4\r\n\r\n",
+		"POST /c HTTP/1.1\r\n\r\n",
+	};
+	for (const char *raw : uncacheable) {
+		processed = 0;
+		cached(&cache, raw);
+		cached(&cache, raw);
+		ASSERT_EQ(processed, 2) << raw;
+	}
+
+	destroyHTTPCache(&cache);
+}
+
+TEST(CacheTest, Vary) {
+	struct httpCache cache;
+	ASSERT_EQ(initHTTPCache(&cache, 1 << 20, 2), 0);
+	ASSERT_EQ(addHTTPCacheVary(&cache, "Accept-Language"), 0);
+	processed = 0;
+
+	ASSERT_EQ(responseBody(cached(&cache, "GET /a HTTP/1.1\r\nAccept-Language: en\r\n\r\n")), "body of /a in en");
+	ASSERT_EQ(responseBody(cached(&cache, "GET /a HTTP/1.1\r\nAccept-Language: de\r\n\r\n")), "body of /a in de");
+	ASSERT_EQ(responseBody(cached(&cache, "GET /a HTTP/1.1\r\n\r\n")), "body of /a");
+	ASSERT_EQ(responseBody(cached(&cache, "GET /a HTTP/1.1\r\nAccept-Language: en\r\n\r\n")), "body of /a in en");
+	ASSERT_EQ(processed, 3);
+
+	for (int i = 1; i < HTTP_CACHE_MAX_VARY; i++) ASSERT_EQ(addHTTPCacheVary(&cache, "X"), 0);
+	ASSERT_EQ(addHTTPCacheVary(&cache, "X"), -1);
+	ASSERT_EQ(errno, ENOSPC);
+
+	destroyHTTPCache(&cache);
+}
+
+TEST(CacheTest, ResponseVary) {
+	struct httpCache cache;
+	ASSERT_EQ(initHTTPCache(&cache, 1 << 20, 2), 0);
+	ASSERT_EQ(addHTTPCacheVary(&cache, "Accept-Language"), 0);
+	processed = 0;
+
+	// Response varies on the key headers only: it is stored.
+	cached(&cache, "GET /a HTTP/1.1\r\nX-Vary: accept-language\r\n\r\n");
+	cached(&cache, "GET /a HTTP/1.1\r\nX-Vary: accept-language\r\n\r\n");
+	ASSERT_EQ(processed, 1);
+
+	const char *notStored[] = {
+		"GET /b HTTP/1.1\r\nX-Vary: Accept-Encoding\r\n\r\n",
+		"GET /c HTTP/1.1\r\nX-Vary: Accept-Language, Accept-Encoding\r\n\r\n",
+		"GET /d HTTP/1.1\r\nX-Vary: *\r\n\r\n",
+	};
+	for (const char *raw : notStored) {
+		processed = 0;
+		cached(&cache, raw);
+		std::string resp = cached(&cache, raw);
+		ASSERT_EQ(processed, 2) << raw;
+		ASSERT_EQ(resp.rfind("HTTP/1.1 200 OK\r\n", 0), 0) << resp;
+	}
+
+	struct httpCacheStats stats;
+	getHTTPCacheStats(&cache, &stats);
+	ASSERT_EQ(stats.entries, 1);
+
+	destroyHTTPCache(&cache);
+}
+
+TEST(CacheTest, Eviction) {
+	struct httpCache cache;
+	// Room for two entries.
+	ASSERT_EQ(initHTTPCache(&cache, 2 * sizeof(struct httpCacheEntry) + 256, 1), 0);
+	processed = 0;
+
+	cached(&cache, "GET /a HTTP/1.1\r\n\r\n");
+	cached(&cache, "GET /b HTTP/1.1\r\n\r\n");
+	cached(&cache, "GET /a HTTP/1.1\r\n\r\n");
+	cached(&cache, "GET /c HTTP/1.1\r\n\r\n");
+	ASSERT_EQ(processed, 3);
+
+	struct httpCacheStats stats;
+	getHTTPCacheStats(&cache, &stats);
+	ASSERT_EQ(stats.evictions, 1);
+	ASSERT_EQ(stats.entries, 2);
+	ASSERT_LE(stats.size, cache.shards[0].capacity);
+
+	// Least recently used /b is evicted.
+	cached(&cache, "GET /a HTTP/1.1\r\n\r\n");
+	ASSERT_EQ(processed, 3);
+	cached(&cache, "GET /b HTTP/1.1\r\n\r\n");
+	ASSERT_EQ(processed, 4);
+
+	destroyHTTPCache(&cache);
+}
+
+TEST(CacheTest, OutlivesEviction) {
+	struct httpCache cache;
+	ASSERT_EQ(initHTTPCache(&cache, 1 << 20, 1), 0);
+	cached(&cache, "GET /a HTTP/1.1\r\n\r\n");
+
+	const char *raw = "GET /a HTTP/1.1\r\n\r\n";
+	struct HTTPRequest req;
+	ASSERT_EQ(parseHTTPRequestBuffer(raw, strlen(raw), strlen(raw), &req), 0);
+	struct HTTPResponse resp;
+	ASSERT_EQ(initHTTPResponse(&resp, req.httpver), 0);
+	struct httpCacheKey key;
+	ASSERT_EQ(lookupHTTPCache(&cache, &req, &resp, &key), 1);
+
+	// Body of the response being sent stays valid after the cache drops it.
+	destroyHTTPCache(&cache);
+	ASSERT_EQ(std::string(resp.body, resp.bodyc), "body of /a");
+
+	destroyHTTPResponse(&resp);
+	destroyHTTPRequest(&req);
+}
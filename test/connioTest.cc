@@ -0,0 +1,200 @@
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cerrno>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include "server/connio.h"
+
+TEST(ConnIOTest, ReadsAcrossRingWrap) {
+	int fds[2];
+	ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+
+	struct connIO io;
+	ASSERT_EQ(initConnIO(&io, fds[0], 10, 0), 0);
+	ASSERT_EQ(io.rcap, 16);
+
+	ASSERT_EQ(write(fds[1], "0123456789abc\n", 14), 14);
+	ASSERT_EQ(connIOFill(&io), 14);
+
+	char buf[16] = {};
+	ASSERT_EQ(connIORead(&io, buf, 12), 12);
+	ASSERT_STREQ(buf, "0123456789ab");
+
+	// Next line wraps around the end of the buffer.
+	ASSERT_EQ(write(fds[1], "line\nrest", 9), 9);
+	ASSERT_EQ(connIOFill(&io), 9);
+	ASSERT_EQ(io.rhead + io.rlen > io.rcap, true);
+
+	char *line = NULL;
+	size_t cap = 0;
+	ASSERT_EQ(connIOGetLine(&io, &line, &cap), 2);
+	ASSERT_STREQ(line, "c\n");
+	ASSERT_EQ(connIOGetLine(&io, &line, &cap), 5);
+	ASSERT_STREQ(line, "line\n");
+
+	size_t len;
+	const char *data = connIOPeek(&io, &len);
+	ASSERT_EQ(len, 4);
+	ASSERT_EQ(memcmp(data, "rest", 4), 0);
+
+	// Line without newline is returned on end of file.
+	close(fds[1]);
+	ASSERT_EQ(connIOGetLine(&io, &line, &cap), 4);
+	ASSERT_STREQ(line, "rest");
+	ASSERT_EQ(connIOGetLine(&io, &line, &cap), -1);
+	ASSERT_EQ(io.eof, 1);
+
+	free(line);
+	destroyConnIO(&io);
+	close(fds[0]);
+}
+
+TEST(ConnIOTest, NonBlockingFillAndFlush) {
+	int fds[2];
+	ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds), 0);
+
+	struct connIO io;
+	ASSERT_EQ(initConnIO(&io, fds[0], 0, 16), 0);
+	ASSERT_EQ(io.nonblock, 1);
+
+	ASSERT_EQ(connIOFill(&io), -1);
+	ASSERT_EQ(errno, EAGAIN);
+
+	// Output does not fit the buffer: it grows instead of blocking.
+	std::string out(1 << 20, 'x');
+	ASSERT_EQ(connIOWrite(&io, out.data(), out.size()), 0);
+	ASSERT_EQ(io.wlen, out.size());
+
+	ASSERT_EQ(connIOFlush(&io), -1);
+	ASSERT_EQ(errno, EAGAIN);
+	ASSERT_LT(io.wlen, out.size());
+
+	std::string received;
+	char buf[4096];
+	while (received.size() < out.size()) {
+		ssize_t rd = read(fds[1], buf, sizeof(buf));
+		if (rd > 0) {
+			received.append(buf, rd);
+			continue;
+		}
+
+		ASSERT_EQ(errno, EAGAIN);
+		int status = connIOFlush(&io);
+		ASSERT_TRUE(status == 0 || errno == EAGAIN);
+	}
+	ASSERT_EQ(received, out);
+	ASSERT_EQ(io.wlen, 0);
+
+	destroyConnIO(&io);
+	close(fds[0]);
+	close(fds[1]);
+}
+
+TEST(ConnIOTest, MemoryBuffer) {
+	struct connIO io;
+	ASSERT_EQ(initConnIO(&io, -1, 4, 4), 0);
+
+	ASSERT_EQ(connIOFeed(&io, "hello\nworld", 11), 0);
+	ASSERT_GE(io.rcap, 11);
+
+	char *line = NULL;
+	size_t cap = 0;
+	ASSERT_EQ(connIOGetLine(&io, &line, &cap), 6);
+	ASSERT_STREQ(line, "hello\n");
+
+	char buf[8] = {};
+	ASSERT_EQ(connIORead(&io, buf, sizeof(buf)), 5);
+	ASSERT_STREQ(buf, "world");
+	ASSERT_EQ(io.eof, 1);
+
+	ASSERT_EQ(connIOPrintf(&io, "%s %d", "status", 200), 10);
+	ASSERT_EQ(connIOFlush(&io), 0);
+
+	size_t len;
+	const char *out = connIOOutput(&io, &len);
+	ASSERT_EQ(std::string(out, len), "status 200");
+	connIOOutputConsume(&io, len);
+	ASSERT_EQ(io.wlen, 0);
+
+	free(line);
+	destroyConnIO(&io);
+}
+
+TEST(ConnIOTest, GatheredSend) {
+	int fds[2];
+	ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+
+	struct connIO io;
+	ASSERT_EQ(initConnIO(&io, fds[0], 0, 16), 0);
+
+	// Pending output wraps the ring: reserved bytes are still contiguous.
+	ASSERT_EQ(connIOWrite(&io, "0123456789", 10), 0);
+	connIOOutputConsume(&io, 8);
+	ASSERT_EQ(connIOWrite(&io, "abcdefghij", 10), 0);
+
+	char *head = connIOWriteReserve(&io, 8);
+	ASSERT_NE(head, nullptr);
+	memcpy(head, "<head>\r\n", 8);
+	connIOWriteCommit(&io, 8);
+
+	ASSERT_EQ(connIOSend(&io, "body", 4), 0);
+	ASSERT_EQ(io.wlen, 0);
+
+	char buf[64] = {};
+	ASSERT_EQ(read(fds[1], buf, sizeof(buf)), 24);
+	ASSERT_STREQ(buf, "89abcdefghij<head>\r\nbody");
+
+	// Closed peer is reported by EPIPE instead of SIGPIPE.
+	close(fds[1]);
+	ASSERT_EQ(connIOSend(&io, "body", 4), -1);
+	ASSERT_EQ(errno, EPIPE);
+
+	destroyConnIO(&io);
+	close(fds[0]);
+}
+
+TEST(ConnIOTest, ScatterSend) {
+	int fds[2];
+	ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds), 0);
+
+	struct connIO io;
+	ASSERT_EQ(initConnIO(&io, fds[0], 0, 0), 0);
+	ASSERT_EQ(connIOWrite(&io, "head", 4), 0);
+
+	// More parts than one gathered write takes, more bytes than the socket buffer.
+	std::vector<std::string> parts;
+	std::vector<struct iovec> iov;
+	std::string expected = "head";
+	for (int i = 0; i < CONN_IO_IOV * 3; i++) {
+		parts.push_back(std::string(i % 5 == 0 ? 0 : 5000 + i, 'a' + i % 26));
+		expected += parts.back();
+	}
+	for (auto &part : parts) iov.push_back({ (void *)part.data(), part.size() });
+
+	ASSERT_EQ(connIOSendv(&io, iov.data(), iov.size()), -1);
+	ASSERT_EQ(errno, EAGAIN);
+	// Parts are not borrowed after the call: the unsent ones are buffered.
+	for (auto &part : parts) std::fill(part.begin(), part.end(), '-');
+
+	std::string received;
+	char buf[65536];
+	while (received.size() < expected.size()) {
+		ssize_t rd = read(fds[1], buf, sizeof(buf));
+		if (rd > 0) {
+			received.append(buf, rd);
+			continue;
+		}
+
+		ASSERT_EQ(errno, EAGAIN);
+		int status = connIOFlush(&io);
+		ASSERT_TRUE(status == 0 || errno == EAGAIN);
+	}
+	ASSERT_EQ(received, expected);
+
+	destroyConnIO(&io);
+	close(fds[0]);
+	close(fds[1]);
+}
@@ -0,0 +1,200 @@
+#include <gtest/gtest.h>
+#include <string>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include "server/files.h"
+#include "server/connio.h"
+
+class FilesTest : public ::testing::Test {
+protected:
+	std::string root;
+	std::string outside;
+
+	void SetUp() override {
+		char tmpl[] = "/tmp/chttpFilesXXXXXX";
+		ASSERT_NE(mkdtemp(tmpl), nullptr);
+		outside = tmpl;
+		root = outside + "/root";
+
+		ASSERT_EQ(mkdir(root.c_str(), 0700), 0);
+		ASSERT_EQ(mkdir((root + "/sub").c_str(), 0700), 0);
+		put("root/index.html", "<h1>index</h1>");
+		put("root/a.txt", "hello");
+		put("root/sub/index.html", "sub");
+		put("root/sub/b.css", "body{}");
+		put("secret", "secret");
+		ASSERT_EQ(symlink((outside + "/secret").c_str(), (root + "/link").c_str()), 0);
+	}
+
+	void TearDown() override {
+		std::string cmd = "rm -rf " + outside;
+		ASSERT_EQ(system(cmd.c_str()), 0);
+	}
+
+	void put(const std::string &name, const std::string &data) {
+		int fd = open((outside + "/" + name).c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+		ASSERT_NE(fd, -1);
+		ASSERT_EQ(write(fd, data.data(), data.size()), (ssize_t)data.size());
+		close(fd);
+	}
+
+	/**
+	 * Serves @raw request and returns the response sent to the socket.
+	 */
+	std::string serve(struct httpFileCache *cache, const char *raw) {
+		int fds[2];
+		EXPECT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+
+		struct connIO io;
+		EXPECT_EQ(initConnIO(&io, fds[0], 0, 0), 0);
+
+		struct HTTPRequest req;
+		EXPECT_EQ(parseHTTPRequestBuffer(raw, strlen(raw), strlen(raw), &req), 0);
+		struct HTTPResponse resp;
+		EXPECT_EQ(initHTTPResponse(&resp, req.httpver), 0);
+
+		serveHTTPFile(cache, &req, &resp, NULL, 0);
+		EXPECT_EQ(writeHTTPResponse(&resp, &io), 0);
+		destroyHTTPResponse(&resp);
+		destroyHTTPRequest(&req);
+
+		std::string out;
+		char buf[4096];
+		ssize_t n;
+		while ((n = recv(fds[1], buf, sizeof(buf), MSG_DONTWAIT)) > 0) out.append(buf, n);
+
+		destroyConnIO(&io);
+		close(fds[0]);
+		close(fds[1]);
+
+		return out;
+	}
+
+	static std::string body(const std::string &resp) {
+		size_t pos = resp.find("\r\n\r\n");
+		return pos == std::string::npos ? "" : resp.substr(pos + 4);
+	}
+};
+
+TEST_F(FilesTest, ServesFiles) {
+	struct httpFileCache cache;
+	ASSERT_EQ(initHTTPFileCache(&cache, root.c_str(), 8), 0);
+
+	std::string resp = serve(&cache, "GET /a.txt HTTP/1.1\r\n\r\n");
+	ASSERT_EQ(resp.rfind("HTTP/1.1 200 OK\r\n", 0), 0) << resp;
+	ASSERT_NE(resp.find("Content-Type: text/plain; charset=utf-8\r\n"), std::string::npos);
+	ASSERT_NE(resp.find("Content-Length: 5\r\n"), std::string::npos);
+	ASSERT_NE(resp.find("Last-Modified: "), std::string::npos);
+	ASSERT_EQ(body(resp), "hello");
+
+	ASSERT_EQ(body(serve(&cache, "GET / HTTP/1.1\r\n\r\n")), "<h1>index</h1>");
+	ASSERT_EQ(body(serve(&cache, "GET /sub HTTP/1.1\r\n\r\n")), "sub");
+	ASSERT_EQ(body(serve(&cache, "GET /sub/ HTTP/1.1\r\n\r\n")), "sub");
+	ASSERT_EQ(body(serve(&cache, "GET //sub//b%2ecss?v=1 HTTP/1.1\r\n\r\n")), "body{}");
+
+	resp = serve(&cache, "HEAD /a.txt HTTP/1.1\r\n\r\n");
+	ASSERT_NE(resp.find("Content-Length: 5\r\n"), std::string::npos);
+	ASSERT_EQ(body(resp), "");
+
+	resp = serve(&cache, "POST /a.txt HTTP/1.1\r\n\r\n");
+	ASSERT_EQ(resp.rfind("HTTP/1.1 405 ", 0), 0) << resp;
+	ASSERT_NE(resp.find("Allow: GET, HEAD\r\n"), std::string::npos);
+
+	ASSERT_EQ(serve(&cache, "GET /missing HTTP/1.1\r\n\r\n").rfind("HTTP/1.1 404 ", 0), 0);
+	ASSERT_EQ(serve(&cache, "GET /a.txt/x HTTP/1.1\r\n\r\n").rfind("HTTP/1.1 404 ", 0), 0);
+
+	destroyHTTPFileCache(&cache);
+}
+
+TEST_F(FilesTest, RejectsTraversal) {
+	struct httpFileCache cache;
+	ASSERT_EQ(initHTTPFileCache(&cache, root.c_str(), 8), 0);
+
+	ASSERT_EQ(serve(&cache, "GET /../secret HTTP/1.1\r\n\r\n").rfind("HTTP/1.1 400 ", 0), 0);
+	ASSERT_EQ(serve(&cache, "GET /sub/%2e%2e/%2E%2E/secret HTTP/1.1\r\n\r\n").rfind("HTTP/1.1 400 ", 0), 0);
+	ASSERT_EQ(serve(&cache, "GET /sub/.%2e%2fsecret HTTP/1.1\r\n\r\n").rfind("HTTP/1.1 400 ", 0), 0);
+	ASSERT_EQ(serve(&cache, "GET /a.txt%00.html HTTP/1.1\r\n\r\n").rfind("HTTP/1.1 400 ", 0), 0);
+	ASSERT_EQ(serve(&cache, "GET /a%2 HTTP/1.1\r\n\r\n").rfind("HTTP/1.1 400 ", 0), 0);
+
+	// Symbolic link leaving the directory.
+	std::string resp = serve(&cache, "GET /link HTTP/1.1\r\n\r\n");
+	ASSERT_EQ(resp.find("secret"), std::string::npos) << resp;
+	ASSERT_EQ(resp.rfind("HTTP/1.1 404 ", 0), 0) << resp;
+
+	destroyHTTPFileCache(&cache);
+}
+
+TEST_F(FilesTest, CachesDescriptors) {
+	struct httpFileCache cache;
+	ASSERT_EQ(initHTTPFileCache(&cache, root.c_str(), 2), 0);
+
+	ASSERT_EQ(body(serve(&cache, "GET /a.txt HTTP/1.1\r\n\r\n")), "hello");
+	ASSERT_EQ(cache.misses, 1);
+	ASSERT_EQ(cache.size, 1);
+	int fd = cache.lruHead->fd;
+
+	ASSERT_EQ(body(serve(&cache, "GET /a.txt HTTP/1.1\r\n\r\n")), "hello");
+	ASSERT_EQ(cache.hits, 1);
+	ASSERT_EQ(cache.lruHead->fd, fd);
+
+	// Changed file is reopened once it is checked.
+	put("root/a.txt", "changed");
+	cache.lruHead->checked -= HTTP_FILE_CACHE_VALID;
+	ASSERT_EQ(body(serve(&cache, "GET /a.txt HTTP/1.1\r\n\r\n")), "changed");
+	ASSERT_EQ(cache.misses, 2);
+	ASSERT_EQ(cache.size, 1);
+
+	// Least recently used file is evicted.
+	serve(&cache, "GET /sub/b.css HTTP/1.1\r\n\r\n");
+	serve(&cache, "GET /a.txt HTTP/1.1\r\n\r\n");
+	serve(&cache, "GET / HTTP/1.1\r\n\r\n");
+	ASSERT_EQ(cache.size, 2);
+	ASSERT_STREQ(cache.lruHead->key, "");
+	ASSERT_STREQ(cache.lruTail->key, "a.txt");
+
+	size_t misses = cache.misses;
+	serve(&cache, "GET /sub/b.css HTTP/1.1\r\n\r\n");
+	ASSERT_EQ(cache.misses, misses + 1);
+
+	destroyHTTPFileCache(&cache);
+}
+
+TEST_F(FilesTest, OutlivesEviction) {
+	struct httpFileCache cache;
+	ASSERT_EQ(initHTTPFileCache(&cache, root.c_str(), 1), 0);
+
+	struct HTTPRequest req;
+	const char *raw = "GET /a.txt HTTP/1.1\r\n\r\n";
+	ASSERT_EQ(parseHTTPRequestBuffer(raw, strlen(raw), strlen(raw), &req), 0);
+	struct HTTPResponse resp;
+	ASSERT_EQ(initHTTPResponse(&resp, req.httpver), 0);
+	serveHTTPFile(&cache, &req, &resp, NULL, 0);
+	ASSERT_EQ(resp.status, 200);
+
+	// File of the response being sent stays open after the cache drops it.
+	serve(&cache, "GET /sub/b.css HTTP/1.1\r\n\r\n");
+	destroyHTTPFileCache(&cache);
+
+	char buf[8] = {};
+	ASSERT_EQ(pread(resp.source.file.fd, buf, sizeof(buf), 0), 5);
+	ASSERT_STREQ(buf, "hello");
+
+	destroyHTTPResponse(&resp);
+	destroyHTTPRequest(&req);
+}
+
+TEST_F(FilesTest, WithoutCache) {
+	struct httpFileCache cache;
+	ASSERT_EQ(initHTTPFileCache(&cache, root.c_str(), 0), 0);
+
+	ASSERT_EQ(body(serve(&cache, "GET /a.txt HTTP/1.1\r\n\r\n")), "hello");
+	ASSERT_EQ(body(serve(&cache, "GET /a.txt HTTP/1.1\r\n\r\n")), "hello");
+	ASSERT_EQ(cache.misses, 2);
+	ASSERT_EQ(cache.size, 0);
+
+	destroyHTTPFileCache(&cache);
+}
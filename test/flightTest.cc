@@ -0,0 +1,308 @@
+#include <gtest/gtest.h>
+#include <string>
+#include <cstring>
+#include <thread>
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include "server/flight.h"
+#include "server/http.h"
+#include "testUtils.h"
+
+static std::atomic<int> processed;
+static std::atomic<int> delay;
+
+/**
+ * Slow processor of the tests: body counts the calls, response may be cached for a minute,
+ * Set-Cookie is set for path /cookie, body of path /large is larger than HTTP_FLIGHT_MAX_ENTRY.
+ * Body is left out for HEAD and request with matching If-None-Match is answered with 304.
+ */
+static void slowProcessor(struct HTTPRequest *req, struct HTTPResponse *resp)
+{
+	int n = ++processed;
+	std::this_thread::sleep_for(std::chrono::milliseconds(delay));
+
+	std::string path = req->views ? std::string(req->pathv.ptr, req->pathv.len) : std::string(req->path);
+	if (path == "/cookie") addKVHTTPHeader_p(&resp->headers, "Set-Cookie", "id=1");
+	addKVHTTPHeader_p(&resp->headers, "ETag", "\"v1\"");
+	addKVHTTPHeader_p(&resp->headers, "Cache-Control", "max-age=60");
+
+	static thread_local std::string body;
+	body = "call " + std::to_string(n);
+	if (path == "/large") body.resize(HTTP_FLIGHT_MAX_ENTRY + 1, 'x');
+
+	const char *etag = getHTTPRequestHeader(req, "If-None-Match", NULL);
+	if (etag != NULL && strncmp(etag, "\"v1\"", 4) == 0) {
+		resp->status = 304;
+		return;
+	}
+
+	resp->status = 200;
+	if (req->method == HTTPM_HEAD) return;
+	resp->body = (char *)body.c_str();
+	resp->bodyc = body.size();
+}
+
+/**
+ * @Returns arguments of the connection handler coalescing requests to slowProcessor() by @group.
+ */
+static struct HTTPConnectionHandlerArgs flightArgs(struct httpFlightGroup *group)
+{
+	struct HTTPConnectionHandlerArgs args = {};
+	args.httpRequestProcessor = slowProcessor;
+	args.flights = group;
+
+	return args;
+}
+
+/**
+ * Sends @raw by @count threads at once.
+ */
+static std::vector<std::string> concurrently(struct HTTPConnectionHandlerArgs *args, const char *raw, int count)
+{
+	std::vector<std::string> out(count);
+	std::vector<std::thread> threads;
+
+	for (int i = 0; i < count; i++)
+		threads.emplace_back([&, i]() { out[i] = handleConnection(args, raw); });
+	for (auto &t : threads) t.join();
+
+	return out;
+}
+
+/**
+ * Sends @follower by @count threads while the flight of @leader is in progress.
+ * Response to @leader is stored in @first if it is not NULL.
+ */
+static std::vector<std::string> following(struct HTTPConnectionHandlerArgs *args, const char *leader, const char *follower,
+	int count, std::string *first = NULL)
+{
+	std::string out;
+	std::thread thread([&]() { out = handleConnection(args, leader); });
+	std::this_thread::sleep_for(std::chrono::milliseconds(50));
+	std::vector<std::string> followers = concurrently(args, follower, count);
+	thread.join();
+
+	if (first != NULL) *first = out;
+	return followers;
+}
+
+TEST(FlightTest, Coalesces) {
+	struct httpFlightGroup group;
+	ASSERT_EQ(initHTTPFlightGroup(&group, NULL, NULL, 5000), 0);
+	struct HTTPConnectionHandlerArgs args = flightArgs(&group);
+	processed = 0;
+	delay = 200;
+
+	std::vector<std::string> out = concurrently(&args, "GET /a HTTP/1.1\r\n\r\n", 16);
+	ASSERT_EQ(processed, 1);
+	for (auto &resp : out) {
+		ASSERT_EQ(resp.rfind("HTTP/1.1 200 OK\r\n", 0), 0) << resp;
+		ASSERT_EQ(responseBody(resp), "call 1");
+		ASSERT_NE(resp.find("ETag: \"v1\"\r\n"), std::string::npos);
+	}
+	ASSERT_EQ(group.flights, 1);
+	ASSERT_EQ(group.followers, 15);
+
+	// Flight has ended: the next request is processed.
+	ASSERT_EQ(responseBody(handleConnection(&args, "GET /a HTTP/1.1\r\n\r\n")), "call 2");
+
+	// Requests not coalesced by default.
+	processed = 0;
+	delay = 50;
+	concurrently(&args, "POST /a HTTP/1.1\r\n\r\n", 4);
+	concurrently(&args, "GET /a HTTP/1.1\r\nAuthorization: Basic eDp4\r\n\r\n", 4);
+	ASSERT_EQ(processed, 8);
+
+	destroyHTTPFlightGroup(&group);
+}
+
+TEST(FlightTest, PrivateResponse) {
+	struct httpFlightGroup group;
+	ASSERT_EQ(initHTTPFlightGroup(&group, NULL, NULL, 5000), 0);
+	struct HTTPConnectionHandlerArgs args = flightArgs(&group);
+	processed = 0;
+	delay = 100;
+
+	// Response with Set-Cookie is not shared, waiting requests are processed on their own.
+	std::vector<std::string> out = concurrently(&args, "GET /cookie HTTP/1.1\r\n\r\n", 4);
+	ASSERT_EQ(processed, 4);
+	ASSERT_EQ(group.followers, 0);
+
+	destroyHTTPFlightGroup(&group);
+}
+
+TEST(FlightTest, LargeResponse) {
+	struct httpFlightGroup group;
+	ASSERT_EQ(initHTTPFlightGroup(&group, NULL, NULL, 5000), 0);
+	struct HTTPConnectionHandlerArgs args = flightArgs(&group);
+	processed = 0;
+	delay = 100;
+
+	// Response is not copied for the waiting requests, they are processed on their own.
+	concurrently(&args, "GET /large HTTP/1.1\r\n\r\n", 4);
+	ASSERT_EQ(processed, 4);
+	ASSERT_EQ(group.followers, 0);
+
+	destroyHTTPFlightGroup(&group);
+}
+
+TEST(FlightTest, HeadLeader) {
+	struct httpFlightGroup group;
+	ASSERT_EQ(initHTTPFlightGroup(&group, NULL, NULL, 5000), 0);
+	struct HTTPConnectionHandlerArgs args = flightArgs(&group);
+	processed = 0;
+	delay = 200;
+
+	// HEAD has the key of GET, but its response has no body to share.
+	std::vector<std::string> out = following(&args, "HEAD /a HTTP/1.1\r\n\r\n", "GET /a HTTP/1.1\r\n\r\n", 3);
+	for (auto &resp : out) {
+		ASSERT_EQ(resp.rfind("HTTP/1.1 200 OK\r\n", 0), 0) << resp;
+		ASSERT_EQ(responseBody(resp).rfind("call ", 0), 0) << resp;
+	}
+	ASSERT_GT(processed, 1);
+
+	destroyHTTPFlightGroup(&group);
+}
+
+TEST(FlightTest, NotModifiedLeader) {
+	struct httpFlightGroup group;
+	ASSERT_EQ(initHTTPFlightGroup(&group, NULL, NULL, 5000), 0);
+	struct HTTPConnectionHandlerArgs args = flightArgs(&group);
+	processed = 0;
+	delay = 200;
+
+	// 304 made by the processor for the conditional leader is not the answer to unconditional requests.
+	std::vector<std::string> out = following(&args, "GET /a HTTP/1.1\r\nIf-None-Match: \"v1\"\r\n\r\n",
+		"GET /a HTTP/1.1\r\n\r\n", 3);
+	for (auto &resp : out) {
+		ASSERT_EQ(resp.rfind("HTTP/1.1 200 OK\r\n", 0), 0) << resp;
+		ASSERT_EQ(responseBody(resp).rfind("call ", 0), 0) << resp;
+	}
+	ASSERT_GT(processed, 1);
+
+	destroyHTTPFlightGroup(&group);
+}
+
+TEST(FlightTest, LandsBeforeStore) {
+	struct httpFlightGroup group;
+	ASSERT_EQ(initHTTPFlightGroup(&group, NULL, NULL, 5000), 0);
+	struct httpCache cache;
+	ASSERT_EQ(initHTTPCache(&cache, 1 << 20, 1), 0);
+	struct HTTPConnectionHandlerArgs args = flightArgs(&group);
+	args.cache = &cache;
+	processed = 0;
+	delay = 200;
+
+	// Cache replaces response of the conditional leader by 304 once it is stored, the followers get it as processed.
+	std::string first;
+	std::vector<std::string> out = following(&args, "GET /a HTTP/1.1\r\nIf-None-Match: *\r\n\r\n",
+		"GET /a HTTP/1.1\r\n\r\n", 3, &first);
+	ASSERT_EQ(first.rfind("HTTP/1.1 304 ", 0), 0) << first;
+	for (auto &resp : out) {
+		ASSERT_EQ(resp.rfind("HTTP/1.1 200 OK\r\n", 0), 0) << resp;
+		ASSERT_EQ(responseBody(resp), "call 1");
+	}
+	ASSERT_EQ(processed, 1);
+	ASSERT_EQ(group.followers, 3);
+
+	// The stored response answers the next request.
+	ASSERT_EQ(responseBody(handleConnection(&args, "GET /a HTTP/1.1\r\n\r\n")), "call 1");
+	ASSERT_EQ(processed, 1);
+
+	destroyHTTPCache(&cache);
+	destroyHTTPFlightGroup(&group);
+}
+
+TEST(FlightTest, EventHandler) {
+	struct httpFlightGroup group;
+	ASSERT_EQ(initHTTPFlightGroup(&group, NULL, NULL, 5000), 0);
+	struct HTTPConnectionHandlerArgs args = flightArgs(&group);
+	processed = 0;
+	delay = 200;
+
+	std::thread leader([&]() { handleConnection(&args, "GET /a HTTP/1.1\r\n\r\n"); });
+	std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+	// Event loop does not wait for the flight: the request is processed on its own.
+	struct eventLoop loop = {};
+	struct eventConn conn = {};
+	conn.loop = &loop;
+
+	std::string raw = "GET /a HTTP/1.1\r\n\r\n";
+	ASSERT_EQ(eventConnReserve(&conn, raw.size()), 0);
+	memcpy(conn.rbuf, raw.data(), raw.size());
+	conn.rlen = raw.size();
+	httpEventHandler(&conn, &args);
+
+	std::string resp(conn.wbuf, conn.wlen);
+	ASSERT_EQ(resp.rfind("HTTP/1.1 200 OK\r\n", 0), 0) << resp;
+	ASSERT_EQ(responseBody(resp), "call 2");
+
+	eventConnFreeState(&conn);
+	free(conn.rbuf);
+	free(conn.wbuf);
+
+	leader.join();
+	ASSERT_EQ(processed, 2);
+	ASSERT_EQ(group.flights, 1);
+	ASSERT_EQ(group.followers, 0);
+
+	destroyHTTPFlightGroup(&group);
+}
+
+TEST(FlightTest, Timeout) {
+	struct httpFlightGroup group;
+	ASSERT_EQ(initHTTPFlightGroup(&group, NULL, NULL, 20), 0);
+	struct HTTPConnectionHandlerArgs args = flightArgs(&group);
+	processed = 0;
+	delay = 300;
+
+	concurrently(&args, "GET /a HTTP/1.1\r\n\r\n", 4);
+	ASSERT_EQ(processed, 4);
+	ASSERT_EQ(group.timeouts, 3);
+
+	destroyHTTPFlightGroup(&group);
+}
+
+/**
+ * Coalesces requests by path only, whatever the method and the headers.
+ */
+static void pathKey(struct HTTPRequest *req, struct httpCacheKey *key, void *ctx)
+{
+	std::string path = req->views ? std::string(req->pathv.ptr, req->pathv.len) : std::string(req->path);
+	key->len = path.size();
+	memcpy(key->buf, path.data(), key->len);
+	key->cacheable = *(int *)ctx;
+}
+
+TEST(FlightTest, KeyFunction) {
+	int enabled = 1;
+	struct httpFlightGroup group;
+	ASSERT_EQ(initHTTPFlightGroup(&group, pathKey, &enabled, 5000), 0);
+	struct HTTPConnectionHandlerArgs args = flightArgs(&group);
+	processed = 0;
+	delay = 200;
+
+	std::vector<std::string> out = concurrently(&args, "GET /a HTTP/1.1\r\nAuthorization: Basic eDp4\r\n\r\n", 4);
+	ASSERT_EQ(processed, 1);
+	for (auto &resp : out) ASSERT_EQ(responseBody(resp), "call 1");
+
+	// Response of leader that is not GET is not shared.
+	processed = 0;
+	concurrently(&args, "POST /a HTTP/1.1\r\n\r\n", 4);
+	ASSERT_EQ(processed, 4);
+
+	// Conditional request waiting for the flight is answered with 304.
+	processed = 0;
+	std::string resp = following(&args, "GET /b HTTP/1.1\r\n\r\n", "GET /b HTTP/1.1\r\nIf-None-Match: \"v1\"\r\n\r\n", 1)[0];
+	ASSERT_EQ(resp.rfind("HTTP/1.1 304 ", 0), 0) << resp;
+	ASSERT_EQ(processed, 1);
+
+	processed = 0;
+	enabled = 0;
+	concurrently(&args, "GET /a HTTP/1.1\r\n\r\n", 4);
+	ASSERT_EQ(processed, 4);
+
+	destroyHTTPFlightGroup(&group);
+}
@@ -0,0 +1,221 @@
+#include <gtest/gtest.h>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "server/handoff.h"
+#include "server/http.h"
+#include "testUtils.h"
+
+static int listeningSocket(struct sockaddr_in *addr)
+{
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd == -1) return -1;
+
+	memset(addr, 0, sizeof(*addr));
+	addr->sin_family = AF_INET;
+	addr->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	socklen_t len = sizeof(*addr);
+	if (	bind(fd, (struct sockaddr *)addr, sizeof(*addr)) || listen(fd, 1) ||
+		getsockname(fd, (struct sockaddr *)addr, &len)) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+TEST(HandoffTest, AdoptsListeningSocket) {
+	struct sockaddr_in addr;
+	int fd = listeningSocket(&addr);
+	ASSERT_NE(fd, -1);
+
+	struct ssock sock;
+	ASSERT_EQ(adoptSocket(&sock, fd), 0);
+	ASSERT_EQ(sock.fd, fd);
+	ASSERT_EQ(sock.cpu, -1);
+	ASSERT_EQ(sock.addr->sa_family, AF_INET);
+	ASSERT_EQ(((struct sockaddr_in *)sock.addr)->sin_port, addr.sin_port);
+	free(sock.addr);
+
+	// Not listening socket is rejected.
+	int other = socket(AF_INET, SOCK_STREAM, 0);
+	ASSERT_EQ(adoptSocket(&sock, other), -1);
+	ASSERT_EQ(errno, EINVAL);
+
+	close(other);
+	close(fd);
+}
+
+TEST(HandoffTest, PassesSockets) {
+	int chan[2];
+	ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, chan), 0);
+
+	struct sockaddr_in addr[2];
+	int fds[2] = { listeningSocket(addr), listeningSocket(addr + 1) };
+	ASSERT_NE(fds[0], -1);
+	ASSERT_NE(fds[1], -1);
+
+	ASSERT_EQ(sendSockets(chan[0], fds, 2), 0);
+
+	int received[HANDOFF_MAX_SOCKS];
+	ASSERT_EQ(recvSockets(chan[1], received, HANDOFF_MAX_SOCKS), 2);
+
+	for (int i = 0; i < 2; i++) {
+		// Received descriptor refers to the same socket.
+		ASSERT_NE(received[i], fds[i]);
+
+		struct ssock sock;
+		ASSERT_EQ(adoptSocket(&sock, received[i]), 0);
+		ASSERT_EQ(((struct sockaddr_in *)sock.addr)->sin_port, addr[i].sin_port);
+		free(sock.addr);
+
+		close(received[i]);
+		close(fds[i]);
+	}
+
+	// Empty handoff is valid.
+	ASSERT_EQ(sendSockets(chan[0], NULL, 0), 0);
+	ASSERT_EQ(recvSockets(chan[1], received, HANDOFF_MAX_SOCKS), 0);
+
+	close(chan[0]);
+	close(chan[1]);
+}
+
+/**
+ * Inherits a listening socket passed at LISTEN_FDS_START. Runs in a child process, which may own the descriptor.
+ * Exits with the line of the failed check, 0 on success.
+ */
+static void inheritListenFds()
+{
+#define CHECK(cond) if (!(cond)) _exit(__LINE__)
+	struct sockaddr_in addr;
+	int fd = listeningSocket(&addr);
+	CHECK(fd != -1);
+	CHECK(dup2(fd, LISTEN_FDS_START) == LISTEN_FDS_START);
+	close(fd);
+
+	struct ApplicationContext context;
+	CHECK(initContext(&context, NULL, NULL) == 0);
+
+	// Sockets are passed to another process.
+	setenv("LISTEN_FDS", "1", 1);
+	setenv("LISTEN_PID", std::to_string(getpid() + 1).c_str(), 1);
+	CHECK(contextInheritSockets(&context) == 0);
+	CHECK(context.socks.size == 0);
+
+	setenv("LISTEN_PID", std::to_string(getpid()).c_str(), 1);
+	CHECK(contextInheritSockets(&context) == 1);
+	CHECK(getenv("LISTEN_FDS") == NULL && getenv("LISTEN_PID") == NULL);
+
+	struct ssock *sock = (struct ssock *)vectorGetEl(&context.socks, 0);
+	CHECK(sock != NULL && sock->fd == LISTEN_FDS_START && sock->inherited);
+	CHECK(((struct sockaddr_in *)sock->addr)->sin_port == addr.sin_port);
+	CHECK(fcntl(LISTEN_FDS_START, F_GETFD) & FD_CLOEXEC);
+#undef CHECK
+
+	_exit(0);
+}
+
+TEST(HandoffTest, InheritsSockets) {
+	ASSERT_EXIT(inheritListenFds(), ::testing::ExitedWithCode(0), "");
+}
+
+static std::atomic<int> interrupted;
+
+static void onInterrupt(int sig)
+{
+	(void)sig;
+	interrupted = 1;
+}
+
+static void doneProcessor(struct HTTPRequest *req, struct HTTPResponse *resp)
+{
+	(void)req;
+
+	resp->status = 200;
+	resp->body = (char *)"done";
+	resp->bodyc = 4;
+}
+
+TEST(HandoffTest, TakesOver) {
+	ASSERT_EQ(initApplicationOnce(), 0);
+
+	// Predecessor interrupts itself once the takeover is committed.
+	struct sigaction act = {}, old;
+	act.sa_handler = onInterrupt;
+	ASSERT_EQ(sigaction(SIGINT, &act, &old), 0);
+	interrupted = 0;
+
+	struct HTTPConnectionHandlerArgs args = {};
+	args.httpRequestProcessor = doneProcessor;
+	struct ServerOptions options = {};
+
+	std::string path = "/tmp/chttp_takeover_" + std::to_string(getpid());
+	std::string handoffPath = path + ".handoff";
+	unlink(path.c_str());
+
+	struct ApplicationContext predecessor;
+	ASSERT_EQ(initContext(&predecessor, httpConnetionHandler, &args), 0);
+	struct ssock sock;
+	ASSERT_EQ(bindUnixSocket(&sock, path.c_str()), 0);
+	ASSERT_EQ(contextRegisterSocket(&predecessor, sock), 0);
+	ASSERT_EQ(contextServeHandoff(&predecessor, handoffPath.c_str()), 0);
+
+	std::thread predecessorServer([&]() { startServer(&predecessor, &options); });
+
+	int fd = connectUnix(path.c_str());
+	ASSERT_NE(fd, -1);
+	ASSERT_NE(request(fd, "GET / HTTP/1.1\r\n\r\n").find("200 OK"), std::string::npos);
+
+	// Successor failing to start aborts the takeover: predecessor keeps serving and the socket file.
+	struct ApplicationContext failed;
+	ASSERT_EQ(initContext(&failed, httpConnetionHandler, &args), 0);
+	ASSERT_EQ(contextTakeoverSockets(&failed, handoffPath.c_str()), 1);
+	struct ClosingContext closing = { &failed, 0 };
+	closeServer(closing);
+
+	ASSERT_EQ(access(path.c_str(), F_OK), 0);
+	ASSERT_NE(request(fd, "GET / HTTP/1.1\r\n\r\n").find("200 OK"), std::string::npos);
+	ASSERT_EQ(interrupted, 0);
+	ASSERT_FALSE(predecessor.handedOff);
+
+	// Started successor commits the takeover.
+	struct ApplicationContext successor;
+	ASSERT_EQ(initContext(&successor, httpConnetionHandler, &args), 0);
+	ASSERT_EQ(contextTakeoverSockets(&successor, handoffPath.c_str()), 1);
+
+	std::thread successorServer([&]() { startServer(&successor, &options); });
+
+	for (int i = 0; i < 500 && !interrupted; i++)
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	ASSERT_EQ(interrupted, 1);
+	ASSERT_TRUE(predecessor.handedOff);
+
+	closing.context = &predecessor;
+	closeServer(closing);
+	predecessorServer.join();
+
+	// Keep-alive connection of the predecessor is closed, new ones are served by the successor.
+	ASSERT_EQ(readAll(fd), "");
+	close(fd);
+
+	fd = connectUnix(path.c_str());
+	ASSERT_NE(fd, -1);
+	ASSERT_NE(request(fd, "GET / HTTP/1.1\r\n\r\n").find("200 OK"), std::string::npos);
+	close(fd);
+
+	closing.context = &successor;
+	closeServer(closing);
+	successorServer.join();
+
+	ASSERT_NE(access(path.c_str(), F_OK), 0);
+	sigaction(SIGINT, &old, NULL);
+}
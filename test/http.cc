@@ -1,5 +1,11 @@
 #include <gtest/gtest.h>
 #include <cstring>
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
 #include "server/http.h"
 
 char *stringToCharArr(std::string sline) {
@@ -13,7 +19,24 @@ TEST(HTTPParser, HTTPMethod) {
 	ASSERT_EQ(parseHTTPMethod("GET"), HTTPM_GET);
 	ASSERT_EQ(parseHTTPMethod("HEAD"), HTTPM_HEAD);
 	ASSERT_EQ(parseHTTPMethod("POST"), HTTPM_POST);
+	ASSERT_EQ(parseHTTPMethod("PUT"), HTTPM_PUT);
+	ASSERT_EQ(parseHTTPMethod("DELETE"), HTTPM_DELETE);
+	ASSERT_EQ(parseHTTPMethod("CONNECT"), HTTPM_CONNECT);
+	ASSERT_EQ(parseHTTPMethod("OPTIONS"), HTTPM_OPTIONS);
+	ASSERT_EQ(parseHTTPMethod("TRACE"), HTTPM_TRACE);
+	ASSERT_EQ(parseHTTPMethod("PATCH"), HTTPM_PATCH);
 	ASSERT_EQ(parseHTTPMethod("QWERTY"), HTTPM_FAILED);
+	ASSERT_EQ(parseHTTPMethod("get"), HTTPM_FAILED);
+	ASSERT_EQ(parseHTTPMethod("PATCHES"), HTTPM_FAILED);
+	ASSERT_EQ(parseHTTPMethod("OPTIONS1"), HTTPM_FAILED);
+	ASSERT_EQ(parseHTTPMethod(""), HTTPM_FAILED);
+
+	for (int method = HTTPM_GET; method <= HTTPM_PATCH; method++) {
+		const char *name = HTTPMethodToString(method);
+		ASSERT_NE(name, nullptr);
+		ASSERT_EQ(httpMethodId(name, strlen(name)), method);
+	}
+	ASSERT_EQ(HTTPMethodToString(HTTPM_NULL), nullptr);
 
 	// Try to hack parser
 	ASSERT_EQ(parseHTTPMethod("GET\0\0\0\0"), HTTPM_GET);
@@ -32,6 +55,57 @@ TEST(HTTPParse, HTTPVersion) {
 	ASSERT_EQ(parseHTTPVersion("HTTP/2.0"), HTTPV_INVAL);
 
 	ASSERT_EQ(parseHTTPVersion("HTTP/\n1.0"), HTTPV_INVAL);
+	ASSERT_EQ(parseHTTPVersion("HTTP/1."), HTTPV_INVAL);
+	ASSERT_EQ(httpVersionId("HTTP/1.1\r\n", 8), HTTPV_11);
+}
+
+TEST(HTTP, ResponseHead) {
+	struct HTTPResponse response;
+	initHTTPResponse(&response, HTTPV_11);
+
+	addKVHTTPHeader_p(&response.headers, "Content-Length", "1");
+	addKVHTTPHeader_p(&response.headers, "Server", "chttp");
+	addKVHTTPHeader_p(&response.headers, "X-Deleted", "x");
+	deleteHTTPHeader_p(&response.headers, "X-Deleted");
+
+	response.status = 299;
+	response.body = "hello";
+	response.bodyc = 5;
+
+	const char *expected = "HTTP/1.1 299\r\nContent-Length: 5\r\nServer: chttp\r\n\r\n";
+	ssize_t len = renderHTTPResponseHead(&response, NULL, 0);
+	ASSERT_EQ(len, strlen(expected));
+
+	// Head that does not fit is only measured.
+	char buf[128];
+	ASSERT_EQ(renderHTTPResponseHead(&response, buf, 10), len);
+	ASSERT_EQ(renderHTTPResponseHead(&response, buf, len), len);
+	ASSERT_EQ(std::string(buf, len), expected);
+
+	response.status = 200;
+	response.bodyc = 1234567890;
+	deleteHTTPHeader_p(&response.headers, "Server");
+	len = renderHTTPResponseHead(&response, buf, sizeof(buf));
+	ASSERT_EQ(std::string(buf, len), "HTTP/1.1 200 OK\r\nContent-Length: 1234567890\r\n\r\n");
+
+	response.status = 0;
+	ASSERT_EQ(renderHTTPResponseHead(&response, buf, sizeof(buf)), -1);
+
+	destroyHTTPResponse(&response);
+}
+
+TEST(HTTP, StatusLine) {
+	size_t len;
+	const char *line = httpStatusLine(HTTPV_11, 200, &len);
+	ASSERT_EQ(std::string(line, len), "HTTP/1.1 200 OK\r\n");
+
+	line = httpStatusLine(HTTPV_10, 404, &len);
+	ASSERT_EQ(std::string(line, len), "HTTP/1.0 404 Not Found\r\n");
+
+	line = httpStatusLine(HTTPV_11, 599, &len);
+	ASSERT_EQ(line, nullptr);
+	ASSERT_EQ(httpStatusLine(HTTPV_11, 99, &len), nullptr);
+	ASSERT_EQ(httpStatusLine(HTTPV_INVAL, 200, &len), nullptr);
 }
 
 TEST(HTTPParse, CRLFSignature) {
@@ -115,7 +189,7 @@ TEST(HTTP, HTTPHeaderUnit) {
 }
 
 TEST(HTTP, HTTPHeaderVector) {
-	struct vector_p headers;
+	struct HTTPHeaders headers;
 	struct HTTPHeader header;
 
 	createHTTPHeaderVector(&headers);
@@ -138,34 +212,411 @@ TEST(HTTP, HTTPHeaderVector) {
 	destroyHTTPHeaderVector(&headers);
 }
 
+TEST(HTTP, HTTPHeaderIndex) {
+	for (int id = HTTPH_OTHER + 1; id < HTTPH_COUNT; id++) {
+		std::string name = httpHeaderName(id);
+		ASSERT_EQ(httpHeaderId(name.data(), name.size()), id) << name;
+
+		for (char &c : name) c = tolower(c);
+		ASSERT_EQ(httpHeaderId(name.data(), name.size()), id) << name;
+
+		name.back() = '_';
+		ASSERT_EQ(httpHeaderId(name.data(), name.size()), HTTPH_OTHER) << name;
+	}
+	ASSERT_EQ(httpHeaderId("X-Custom", 8), HTTPH_OTHER);
+	ASSERT_EQ(httpHeaderId("", 0), HTTPH_OTHER);
+	ASSERT_EQ(httpHeaderName(HTTPH_OTHER), nullptr);
+
+	struct HTTPHeaders headers;
+	createHTTPHeaderVector(&headers);
+
+	ASSERT_EQ(addKVHTTPHeader_p(&headers, "Content-Length", "10"), 0);
+	ASSERT_EQ(addKVHTTPHeader_p(&headers, "X-Custom", "a"), 0);
+	ASSERT_EQ(addKVHTTPHeader_p(&headers, "x-custom", "b"), 0);
+	ASSERT_EQ(headers.vec.size, 2);
+	ASSERT_STREQ(getHTTPHeader_p(&headers, "content-length"), "10");
+	ASSERT_STREQ(getHTTPHeader_p(&headers, "X-CUSTOM"), "b");
+	ASSERT_EQ(getHTTPHeader_p(&headers, "X-Custom2"), nullptr);
+
+	// Index is bounded by HTTP_MAX_HEADERS names.
+	for (int i = 1; i < HTTP_MAX_HEADERS; i++)
+		ASSERT_EQ(addKVHTTPHeader_p(&headers, ("X-H" + std::to_string(i)).c_str(), "v"), 0);
+	ASSERT_EQ(addKVHTTPHeader_p(&headers, "X-Overflow", "v"), -1);
+	ASSERT_EQ(errno, E2BIG);
+	ASSERT_EQ(addKVHTTPHeader_p(&headers, "Host", "v"), 0);
+	ASSERT_STREQ(getHTTPHeader_p(&headers, "x-h63"), "v");
+
+	destroyHTTPHeaderVector(&headers);
+
+	const char *raw = "GET / HTTP/1.1\r\nhost: a\r\nX-Custom: 1\r\nHOST: b\r\n\r\n";
+	struct HTTPRequest req;
+	ASSERT_EQ(parseHTTPRequestBuffer(raw, strlen(raw), strlen(raw), &req), 0);
+
+	size_t len;
+	const char *value = getHTTPRequestHeader(&req, "Host", &len);
+	ASSERT_EQ(std::string(value, len), "b");
+	value = getHTTPRequestHeader(&req, "x-custom", &len);
+	ASSERT_EQ(std::string(value, len), "1");
+	ASSERT_EQ(getHTTPRequestHeader(&req, "Accept", &len), nullptr);
+	destroyHTTPRequest(&req);
+}
+
 TEST(HTTPparse, HTTPRequest) {
 	struct HTTPRequest req;
 	
-	FILE * stream = tmpfile();
-	fprintf(stream, "GET / HTTP/1.1\r\nHead: example.com\r\nContent-Length: 10\r\n\r\nabcdefghjklmn\r\n");
-	fflush(stream);
-	ASSERT_EQ(fseek(stream, 0, SEEK_SET), 0);
-	ASSERT_EQ(parseHTTPRequest(stream, &req), 0);
+	int fds[2];
+	ASSERT_EQ(pipe(fds), 0);
+	const char *raw = "GET / HTTP/1.1\r\nHead: example.com\r\nContent-Length: 10\r\n\r\nabcdefghjklmn\r\n";
+	ASSERT_EQ(write(fds[1], raw, strlen(raw)), strlen(raw));
+	close(fds[1]);
+
+	struct connIO io;
+	ASSERT_EQ(initConnIO(&io, fds[0], 0, 0), 0);
+	ASSERT_EQ(parseHTTPRequest(&io, &req), 0);
 	ASSERT_EQ(req.bodyc, 10);
 	ASSERT_EQ(req.method, HTTPM_GET);
 	ASSERT_STREQ(req.path, "/");
 	ASSERT_EQ(req.httpver, HTTPV_11);
 	ASSERT_STREQ(req.body, "abcdefghjk");
-	struct HTTPHeader *header = (struct HTTPHeader *)vectorGetEl_p(&req.headers, 0);
+	struct HTTPHeader *header = (struct HTTPHeader *)vectorGetEl_p(&req.headers.vec, 0);
 	ASSERT_STREQ(header->key, "Head");
 	ASSERT_STREQ(header->value, "example.com");
-	header = (struct HTTPHeader *)vectorGetEl_p(&req.headers, 1);
+	header = (struct HTTPHeader *)vectorGetEl_p(&req.headers.vec, 1);
 	ASSERT_STREQ(header->key, "Content-Length");
 	ASSERT_STREQ(header->value, "10");
 	destroyHTTPRequest(&req);
 
-	ASSERT_EQ(parseHTTPRequest(stream, &req), -1);
+	ASSERT_EQ(parseHTTPRequest(&io, &req), -1);
+	destroyHTTPRequest(&req);
+	destroyConnIO(&io);
+	close(fds[0]);
+}
+
+static std::string sliceString(struct httpSlice s) {
+	return std::string(s.ptr, s.len);
+}
+
+TEST(HTTPparse, HTTPRequestView) {
+	int fds[2];
+	ASSERT_EQ(pipe(fds), 0);
+	const char *raw =
+		"POST /submit HTTP/1.1\r\nHost: example.com\r\nContent-Length: 5\r\n\r\nhello"
+		"GET /next?q=1 HTTP/1.0\nX-Empty:\n\n";
+	ASSERT_EQ(write(fds[1], raw, strlen(raw)), strlen(raw));
+	close(fds[1]);
+
+	struct connIO io;
+	ASSERT_EQ(initConnIO(&io, fds[0], 0, 0), 0);
+
+	struct HTTPRequest req;
+	ASSERT_EQ(parseHTTPRequestView(&io, &req), HTTPREQ_SUCCESS);
+	ASSERT_EQ(req.views, 1);
+	ASSERT_EQ(req.path, nullptr);
+	ASSERT_EQ(sliceString(req.methodv), "POST");
+	ASSERT_EQ(sliceString(req.pathv), "/submit");
+	ASSERT_EQ(req.httpver, HTTPV_11);
+	ASSERT_EQ(req.headervc, 2);
+	ASSERT_EQ(sliceString(req.headerv[0].key), "Host");
+	ASSERT_EQ(sliceString(req.headerv[0].value), "example.com");
+
+	// Views point into the read buffer.
+	ASSERT_GE(req.pathv.ptr, io.rbuf);
+	ASSERT_LT(req.pathv.ptr, io.rbuf + io.rcap);
+	ASSERT_EQ(req.bodyc, 5);
+	ASSERT_EQ(std::string(req.body, req.bodyc), "hello");
+
+	size_t len;
+	const char *host = getHTTPRequestHeader(&req, "Host", &len);
+	ASSERT_EQ(std::string(host, len), "example.com");
+	ASSERT_EQ(getHTTPRequestHeader(&req, "Accept", &len), nullptr);
+
+	destroyHTTPRequest(&req);
+
+	ASSERT_EQ(parseHTTPRequestView(&io, &req), HTTPREQ_SUCCESS);
+	ASSERT_EQ(sliceString(req.methodv), "GET");
+	ASSERT_EQ(req.method, HTTPM_GET);
+	ASSERT_EQ(sliceString(req.pathv), "/next?q=1");
+	ASSERT_EQ(req.httpver, HTTPV_10);
+	ASSERT_EQ(req.headervc, 1);
+	ASSERT_EQ(sliceString(req.headerv[0].value), "");
+	ASSERT_EQ(req.body, nullptr);
+	destroyHTTPRequest(&req);
+
+	ASSERT_EQ(parseHTTPRequestView(&io, &req), HTTPREQ_EOF);
+	destroyHTTPRequest(&req);
+
+	destroyConnIO(&io);
+	close(fds[0]);
+}
+
+TEST(HTTPparse, HTTPRequestViewLargeBody) {
+	int fds[2];
+	ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+
+	std::string body(300, 'b');
+	std::string raw = "PUT /upload HTTP/1.1\r\nContent-Length: 300\r\n\r\n" + body + "GET / HTTP/1.1\r\n\r\n";
+	ASSERT_EQ(write(fds[1], raw.data(), raw.size()), raw.size());
+
+	// Body does not fit the buffer: request is copied.
+	struct connIO io;
+	ASSERT_EQ(initConnIO(&io, fds[0], 128, 0), 0);
+
+	struct HTTPRequest req;
+	ASSERT_EQ(parseHTTPRequestView(&io, &req), HTTPREQ_SUCCESS);
+	ASSERT_NE(req.storage, nullptr);
+	ASSERT_EQ(sliceString(req.pathv), "/upload");
+	ASSERT_EQ(req.bodyc, 300);
+	ASSERT_STREQ(req.body, body.c_str());
+	destroyHTTPRequest(&req);
+
+	ASSERT_EQ(parseHTTPRequestView(&io, &req), HTTPREQ_SUCCESS);
+	ASSERT_EQ(req.storage, nullptr);
+	ASSERT_EQ(sliceString(req.pathv), "/");
+	destroyHTTPRequest(&req);
+	ASSERT_EQ(io.rlen, 0);
+
+	// Malformed request line.
+	ASSERT_EQ(write(fds[1], "GET /\r\n\r\n", 9), 9);
+	ASSERT_EQ(parseHTTPRequestView(&io, &req), HTTPREQ_FAILED);
+	destroyHTTPRequest(&req);
+
+	destroyConnIO(&io);
+	close(fds[0]);
+	close(fds[1]);
+}
+
+TEST(HTTPparse, IncrementalParser) {
+	std::string first = "POST /form HTTP/1.1\r\nHost: example.com\r\ncontent-length: 4\r\nX-Trim: \t v \r\n\r\nbody";
+	std::string raw = first + "GET / HTTP/1.1\r\n\r\n";
+
+	struct httpParser parser;
+	initHTTPParser(&parser);
+
+	// Request arrives byte by byte and the buffer is moved on every feed.
+	std::string buffer;
+	size_t consumed = 0;
+	int status = HTTPPARSE_NEED_MORE;
+	for (size_t i = 0; i < raw.size() && status == HTTPPARSE_NEED_MORE; i++) {
+		buffer = std::string(buffer) + raw[i];
+		status = httpParserFeed(&parser, buffer.data(), buffer.size(), &consumed);
+
+		if (status == HTTPPARSE_NEED_MORE) {
+			// Everything but incomplete line break is parsed at once.
+			ASSERT_GE(consumed + 1, buffer.size());
+			ASSERT_EQ(parser.parsed, consumed);
+		}
+	}
+
+	ASSERT_EQ(status, HTTPPARSE_DONE);
+	ASSERT_EQ(consumed, first.size());
+	ASSERT_EQ(buffer.size(), first.size());
+
+	struct HTTPRequest req;
+	httpParserRequest(&parser, buffer.data(), &req);
+	ASSERT_EQ(req.method, HTTPM_POST);
+	ASSERT_EQ(std::string(req.pathv.ptr, req.pathv.len), "/form");
+	ASSERT_EQ(req.headervc, 3);
+	ASSERT_EQ(std::string(req.headerv[2].value.ptr, req.headerv[2].value.len), "v");
+	ASSERT_EQ(std::string(req.body, req.bodyc), "body");
+	destroyHTTPRequest(&req);
+
+	// The next pipelined request is parsed by the reset parser.
+	initHTTPParser(&parser);
+	std::string rest = raw.substr(consumed);
+	ASSERT_EQ(httpParserFeed(&parser, rest.data(), rest.size(), &consumed), HTTPPARSE_DONE);
+	ASSERT_EQ(consumed, rest.size());
+
+	initHTTPParser(&parser);
+	const char *bad = "GET / HTTP/1.1\r\nContent-Length: 1x\r\n\r\n";
+	ASSERT_EQ(httpParserFeed(&parser, bad, strlen(bad), &consumed), HTTPPARSE_ERROR);
+
+	initHTTPParser(&parser);
+	const char *bare = "GET / HTTP/1.1\rHost: x\r\n\r\n";
+	ASSERT_EQ(httpParserFeed(&parser, bare, strlen(bare), &consumed), HTTPPARSE_ERROR);
+}
+
+/**
+ * Decodes @encoded fed by @step bytes into a buffer that keeps unconsumed bytes.
+ *
+ * @Returns decoded body followed by "|name=value" of each trailer, or "ERROR".
+ */
+static std::string decodeChunked(const std::string &encoded, size_t step, size_t max) {
+	struct httpChunkedDecoder dec;
+	initHTTPChunkedDecoder(&dec);
+
+	std::string pending, res, trailers;
+	for (size_t fed = 0; dec.state != HTTPCHUNK_DONE;) {
+		if (fed == encoded.size()) return "INCOMPLETE";
+
+		pending += encoded.substr(fed, step);
+		fed += std::min(step, encoded.size() - fed);
+
+		int status;
+		do {
+			size_t consumed;
+			struct HTTPHeaderView out;
+			status = httpChunkedFeed(&dec, pending.data(), pending.size(), max, &consumed, &out);
+			if (status == HTTPPARSE_ERROR) return "ERROR";
+
+			if (status == HTTPPARSE_DATA) {
+				EXPECT_LE(out.value.len, max);
+				res += std::string(out.value.ptr, out.value.len);
+			} else if (status == HTTPPARSE_TRAILER) {
+				trailers += "|" + std::string(out.key.ptr, out.key.len) + "=" + std::string(out.value.ptr, out.value.len);
+			}
+
+			pending.erase(0, consumed);
+		} while (status == HTTPPARSE_DATA || status == HTTPPARSE_TRAILER);
+	}
+
+	return res + trailers;
+}
+
+TEST(HTTPparse, ChunkedDecoder) {
+	std::string body = "4;ext=1\r\nWiki\r\n5 \r\npedia\r\nE\r\n in\r\n\r\nchunks.\r\n0\r\nExpires: never\r\nX-Sum:  abc \r\n\r\n";
+	std::string decoded = "Wikipedia in\r\n\r\nchunks.|Expires=never|X-Sum=abc";
+
+	ASSERT_EQ(decodeChunked(body, body.size(), SIZE_MAX), decoded);
+	ASSERT_EQ(decodeChunked(body, 1, SIZE_MAX), decoded);
+	ASSERT_EQ(decodeChunked(body, 7, 3), decoded);
+	ASSERT_EQ(decodeChunked("0\n\n", 1, SIZE_MAX), "");
+	ASSERT_EQ(decodeChunked("3\r\nabc\r\n", 1, SIZE_MAX), "INCOMPLETE");
+
+	ASSERT_EQ(decodeChunked("g\r\n", 4, SIZE_MAX), "ERROR");
+	ASSERT_EQ(decodeChunked(";x\r\n", 4, SIZE_MAX), "ERROR");
+	ASSERT_EQ(decodeChunked("3\r\nabcXX0\r\n\r\n", 1, SIZE_MAX), "ERROR");
+	ASSERT_EQ(decodeChunked("3\rx\r\n", 5, SIZE_MAX), "ERROR");
+	ASSERT_EQ(decodeChunked("0\r\nbad trailer\r\n\r\n", 64, SIZE_MAX), "ERROR");
+
+	// Size limits.
+	ASSERT_EQ(decodeChunked("10000000000000000\r\n", 64, SIZE_MAX), "ERROR");
+	ASSERT_EQ(decodeChunked("8000000\r\n", 64, SIZE_MAX), "ERROR");
+	ASSERT_EQ(decodeChunked("1;" + std::string(HTTP_MAX_CHUNK_LINE, 'x') + "\r\n", 1024, SIZE_MAX), "ERROR");
+}
+
+TEST(HTTPparse, ChunkedRequestBuffer) {
+	std::string first = "POST /up HTTP/1.1\r\nTransfer-Encoding: Chunked\r\n\r\n3\r\nabc\r\n2\r\nde\r\n0\r\nX-T: 1\r\n\r\n";
+	std::string raw = first + "GET / HTTP/1.1\r\n\r\n";
+
+	ASSERT_EQ(httpRequestLength(raw.data(), raw.size()), first.size());
+	ASSERT_EQ(httpRequestLength(first.data(), first.size() - 1), 0);
+
+	// Head is done at the empty line, the body is decoded separately.
+	struct httpParser parser;
+	initHTTPParser(&parser);
+	size_t consumed;
+	ASSERT_EQ(httpParserFeed(&parser, first.data(), first.size(), &consumed), HTTPPARSE_DONE);
+	ASSERT_EQ(parser.chunked, 1);
+	ASSERT_EQ(consumed, first.find("\r\n\r\n") + 4);
+
+	struct HTTPRequest req;
+	ASSERT_EQ(parseHTTPRequestBuffer(first.data(), consumed, first.size(), &req), 0);
+	ASSERT_EQ(req.chunked, 1);
+	ASSERT_EQ(std::string(req.body, req.bodyc), "abcde");
+	ASSERT_STREQ(getHTTPRequestTrailer(&req, "x-t"), "1");
+
+	char buf[4];
+	ASSERT_EQ(readHTTPRequestBody(&req, buf, sizeof(buf)), 4);
+	ASSERT_EQ(readHTTPRequestBody(&req, buf, sizeof(buf)), 1);
+	ASSERT_EQ(buf[0], 'e');
+	ASSERT_EQ(readHTTPRequestBody(&req, buf, sizeof(buf)), 0);
+	destroyHTTPRequest(&req);
+
+	// Framing of the body is ambiguous.
+	const char *smuggled = "POST / HTTP/1.1\r\nContent-Length: 5\r\nTransfer-Encoding: chunked\r\n\r\n0\r\n\r\n";
+	ASSERT_EQ(httpRequestLength(smuggled, strlen(smuggled)), -1);
+	const char *gzip = "POST / HTTP/1.1\r\nTransfer-Encoding: gzip\r\n\r\n";
+	ASSERT_EQ(httpRequestLength(gzip, strlen(gzip)), -1);
+
+	// Copying parser reads the whole body.
+	struct connIO io;
+	ASSERT_EQ(initConnIO(&io, -1, raw.size(), 0), 0);
+	connIOFeed(&io, raw.data(), raw.size());
+
+	ASSERT_EQ(parseHTTPRequest(&io, &req), HTTPREQ_SUCCESS);
+	ASSERT_EQ(req.chunked, 1);
+	ASSERT_EQ(std::string(req.body, req.bodyc), "abcde");
+	ASSERT_STREQ(getHTTPRequestTrailer(&req, "X-T"), "1");
+	destroyHTTPRequest(&req);
+
+	ASSERT_EQ(parseHTTPRequest(&io, &req), HTTPREQ_SUCCESS);
+	ASSERT_STREQ(req.path, "/");
 	destroyHTTPRequest(&req);
-	fclose(stream);
+	destroyConnIO(&io);
+}
+
+TEST(HTTPparse, ChunkedRequestView) {
+	int fds[2];
+	ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+
+	std::string raw = "POST /upload HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n5\r\nhello\r\n";
+	ASSERT_EQ(write(fds[1], raw.data(), raw.size()), raw.size());
+
+	struct connIO io;
+	ASSERT_EQ(initConnIO(&io, fds[0], 0, 0), 0);
+
+	struct HTTPRequest req;
+	ASSERT_EQ(parseHTTPRequestView(&io, &req), HTTPREQ_SUCCESS);
+	ASSERT_EQ(req.chunked, 1);
+	ASSERT_EQ(req.bodyio, &io);
+	ASSERT_EQ(sliceString(req.pathv), "/upload");
+
+	// Data received so far is returned without waiting for the rest of the body.
+	char buf[64];
+	ASSERT_EQ(readHTTPRequestBody(&req, buf, sizeof(buf)), 5);
+	ASSERT_EQ(std::string(buf, 5), "hello");
+	ASSERT_EQ(getHTTPRequestTrailer(&req, "Digest"), nullptr);
+
+	raw = "3;name=v\r\n wo\r\n3\r\nrld\r\n0\r\nDigest: sha-256=x\r\n\r\nGET /next HTTP/1.1\r\n\r\n";
+	ASSERT_EQ(write(fds[1], raw.data(), raw.size()), raw.size());
+
+	std::string body;
+	ssize_t rd;
+	while ((rd = readHTTPRequestBody(&req, buf, 2)) > 0) body += std::string(buf, rd);
+	ASSERT_EQ(rd, 0);
+	ASSERT_EQ(body, " world");
+	ASSERT_EQ(req.bodyRead, 11);
+	ASSERT_STREQ(getHTTPRequestTrailer(&req, "Digest"), "sha-256=x");
+	destroyHTTPRequest(&req);
+
+	ASSERT_EQ(parseHTTPRequestView(&io, &req), HTTPREQ_SUCCESS);
+	ASSERT_EQ(sliceString(req.pathv), "/next");
+	destroyHTTPRequest(&req);
+
+	// Body the processor has not read is skipped.
+	raw = "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n2\r\nab\r\n0\r\n\r\nGET /after HTTP/1.1\r\n\r\n";
+	ASSERT_EQ(write(fds[1], raw.data(), raw.size()), raw.size());
+
+	ASSERT_EQ(parseHTTPRequestView(&io, &req), HTTPREQ_SUCCESS);
+	ASSERT_EQ(discardHTTPRequestBody(&req), 0);
+	destroyHTTPRequest(&req);
+
+	ASSERT_EQ(parseHTTPRequestView(&io, &req), HTTPREQ_SUCCESS);
+	ASSERT_EQ(sliceString(req.pathv), "/after");
+	destroyHTTPRequest(&req);
+
+	// Connection is closed in the middle of the body.
+	raw = "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n5\r\nab";
+	ASSERT_EQ(write(fds[1], raw.data(), raw.size()), raw.size());
+	shutdown(fds[1], SHUT_WR);
+
+	ASSERT_EQ(parseHTTPRequestView(&io, &req), HTTPREQ_SUCCESS);
+	ASSERT_EQ(discardHTTPRequestBody(&req), -1);
+	destroyHTTPRequest(&req);
+
+	destroyConnIO(&io);
+	close(fds[0]);
+	close(fds[1]);
 }
 
 TEST(HTTP, ResponseWriter) {
-	FILE *stream = tmpfile();
+	int fds[2];
+	ASSERT_EQ(pipe(fds), 0);
+
+	struct connIO out, in;
+	ASSERT_EQ(initConnIO(&out, fds[1], 0, 0), 0);
+	ASSERT_EQ(initConnIO(&in, fds[0], 0, 0), 0);
+
 	struct HTTPResponse response;
 	initHTTPResponse(&response, HTTPV_11);
 
@@ -178,28 +629,678 @@ TEST(HTTP, ResponseWriter) {
 	response.bodyc = bodyc;
 	response.body = body;
 
-	writeHTTPResponse(&response, stream);
-	fseek(stream, 0, SEEK_SET);
+	ASSERT_EQ(writeHTTPResponse(&response, &out), 0);
+	ASSERT_EQ(out.wlen, 0);
 
 	char *line = NULL;
 	size_t lineLen = 0;
 
-	getline(&line, &lineLen, stream);
+	connIOGetLine(&in, &line, &lineLen);
 	ASSERT_STREQ(line, "HTTP/1.1 200 OK\r\n");
 
-	getline(&line, &lineLen, stream);
+	connIOGetLine(&in, &line, &lineLen);
 	ASSERT_STREQ(line, "Authorization: Bearer\r\n");
 
-	getline(&line, &lineLen, stream);
+	connIOGetLine(&in, &line, &lineLen);
 	ASSERT_STREQ(line, "Content-Length: 12\r\n");
 
-	getline(&line, &lineLen, stream);
+	connIOGetLine(&in, &line, &lineLen);
 	ASSERT_STREQ(line, "\r\n");
 
-	getline(&line, &lineLen, stream);
+	connIOGetLine(&in, &line, &lineLen);
 	ASSERT_STREQ(line, body);
 
 	free(line);
 	destroyHTTPResponse(&response);
-	fclose(stream);
+	destroyConnIO(&out);
+	destroyConnIO(&in);
+	close(fds[0]);
+	close(fds[1]);
+}
+
+/**
+ * Producer of @left bytes of counting pattern.
+ */
+struct countingBody {
+	size_t left;
+	size_t produced;
+	bool freed;
+	bool fail;
+};
+
+static ssize_t countingProducer(void *ctx, char *buf, size_t n) {
+	struct countingBody *body = (struct countingBody *)ctx;
+	if (body->fail && body->produced != 0) return -1;
+
+	// Parts of different sizes.
+	n = std::min({ n, body->left, (size_t)1000 + body->produced % 7 });
+	for (size_t i = 0; i < n; i++) buf[i] = 'a' + (body->produced + i) % 26;
+
+	body->left -= n;
+	body->produced += n;
+	return n;
+}
+
+static void countingFree(void *ctx) {
+	((struct countingBody *)ctx)->freed = true;
+}
+
+TEST(HTTP, StreamedResponse) {
+	std::string expected;
+	for (size_t i = 0; i < 50000; i++) expected += 'a' + i % 26;
+
+	struct connIO io;
+	ASSERT_EQ(initConnIO(&io, -1, 0, 0), 0);
+
+	struct countingBody body = { expected.size(), 0, false, false };
+
+	struct HTTPResponse response;
+	initHTTPResponse(&response, HTTPV_11);
+	response.status = 200;
+	addKVHTTPHeader_p(&response.headers, "Content-Length", "5");
+	setHTTPResponseProducer(&response, countingProducer, &body, countingFree);
+
+	ASSERT_EQ(writeHTTPResponse(&response, &io), 0);
+	ASSERT_FALSE(body.freed);
+	destroyHTTPResponse(&response);
+	ASSERT_TRUE(body.freed);
+
+	std::string out(io.wbuf, io.wlen);
+	size_t headlen = out.find("\r\n\r\n") + 4;
+	ASSERT_EQ(out.substr(0, headlen), "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n");
+	ASSERT_EQ(decodeChunked(out.substr(headlen), out.size(), SIZE_MAX), expected);
+
+	// HTTP/1.0 body is delimited by connection close.
+	connIOOutputConsume(&io, io.wlen);
+	body = { expected.size(), 0, false, false };
+
+	initHTTPResponse(&response, HTTPV_10);
+	response.status = 200;
+	setHTTPResponseProducer(&response, countingProducer, &body, countingFree);
+	ASSERT_EQ(writeHTTPResponse(&response, &io), 0);
+	destroyHTTPResponse(&response);
+
+	out = std::string(io.wbuf, io.wlen);
+	ASSERT_EQ(out, "HTTP/1.0 200 OK\r\n\r\n" + expected);
+
+	// Response is cut on producer failure.
+	connIOOutputConsume(&io, io.wlen);
+	body = { expected.size(), 0, false, true };
+
+	initHTTPResponse(&response, HTTPV_11);
+	response.status = 200;
+	setHTTPResponseProducer(&response, countingProducer, &body, countingFree);
+	ASSERT_EQ(writeHTTPResponse(&response, &io), -1);
+	destroyHTTPResponse(&response);
+	ASSERT_TRUE(body.freed);
+
+	destroyConnIO(&io);
+}
+
+static void countRelease(void *ctx) {
+	(*(int *)ctx)++;
+}
+
+/**
+ * @Returns memory file holding @data.
+ */
+static int dataFile(const std::string &data) {
+	int fd = memfd_create("test", MFD_CLOEXEC);
+	EXPECT_EQ(write(fd, data.data(), data.size()), (ssize_t)data.size());
+	return fd;
+}
+
+TEST(HTTP, ResponseBodySources) {
+	struct connIO io;
+	ASSERT_EQ(initConnIO(&io, -1, 0, 0), 0);
+
+	int released = 0;
+	struct HTTPResponse response;
+
+	// Parts of template are sent without concatenation.
+	struct iovec iov[] = { { (void *)"<p>", 3 }, { (void *)"", 0 }, { (void *)"name", 4 }, { (void *)"</p>", 4 } };
+	initHTTPResponse(&response, HTTPV_11);
+	response.status = 200;
+	setHTTPResponseIovec(&response, iov, 4, countRelease, &released);
+	ASSERT_EQ(response.bodyc, 11);
+	ASSERT_EQ(writeHTTPResponse(&response, &io), 0);
+	destroyHTTPResponse(&response);
+	ASSERT_EQ(released, 1);
+
+	ASSERT_EQ(std::string(io.wbuf, io.wlen), "HTTP/1.1 200 OK\r\nContent-Length: 11\r\n\r\n<p>name</p>");
+	connIOOutputConsume(&io, io.wlen);
+
+	// Memory connIO reads file range into the output.
+	int fd = dataFile("0123456789");
+	initHTTPResponse(&response, HTTPV_11);
+	response.status = 200;
+	setHTTPResponseFile(&response, fd, 2, 3, countRelease, &released);
+	ASSERT_EQ(writeHTTPResponse(&response, &io), 0);
+
+	// Source is released when it is replaced.
+	setHTTPResponseFile(&response, fd, 0, 20, countRelease, &released);
+	ASSERT_EQ(released, 2);
+	response.headOnly = 1;
+	ASSERT_EQ(writeHTTPResponse(&response, &io), 0);
+	destroyHTTPResponse(&response);
+	ASSERT_EQ(released, 3);
+
+	ASSERT_EQ(std::string(io.wbuf, io.wlen), "HTTP/1.1 200 OK\r\nContent-Length: 3\r\n\r\n234"
+		"HTTP/1.1 200 OK\r\nContent-Length: 20\r\n\r\n");
+	connIOOutputConsume(&io, io.wlen);
+
+	// Truncated file can not meet Content-Length.
+	initHTTPResponse(&response, HTTPV_11);
+	response.status = 200;
+	setHTTPResponseFile(&response, fd, 0, 20, NULL, NULL);
+	ASSERT_EQ(writeHTTPResponse(&response, &io), -1);
+	ASSERT_EQ(errno, EIO);
+	destroyHTTPResponse(&response);
+
+	destroyConnIO(&io);
+	close(fd);
+}
+
+TEST(HTTP, ResponseFileToSocket) {
+	int fds[2];
+	ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+
+	struct connIO io;
+	ASSERT_EQ(initConnIO(&io, fds[0], 0, 0), 0);
+
+	struct HTTPResponse response;
+
+	// File range is sent by sendfile(2).
+	int fd = dataFile("0123456789");
+	initHTTPResponse(&response, HTTPV_11);
+	response.status = 200;
+	setHTTPResponseFile(&response, fd, 4, 6, NULL, NULL);
+	ASSERT_EQ(writeHTTPResponse(&response, &io), 0);
+	destroyHTTPResponse(&response);
+	close(fd);
+
+	// Pipe is spliced from its current position.
+	int pipefds[2];
+	ASSERT_EQ(pipe(pipefds), 0);
+	ASSERT_EQ(write(pipefds[1], "piped", 5), 5);
+
+	initHTTPResponse(&response, HTTPV_11);
+	response.status = 200;
+	setHTTPResponseFile(&response, pipefds[0], 100, 5, NULL, NULL);
+	ASSERT_EQ(writeHTTPResponse(&response, &io), 0);
+	destroyHTTPResponse(&response);
+	close(pipefds[0]);
+	close(pipefds[1]);
+
+	std::string out;
+	char buf[4096];
+	ssize_t rd;
+	while ((rd = recv(fds[1], buf, sizeof(buf), MSG_DONTWAIT)) > 0) out.append(buf, rd);
+	ASSERT_EQ(out, "HTTP/1.1 200 OK\r\nContent-Length: 6\r\n\r\n456789HTTP/1.1 200 OK\r\nContent-Length: 5\r\n\r\npiped");
+
+	destroyConnIO(&io);
+	close(fds[0]);
+	close(fds[1]);
+}
+
+static int sourcesFd;
+static struct iovec sourcesIov[] = { { (void *)"io", 2 }, { (void *)"vec", 3 } };
+
+static void sourcesProcessor(struct HTTPRequest *request, struct HTTPResponse *response) {
+	response->status = 200;
+
+	// Event handler parses requests into views.
+	const char *path = request->views ? request->pathv.ptr : request->path;
+
+	if (!strncmp(path, "/file", 5)) setHTTPResponseFile(response, sourcesFd, 0, 10, NULL, NULL);
+	else setHTTPResponseIovec(response, sourcesIov, 2, NULL, NULL);
+}
+
+TEST(HTTP, EventBodySources) {
+	int fds[2];
+	ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds), 0);
+	sourcesFd = dataFile("0123456789");
+
+	struct eventLoop loop = {};
+	struct eventConn conn = {};
+	conn.loop = &loop;
+	conn.src.fd = fds[0];
+
+	struct HTTPConnectionHandlerArgs args = {};
+	args.httpRequestProcessor = sourcesProcessor;
+
+	std::string in = "GET /file HTTP/1.1\r\n\r\nGET /iov HTTP/1.1\r\n\r\n";
+	ASSERT_EQ(eventConnReserve(&conn, in.size()), 0);
+	memcpy(conn.rbuf, in.data(), in.size());
+	conn.rlen = in.size();
+
+	// Head is buffered, the file is sent once the output is flushed.
+	ASSERT_EQ(httpEventHandler(&conn, &args), CONNEV_KEEP);
+	ASSERT_EQ(conn.producing, 1);
+	std::string head(conn.wbuf, conn.wlen);
+	ASSERT_EQ(head, "HTTP/1.1 200 OK\r\nContent-Length: 10\r\n\r\n");
+	ASSERT_EQ(write(fds[0], conn.wbuf, conn.wlen), (ssize_t)conn.wlen);
+	conn.wlen = 0;
+
+	ASSERT_EQ(httpEventHandler(&conn, &args), CONNEV_KEEP);
+	ASSERT_EQ(conn.producing, 0);
+	ASSERT_EQ(conn.rlen, 0);
+	ASSERT_EQ(std::string(conn.wbuf, conn.wlen), "HTTP/1.1 200 OK\r\nContent-Length: 5\r\n\r\niovec");
+
+	char buf[256];
+	ssize_t rd = recv(fds[1], buf, sizeof(buf), MSG_DONTWAIT);
+	ASSERT_EQ(std::string(buf, rd > 0 ? rd : 0), head + "0123456789");
+
+	eventConnFreeState(&conn);
+	free(conn.rbuf);
+	free(conn.wbuf);
+	close(sourcesFd);
+	close(fds[0]);
+	close(fds[1]);
+}
+
+TEST(HTTPParse, HTTPRequestLength) {
+	const char *req = "GET / HTTP/1.1\r\nHost: example.com\r\n\r\n";
+	ASSERT_EQ(httpRequestLength(req, strlen(req)), strlen(req));
+	ASSERT_EQ(httpRequestLength(req, strlen(req) - 1), 0);
+	ASSERT_EQ(httpRequestLength(req, 0), 0);
+
+	req = "GET / HTTP/1.1\nContent-Length: 10\n\nabcdefghjkGET";
+	ASSERT_EQ(httpRequestLength(req, strlen(req)), strlen(req) - 3);
+	ASSERT_EQ(httpRequestLength(req, strlen(req) - 4), 0);
+
+	req = "GET / HTTP/1.1\r\nContent-Length: 1a\r\n\r\n";
+	ASSERT_EQ(httpRequestLength(req, strlen(req)), -1);
+}
+
+/**
+ * @Returns result of parseHTTPRequest() on @raw, with its body in @body on success.
+ */
+static int parseRaw(const char *raw, std::string *body) {
+	int fds[2];
+	EXPECT_EQ(pipe(fds), 0);
+	EXPECT_EQ(write(fds[1], raw, strlen(raw)), strlen(raw));
+	close(fds[1]);
+
+	struct connIO io;
+	EXPECT_EQ(initConnIO(&io, fds[0], 0, 0), 0);
+
+	struct HTTPRequest req;
+	int status = parseHTTPRequest(&io, &req);
+	if (status == 0) *body = std::string(req.body != NULL ? req.body : "", req.bodyc);
+	destroyHTTPRequest(&req);
+
+	destroyConnIO(&io);
+	close(fds[0]);
+	return status;
+}
+
+TEST(HTTPparse, RepeatedContentLength) {
+	const char *same = "POST / HTTP/1.1\r\nContent-Length: 3\r\nContent-Length: 003\r\n\r\nabcGET";
+	const char *differs = "POST / HTTP/1.1\r\nContent-Length: 3\r\nContent-Length: 5\r\n\r\nabcdeGET";
+
+	// Repeated Content-Length of the same value is accepted, the differing one is a request smuggling attempt.
+	ASSERT_EQ(httpRequestLength(same, strlen(same)), strlen(same) - 3);
+	ASSERT_EQ(httpRequestLength(differs, strlen(differs)), -1);
+
+	struct httpParser parser;
+	size_t consumed;
+	initHTTPParser(&parser);
+	ASSERT_EQ(httpParserFeed(&parser, differs, strlen(differs), &consumed), HTTPPARSE_ERROR);
+
+	std::string body;
+	ASSERT_EQ(parseRaw(same, &body), 0);
+	ASSERT_EQ(body, "abc");
+	ASSERT_EQ(parseRaw(differs, &body), -1);
+}
+
+static void pipelineProcessor(struct HTTPRequest *request, struct HTTPResponse *response) {
+	response->status = 200;
+	response->body = "ok";
+	response->bodyc = 2;
+}
+
+/**
+ * @Returns count of responses in each message written by the handler.
+ */
+static std::vector<int> runPipeline(const std::string &requests) {
+	// Message boundaries of SOCK_SEQPACKET show how responses are coalesced into writes.
+	int fds[2];
+	EXPECT_EQ(socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fds), 0);
+	EXPECT_EQ(write(fds[1], requests.data(), requests.size()), requests.size());
+	shutdown(fds[1], SHUT_WR);
+
+	struct connIO io;
+	EXPECT_EQ(initConnIO(&io, fds[0], 0, 0), 0);
+
+	struct HTTPConnectionHandlerArgs args = {};
+	args.httpRequestProcessor = pipelineProcessor;
+	httpConnetionHandler(&io, &args);
+	destroyConnIO(&io);
+	close(fds[0]);
+
+	std::vector<int> messages;
+	char buf[65536];
+	ssize_t rd;
+	while ((rd = read(fds[1], buf, sizeof(buf))) > 0) {
+		std::string msg(buf, rd);
+
+		int responses = 0;
+		for (size_t pos = 0; (pos = msg.find("HTTP/1.", pos)) != std::string::npos; pos++)
+			responses++;
+		messages.push_back(responses);
+	}
+	close(fds[1]);
+
+	return messages;
+}
+
+TEST(HTTP, Pipelining) {
+	std::string get = "GET / HTTP/1.1\r\n\r\n";
+
+	// Requests received together are answered by one write.
+	ASSERT_EQ(runPipeline(get + get + get + "GET / HTTP/1.0\r\n\r\n"), std::vector<int>({ 4 }));
+	ASSERT_EQ(runPipeline(get), std::vector<int>({ 1 }));
+
+	// Pipeline depth is limited.
+	std::string deep;
+	for (int i = 0; i < HTTP_PIPELINE_DEPTH + 2; i++) deep += get;
+	ASSERT_EQ(runPipeline(deep), std::vector<int>({ HTTP_PIPELINE_DEPTH, 2 }));
+
+	// Chunked body the processor has not read is skipped.
+	ASSERT_EQ(runPipeline("POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n1\r\nx\r\n0\r\n\r\n" + get), std::vector<int>({ 2 }));
+
+	// Responses preceding the malformed request are sent.
+	ASSERT_EQ(runPipeline(get + get + "BAD\r\n\r\n"), std::vector<int>({ 2 }));
+}
+
+TEST(HTTPparse, BodyLimits) {
+	std::string large = "POST / HTTP/1.1\r\nContent-Length: " + std::to_string(HTTP_MAX_BODY_SIZE + 1) + "\r\n\r\n";
+
+	struct connIO io;
+	ASSERT_EQ(initConnIO(&io, -1, 0, 0), 0);
+	connIOFeed(&io, large.data(), large.size());
+
+	struct HTTPRequest req;
+	ASSERT_EQ(parseHTTPRequest(&io, &req), HTTPREQ_TOO_LARGE);
+	destroyConnIO(&io);
+
+	// Copying parser allocates the declared body only up to the memory limit.
+	std::string declared = "POST / HTTP/1.1\r\nContent-Length: " + std::to_string(HTTP_BODY_MEMORY_LIMIT + 1) + "\r\n\r\n";
+	ASSERT_EQ(initConnIO(&io, -1, 0, 0), 0);
+	connIOFeed(&io, declared.data(), declared.size());
+	ASSERT_EQ(parseHTTPRequest(&io, &req), HTTPREQ_TOO_LARGE);
+	destroyConnIO(&io);
+
+	std::string fits = "POST / HTTP/1.1\r\nContent-Length: " + std::to_string(HTTP_BODY_MEMORY_LIMIT) + "\r\n\r\n"
+		+ std::string(HTTP_BODY_MEMORY_LIMIT, 'f');
+	ASSERT_EQ(initConnIO(&io, -1, fits.size(), 0), 0);
+	connIOFeed(&io, fits.data(), fits.size());
+	ASSERT_EQ(parseHTTPRequest(&io, &req), HTTPREQ_SUCCESS);
+	ASSERT_EQ(req.bodyc, HTTP_BODY_MEMORY_LIMIT);
+	destroyHTTPRequest(&req);
+	destroyConnIO(&io);
+
+	// Chunked body is decoded into memory up to the same limit.
+	char size[32];
+	snprintf(size, sizeof(size), "%zx", (size_t)HTTP_BODY_MEMORY_LIMIT);
+	std::string chunk = std::string(size) + "\r\n" + std::string(HTTP_BODY_MEMORY_LIMIT, 'c') + "\r\n";
+	std::string chunked = "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n" + chunk;
+	std::string over = chunked + "1\r\nc\r\n0\r\n\r\n";
+	chunked += "0\r\n\r\n";
+
+	ASSERT_EQ(initConnIO(&io, -1, chunked.size(), 0), 0);
+	connIOFeed(&io, chunked.data(), chunked.size());
+	ASSERT_EQ(parseHTTPRequest(&io, &req), HTTPREQ_SUCCESS);
+	ASSERT_EQ(req.bodyc, HTTP_BODY_MEMORY_LIMIT);
+	destroyHTTPRequest(&req);
+	destroyConnIO(&io);
+
+	ASSERT_EQ(initConnIO(&io, -1, over.size(), 0), 0);
+	connIOFeed(&io, over.data(), over.size());
+	ASSERT_EQ(parseHTTPRequest(&io, &req), HTTPREQ_TOO_LARGE);
+	destroyConnIO(&io);
+
+	int fds[2];
+	ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+	ASSERT_EQ(initConnIO(&io, fds[0], 0, 0), 0);
+
+	ASSERT_EQ(write(fds[1], large.data(), large.size()), large.size());
+	ASSERT_EQ(parseHTTPRequestView(&io, &req), HTTPREQ_TOO_LARGE);
+	destroyHTTPRequest(&req);
+	destroyConnIO(&io);
+
+	// Body larger than memory limit is streamed, only the head is waited for.
+	ASSERT_EQ(initConnIO(&io, fds[0], 0, 0), 0);
+	std::string body(HTTP_BODY_MEMORY_LIMIT + 1, 'b');
+	std::string raw = "POST /up HTTP/1.1\r\nContent-Length: " + std::to_string(body.size()) + "\r\n\r\nbbb";
+	ASSERT_EQ(write(fds[1], raw.data(), raw.size()), raw.size());
+
+	ASSERT_EQ(parseHTTPRequestView(&io, &req), HTTPREQ_SUCCESS);
+	ASSERT_EQ(req.bodyio, &io);
+	ASSERT_EQ(req.body, nullptr);
+	ASSERT_EQ(req.bodyc, body.size());
+	ASSERT_EQ(sliceString(req.pathv), "/up");
+
+	char buf[64];
+	ASSERT_EQ(readHTTPRequestBody(&req, buf, sizeof(buf)), 3);
+
+	raw = body.substr(3) + "GET /next HTTP/1.1\r\n\r\n";
+	std::thread writer([&]() {
+		ASSERT_EQ(write(fds[1], raw.data(), raw.size()), raw.size());
+	});
+
+	std::string received = "bbb";
+	ssize_t rd;
+	while ((rd = readHTTPRequestBody(&req, buf, sizeof(buf))) > 0) received += std::string(buf, rd);
+	writer.join();
+
+	ASSERT_EQ(rd, 0);
+	ASSERT_EQ(received, body);
+	destroyHTTPRequest(&req);
+
+	ASSERT_EQ(parseHTTPRequestView(&io, &req), HTTPREQ_SUCCESS);
+	ASSERT_EQ(sliceString(req.pathv), "/next");
+	destroyHTTPRequest(&req);
+
+	destroyConnIO(&io);
+	close(fds[0]);
+	close(fds[1]);
+}
+
+static std::string receivedBody;
+static int receivedSpilled;
+
+static void bodyProcessor(struct HTTPRequest *request, struct HTTPResponse *response) {
+	char buf[7];
+	ssize_t rd;
+
+	receivedBody.clear();
+	receivedSpilled = request->bodyfd != -1;
+	while ((rd = readHTTPRequestBody(request, buf, sizeof(buf))) > 0) receivedBody += std::string(buf, rd);
+
+	response->status = rd == 0 ? 200 : 500;
+}
+
+TEST(HTTP, EventBodySpill) {
+	struct eventLoop loop = {};
+	struct eventConn conn = {};
+	conn.loop = &loop;
+
+	struct HTTPConnectionHandlerArgs args = {};
+	args.httpRequestProcessor = bodyProcessor;
+	args.bodyLimits.memory = 16;
+	args.bodyLimits.max = 64;
+
+	auto feed = [&](const std::string &data) {
+		for (size_t off = 0; off < data.size(); off += 10) {
+			std::string piece = data.substr(off, 10);
+			ASSERT_EQ(eventConnReserve(&conn, piece.size()), 0);
+			memcpy(conn.rbuf + conn.rlen, piece.data(), piece.size());
+			conn.rlen += piece.size();
+
+			int status = httpEventHandler(&conn, &args);
+			ASSERT_NE(status, CONNEV_ABORT);
+			// Input holds the head and at most the memory limit of body.
+			ASSERT_LE(conn.rlen, 64 + 16 + 10);
+		}
+	};
+
+	std::string body = "0123456789abcdefghijklmnopqrstuvwxyz";
+	feed("POST / HTTP/1.1\r\nContent-Length: " + std::to_string(body.size()) + "\r\n\r\n" + body);
+	ASSERT_EQ(receivedBody, body);
+	ASSERT_EQ(receivedSpilled, 1);
+	ASSERT_EQ(conn.rlen, 0);
+
+	// Small body stays in the input buffer.
+	feed("POST / HTTP/1.1\r\nContent-Length: 5\r\n\r\nsmall");
+	ASSERT_EQ(receivedBody, "small");
+	ASSERT_EQ(receivedSpilled, 0);
+
+	feed("POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n10\r\n0123456789abcdef\r\n"
+		"14\r\nghijklmnopqrstuvwxyz\r\n0\r\n\r\n");
+	ASSERT_EQ(receivedBody, body);
+	ASSERT_EQ(receivedSpilled, 1);
+	ASSERT_EQ(conn.rlen, 0);
+
+	std::string out(conn.wbuf, conn.wlen);
+	ASSERT_EQ(out.find("HTTP/1.1 413"), std::string::npos);
+
+	// Declared size beyond the maximum is rejected right after the head.
+	std::string tooLarge = "POST / HTTP/1.1\r\nContent-Length: 65\r\n\r\n";
+	ASSERT_EQ(eventConnReserve(&conn, tooLarge.size()), 0);
+	memcpy(conn.rbuf, tooLarge.data(), tooLarge.size());
+	conn.rlen = tooLarge.size();
+	ASSERT_EQ(httpEventHandler(&conn, &args), CONNEV_CLOSE);
+
+	out = std::string(conn.wbuf, conn.wlen);
+	ASSERT_NE(out.find("HTTP/1.1 413"), std::string::npos);
+
+	eventConnFreeState(&conn);
+	free(conn.rbuf);
+	free(conn.wbuf);
+}
+
+static size_t patternBodyc;
+static int patternMatches;
+
+/**
+ * @Returns byte @i of the body sent by the tests.
+ */
+static char patternByte(size_t i) {
+	return 'a' + i % 26;
+}
+
+/**
+ * Counts the body and checks that it is the pattern of patternByte().
+ */
+static void patternProcessor(struct HTTPRequest *request, struct HTTPResponse *response) {
+	std::vector<char> buf(64 << 10);
+	ssize_t rd;
+
+	patternBodyc = 0;
+	patternMatches = 1;
+	while ((rd = readHTTPRequestBody(request, buf.data(), buf.size())) > 0) {
+		for (ssize_t i = 0; i < rd; i++) patternMatches &= buf[i] == patternByte(patternBodyc + i);
+		patternBodyc += rd;
+	}
+
+	response->status = rd == 0 ? 200 : 500;
+}
+
+TEST(HTTP, EventBodyBoundedInput) {
+	struct eventLoop loop = {};
+	struct eventConn conn = {};
+	conn.loop = &loop;
+
+	struct HTTPConnectionHandlerArgs args = {};
+	args.httpRequestProcessor = patternProcessor;
+	args.bodyLimits.memory = 64 << 10;
+	args.bodyLimits.max = 16 << 20;
+	size_t limit = httpInputLimit(&args);
+
+	// Feeds @data like the event loop does: in reads of 48 KiB while the input is below the limit.
+	auto feed = [&](const std::string &data) {
+		size_t off = 0;
+		while (off < data.size()) {
+			size_t len = std::min({ data.size() - off, (size_t)48 << 10, limit - conn.rlen });
+			ASSERT_EQ(eventConnReserve(&conn, len), 0);
+			memcpy(conn.rbuf + conn.rlen, data.data() + off, len);
+			conn.rlen += len;
+			off += len;
+
+			ASSERT_EQ(httpEventHandler(&conn, &args), CONNEV_KEEP);
+			// Handler makes room for more input, so the loop does not close the connection.
+			ASSERT_LT(conn.rlen, limit);
+			ASSERT_LE(conn.rcap, 2 * limit);
+		}
+	};
+
+	size_t bodyc = 4 << 20;
+	std::string body(bodyc, 0);
+	for (size_t i = 0; i < bodyc; i++) body[i] = patternByte(i);
+
+	feed("POST / HTTP/1.1\r\nContent-Length: " + std::to_string(bodyc) + "\r\n\r\n" + body);
+	ASSERT_EQ(patternBodyc, bodyc);
+	ASSERT_TRUE(patternMatches);
+	ASSERT_EQ(conn.rlen, 0);
+
+	std::string chunked = "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n";
+	for (size_t off = 0; off < bodyc; off += 100000) {
+		size_t len = std::min(bodyc - off, (size_t)100000);
+		char line[32];
+		snprintf(line, sizeof(line), "%zx\r\n", len);
+		chunked += line + body.substr(off, len) + "\r\n";
+	}
+	feed(chunked + "0\r\n\r\n");
+	ASSERT_EQ(patternBodyc, bodyc);
+	ASSERT_TRUE(patternMatches);
+	ASSERT_EQ(conn.rlen, 0);
+
+	std::string out(conn.wbuf, conn.wlen);
+	ASSERT_NE(out.find("HTTP/1.1 200"), std::string::npos);
+	ASSERT_EQ(out.find("HTTP/1.1 500"), std::string::npos);
+
+	eventConnFreeState(&conn);
+	free(conn.rbuf);
+	free(conn.wbuf);
+}
+
+TEST(HTTP, ChunkedBodyLimit) {
+	struct eventLoop loop = {};
+	struct eventConn conn = {};
+	conn.loop = &loop;
+
+	struct HTTPConnectionHandlerArgs args = {};
+	args.httpRequestProcessor = bodyProcessor;
+	args.bodyLimits.max = 8;
+
+	std::string raw = "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n5\r\nhello\r\n5\r\nworld\r\n0\r\n\r\n";
+	ASSERT_EQ(eventConnReserve(&conn, raw.size()), 0);
+	memcpy(conn.rbuf, raw.data(), raw.size());
+	conn.rlen = raw.size();
+	ASSERT_EQ(httpEventHandler(&conn, &args), CONNEV_CLOSE);
+	ASSERT_NE(std::string(conn.wbuf, conn.wlen).find("HTTP/1.1 413"), std::string::npos);
+
+	eventConnFreeState(&conn);
+	free(conn.rbuf);
+	free(conn.wbuf);
+
+	// Threaded handler replaces the response once the processor has read past the limit.
+	int fds[2];
+	ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+	ASSERT_EQ(write(fds[1], raw.data(), raw.size()), raw.size());
+	shutdown(fds[1], SHUT_WR);
+
+	struct connIO io;
+	ASSERT_EQ(initConnIO(&io, fds[0], 0, 0), 0);
+	httpConnetionHandler(&io, &args);
+	destroyConnIO(&io);
+	close(fds[0]);
+
+	char buf[256];
+	ssize_t rd = read(fds[1], buf, sizeof(buf));
+	ASSERT_GT(rd, 0);
+	ASSERT_EQ(std::string(buf, rd).find("HTTP/1.1 413"), 0);
+	close(fds[1]);
 }
@@ -0,0 +1,50 @@
+#include <gtest/gtest.h>
+#include "server/pool.h"
+
+TEST(PoolDequeTest, PushPopSteal) {
+	struct poolDeque deque;
+	ASSERT_EQ(initPoolDeque(&deque, 2), 0);
+
+	struct poolTask task = {};
+	for (size_t i = 0; i < 5; i++) {
+		task.data = i;
+		ASSERT_EQ(poolDequePush(&deque, task), 0);
+	}
+	ASSERT_EQ(deque.size, 5);
+	ASSERT_EQ(deque.capacity, 8);
+
+	// Owner takes the newest task, thief takes the oldest one.
+	ASSERT_EQ(poolDequePop(&deque, &task), 1);
+	ASSERT_EQ(task.data, 4);
+	ASSERT_EQ(poolDequeSteal(&deque, &task), 1);
+	ASSERT_EQ(task.data, 0);
+	ASSERT_EQ(poolDequeSteal(&deque, &task), 1);
+	ASSERT_EQ(task.data, 1);
+	ASSERT_EQ(poolDequePop(&deque, &task), 1);
+	ASSERT_EQ(task.data, 3);
+	ASSERT_EQ(poolDequePop(&deque, &task), 1);
+	ASSERT_EQ(task.data, 2);
+
+	ASSERT_EQ(poolDequePop(&deque, &task), 0);
+	ASSERT_EQ(poolDequeSteal(&deque, &task), 0);
+
+	destroyPoolDeque(&deque);
+}
+
+static void countTask(void *arg, uint64_t data) {
+	__atomic_add_fetch((size_t *)arg, data, __ATOMIC_RELAXED);
+}
+
+TEST(WorkerPoolTest, RunsAllTasks) {
+	struct workerPool pool;
+	ASSERT_EQ(initWorkerPool(&pool, 4), 0);
+	ASSERT_EQ(pool.workersc, 4);
+
+	size_t sum = 0;
+	for (size_t i = 1; i <= 1000; i++)
+		ASSERT_EQ(poolSubmit(&pool, countTask, &sum, i), 0);
+
+	// Pool finishes queued tasks before it stops.
+	destroyWorkerPool(&pool);
+	ASSERT_EQ(sum, 500500);
+}
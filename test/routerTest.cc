@@ -0,0 +1,179 @@
+#include <gtest/gtest.h>
+#include <string>
+#include <cstring>
+#include <cerrno>
+#include "server/router.h"
+
+static void usersProcessor(struct HTTPRequest *request, struct HTTPResponse *response) {
+	response->status = 200;
+}
+
+static void userProcessor(struct HTTPRequest *request, struct HTTPResponse *response) {
+	size_t len;
+	const char *id = getHTTPRequestParam(request, "id", &len);
+
+	response->status = id != NULL && std::string(id, len) == "42" ? 201 : 500;
+}
+
+static void newUserProcessor(struct HTTPRequest *request, struct HTTPResponse *response) {
+	response->status = 202;
+}
+
+static void filesProcessor(struct HTTPRequest *request, struct HTTPResponse *response) {
+	response->status = 203;
+}
+
+/**
+ * Parameters are slices of @path, so it should outlive @m.
+ */
+static int match(struct httpRouter *router, int method, const char *path, struct httpRouteMatch *m) {
+	return matchHTTPRoute(router, method, path, strlen(path), m);
+}
+
+static std::string param(struct httpRouteMatch *m, size_t i) {
+	return std::string(m->params[i].value.ptr, m->params[i].value.len);
+}
+
+TEST(RouterTest, MatchesRoutes) {
+	struct httpRouter router;
+	ASSERT_EQ(initHTTPRouter(&router), 0);
+
+	ASSERT_EQ(addHTTPRoute(&router, HTTPM_GET, "/users", usersProcessor), 0);
+	ASSERT_EQ(addHTTPRoute(&router, HTTPM_GET, "/users/:id", userProcessor), 0);
+	ASSERT_EQ(addHTTPRoute(&router, HTTPM_GET, "/users/new", newUserProcessor), 0);
+	ASSERT_EQ(addHTTPRoute(&router, HTTPM_GET, "/users/:id/posts/:post", userProcessor), 0);
+	ASSERT_EQ(addHTTPRoute(&router, HTTPM_GET, "/users/new/edit", newUserProcessor), 0);
+	ASSERT_EQ(addHTTPRoute(&router, HTTPM_GET, "/u", usersProcessor), 0);
+	ASSERT_EQ(addHTTPRoute(&router, HTTPM_GET, "/static/*path", filesProcessor), 0);
+	ASSERT_EQ(addHTTPRoute(&router, HTTPM_POST, "/users", usersProcessor), 0);
+	ASSERT_EQ(router.routesc, 8);
+
+	struct httpRouteMatch m;
+	ASSERT_EQ(match(&router, HTTPM_GET, "/users", &m), HTTPROUTE_FOUND);
+	ASSERT_EQ(m.processor, usersProcessor);
+	ASSERT_EQ(m.paramsc, 0);
+
+	ASSERT_EQ(match(&router, HTTPM_GET, "/u", &m), HTTPROUTE_FOUND);
+	ASSERT_EQ(match(&router, HTTPM_GET, "/us", &m), HTTPROUTE_NOT_FOUND);
+
+	// Static segment takes precedence over parameter.
+	ASSERT_EQ(match(&router, HTTPM_GET, "/users/new", &m), HTTPROUTE_FOUND);
+	ASSERT_EQ(m.processor, newUserProcessor);
+
+	ASSERT_EQ(match(&router, HTTPM_GET, "/users/newer", &m), HTTPROUTE_FOUND);
+	ASSERT_EQ(m.processor, userProcessor);
+	ASSERT_EQ(param(&m, 0), "newer");
+
+	// Static prefix matches, but the route continues with the parameter.
+	ASSERT_EQ(match(&router, HTTPM_GET, "/users/new/posts/7?x=1", &m), HTTPROUTE_FOUND);
+	ASSERT_EQ(m.processor, userProcessor);
+	ASSERT_EQ(m.paramsc, 2);
+	ASSERT_EQ(std::string(m.params[0].name.ptr, m.params[0].name.len), "id");
+	ASSERT_EQ(param(&m, 0), "new");
+	ASSERT_EQ(std::string(m.params[1].name.ptr, m.params[1].name.len), "post");
+	ASSERT_EQ(param(&m, 1), "7");
+
+	ASSERT_EQ(match(&router, HTTPM_GET, "/users//posts/7", &m), HTTPROUTE_NOT_FOUND);
+	ASSERT_EQ(match(&router, HTTPM_GET, "/users/42/", &m), HTTPROUTE_NOT_FOUND);
+
+	ASSERT_EQ(match(&router, HTTPM_GET, "/static/css/site.css", &m), HTTPROUTE_FOUND);
+	ASSERT_EQ(m.processor, filesProcessor);
+	ASSERT_EQ(param(&m, 0), "css/site.css");
+	ASSERT_EQ(match(&router, HTTPM_GET, "/static/", &m), HTTPROUTE_FOUND);
+	ASSERT_EQ(param(&m, 0), "");
+
+	ASSERT_EQ(match(&router, HTTPM_DELETE, "/users", &m), HTTPROUTE_METHOD);
+	ASSERT_EQ(match(&router, HTTPM_DELETE, "/static/a", &m), HTTPROUTE_METHOD);
+	ASSERT_EQ(match(&router, HTTPM_POST, "/users", &m), HTTPROUTE_FOUND);
+	ASSERT_EQ(match(&router, HTTPM_GET, "/nothing", &m), HTTPROUTE_NOT_FOUND);
+	ASSERT_EQ(match(&router, HTTPM_GET, "", &m), HTTPROUTE_NOT_FOUND);
+
+	destroyHTTPRouter(&router);
+}
+
+TEST(RouterTest, RejectsInvalidRoutes) {
+	struct httpRouter router;
+	ASSERT_EQ(initHTTPRouter(&router), 0);
+
+	ASSERT_EQ(addHTTPRoute(&router, HTTPM_GET, "/a/:id", usersProcessor), 0);
+
+	ASSERT_EQ(addHTTPRoute(&router, HTTPM_GET, "/a/:id", usersProcessor), -1);
+	ASSERT_EQ(errno, EEXIST);
+	ASSERT_EQ(addHTTPRoute(&router, HTTPM_GET, "/a/:name/b", usersProcessor), -1);
+	ASSERT_EQ(errno, EINVAL);
+	ASSERT_EQ(addHTTPRoute(&router, HTTPM_GET, "a", usersProcessor), -1);
+	ASSERT_EQ(addHTTPRoute(&router, HTTPM_GET, "/a/:", usersProcessor), -1);
+	ASSERT_EQ(addHTTPRoute(&router, HTTPM_GET, "/a/*rest/b", usersProcessor), -1);
+	ASSERT_EQ(addHTTPRoute(&router, HTTPM_FAILED, "/b", usersProcessor), -1);
+
+	std::string many;
+	for (int i = 0; i <= HTTP_MAX_ROUTE_PARAMS; i++) many += "/:p" + std::to_string(i);
+	ASSERT_EQ(addHTTPRoute(&router, HTTPM_GET, many.c_str(), usersProcessor), -1);
+
+	// Colon inside of segment is a plain byte.
+	ASSERT_EQ(addHTTPRoute(&router, HTTPM_GET, "/a:b", usersProcessor), 0);
+	struct httpRouteMatch m;
+	ASSERT_EQ(match(&router, HTTPM_GET, "/a:b", &m), HTTPROUTE_FOUND);
+
+	destroyHTTPRouter(&router);
+}
+
+TEST(RouterTest, ManyRoutes) {
+	struct httpRouter router;
+	ASSERT_EQ(initHTTPRouter(&router), 0);
+
+	for (int i = 0; i < 2000; i++) {
+		std::string route = "/api/v" + std::to_string(i % 3) + "/resource" + std::to_string(i) + "/:id";
+		ASSERT_EQ(addHTTPRoute(&router, HTTPM_GET, route.c_str(), userProcessor), 0) << route;
+	}
+
+	for (int i = 0; i < 2000; i++) {
+		struct httpRouteMatch m;
+		std::string path = "/api/v" + std::to_string(i % 3) + "/resource" + std::to_string(i) + "/x" + std::to_string(i);
+		ASSERT_EQ(match(&router, HTTPM_GET, path.c_str(), &m), HTTPROUTE_FOUND) << path;
+		ASSERT_EQ(param(&m, 0), "x" + std::to_string(i));
+
+		path = "/api/v" + std::to_string((i + 1) % 3) + "/resource" + std::to_string(i) + "/x";
+		ASSERT_EQ(match(&router, HTTPM_GET, path.c_str(), &m), HTTPROUTE_NOT_FOUND) << path;
+	}
+
+	destroyHTTPRouter(&router);
+}
+
+TEST(RouterTest, RoutesRequests) {
+	struct httpRouter router;
+	ASSERT_EQ(initHTTPRouter(&router), 0);
+	ASSERT_EQ(addHTTPRoute(&router, HTTPM_GET, "/users/:id", userProcessor), 0);
+	ASSERT_EQ(addHTTPRoute(&router, HTTPM_PUT, "/users/:id", userProcessor), 0);
+
+	auto route = [&](const char *raw, struct HTTPResponse *resp) {
+		struct HTTPRequest req;
+		ASSERT_EQ(parseHTTPRequestBuffer(raw, strlen(raw), strlen(raw), &req), 0);
+		ASSERT_EQ(initHTTPResponse(resp, req.httpver), 0);
+
+		routeHTTPRequest(&router, &req, resp);
+		ASSERT_EQ(req.route, nullptr);
+		destroyHTTPRequest(&req);
+	};
+
+	struct HTTPResponse resp;
+	route("GET /users/42 HTTP/1.1\r\n\r\n", &resp);
+	ASSERT_EQ(resp.status, 201);
+	destroyHTTPResponse(&resp);
+
+	route("GET /groups/42 HTTP/1.1\r\n\r\n", &resp);
+	ASSERT_EQ(resp.status, 404);
+	destroyHTTPResponse(&resp);
+
+	route("DELETE /users/42 HTTP/1.1\r\n\r\n", &resp);
+	ASSERT_EQ(resp.status, 405);
+	ASSERT_STREQ(getHTTPHeader_p(&resp.headers, "Allow"), "GET, PUT");
+	destroyHTTPResponse(&resp);
+
+	router.fallback = newUserProcessor;
+	route("GET /groups/42 HTTP/1.1\r\n\r\n", &resp);
+	ASSERT_EQ(resp.status, 202);
+	destroyHTTPResponse(&resp);
+
+	destroyHTTPRouter(&router);
+}
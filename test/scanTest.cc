@@ -0,0 +1,90 @@
+#include <gtest/gtest.h>
+#include <string>
+#include "server/scan.h"
+#include "server/http.h"
+
+/**
+ * Reference classification of RFC 9110.
+ */
+static bool isToken(unsigned char c) {
+	return isalnum(c) || (c != 0 && strchr("!#$%&'*+-.^_`|~", c) != NULL && c < 0x80);
+}
+
+static bool isTarget(unsigned char c) {
+	return c > 0x20 && c != 0x7f;
+}
+
+static bool isValue(unsigned char c) {
+	return (c >= 0x20 || c == '\t') && c != 0x7f;
+}
+
+static size_t firstInvalid(const std::string &s, bool (*valid)(unsigned char)) {
+	for (size_t i = 0; i < s.size(); i++)
+		if (!valid(s[i])) return i;
+
+	return s.size();
+}
+
+TEST(ScanTest, ImplementationsMatchReference) {
+	ASSERT_NE(httpScanner(), nullptr);
+	ASSERT_NE(httpScannerImpl(HTTP_SCAN_SCALAR), nullptr);
+
+	// Every byte value at every position of blocks and tails.
+	std::string base(70, 'a');
+	for (int impl = 0; impl < HTTP_SCAN_COUNT; impl++) {
+		const struct httpScanner *scan = httpScannerImpl(impl);
+		if (scan == NULL) continue;
+
+		for (size_t len : {0, 3, 15, 16, 17, 31, 32, 33, 48, 70}) {
+			std::string s = base.substr(0, len);
+			ASSERT_EQ(scan->token(s.data(), s.size()), len) << scan->name;
+			ASSERT_EQ(scan->target(s.data(), s.size()), len) << scan->name;
+			ASSERT_EQ(scan->value(s.data(), s.size()), len) << scan->name;
+
+			for (size_t pos = 0; pos < len; pos += 7) {
+				for (int c = 0; c < 256; c++) {
+					std::string t = s;
+					t[pos] = (char)c;
+
+					ASSERT_EQ(scan->token(t.data(), t.size()), firstInvalid(t, isToken))
+						<< scan->name << " byte " << c << " at " << pos;
+					ASSERT_EQ(scan->target(t.data(), t.size()), firstInvalid(t, isTarget))
+						<< scan->name << " byte " << c << " at " << pos;
+					ASSERT_EQ(scan->value(t.data(), t.size()), firstInvalid(t, isValue))
+						<< scan->name << " byte " << c << " at " << pos;
+				}
+			}
+		}
+	}
+}
+
+TEST(ScanTest, RejectsInvalidCharacters) {
+	const char *bad[] = {
+		"G(T / HTTP/1.1\r\n\r\n",
+		"GET /a\x01 HTTP/1.1\r\n\r\n",
+		"GET / HTTP/1.1\r\nBad Name: x\r\n\r\n",
+		"GET / HTTP/1.1\r\nName: x\x7fy\r\n\r\n",
+		"GET / HTTP/1.1\r\nName: x\ry\r\n\r\n",
+	};
+
+	for (int impl = 0; impl < HTTP_SCAN_COUNT; impl++) {
+		if (httpSelectScanner(impl)) continue;
+
+		for (const char *req : bad) {
+			size_t len = strlen(req);
+			ssize_t reqlen = httpRequestLength(req, len);
+			struct HTTPRequest parsed;
+
+			ASSERT_TRUE(reqlen == -1 || parseHTTPRequestBuffer(req, reqlen, reqlen, &parsed) == -1) << req;
+		}
+
+		const char *good = "GET /caf\xc3\xa9?q=1 HTTP/1.1\r\nUser-Agent: \tx\ty \r\n\r\n";
+		struct HTTPRequest parsed;
+		ASSERT_EQ(httpRequestLength(good, strlen(good)), strlen(good));
+		ASSERT_EQ(parseHTTPRequestBuffer(good, strlen(good), strlen(good), &parsed), 0);
+		ASSERT_EQ(std::string(parsed.headerv[0].value.ptr, parsed.headerv[0].value.len), "x\ty");
+		destroyHTTPRequest(&parsed);
+	}
+
+	ASSERT_EQ(httpSelectScanner(HTTP_SCAN_COUNT), -1);
+}
@@ -0,0 +1,96 @@
+#include "testUtils.h"
+#include <gtest/gtest.h>
+#include <cstring>
+#include <thread>
+#include <chrono>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "server/server.h"
+#include "server/http.h"
+
+int initApplicationOnce()
+{
+	static int status = initApplication();
+	return status;
+}
+
+int connectUnix(const char *path)
+{
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	// Socket is listened by the listener thread once it starts.
+	for (int i = 0; i < 100; i++) {
+		int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0) return fd;
+		close(fd);
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+
+	return -1;
+}
+
+std::string request(int fd, const char *raw)
+{
+	send(fd, raw, strlen(raw), MSG_NOSIGNAL);
+
+	std::string out;
+	char buf[4096];
+	ssize_t n;
+	while (out.find("done") == std::string::npos && (n = recv(fd, buf, sizeof(buf), 0)) > 0)
+		out.append(buf, n);
+
+	return out;
+}
+
+std::string readAll(int fd)
+{
+	std::string out;
+	char buf[4096];
+	ssize_t n;
+	while ((n = recv(fd, buf, sizeof(buf), 0)) > 0) out.append(buf, n);
+
+	return out;
+}
+
+std::string handleConnection(struct HTTPConnectionHandlerArgs *args, const std::string &raw)
+{
+	int fds[2];
+	EXPECT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+
+	// Responses may not fit the socket buffer.
+	std::string out;
+	std::thread reader([&]() { out = readAll(fds[1]); });
+
+	EXPECT_EQ(send(fds[1], raw.data(), raw.size(), MSG_NOSIGNAL), raw.size());
+	shutdown(fds[1], SHUT_WR);
+
+	struct connIO io;
+	EXPECT_EQ(initConnIO(&io, fds[0], 0, 0), 0);
+	httpConnetionHandler(&io, args);
+	destroyConnIO(&io);
+	close(fds[0]);
+
+	reader.join();
+	close(fds[1]);
+
+	return out;
+}
+
+std::string responseBody(const std::string &resp)
+{
+	size_t pos = resp.find("\r\n\r\n");
+	return pos == std::string::npos ? "" : resp.substr(pos + 4);
+}
+
+std::string responseHeader(const std::string &resp, const std::string &name)
+{
+	size_t pos = resp.find("\r\n" + name + ": ");
+	if (pos == std::string::npos) return "";
+
+	pos += name.size() + 4;
+	return resp.substr(pos, resp.find("\r\n", pos) - pos);
+}
@@ -0,0 +1,49 @@
+#ifndef TEST_UTILS_H
+#define TEST_UTILS_H
+
+#include <string>
+
+struct HTTPConnectionHandlerArgs;
+
+/**
+ * Initializes the application once for all the tests.
+ *
+ * @Returns status of initApplication().
+ */
+int initApplicationOnce();
+
+/**
+ * Connects to unix socket @path, waiting for the server to listen on it.
+ *
+ * @Returns connected socket, -1 if the server does not listen.
+ */
+int connectUnix(const char *path);
+
+/**
+ * Sends @raw request to @fd and reads the response until its body "done" is received.
+ */
+std::string request(int fd, const char *raw);
+
+/**
+ * Reads @fd until EOF.
+ */
+std::string readAll(int fd);
+
+/**
+ * Serves connection that sends @raw requests and closes its write side by httpConnetionHandler() with @args.
+ *
+ * @Returns everything written to the connection.
+ */
+std::string handleConnection(struct HTTPConnectionHandlerArgs *args, const std::string &raw);
+
+/**
+ * @Returns body of response @resp.
+ */
+std::string responseBody(const std::string &resp);
+
+/**
+ * @Returns value of header @name of response @resp, empty if it has none.
+ */
+std::string responseHeader(const std::string &resp, const std::string &name);
+
+#endif /* TEST_UTILS_H */
@@ -0,0 +1,117 @@
+#include <gtest/gtest.h>
+#include "server/timer.h"
+
+static void countExpired(struct timer *timer) {
+	(*(int *)timer->arg)++;
+}
+
+TEST(TimerWheelTest, ExpiresOnTime) {
+	struct timerWheel wheel;
+	initTimerWheel(&wheel, 1000);
+
+	int fired = 0;
+	struct timer timer;
+	initTimer(&timer, countExpired, &fired);
+
+	timerArm(&wheel, &timer, 1000, 5 * TIMER_TICK_MS);
+	ASSERT_TRUE(timerArmed(&timer));
+	ASSERT_EQ(timerWheelTimeout(&wheel, 1000), TIMER_TICK_MS);
+
+	timerWheelAdvance(&wheel, 1000 + 4 * TIMER_TICK_MS);
+	ASSERT_EQ(fired, 0);
+
+	timerWheelAdvance(&wheel, 1000 + 5 * TIMER_TICK_MS);
+	ASSERT_EQ(fired, 1);
+	ASSERT_FALSE(timerArmed(&timer));
+	ASSERT_EQ(wheel.armed, 0);
+	ASSERT_EQ(timerWheelTimeout(&wheel, 1000), -1);
+}
+
+TEST(TimerWheelTest, CancelsAndRearms) {
+	struct timerWheel wheel;
+	initTimerWheel(&wheel, 0);
+
+	int fired = 0;
+	struct timer timer;
+	initTimer(&timer, countExpired, &fired);
+
+	timerArm(&wheel, &timer, 0, TIMER_TICK_MS);
+	timerCancel(&wheel, &timer);
+	timerCancel(&wheel, &timer);
+	ASSERT_EQ(wheel.armed, 0);
+
+	timerWheelAdvance(&wheel, 10 * TIMER_TICK_MS);
+	ASSERT_EQ(fired, 0);
+
+	timerArm(&wheel, &timer, 10 * TIMER_TICK_MS, 2 * TIMER_TICK_MS);
+	timerArm(&wheel, &timer, 10 * TIMER_TICK_MS, 20 * TIMER_TICK_MS);
+	ASSERT_EQ(wheel.armed, 1);
+
+	timerWheelAdvance(&wheel, 29 * TIMER_TICK_MS);
+	ASSERT_EQ(fired, 0);
+	timerWheelAdvance(&wheel, 30 * TIMER_TICK_MS);
+	ASSERT_EQ(fired, 1);
+}
+
+TEST(TimerWheelTest, CascadesLongTimeouts) {
+	struct timerWheel wheel;
+	initTimerWheel(&wheel, 0);
+
+	// Timeouts crossing every level of the wheel.
+	const uint64_t ticks[] = { 1, 63, 64, 65, 100, 4095, 4096, 5000, 300000 };
+	const size_t n = sizeof(ticks) / sizeof(ticks[0]);
+
+	int fired[n] = {};
+	struct timer timers[n];
+	for (size_t i = 0; i < n; i++) {
+		initTimer(timers + i, countExpired, fired + i);
+		timerArm(&wheel, timers + i, 0, ticks[i] * TIMER_TICK_MS);
+	}
+
+	for (size_t i = 0; i < n; i++) {
+		timerWheelAdvance(&wheel, (ticks[i] - 1) * TIMER_TICK_MS);
+		ASSERT_EQ(fired[i], 0) << "timer of " << ticks[i] << " ticks";
+
+		timerWheelAdvance(&wheel, ticks[i] * TIMER_TICK_MS);
+		ASSERT_EQ(fired[i], 1) << "timer of " << ticks[i] << " ticks";
+	}
+
+	ASSERT_EQ(wheel.armed, 0);
+}
+
+TEST(ConnDeadlineTest, EnforcesPhases) {
+	struct timerWheel wheel;
+	initTimerWheel(&wheel, 0);
+
+	struct ConnTimeouts timeouts = {};
+	timeouts.idle = 1000;
+	timeouts.head = 2000;
+	timeouts.bodyMinRate = 100;
+	timeouts.bodyGrace = 1000;
+
+	int fired = 0;
+	struct connDeadline dl;
+	initConnDeadline(&dl, countExpired, &fired);
+
+	connDeadlineUpdate(&wheel, &dl, &timeouts, CONN_PHASE_IDLE, 0);
+	ASSERT_TRUE(timerArmed(&dl.timer));
+	ASSERT_EQ(connDeadlineExpired(&wheel, &dl, &timeouts, 1000), CONNDL_CLOSE);
+
+	// Head deadline is not restarted by progress in the same phase.
+	connDeadlineUpdate(&wheel, &dl, &timeouts, CONN_PHASE_HEAD, 0);
+	uint64_t expires = dl.timer.expires;
+	connDeadlineUpdate(&wheel, &dl, &timeouts, CONN_PHASE_HEAD, 1500);
+	ASSERT_EQ(dl.timer.expires, expires);
+	ASSERT_EQ(connDeadlineExpired(&wheel, &dl, &timeouts, 2000), CONNDL_REJECT);
+
+	connDeadlineUpdate(&wheel, &dl, &timeouts, CONN_PHASE_BODY, 0);
+	dl.progress = 100;
+	// 2 seconds after grace require 200 bytes.
+	ASSERT_EQ(connDeadlineExpired(&wheel, &dl, &timeouts, 2000), CONNDL_KEEP);
+	ASSERT_TRUE(timerArmed(&dl.timer));
+	ASSERT_EQ(connDeadlineExpired(&wheel, &dl, &timeouts, 3000), CONNDL_REJECT);
+
+	connDeadlineUpdate(&wheel, &dl, &timeouts, CONN_PHASE_PROCESSING, 3000);
+	ASSERT_FALSE(timerArmed(&dl.timer));
+	ASSERT_EQ(fired, 0);
+}
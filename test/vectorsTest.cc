@@ -152,3 +152,148 @@ TEST(VectorPTest, VectorInsertsAndSets) {
 
 	vectorDestroy_p(&vc);
 }
+
+TEST(SlotTableTest, InsertsRemovesAndReusesSlots) {
+	struct slotTable table;
+	ASSERT_EQ(initSlotTable(&table, sizeof(int), 2), 0);
+
+	int a = 1;
+	int b = 2;
+	int c = 3;
+	int res;
+
+	slothandle_t ha = slotTableInsert(&table, (char *)&a);
+	slothandle_t hb = slotTableInsert(&table, (char *)&b);
+	ASSERT_NE(ha, SLOTHANDLE_INVAL);
+	ASSERT_NE(hb, SLOTHANDLE_INVAL);
+	ASSERT_EQ(table.size, 2);
+
+	// Table is full.
+	ASSERT_EQ(slotTableInsert(&table, (char *)&c), SLOTHANDLE_INVAL);
+
+	ASSERT_EQ(slotTableCopyEl(&table, ha, (char *)&res), 0);
+	ASSERT_EQ(res, a);
+
+	ASSERT_EQ(slotTableRemove(&table, ha, (char *)&res), 0);
+	ASSERT_EQ(res, a);
+	ASSERT_EQ(table.size, 1);
+	ASSERT_EQ(slotTableRemove(&table, ha, NULL), -1);
+
+	// Freed slot is reused, but the old handle stays stale.
+	slothandle_t hc = slotTableInsert(&table, (char *)&c);
+	ASSERT_NE(hc, SLOTHANDLE_INVAL);
+	ASSERT_NE(hc, ha);
+	ASSERT_EQ(hc & UINT32_MAX, ha & UINT32_MAX);
+	ASSERT_EQ(slotTableCopyEl(&table, ha, (char *)&res), -1);
+	ASSERT_EQ(slotTableSetEl(&table, ha, (char *)&b), -1);
+
+	ASSERT_EQ(slotTableCopyEl(&table, hc, (char *)&res), 0);
+	ASSERT_EQ(res, c);
+
+	ASSERT_EQ(slotTableSetEl(&table, hc, (char *)&a), 0);
+	ASSERT_EQ(slotTableCopyEl(&table, hc, (char *)&res), 0);
+	ASSERT_EQ(res, a);
+
+	destroySlotTable(&table);
+}
+
+static int sumAndRemoveOdd(slothandle_t h, char *el, void *arg) {
+	int v = *(int *)el;
+	*(int *)arg += v;
+	return v % 2;
+}
+
+TEST(SlotTableTest, ForEachVisitsLiveElements) {
+	struct slotTable table;
+	ASSERT_EQ(initSlotTable(&table, sizeof(int), 8), 0);
+
+	slothandle_t hs[5];
+	for (int i = 1; i <= 5; i++)
+		hs[i - 1] = slotTableInsert(&table, (char *)&i);
+
+	ASSERT_EQ(slotTableRemove(&table, hs[1], NULL), 0);
+
+	int sum = 0;
+	slotTableForEach(&table, sumAndRemoveOdd, &sum);
+	ASSERT_EQ(sum, 1 + 3 + 4 + 5);
+	ASSERT_EQ(table.size, 1);
+
+	sum = 0;
+	slotTableForEach(&table, sumAndRemoveOdd, &sum);
+	ASSERT_EQ(sum, 4);
+	ASSERT_EQ(slotTableCopyEl(&table, hs[3], (char *)&sum), 0);
+
+	destroySlotTable(&table);
+}
+
+TEST(VectorTest, LocalVectorInserts) {
+	struct vector_p vc;
+	ASSERT_EQ(initLocalVector_p(&vc, sizeof(int), 1), 0);
+	ASSERT_EQ(vc.local, 1);
+
+	for (int i = 0; i < 10; i++)
+		ASSERT_EQ(vectorInsertEl_p(&vc, (char *)&i), i);
+
+	int res;
+	vectorCopyEl_p(&vc, 7, (char *)&res);
+	ASSERT_EQ(res, 7);
+
+	vectorDestroy_p(&vc);
+}
+
+TEST(RcuVectorTest, InsertsAndGets) {
+	struct rcuVector vc;
+	ASSERT_EQ(initRcuVector(&vc, 1), 0);
+
+	int els[100];
+	for (int i = 0; i < 100; i++)
+		ASSERT_EQ(rcuVectorInsertEl(&vc, els + i), i);
+
+	for (int i = 0; i < 100; i++)
+		ASSERT_EQ(rcuVectorGetEl(&vc, i), els + i);
+
+	ASSERT_EQ(rcuVectorGetEl(&vc, 100), nullptr);
+
+	rcuVectorSetEl(&vc, 5, NULL);
+	ASSERT_EQ(rcuVectorGetEl(&vc, 5), nullptr);
+
+	rcuVectorDestroy(&vc);
+}
+
+static void *readRcuVector(void *rawvc) {
+	struct rcuVector *vc = (struct rcuVector *)rawvc;
+	size_t bad = 0;
+
+	// Reads race with grows: every published element should be seen.
+	for (size_t n = 0; n < 100000; n++) {
+		size_t sz = __atomic_load_n(&vc->size, __ATOMIC_ACQUIRE);
+		if (sz == 0) continue;
+
+		size_t i = n % sz;
+		if ((size_t)rcuVectorGetEl(vc, i) != i + 1) bad++;
+	}
+
+	return (void *)bad;
+}
+
+TEST(RcuVectorTest, ConcurrentReadsWhileGrowing) {
+	struct rcuVector vc;
+	ASSERT_EQ(initRcuVector(&vc, 1), 0);
+	rcuVectorInsertEl(&vc, (void *)1);
+
+	pthread_t readers[4];
+	for (int i = 0; i < 4; i++)
+		ASSERT_EQ(pthread_create(readers + i, NULL, readRcuVector, &vc), 0);
+
+	for (size_t i = 1; i < 4096; i++)
+		rcuVectorInsertEl(&vc, (void *)(i + 1));
+
+	for (int i = 0; i < 4; i++) {
+		void *bad;
+		pthread_join(readers[i], &bad);
+		ASSERT_EQ(bad, nullptr);
+	}
+
+	ASSERT_EQ(vc.size, 4096);
+	rcuVectorDestroy(&vc);
+}